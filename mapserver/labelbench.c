@@ -0,0 +1,171 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Benchmark of label cache placement on dense label sets.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** Fills the label cache of a POINT layer (marker + truetype label with
+** MINDISTANCE) with increasing numbers of randomly placed labels and times
+** msDrawLabelCache(), so that the growth of the placement time with the
+** number of labels can be checked.
+**
+** usage: labelbench [-s size] [-n maxlabels] [fontset]
+** Run from the tests/ directory to use the default fontset.
+*/
+
+#include "mapserver.h"
+#include "maptime.h"
+
+MS_CVSID("$Id$")
+
+static const char *bench_map =
+  "MAP\n"
+  "  SIZE %d %d\n"
+  "  EXTENT 0 0 %d %d\n"
+  "  FONTSET \"%s\"\n"
+  "  IMAGETYPE png\n"
+  "  LAYER\n"
+  "    NAME \"labels\"\n"
+  "    TYPE POINT\n"
+  "    STATUS ON\n"
+  "    CLASS\n"
+  "      STYLE\n"
+  "        SIZE 4\n"
+  "        COLOR 0 0 0\n"
+  "      END\n"
+  "      LABEL\n"
+  "        TYPE TRUETYPE\n"
+  "        FONT \"Vera\"\n"
+  "        SIZE 7\n"
+  "        POSITION AUTO\n"
+  "        MINDISTANCE 50\n"
+  "        PARTIALS FALSE\n"
+  "      END\n"
+  "    END\n"
+  "  END\n"
+  "END\n";
+
+static int runBench(mapObj *map, int numlabels)
+{
+  layerObj *layer = GET_LAYER(map, 0);
+  labelObj *label = layer->class[0]->labels[0];
+  imageObj *image;
+  struct mstimeval start, end;
+  char text[32];
+  int i, p, rendered = 0;
+  double elapsed;
+
+  msInitLabelCache(&(map->labelcache));
+  image = msPrepareImage(map, MS_FALSE);
+  if(!image)
+    return MS_FAILURE;
+  layer->scalefactor = 1.0;
+
+  srand(numlabels);
+  for(i=0; i<numlabels; i++) {
+    pointObj point;
+    point.x = rand() % map->width;
+    point.y = rand() % map->height;
+#ifdef USE_POINT_Z_M
+    point.z = point.m = 0.0;
+#endif
+    /* a few distinct texts so that the mindistance duplicate test kicks in */
+    snprintf(text, sizeof(text), "Label %d", i % 500);
+    label->annotext = text;
+    if(msAddLabel(map, label, 0, 0, NULL, &point, NULL, -1) != MS_SUCCESS) {
+      label->annotext = NULL;
+      msFreeImage(image);
+      return MS_FAILURE;
+    }
+  }
+  label->annotext = NULL;
+
+  msGettimeofday(&start, NULL);
+  if(msDrawLabelCache(image, map) != MS_SUCCESS) {
+    msFreeImage(image);
+    return MS_FAILURE;
+  }
+  msGettimeofday(&end, NULL);
+
+  for(p=0; p<MS_MAX_LABEL_PRIORITY; p++) {
+    for(i=0; i<map->labelcache.slots[p].numlabels; i++)
+      if(map->labelcache.slots[p].labels[i].status == MS_TRUE) rendered++;
+  }
+
+  elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+  printf("labels=%-8d rendered=%-8d %8.3fs %10.2f us/label\n", numlabels, rendered,
+         elapsed, elapsed * 1000000.0 / numlabels);
+
+  msFreeImage(image);
+  return MS_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *fontset = "fonts.txt";
+  char *mapstring;
+  mapObj *map;
+  int size = 4096, maxlabels = 40000, numlabels, i;
+
+  for(i=1; i<argc; i++) {
+    if(strcmp(argv[i], "-s") == 0 && i+1 < argc)
+      size = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+      maxlabels = atoi(argv[++i]);
+    else if(argv[i][0] != '-')
+      fontset = argv[i];
+    else {
+      fprintf(stderr, "usage: labelbench [-s size] [-n maxlabels] [fontset]\n");
+      exit(1);
+    }
+  }
+
+  if(msSetup() != MS_SUCCESS) {
+    msWriteError(stderr);
+    exit(1);
+  }
+
+  mapstring = (char *) msSmallMalloc(strlen(bench_map) + strlen(fontset) + 64);
+  sprintf(mapstring, bench_map, size, size, size, size, fontset);
+  map = msLoadMapFromString(mapstring, NULL);
+  free(mapstring);
+  if(!map) {
+    msWriteError(stderr);
+    exit(1);
+  }
+
+  for(numlabels=1250; numlabels<=maxlabels; numlabels*=2) {
+    if(runBench(map, numlabels) != MS_SUCCESS) {
+      msWriteError(stderr);
+      exit(1);
+    }
+  }
+
+  msFreeMap(map);
+  msCleanup();
+  return 0;
+}
@@ -50,6 +50,7 @@
 
 #include <assert.h>
 #include <apr_time.h>
+#include <apr_thread_mutex.h>
 
 #ifdef USE_PCRE
 #include <pcre.h>
@@ -76,6 +77,9 @@
 
 #define MAPCACHE_LOCKFILE_PREFIX "_gc_lock"
 
+/* pool size started by the legacy <threaded_fetching>true</threaded_fetching> */
+#define MAPCACHE_DEFAULT_DOWNLOAD_THREADS 8
+
 
 
 typedef struct mapcache_image_format mapcache_image_format;
@@ -102,6 +106,14 @@ typedef struct mapcache_cache_disk mapcache_cache_disk;
 #ifdef USE_TIFF
 typedef struct mapcache_cache_tiff mapcache_cache_tiff;
 #endif
+typedef struct mapcache_cache_memory mapcache_cache_memory;
+typedef struct mapcache_cache_composite mapcache_cache_composite;
+typedef struct mapcache_cache_composite_tier mapcache_cache_composite_tier;
+typedef struct mapcache_locker mapcache_locker;
+typedef struct mapcache_locker_disk mapcache_locker_disk;
+typedef struct mapcache_locker_memory mapcache_locker_memory;
+typedef struct mapcache_thread_pool mapcache_thread_pool;
+typedef struct mapcache_task_group mapcache_task_group;
 typedef struct mapcache_http mapcache_http;
 typedef struct mapcache_request mapcache_request;
 typedef struct mapcache_request_proxy mapcache_request_proxy;
@@ -337,6 +349,8 @@ typedef enum {
 #ifdef USE_TIFF
        ,MAPCACHE_CACHE_TIFF
 #endif
+       ,MAPCACHE_CACHE_MEMORY
+       ,MAPCACHE_CACHE_COMPOSITE
 } mapcache_cache_type;
 
 /** \interface mapcache_cache
@@ -371,6 +385,14 @@ struct mapcache_cache {
      */
     void (*tile_set)(mapcache_context *ctx, mapcache_tile * tile);
 
+    /**
+     * set the content of several tiles of the same tileset and grid to cache, e.g.
+     * all the tiles of a metatile. optional, mapcache_cache::tile_set() is called
+     * for each tile if NULL
+     * \memberof mapcache_cache
+     */
+    void (*tile_multi_set)(mapcache_context *ctx, mapcache_tile *tiles, int ntiles);
+
     void (*configuration_parse_xml)(mapcache_context *ctx, ezxml_t xml, mapcache_cache * cache, mapcache_cfg *config);
     void (*configuration_post_config)(mapcache_context *ctx, mapcache_cache * cache, mapcache_cfg *config);
 };
@@ -400,6 +422,13 @@ struct mapcache_cache_tiff {
     int count_x;
     int count_y;
     mapcache_image_format_jpeg *format;
+    int max_handles; /**< number of parsed tiff files kept open, 0 to disable */
+    apr_pool_t *pool;
+    apr_hash_t *handles; /**< parsed tiff files, keyed by filename */
+    apr_uint64_t handles_clock; /**< incremented on each handle use, for lru eviction */
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *handles_mutex;
+#endif
 };
 #endif
 
@@ -419,6 +448,13 @@ struct mapcache_cache_sqlite {
    mapcache_cache cache;
    char *dbname_template;
    int hitstats;
+   char *journal_mode; /**< journal mode set on read-write connections, NULL to leave the database's own */
+   apr_pool_t *pool;
+   apr_hash_t *connection_pools; /**< one apr_reslist_t of connections per database file and access mode */
+   int connection_pools_pid; /**< process the connection pools were opened in */
+#if APR_HAS_THREADS
+   apr_thread_mutex_t *connection_pools_mutex;
+#endif
    mapcache_cache_sqlite_stmt create_stmt;
    mapcache_cache_sqlite_stmt exists_stmt;
    mapcache_cache_sqlite_stmt get_stmt;
@@ -463,6 +499,188 @@ struct mapcache_cache_memcache {
 mapcache_cache* mapcache_cache_memcache_create(mapcache_context *ctx);
 #endif
 
+/**\class mapcache_cache_memory
+ * \brief an LRU of encoded tiles held in memory in front of another mapcache_cache
+ * \implements mapcache_cache
+ *
+ * the tiles read from or written to the backend are kept in the memory of the
+ * process, split in shards that are locked independently. Each process serving
+ * the configuration has its own copy.
+ */
+struct mapcache_cache_memory {
+    mapcache_cache cache;
+    mapcache_cache *backend; /**< the cache the tiles are read from and written to */
+    apr_size_t max_size; /**< maximum number of bytes of tile data held in memory */
+    int nshards;
+    apr_time_t ttl; /**< time after which a tile is read again from the backend, 0 for never */
+    void *shards;
+};
+
+/**
+ * \memberof mapcache_cache_memory
+ */
+mapcache_cache* mapcache_cache_memory_create(mapcache_context *ctx);
+
+/** which tiles are written to a tier of a mapcache_cache_composite */
+typedef enum {
+   MAPCACHE_COMPOSITE_WRITE_ALL, /**< rendered tiles and tiles promoted from the lower tiers */
+   MAPCACHE_COMPOSITE_WRITE_RENDERED, /**< only the newly rendered tiles */
+   MAPCACHE_COMPOSITE_WRITE_PROMOTED, /**< only the tiles found in a lower tier */
+   MAPCACHE_COMPOSITE_WRITE_NONE /**< read only tier */
+} mapcache_composite_write_policy;
+
+struct mapcache_cache_composite_tier {
+    mapcache_cache *cache;
+    mapcache_composite_write_policy write;
+};
+
+/**\class mapcache_cache_composite
+ * \brief a mapcache_cache chaining several other caches
+ * \implements mapcache_cache
+ *
+ * tiles are read from the first tier holding them, and copied to the tiers
+ * above it according to their write policy
+ */
+struct mapcache_cache_composite {
+    mapcache_cache cache;
+    apr_array_header_t *tiers; /**< mapcache_cache_composite_tier*, fastest first */
+};
+
+/**
+ * \memberof mapcache_cache_composite
+ */
+mapcache_cache* mapcache_cache_composite_create(mapcache_context *ctx);
+
+/** @} */
+
+/** \defgroup locker Lockers */
+/** @{ */
+
+typedef enum {
+   MAPCACHE_LOCKER_DISK,
+   MAPCACHE_LOCKER_MEMORY
+} mapcache_locker_type;
+
+/** \interface mapcache_locker
+ * \brief serializes the creation of a resource (typically a metatile) between
+ * the threads and processes serving a configuration
+ */
+struct mapcache_locker {
+    mapcache_locker_type type;
+
+    /**
+     * a lock older than this is considered abandoned by a crashed or hung
+     * renderer, and is taken over by the next request that waits on it.
+     * 0 disables the check.
+     */
+    apr_interval_time_t timeout;
+
+    /**
+     * \returns MAPCACHE_TRUE if the lock was acquired, in which case the caller
+     * must create the resource and call unlock()
+     * \returns MAPCACHE_FALSE once another thread or process holding the lock
+     * has released it
+     * \memberof mapcache_locker
+     */
+    int (*lock_or_wait)(mapcache_context *ctx, mapcache_locker *locker, char *resource);
+
+    /**
+     * release a lock acquired by lock_or_wait(), waking up its waiters
+     * \memberof mapcache_locker
+     */
+    void (*unlock)(mapcache_context *ctx, mapcache_locker *locker, char *resource);
+
+    void (*configuration_parse_xml)(mapcache_context *ctx, ezxml_t node, mapcache_locker *locker);
+
+    /**
+     * called once the configuration is loaded, before the server forks its children
+     * \param cgi MAPCACHE_TRUE if this process is only serving a single request
+     */
+    void (*configuration_post_config)(mapcache_context *ctx, mapcache_locker *locker, mapcache_cfg *config, int cgi);
+};
+
+/**\class mapcache_locker_disk
+ * \brief a mapcache_locker using lock files in a directory
+ * \implements mapcache_locker
+ *
+ * works between independant processes and machines sharing the directory, at
+ * the cost of waiters polling for the lock file to disappear.
+ */
+struct mapcache_locker_disk {
+    mapcache_locker locker;
+
+    /**
+     * directory where lock files will be placed.
+     * Must be readable and writable by the apache user.
+     * Must be placed on a network mounted shared directory if multiple mapcache instances
+     * need to be synchronized
+     */
+    const char *dir;
+
+    /**
+     * time in microseconds to wait before rechecking for lockfile presence
+     */
+    apr_interval_time_t retry;
+};
+
+/**\class mapcache_locker_memory
+ * \brief a mapcache_locker holding its locks in shared memory
+ * \implements mapcache_locker
+ *
+ * waiters sleep on a process shared condition variable and are woken up as
+ * soon as the lock is released. The shared segment is created when the
+ * configuration is loaded, so only the threads and processes forked from the
+ * process that loaded it are synchronized (i.e. the apache children, or the
+ * seeder threads), not independant cgi/fastcgi processes.
+ */
+struct mapcache_locker_memory {
+    mapcache_locker locker;
+    int slots; /**< maximum number of locks held at the same time */
+    void *shm; /**< the shared lock table */
+};
+
+mapcache_locker* mapcache_locker_disk_create(mapcache_context *ctx);
+mapcache_locker* mapcache_locker_memory_create(mapcache_context *ctx);
+
+/** @} */
+
+/** \defgroup threadpool Thread pool */
+/** @{ */
+
+typedef void (*mapcache_task_func)(void *data);
+
+/**
+ * \brief a set of tasks queued on the process wide thread pool by a request
+ *
+ * the threads of the pool are started the first time a task group is created
+ * in a process, and are shared by all the requests it serves.
+ */
+mapcache_task_group* mapcache_task_group_create(mapcache_context *ctx);
+
+/**
+ * \brief queue a task for execution by the thread pool
+ *
+ * the task is run immediately in the calling thread if the pool could not be
+ * started (or if apr was built without thread support)
+ */
+void mapcache_task_group_push(mapcache_context *ctx, mapcache_task_group *group, mapcache_task_func func, void *data);
+
+/**
+ * \brief wait for all the tasks of a group to be completed
+ *
+ * while waiting, the calling thread runs the tasks of the group that have not
+ * been picked up by a worker yet.
+ */
+void mapcache_task_group_wait(mapcache_context *ctx, mapcache_task_group *group);
+
+/**
+ * \brief stop the threads of the configuration's thread pool and free it
+ *
+ * registered as a cleanup of the configuration pool, so that reloading the
+ * configuration does not leave the previous threads running
+ */
+void mapcache_thread_pool_destroy(mapcache_cfg *config);
+
 /** @} */
 
 
@@ -816,6 +1034,22 @@ void mapcache_image_copy_resampled_nearest(mapcache_context *ctx, mapcache_image
 void mapcache_image_copy_resampled_bilinear(mapcache_context *ctx, mapcache_image *src, mapcache_image *dst,
       double off_x, double off_y, double scale_x, double scale_y);
 
+/**
+ * \brief resample a horizontal band of a larger source image
+ *
+ * allows resampling a source image that is never held in memory as a whole.
+ * \param src the rows [src_y,src_y+src_rows) of the source image, optionally
+ * followed by the next row which is needed for bilinear interpolation
+ * \param src_h the number of rows of the whole source image
+ * \param off_x,off_y,scale_x,scale_y the transform of the whole source image
+ * only the rows of dst that are resampled from the band are written. pixman is not
+ * used, even when available.
+ */
+void mapcache_image_copy_resampled_band(mapcache_context *ctx, mapcache_image *src,
+      int src_y, int src_rows, int src_h, mapcache_image *dst,
+      double off_x, double off_y, double scale_x, double scale_y,
+      mapcache_resample_mode mode);
+
 
 /**
  * \brief merge two images
@@ -937,19 +1171,21 @@ struct mapcache_cfg {
     apr_table_t *metadata;
 
     /**
-     * directory where lock files will be placed.
-     * Must be readable and writable by the apache user.
-     * Must be placed on a network mounted shared directory if multiple mapcache instances
-     * need to be synchronized
+     * how metatile and blank tile creation is serialized between threads and processes
      */
-    const char *lockdir;
-    
+    mapcache_locker *locker;
+
     /**
-     * time in nanoseconds to wait before rechecking for lockfile presence
+     * number of threads in the pool used for fetching multiple tiles, shared by
+     * all the requests served by a process. 0 (the default) fetches the tiles
+     * sequentially, the legacy <threaded_fetching>true</threaded_fetching>
+     * setting starts MAPCACHE_DEFAULT_DOWNLOAD_THREADS threads
      */
-    apr_interval_time_t lock_retry_interval; /* time in nanoseconds to wait before rechecking for lockfile presence */
-
-    int threaded_fetching;
+    int download_threads;
+    mapcache_thread_pool *thread_pool;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *thread_pool_mutex; /**< protects the creation of thread_pool */
+#endif
     
     /**
      * the uri where the base of the service is mapped
@@ -1352,9 +1588,32 @@ const char* mapcache_util_str_sanitize(apr_pool_t *pool, const char *str, const
 typedef enum {
     MAPCACHE_COMPRESSION_BEST, /**< best but slowest compression*/
     MAPCACHE_COMPRESSION_FAST, /**< fast compression*/
-    MAPCACHE_COMPRESSION_DEFAULT /**< default compression*/
+    MAPCACHE_COMPRESSION_DEFAULT, /**< default compression*/
+    MAPCACHE_COMPRESSION_NONE /**< no compression, for intermediate images that are re-read shortly after*/
 } mapcache_compression_type;
 
+/**
+ * PNG row filter to apply before compression
+ */
+typedef enum {
+    MAPCACHE_PNG_FILTER_NONE, /**< no filtering, fastest*/
+    MAPCACHE_PNG_FILTER_SUB,
+    MAPCACHE_PNG_FILTER_UP,
+    MAPCACHE_PNG_FILTER_AVG,
+    MAPCACHE_PNG_FILTER_PAETH,
+    MAPCACHE_PNG_FILTER_ADAPTIVE /**< let libpng choose the best filter for each row*/
+} mapcache_png_filter;
+
+/**
+ * zlib strategy to use when compressing PNG data
+ */
+typedef enum {
+    MAPCACHE_PNG_STRATEGY_DEFAULT,
+    MAPCACHE_PNG_STRATEGY_FILTERED,
+    MAPCACHE_PNG_STRATEGY_RLE, /**< run length encoding only, much faster on flat imagery*/
+    MAPCACHE_PNG_STRATEGY_HUFFMAN /**< huffman coding only, no string matching*/
+} mapcache_png_strategy;
+
 /**
  * photometric interpretation for jpeg bands
  */
@@ -1395,6 +1654,8 @@ struct mapcache_image_format {
 struct mapcache_image_format_png {
     mapcache_image_format format;
     mapcache_compression_type compression_level; /**< PNG compression level to apply */
+    mapcache_png_filter filter; /**< row filter, the same for every row of the image */
+    mapcache_png_strategy strategy; /**< zlib strategy */
 };
 
 struct mapcache_image_format_mixed {
@@ -1414,6 +1675,9 @@ mapcache_image_format* mapcache_imageio_create_mixed_format(apr_pool_t *pool,
 struct mapcache_image_format_png_q {
     mapcache_image_format_png format;
     int ncolors; /**< number of colors used in quantization, 2-256 */
+    unsigned char *palette; /**< optional fixed palette of ncolors premultiplied entries, laid out
+                              like the pixels of a mapcache_image. when set the images are not
+                              quantized, each pixel is mapped to its closest palette entry */
 };
 
 /**
@@ -1430,7 +1694,7 @@ void mapcache_image_create_empty(mapcache_context *ctx, mapcache_cfg *cfg);
  * @return
  */
 void _mapcache_imageio_png_decode_to_image(mapcache_context *ctx, mapcache_buffer *buffer,
-      mapcache_image *image);
+      mapcache_image *image, int nrows);
 
 
 /**
@@ -1454,6 +1718,14 @@ mapcache_image_format* mapcache_imageio_create_png_format(apr_pool_t *pool, char
  */
 mapcache_image_format* mapcache_imageio_create_png_q_format(apr_pool_t *pool, char *name, mapcache_compression_type compression, int ncolors);
 
+/**
+ * \brief load the fixed palette of a quantized png format
+ * \memberof mapcache_image_format_png_q
+ * @param filename a text file with one r,g,b or r,g,b,a entry per line. blank lines
+ * and lines starting with # are skipped
+ */
+void mapcache_imageio_png_q_load_palette(mapcache_context *ctx, mapcache_image_format *format, const char *filename);
+
 /** @} */
 
 /**\defgroup imageio_jpg JPEG Image IO
@@ -1486,7 +1758,7 @@ mapcache_image* _mapcache_imageio_jpeg_decode(mapcache_context *ctx, mapcache_bu
  * @return
  */
 void _mapcache_imageio_jpeg_decode_to_image(mapcache_context *ctx, mapcache_buffer *buffer,
-      mapcache_image *image);
+      mapcache_image *image, int nrows);
 
 /** @} */
 
@@ -1511,6 +1783,13 @@ mapcache_image* mapcache_imageio_decode(mapcache_context *ctx, mapcache_buffer *
  */
 void mapcache_imageio_decode_to_image(mapcache_context *ctx, mapcache_buffer *buffer, mapcache_image *image);
 
+/**
+ * decodes the first nrows rows of given buffer to an allocated image. the
+ * following rows of the image may or may not be decoded
+ */
+void mapcache_imageio_decode_rows_to_image(mapcache_context *ctx, mapcache_buffer *buffer,
+      mapcache_image *image, int nrows);
+
 
 /** @} */
 
@@ -0,0 +1,255 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache tile caching support file: composite cache chaining
+ *           several cache backends.
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include "mapcache.h"
+#include <apr_strings.h>
+
+/*
+ * the tiers are queried in the order they are configured, the fastest first.
+ * a tile found in a tier is copied to the tiers above it that accept promoted
+ * tiles, and a rendered tile is written to the tiers that accept rendered tiles.
+ */
+
+#define TIER(cache,i) APR_ARRAY_IDX((cache)->tiers,i,mapcache_cache_composite_tier*)
+
+/*
+ * the tier backends find their own configuration through tile->tileset->cache,
+ * so they are called on a copy of the tileset pointing to the tier
+ */
+#define TIER_TILESET_SWAP(tile,tier_tileset,tier) \
+   tier_tileset = *((tile)->tileset); \
+   tier_tileset.cache = (tier)->cache; \
+   (tile)->tileset = &tier_tileset
+
+/* a failing tier must not fail the request if the other tiers can serve it */
+static void _mapcache_cache_composite_tier_error(mapcache_context *ctx, mapcache_cache *cache,
+      mapcache_cache_composite_tier *tier, const char *operation) {
+   ctx->log(ctx, MAPCACHE_WARN, "composite cache %s: failed to %s tile on cache %s: %s",
+         cache->name, operation, tier->cache->name, ctx->get_error_message(ctx));
+   ctx->clear_errors(ctx);
+}
+
+static int _mapcache_cache_composite_has_tile(mapcache_context *ctx, mapcache_tile *tile) {
+   mapcache_cache_composite *cache = (mapcache_cache_composite*)tile->tileset->cache;
+   mapcache_tileset *tileset = tile->tileset, tier_tileset;
+   int i, ret = MAPCACHE_FALSE;
+   for(i=0; i<cache->tiers->nelts && ret == MAPCACHE_FALSE; i++) {
+      mapcache_cache_composite_tier *tier = TIER(cache,i);
+      TIER_TILESET_SWAP(tile, tier_tileset, tier);
+      ret = tier->cache->tile_exists(ctx, tile);
+      tile->tileset = tileset;
+      if(GC_HAS_ERROR(ctx)) {
+         _mapcache_cache_composite_tier_error(ctx, &cache->cache, tier, "check");
+         ret = MAPCACHE_FALSE;
+      }
+   }
+   return ret;
+}
+
+/* read only tiers are left alone, their backend may not even support deleting */
+static void _mapcache_cache_composite_delete(mapcache_context *ctx, mapcache_tile *tile) {
+   mapcache_cache_composite *cache = (mapcache_cache_composite*)tile->tileset->cache;
+   mapcache_tileset *tileset = tile->tileset, tier_tileset;
+   int i;
+   for(i=0; i<cache->tiers->nelts; i++) {
+      mapcache_cache_composite_tier *tier = TIER(cache,i);
+      if(tier->write == MAPCACHE_COMPOSITE_WRITE_NONE) {
+         continue;
+      }
+      TIER_TILESET_SWAP(tile, tier_tileset, tier);
+      tier->cache->tile_delete(ctx, tile);
+      tile->tileset = tileset;
+      GC_CHECK_ERROR(ctx);
+   }
+}
+
+/**
+ * \brief get content of given tile
+ *
+ * reads the tile from the first tier holding it, and promotes it to the
+ * tiers above that one
+ * \private \memberof mapcache_cache_composite
+ * \sa mapcache_cache::tile_get()
+ */
+static int _mapcache_cache_composite_get(mapcache_context *ctx, mapcache_tile *tile) {
+   mapcache_cache_composite *cache = (mapcache_cache_composite*)tile->tileset->cache;
+   mapcache_tileset *tileset = tile->tileset, tier_tileset;
+   int i, j, ret = MAPCACHE_CACHE_MISS;
+   for(i=0; i<cache->tiers->nelts; i++) {
+      mapcache_cache_composite_tier *tier = TIER(cache,i);
+      TIER_TILESET_SWAP(tile, tier_tileset, tier);
+      ret = tier->cache->tile_get(ctx, tile);
+      tile->tileset = tileset;
+      if(GC_HAS_ERROR(ctx)) {
+         _mapcache_cache_composite_tier_error(ctx, &cache->cache, tier, "read");
+         ret = MAPCACHE_CACHE_MISS;
+      }
+      if(ret != MAPCACHE_CACHE_MISS) break;
+   }
+   if(ret != MAPCACHE_SUCCESS || i == cache->tiers->nelts) {
+      return ret;
+   }
+   for(j=0; j<i; j++) {
+      mapcache_cache_composite_tier *tier = TIER(cache,j);
+      if(tier->write != MAPCACHE_COMPOSITE_WRITE_ALL && tier->write != MAPCACHE_COMPOSITE_WRITE_PROMOTED) {
+         continue;
+      }
+      TIER_TILESET_SWAP(tile, tier_tileset, tier);
+      tier->cache->tile_set(ctx, tile);
+      tile->tileset = tileset;
+      if(GC_HAS_ERROR(ctx)) {
+         _mapcache_cache_composite_tier_error(ctx, &cache->cache, tier, "promote");
+      }
+   }
+   return ret;
+}
+
+static void _mapcache_cache_composite_set(mapcache_context *ctx, mapcache_tile *tile) {
+   mapcache_cache_composite *cache = (mapcache_cache_composite*)tile->tileset->cache;
+   mapcache_tileset *tileset = tile->tileset, tier_tileset;
+   int i;
+   for(i=0; i<cache->tiers->nelts; i++) {
+      mapcache_cache_composite_tier *tier = TIER(cache,i);
+      if(tier->write != MAPCACHE_COMPOSITE_WRITE_ALL && tier->write != MAPCACHE_COMPOSITE_WRITE_RENDERED) {
+         continue;
+      }
+      TIER_TILESET_SWAP(tile, tier_tileset, tier);
+      tier->cache->tile_set(ctx, tile);
+      tile->tileset = tileset;
+      GC_CHECK_ERROR(ctx);
+   }
+}
+
+static void _mapcache_cache_composite_multi_set(mapcache_context *ctx, mapcache_tile *tiles, int ntiles) {
+   mapcache_cache_composite *cache = (mapcache_cache_composite*)tiles[0].tileset->cache;
+   mapcache_tileset *tileset = tiles[0].tileset, tier_tileset;
+   int i, t;
+   for(i=0; i<cache->tiers->nelts; i++) {
+      mapcache_cache_composite_tier *tier = TIER(cache,i);
+      if(tier->write != MAPCACHE_COMPOSITE_WRITE_ALL && tier->write != MAPCACHE_COMPOSITE_WRITE_RENDERED) {
+         continue;
+      }
+      tier_tileset = *tileset;
+      tier_tileset.cache = tier->cache;
+      for(t=0; t<ntiles; t++) tiles[t].tileset = &tier_tileset;
+      if(tier->cache->tile_multi_set) {
+         tier->cache->tile_multi_set(ctx, tiles, ntiles);
+      } else {
+         for(t=0; t<ntiles && !GC_HAS_ERROR(ctx); t++) {
+            tier->cache->tile_set(ctx, &tiles[t]);
+         }
+      }
+      for(t=0; t<ntiles; t++) tiles[t].tileset = tileset;
+      GC_CHECK_ERROR(ctx);
+   }
+}
+
+/**
+ * \private \memberof mapcache_cache_composite
+ */
+static void _mapcache_cache_composite_configuration_parse_xml(mapcache_context *ctx, ezxml_t node, mapcache_cache *cache, mapcache_cfg *config) {
+   ezxml_t cur_node;
+   mapcache_cache_composite *dcache = (mapcache_cache_composite*)cache;
+   for(cur_node = ezxml_child(node,"cache"); cur_node; cur_node = cur_node->next) {
+      mapcache_cache_composite_tier *tier;
+      const char *write = ezxml_attr(cur_node,"write");
+      if(!cur_node->txt || !*cur_node->txt) {
+         ctx->set_error(ctx, 400, "composite cache \"%s\" has an empty <cache> entry", cache->name);
+         return;
+      }
+      tier = apr_pcalloc(ctx->pool, sizeof(mapcache_cache_composite_tier));
+      tier->cache = mapcache_configuration_get_cache(config, cur_node->txt);
+      if(!tier->cache) {
+         ctx->set_error(ctx, 400, "composite cache \"%s\" references cache \"%s\","
+               " but it is not configured (hint: referenced caches must be declared before this cache in the xml file)",
+               cache->name, cur_node->txt);
+         return;
+      }
+      if(!write || !strcmp(write,"all")) {
+         tier->write = MAPCACHE_COMPOSITE_WRITE_ALL;
+      } else if(!strcmp(write,"rendered")) {
+         tier->write = MAPCACHE_COMPOSITE_WRITE_RENDERED;
+      } else if(!strcmp(write,"promoted")) {
+         tier->write = MAPCACHE_COMPOSITE_WRITE_PROMOTED;
+      } else if(!strcmp(write,"none")) {
+         tier->write = MAPCACHE_COMPOSITE_WRITE_NONE;
+      } else {
+         ctx->set_error(ctx, 400, "composite cache \"%s\": invalid write policy \"%s\" for cache \"%s\""
+               " (expecting \"all\", \"rendered\", \"promoted\" or \"none\")", cache->name, write, cur_node->txt);
+         return;
+      }
+      APR_ARRAY_PUSH(dcache->tiers,mapcache_cache_composite_tier*) = tier;
+   }
+}
+
+/**
+ * \private \memberof mapcache_cache_composite
+ */
+static void _mapcache_cache_composite_configuration_post_config(mapcache_context *ctx, mapcache_cache *cache,
+      mapcache_cfg *cfg) {
+   mapcache_cache_composite *dcache = (mapcache_cache_composite*)cache;
+   int i;
+   if(apr_is_empty_array(dcache->tiers)) {
+      ctx->set_error(ctx, 400, "composite cache \"%s\" has no <cache>s configured", cache->name);
+      return;
+   }
+   for(i=0; i<dcache->tiers->nelts; i++) {
+      if(TIER(dcache,i)->cache == cache) {
+         ctx->set_error(ctx, 400, "composite cache \"%s\" cannot contain itself", cache->name);
+         return;
+      }
+   }
+}
+
+
+/**
+ * \brief creates and initializes a mapcache_cache_composite
+ */
+mapcache_cache* mapcache_cache_composite_create(mapcache_context *ctx) {
+   mapcache_cache_composite *cache = apr_pcalloc(ctx->pool,sizeof(mapcache_cache_composite));
+   if(!cache) {
+      ctx->set_error(ctx, 500, "failed to allocate composite cache");
+      return NULL;
+   }
+   cache->cache.metadata = apr_table_make(ctx->pool,3);
+   cache->cache.type = MAPCACHE_CACHE_COMPOSITE;
+   cache->cache.tile_get = _mapcache_cache_composite_get;
+   cache->cache.tile_exists = _mapcache_cache_composite_has_tile;
+   cache->cache.tile_set = _mapcache_cache_composite_set;
+   cache->cache.tile_multi_set = _mapcache_cache_composite_multi_set;
+   cache->cache.tile_delete = _mapcache_cache_composite_delete;
+   cache->cache.configuration_post_config = _mapcache_cache_composite_configuration_post_config;
+   cache->cache.configuration_parse_xml = _mapcache_cache_composite_configuration_parse_xml;
+   cache->tiers = apr_array_make(ctx->pool,3,sizeof(mapcache_cache_composite_tier*));
+   return (mapcache_cache*)cache;
+}
+
+/* vim: ai ts=3 sts=3 et sw=3
+*/
@@ -0,0 +1,502 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache tile caching support file: in-process LRU cache in
+ *           front of another cache backend.
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include "mapcache.h"
+#include <apr_strings.h>
+#include <string.h>
+#include <stdlib.h>
+
+/*
+ * the tiles are spread over several shards according to the hash of their key,
+ * each shard having its own lock, hash table and LRU list, so that concurrent
+ * requests seldom wait on each other.
+ */
+
+typedef struct _mapcache_lru_entry _mapcache_lru_entry;
+struct _mapcache_lru_entry {
+   apr_uint64_t hash;
+   char *key;
+   unsigned char *data;
+   size_t size;
+   apr_time_t mtime; /* modification time of the tile, as returned by the backend */
+   apr_time_t added; /* when the tile was put in memory, for the ttl */
+   _mapcache_lru_entry *prev, *next; /* LRU list, most recently used first */
+   _mapcache_lru_entry *chain; /* hash bucket */
+};
+
+typedef struct {
+#if APR_HAS_THREADS
+   apr_thread_mutex_t *mutex;
+#endif
+   _mapcache_lru_entry **buckets;
+   int nbuckets;
+   int count;
+   apr_size_t size;
+   apr_size_t max_size;
+   _mapcache_lru_entry *head, *tail;
+   unsigned int hits, misses;
+} _mapcache_lru_shard;
+
+#define MAPCACHE_LRU_INITIAL_BUCKETS 256
+/* log the hit/miss counters every so many lookups */
+#define MAPCACHE_LRU_STATS_INTERVAL 65536
+
+/* 64 bit FNV-1a */
+static apr_uint64_t _mapcache_lru_hash(const char *str) {
+   apr_uint64_t hash = 14695981039346656037ULL;
+   while(*str) {
+      hash ^= (unsigned char)*str++;
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+static void _mapcache_cache_memory_tile_key(mapcache_context *ctx, mapcache_tile *tile, char **key) {
+   char *start;
+   start = apr_pstrcat(ctx->pool,
+         tile->tileset->name,"/",
+         tile->grid_link->grid->name,
+         NULL);
+   if(tile->dimensions) {
+      const apr_array_header_t *elts = apr_table_elts(tile->dimensions);
+      int i = elts->nelts;
+      while(i--) {
+         apr_table_entry_t *entry = &(APR_ARRAY_IDX(elts,i,apr_table_entry_t));
+         start = apr_pstrcat(ctx->pool,start,"/",entry->val,NULL);
+      }
+   }
+   *key = apr_psprintf(ctx->pool,"%s/%d/%d/%d",start,tile->z,tile->x,tile->y);
+}
+
+static _mapcache_lru_shard* _mapcache_lru_shard_get(mapcache_cache_memory *cache, apr_uint64_t hash) {
+   return &((_mapcache_lru_shard*)cache->shards)[(hash >> 32) % cache->nshards];
+}
+
+static void _mapcache_lru_unlink(_mapcache_lru_shard *shard, _mapcache_lru_entry *e) {
+   if(e->prev) e->prev->next = e->next; else shard->head = e->next;
+   if(e->next) e->next->prev = e->prev; else shard->tail = e->prev;
+   e->prev = e->next = NULL;
+}
+
+static void _mapcache_lru_push_front(_mapcache_lru_shard *shard, _mapcache_lru_entry *e) {
+   e->prev = NULL;
+   e->next = shard->head;
+   if(shard->head) shard->head->prev = e;
+   shard->head = e;
+   if(!shard->tail) shard->tail = e;
+}
+
+static _mapcache_lru_entry* _mapcache_lru_find(_mapcache_lru_shard *shard, const char *key, apr_uint64_t hash) {
+   _mapcache_lru_entry *e = shard->buckets[hash % shard->nbuckets];
+   while(e) {
+      if(e->hash == hash && !strcmp(e->key,key)) return e;
+      e = e->chain;
+   }
+   return NULL;
+}
+
+static void _mapcache_lru_remove(_mapcache_lru_shard *shard, _mapcache_lru_entry *e) {
+   _mapcache_lru_entry **b = &shard->buckets[e->hash % shard->nbuckets];
+   while(*b != e) b = &(*b)->chain;
+   *b = e->chain;
+   _mapcache_lru_unlink(shard,e);
+   shard->count--;
+   shard->size -= e->size;
+   free(e);
+}
+
+static void _mapcache_lru_grow(_mapcache_lru_shard *shard) {
+   int i, nbuckets = shard->nbuckets * 2;
+   _mapcache_lru_entry **buckets = calloc(nbuckets, sizeof(_mapcache_lru_entry*));
+   if(!buckets) return; /* keep the current table, it is only slower */
+   for(i=0; i<shard->nbuckets; i++) {
+      _mapcache_lru_entry *e = shard->buckets[i];
+      while(e) {
+         _mapcache_lru_entry *next = e->chain;
+         e->chain = buckets[e->hash % nbuckets];
+         buckets[e->hash % nbuckets] = e;
+         e = next;
+      }
+   }
+   free(shard->buckets);
+   shard->buckets = buckets;
+   shard->nbuckets = nbuckets;
+}
+
+static void _mapcache_lru_lock(_mapcache_lru_shard *shard) {
+#if APR_HAS_THREADS
+   if(shard->mutex) apr_thread_mutex_lock(shard->mutex);
+#endif
+}
+
+static void _mapcache_lru_unlock(_mapcache_lru_shard *shard) {
+#if APR_HAS_THREADS
+   if(shard->mutex) apr_thread_mutex_unlock(shard->mutex);
+#endif
+}
+
+static void _mapcache_cache_memory_log_stats(mapcache_context *ctx, mapcache_cache_memory *cache) {
+   int i, count = 0;
+   apr_uint64_t hits = 0, misses = 0, size = 0;
+   /* approximate: the other shards are read without taking their locks */
+   for(i=0; i<cache->nshards; i++) {
+      _mapcache_lru_shard *shard = &((_mapcache_lru_shard*)cache->shards)[i];
+      hits += shard->hits;
+      misses += shard->misses;
+      count += shard->count;
+      size += shard->size;
+   }
+   ctx->log(ctx, MAPCACHE_DEBUG, "memory cache %s: %llu hits, %llu misses, %d tiles in %llu bytes",
+         cache->cache.name, (unsigned long long)hits, (unsigned long long)misses, count, (unsigned long long)size);
+}
+
+/*
+ * look the tile up in memory, copying its data to the request pool.
+ * returns MAPCACHE_CACHE_MISS if the tile isn't held
+ */
+static int _mapcache_cache_memory_lookup(mapcache_context *ctx, mapcache_cache_memory *cache,
+      mapcache_tile *tile, int copy) {
+   char *key;
+   apr_uint64_t hash;
+   _mapcache_lru_shard *shard;
+   _mapcache_lru_entry *e;
+   int ret = MAPCACHE_CACHE_MISS, logstats = 0;
+
+   _mapcache_cache_memory_tile_key(ctx, tile, &key);
+   hash = _mapcache_lru_hash(key);
+   shard = _mapcache_lru_shard_get(cache, hash);
+   _mapcache_lru_lock(shard);
+   e = _mapcache_lru_find(shard, key, hash);
+   if(e && cache->ttl && apr_time_now() - e->added > cache->ttl) {
+      _mapcache_lru_remove(shard, e);
+      e = NULL;
+   }
+   if(e) {
+      _mapcache_lru_unlink(shard, e);
+      _mapcache_lru_push_front(shard, e);
+      if(copy) {
+         tile->encoded_data = mapcache_buffer_create(e->size, ctx->pool);
+         memcpy(tile->encoded_data->buf, e->data, e->size);
+         tile->encoded_data->size = e->size;
+         tile->mtime = e->mtime;
+      }
+      shard->hits++;
+      ret = MAPCACHE_SUCCESS;
+   } else {
+      shard->misses++;
+   }
+   logstats = ((shard->hits + shard->misses) % MAPCACHE_LRU_STATS_INTERVAL) == 0;
+   _mapcache_lru_unlock(shard);
+   if(logstats) {
+      _mapcache_cache_memory_log_stats(ctx, cache);
+   }
+   return ret;
+}
+
+/* put a copy of the encoded data of the tile in memory, evicting the least recently used tiles */
+static void _mapcache_cache_memory_store(mapcache_context *ctx, mapcache_cache_memory *cache, mapcache_tile *tile) {
+   char *key;
+   size_t keylen;
+   apr_uint64_t hash;
+   _mapcache_lru_shard *shard;
+   _mapcache_lru_entry *e;
+
+   if(!tile->encoded_data || !tile->encoded_data->size) return;
+   _mapcache_cache_memory_tile_key(ctx, tile, &key);
+   hash = _mapcache_lru_hash(key);
+   shard = _mapcache_lru_shard_get(cache, hash);
+   /* don't let a single tile flush a large part of the shard */
+   if(tile->encoded_data->size > shard->max_size / 4) return;
+
+   keylen = strlen(key) + 1;
+   e = malloc(sizeof(_mapcache_lru_entry) + keylen + tile->encoded_data->size);
+   if(!e) return;
+   e->hash = hash;
+   e->key = (char*)(e + 1);
+   memcpy(e->key, key, keylen);
+   e->data = (unsigned char*)e->key + keylen;
+   memcpy(e->data, tile->encoded_data->buf, tile->encoded_data->size);
+   e->size = tile->encoded_data->size;
+   e->mtime = tile->mtime;
+   e->added = apr_time_now();
+   e->prev = e->next = NULL;
+
+   _mapcache_lru_lock(shard);
+   {
+      _mapcache_lru_entry *old = _mapcache_lru_find(shard, key, hash);
+      if(old) _mapcache_lru_remove(shard, old);
+   }
+   while(shard->tail && shard->size + e->size > shard->max_size) {
+      _mapcache_lru_remove(shard, shard->tail);
+   }
+   if(shard->count >= shard->nbuckets * 2) {
+      _mapcache_lru_grow(shard);
+   }
+   e->chain = shard->buckets[hash % shard->nbuckets];
+   shard->buckets[hash % shard->nbuckets] = e;
+   _mapcache_lru_push_front(shard, e);
+   shard->count++;
+   shard->size += e->size;
+   _mapcache_lru_unlock(shard);
+}
+
+static void _mapcache_cache_memory_forget(mapcache_context *ctx, mapcache_cache_memory *cache, mapcache_tile *tile) {
+   char *key;
+   apr_uint64_t hash;
+   _mapcache_lru_shard *shard;
+   _mapcache_lru_entry *e;
+   _mapcache_cache_memory_tile_key(ctx, tile, &key);
+   hash = _mapcache_lru_hash(key);
+   shard = _mapcache_lru_shard_get(cache, hash);
+   _mapcache_lru_lock(shard);
+   if((e = _mapcache_lru_find(shard, key, hash)) != NULL) {
+      _mapcache_lru_remove(shard, e);
+   }
+   _mapcache_lru_unlock(shard);
+}
+
+/*
+ * the backends find their own configuration through tile->tileset->cache, so
+ * they are called on a copy of the tileset pointing to the backend
+ */
+#define BACKEND_TILESET_SWAP(tile,backend_tileset,cache) \
+   backend_tileset = *((tile)->tileset); \
+   backend_tileset.cache = (cache)->backend; \
+   (tile)->tileset = &backend_tileset
+
+static int _mapcache_cache_memory_has_tile(mapcache_context *ctx, mapcache_tile *tile) {
+   mapcache_cache_memory *cache = (mapcache_cache_memory*)tile->tileset->cache;
+   mapcache_tileset *tileset = tile->tileset, backend_tileset;
+   int ret;
+   if(_mapcache_cache_memory_lookup(ctx, cache, tile, 0) == MAPCACHE_SUCCESS) {
+      return MAPCACHE_TRUE;
+   }
+   BACKEND_TILESET_SWAP(tile, backend_tileset, cache);
+   ret = cache->backend->tile_exists(ctx, tile);
+   tile->tileset = tileset;
+   return ret;
+}
+
+static void _mapcache_cache_memory_delete(mapcache_context *ctx, mapcache_tile *tile) {
+   mapcache_cache_memory *cache = (mapcache_cache_memory*)tile->tileset->cache;
+   mapcache_tileset *tileset = tile->tileset, backend_tileset;
+   _mapcache_cache_memory_forget(ctx, cache, tile);
+   BACKEND_TILESET_SWAP(tile, backend_tileset, cache);
+   cache->backend->tile_delete(ctx, tile);
+   tile->tileset = tileset;
+}
+
+/**
+ * \brief get content of given tile
+ *
+ * returns the tile from memory if it is held there, otherwise reads it from the
+ * backend and keeps a copy of it
+ * \private \memberof mapcache_cache_memory
+ * \sa mapcache_cache::tile_get()
+ */
+static int _mapcache_cache_memory_get(mapcache_context *ctx, mapcache_tile *tile) {
+   mapcache_cache_memory *cache = (mapcache_cache_memory*)tile->tileset->cache;
+   mapcache_tileset *tileset = tile->tileset, backend_tileset;
+   int ret;
+   if(_mapcache_cache_memory_lookup(ctx, cache, tile, 1) == MAPCACHE_SUCCESS) {
+      return MAPCACHE_SUCCESS;
+   }
+   BACKEND_TILESET_SWAP(tile, backend_tileset, cache);
+   ret = cache->backend->tile_get(ctx, tile);
+   tile->tileset = tileset;
+   if(ret == MAPCACHE_SUCCESS && !GC_HAS_ERROR(ctx)) {
+      _mapcache_cache_memory_store(ctx, cache, tile);
+   }
+   return ret;
+}
+
+static void _mapcache_cache_memory_set(mapcache_context *ctx, mapcache_tile *tile) {
+   mapcache_cache_memory *cache = (mapcache_cache_memory*)tile->tileset->cache;
+   mapcache_tileset *tileset = tile->tileset, backend_tileset;
+   BACKEND_TILESET_SWAP(tile, backend_tileset, cache);
+   cache->backend->tile_set(ctx, tile);
+   tile->tileset = tileset;
+   GC_CHECK_ERROR(ctx);
+   /* the backend has encoded the tile if it needed to, otherwise don't bother */
+   if(tile->encoded_data) {
+      _mapcache_cache_memory_store(ctx, cache, tile);
+   } else {
+      _mapcache_cache_memory_forget(ctx, cache, tile);
+   }
+}
+
+static void _mapcache_cache_memory_multi_set(mapcache_context *ctx, mapcache_tile *tiles, int ntiles) {
+   mapcache_cache_memory *cache = (mapcache_cache_memory*)tiles[0].tileset->cache;
+   mapcache_tileset *tileset = tiles[0].tileset, backend_tileset;
+   int i;
+   if(!cache->backend->tile_multi_set) {
+      for(i=0; i<ntiles; i++) {
+         _mapcache_cache_memory_set(ctx, &tiles[i]);
+         GC_CHECK_ERROR(ctx);
+      }
+      return;
+   }
+   backend_tileset = *tileset;
+   backend_tileset.cache = cache->backend;
+   for(i=0; i<ntiles; i++) tiles[i].tileset = &backend_tileset;
+   cache->backend->tile_multi_set(ctx, tiles, ntiles);
+   for(i=0; i<ntiles; i++) tiles[i].tileset = tileset;
+   GC_CHECK_ERROR(ctx);
+   for(i=0; i<ntiles; i++) {
+      if(tiles[i].encoded_data) {
+         _mapcache_cache_memory_store(ctx, cache, &tiles[i]);
+      } else {
+         _mapcache_cache_memory_forget(ctx, cache, &tiles[i]);
+      }
+   }
+}
+
+static apr_status_t _mapcache_cache_memory_cleanup(void *data) {
+   mapcache_cache_memory *cache = (mapcache_cache_memory*)data;
+   int i;
+   for(i=0; i<cache->nshards; i++) {
+      _mapcache_lru_shard *shard = &((_mapcache_lru_shard*)cache->shards)[i];
+      while(shard->head) {
+         _mapcache_lru_remove(shard, shard->head);
+      }
+      free(shard->buckets);
+      shard->buckets = NULL;
+   }
+   return APR_SUCCESS;
+}
+
+/**
+ * \private \memberof mapcache_cache_memory
+ */
+static void _mapcache_cache_memory_configuration_parse_xml(mapcache_context *ctx, ezxml_t node, mapcache_cache *cache, mapcache_cfg *config) {
+   ezxml_t cur_node;
+   mapcache_cache_memory *dcache = (mapcache_cache_memory*)cache;
+   char *endptr;
+   if ((cur_node = ezxml_child(node,"cache")) != NULL && cur_node->txt && *cur_node->txt) {
+      dcache->backend = mapcache_configuration_get_cache(config, cur_node->txt);
+      if(!dcache->backend) {
+         ctx->set_error(ctx, 400, "memory cache \"%s\" references cache \"%s\","
+               " but it is not configured (hint: referenced caches must be declared before this cache in the xml file)",
+               cache->name, cur_node->txt);
+         return;
+      }
+   } else {
+      ctx->set_error(ctx, 400, "memory cache \"%s\" has no <cache> to read the tiles from", cache->name);
+      return;
+   }
+   if ((cur_node = ezxml_child(node,"size")) != NULL) {
+      long size = strtol(cur_node->txt,&endptr,10);
+      if(*endptr != 0 || size <= 0) {
+         ctx->set_error(ctx, 400, "failed to parse size \"%s\" of memory cache \"%s\" (expecting a positive number of megabytes)",
+               cur_node->txt, cache->name);
+         return;
+      }
+      dcache->max_size = (apr_size_t)size * 1024 * 1024;
+   }
+   if ((cur_node = ezxml_child(node,"shards")) != NULL) {
+      dcache->nshards = (int)strtol(cur_node->txt,&endptr,10);
+      if(*endptr != 0 || dcache->nshards <= 0) {
+         ctx->set_error(ctx, 400, "failed to parse shards \"%s\" of memory cache \"%s\" (expecting a positive integer)",
+               cur_node->txt, cache->name);
+         return;
+      }
+   }
+   if ((cur_node = ezxml_child(node,"ttl")) != NULL) {
+      int ttl = (int)strtol(cur_node->txt,&endptr,10);
+      if(*endptr != 0 || ttl < 0) {
+         ctx->set_error(ctx, 400, "failed to parse ttl \"%s\" of memory cache \"%s\" (expecting a number of seconds)",
+               cur_node->txt, cache->name);
+         return;
+      }
+      dcache->ttl = apr_time_from_sec(ttl);
+   }
+}
+
+/**
+ * \private \memberof mapcache_cache_memory
+ */
+static void _mapcache_cache_memory_configuration_post_config(mapcache_context *ctx, mapcache_cache *cache,
+      mapcache_cfg *cfg) {
+   mapcache_cache_memory *dcache = (mapcache_cache_memory*)cache;
+   int i;
+   if(!dcache->backend) {
+      ctx->set_error(ctx, 400, "memory cache \"%s\" has no <cache> configured", cache->name);
+      return;
+   }
+   if(dcache->backend == cache) {
+      ctx->set_error(ctx, 400, "memory cache \"%s\" cannot read its tiles from itself", cache->name);
+      return;
+   }
+   if(dcache->shards) return;
+   dcache->shards = apr_pcalloc(ctx->pool, dcache->nshards * sizeof(_mapcache_lru_shard));
+   for(i=0; i<dcache->nshards; i++) {
+      _mapcache_lru_shard *shard = &((_mapcache_lru_shard*)dcache->shards)[i];
+      shard->max_size = dcache->max_size / dcache->nshards;
+      shard->nbuckets = MAPCACHE_LRU_INITIAL_BUCKETS;
+      shard->buckets = calloc(shard->nbuckets, sizeof(_mapcache_lru_entry*));
+      if(!shard->buckets) {
+         ctx->set_error(ctx, 500, "memory cache \"%s\": failed to allocate hash table", cache->name);
+         return;
+      }
+#if APR_HAS_THREADS
+      apr_thread_mutex_create(&shard->mutex, APR_THREAD_MUTEX_DEFAULT, ctx->pool);
+#endif
+   }
+   apr_pool_cleanup_register(ctx->pool, dcache,
+         _mapcache_cache_memory_cleanup, apr_pool_cleanup_null);
+}
+
+
+/**
+ * \brief creates and initializes a mapcache_cache_memory
+ */
+mapcache_cache* mapcache_cache_memory_create(mapcache_context *ctx) {
+   mapcache_cache_memory *cache = apr_pcalloc(ctx->pool,sizeof(mapcache_cache_memory));
+   if(!cache) {
+      ctx->set_error(ctx, 500, "failed to allocate memory cache");
+      return NULL;
+   }
+   cache->cache.metadata = apr_table_make(ctx->pool,3);
+   cache->cache.type = MAPCACHE_CACHE_MEMORY;
+   cache->cache.tile_get = _mapcache_cache_memory_get;
+   cache->cache.tile_exists = _mapcache_cache_memory_has_tile;
+   cache->cache.tile_set = _mapcache_cache_memory_set;
+   cache->cache.tile_multi_set = _mapcache_cache_memory_multi_set;
+   cache->cache.tile_delete = _mapcache_cache_memory_delete;
+   cache->cache.configuration_post_config = _mapcache_cache_memory_configuration_post_config;
+   cache->cache.configuration_parse_xml = _mapcache_cache_memory_configuration_parse_xml;
+   cache->max_size = 64 * 1024 * 1024;
+   cache->nshards = 16;
+   cache->ttl = 0;
+   return (mapcache_cache*)cache;
+}
+
+/* vim: ai ts=3 sts=3 et sw=3
+*/
@@ -31,6 +31,7 @@
 
 #include "mapcache.h"
 #include <apr_strings.h>
+#include <apr_reslist.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
@@ -76,20 +77,109 @@ static char* _get_dbname(mapcache_context *ctx,  mapcache_tileset *tileset, mapc
    return path;
 }
 
-static sqlite3* _get_conn(mapcache_context *ctx, mapcache_tile* tile, int readonly) {
-   sqlite3* handle;
+/* the statements kept prepared on each pooled connection */
+enum {
+   SQLITE_STMT_EXISTS,
+   SQLITE_STMT_GET,
+   SQLITE_STMT_HITSTAT,
+   SQLITE_STMT_SET,
+   SQLITE_STMT_DELETE,
+   SQLITE_STMT_COUNT
+};
+
+struct sqlite_conn {
+   sqlite3 *handle;
+   sqlite3_stmt *prepared_statements[SQLITE_STMT_COUNT];
+   apr_reslist_t *pool; /* the pool this connection was acquired from */
+};
+
+struct sqlite_conn_params {
+   mapcache_cache_sqlite *cache;
    char *dbfile;
+   int readonly;
+};
+
+static apr_status_t _sqlite_reslist_get_connection(void **conn_, void *params, apr_pool_t *pool) {
+   /* the database itself is opened on first use, where errors can be reported to the request */
+   struct sqlite_conn *conn = calloc(1,sizeof(struct sqlite_conn));
+   if(!conn) {
+      return APR_ENOMEM;
+   }
+   *conn_ = conn;
+   return APR_SUCCESS;
+}
+
+static apr_status_t _sqlite_reslist_free_connection(void *conn_, void *params, apr_pool_t *pool) {
+   struct sqlite_conn *conn = (struct sqlite_conn*)conn_;
+   int i;
+   for(i=0; i<SQLITE_STMT_COUNT; i++) {
+      if(conn->prepared_statements[i]) {
+         sqlite3_finalize(conn->prepared_statements[i]);
+      }
+   }
+   if(conn->handle) {
+      sqlite3_close(conn->handle);
+   }
+   free(conn);
+   return APR_SUCCESS; 
+}
+
+/**
+ * \brief get the connection pool for a database file, creating it if needed
+ */
+static apr_reslist_t* _get_conn_pool(mapcache_context *ctx, mapcache_cache_sqlite *cache, char *dbfile, int readonly) {
+   apr_reslist_t *pool;
+   char *key = apr_pstrcat(ctx->pool, readonly?"ro:":"rw:", dbfile, NULL);
+#if APR_HAS_THREADS
+   apr_thread_mutex_lock(cache->connection_pools_mutex);
+#endif
+#ifndef _WIN32
+   if(cache->connection_pools_pid != getpid()) {
+      /* we are a child forked after connections were opened, sqlite handles must not cross a fork */
+      cache->connection_pools = apr_hash_make(cache->pool);
+      cache->connection_pools_pid = getpid();
+   }
+#endif
+   pool = apr_hash_get(cache->connection_pools, key, APR_HASH_KEY_STRING);
+   if(!pool) {
+      apr_status_t rv;
+      struct sqlite_conn_params *params = apr_pcalloc(cache->pool, sizeof(struct sqlite_conn_params));
+      params->cache = cache;
+      params->dbfile = apr_pstrdup(cache->pool, dbfile);
+      params->readonly = readonly;
+      rv = apr_reslist_create(&pool,
+            0 /* min */,
+            10 /* soft max */,
+            200 /* hard max */,
+            60*1000000 /*60 seconds, ttl*/,
+            _sqlite_reslist_get_connection, /* resource constructor */
+            _sqlite_reslist_free_connection, /* resource destructor */
+            params, cache->pool);
+      if(rv != APR_SUCCESS) {
+         ctx->set_error(ctx,500,"failed to create sqlite connection pool for %s", dbfile);
+         pool = NULL;
+      } else {
+         apr_hash_set(cache->connection_pools, apr_pstrdup(cache->pool, key), APR_HASH_KEY_STRING, pool);
+      }
+   }
+#if APR_HAS_THREADS
+   apr_thread_mutex_unlock(cache->connection_pools_mutex);
+#endif
+   return pool;
+}
+
+static sqlite3* _open_db(mapcache_context *ctx, mapcache_cache_sqlite *cache, char *dbfile, int readonly) {
+   sqlite3* handle;
    int flags, ret;
    if(readonly) {
       flags = SQLITE_OPEN_READONLY;
    } else {
       flags = SQLITE_OPEN_READWRITE;
    }
-   dbfile = _get_dbname(ctx,tile->tileset, tile->grid_link->grid);
    ret = sqlite3_open_v2(dbfile,&handle,flags,NULL);
    if(ret != SQLITE_OK) {
       /* maybe the database file doesn't exist yet. so we create it and setup the schema */
-      mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*)tile->tileset->cache;
+      sqlite3_close(handle);
       ret = sqlite3_open_v2(dbfile, &handle,SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE,NULL);
       if (ret != SQLITE_OK) {
          ctx->set_error(ctx, 500, "sqlite backend failed to open db %s: %s", dbfile, sqlite3_errmsg(handle));
@@ -115,9 +205,84 @@ static sqlite3* _get_conn(mapcache_context *ctx, mapcache_tile* tile, int readon
       }
    }
    sqlite3_busy_timeout(handle,300000);
+   if(!readonly && cache->journal_mode) {
+      char *pragma = apr_psprintf(ctx->pool,"PRAGMA journal_mode=%s",cache->journal_mode);
+      if(sqlite3_exec(handle, pragma, 0, 0, NULL) != SQLITE_OK) {
+         ctx->log(ctx, MAPCACHE_WARN, "sqlite backend failed to set journal mode %s on %s: %s",
+               cache->journal_mode, dbfile, sqlite3_errmsg(handle));
+      } else if(!strcasecmp(cache->journal_mode,"wal")) {
+         /* in wal mode this is still safe against corruption, and saves an fsync per commit */
+         sqlite3_exec(handle, "PRAGMA synchronous=NORMAL", 0, 0, NULL);
+      }
+   }
    return handle;
 }
 
+static struct sqlite_conn* _get_conn(mapcache_context *ctx, mapcache_tile* tile, int readonly) {
+   mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*)tile->tileset->cache;
+   struct sqlite_conn *conn;
+   apr_reslist_t *pool;
+   apr_status_t rv;
+   char *dbfile = _get_dbname(ctx,tile->tileset, tile->grid_link->grid);
+   pool = _get_conn_pool(ctx, cache, dbfile, readonly);
+   if(!pool) {
+      return NULL;
+   }
+   rv = apr_reslist_acquire(pool, (void **)&conn);
+   if(rv != APR_SUCCESS) {
+      ctx->set_error(ctx,500,"failed to aquire connection to sqlite db %s", dbfile);
+      return NULL;
+   }
+   conn->pool = pool;
+   if(!conn->handle) {
+      conn->handle = _open_db(ctx, cache, dbfile, readonly);
+      if(!conn->handle) {
+         apr_reslist_invalidate(pool, (void*)conn);
+         return NULL;
+      }
+   }
+   return conn;
+}
+
+static void _release_conn(mapcache_context *ctx, struct sqlite_conn *conn) {
+   if(GC_HAS_ERROR(ctx)) {
+      apr_reslist_invalidate(conn->pool, (void*)conn);
+   } else {
+      apr_reslist_release(conn->pool, (void*)conn);
+   }
+}
+
+/**
+ * \brief get one of the statements of the cache, prepared once per connection
+ */
+static sqlite3_stmt* _get_stmt(mapcache_context *ctx, mapcache_cache_sqlite *cache, struct sqlite_conn *conn, int which) {
+   if(!conn->prepared_statements[which]) {
+      mapcache_cache_sqlite_stmt *stmt;
+      switch(which) {
+         case SQLITE_STMT_EXISTS: stmt = &cache->exists_stmt; break;
+         case SQLITE_STMT_GET: stmt = &cache->get_stmt; break;
+         case SQLITE_STMT_HITSTAT: stmt = &cache->hitstat_stmt; break;
+         case SQLITE_STMT_SET: stmt = &cache->set_stmt; break;
+         default: stmt = &cache->delete_stmt; break;
+      }
+      if(sqlite3_prepare_v2(conn->handle,stmt->sql,-1,&conn->prepared_statements[which],NULL) != SQLITE_OK) {
+         ctx->set_error(ctx,500,"sqlite backend failed to prepare \"%s\": %s",stmt->sql,sqlite3_errmsg(conn->handle));
+         conn->prepared_statements[which] = NULL;
+         return NULL;
+      }
+   }
+   return conn->prepared_statements[which];
+}
+
+/**
+ * \brief reset a statement once we are done with it, so it does not keep a transaction open
+ * on the pooled connection
+ */
+static void _reset_stmt(sqlite3_stmt *stmt) {
+   sqlite3_reset(stmt);
+   sqlite3_clear_bindings(stmt);
+}
+
 /**
  * \brief apply appropriate tile properties to the sqlite statement */
 static void _bind_sqlite_params(mapcache_context *ctx, sqlite3_stmt *stmt, mapcache_tile *tile) {
@@ -170,75 +335,85 @@ static void _bind_sqlite_params(mapcache_context *ctx, sqlite3_stmt *stmt, mapca
 
 static int _mapcache_cache_sqlite_has_tile(mapcache_context *ctx, mapcache_tile *tile) {
    mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*)tile->tileset->cache;
-   sqlite3* handle = _get_conn(ctx,tile,1);
+   struct sqlite_conn *conn = _get_conn(ctx,tile,1);
    sqlite3_stmt *stmt;
    int ret;
    if(GC_HAS_ERROR(ctx)) {
-      sqlite3_close(handle);
       return MAPCACHE_FALSE;
    }
 
-   sqlite3_prepare(handle,cache->exists_stmt.sql,-1,&stmt,NULL);
+   stmt = _get_stmt(ctx,cache,conn,SQLITE_STMT_EXISTS);
+   if(GC_HAS_ERROR(ctx)) {
+      _release_conn(ctx,conn);
+      return MAPCACHE_FALSE;
+   }
    _bind_sqlite_params(ctx,stmt,tile);
    ret = sqlite3_step(stmt);
    if(ret != SQLITE_DONE && ret != SQLITE_ROW) {
-      ctx->set_error(ctx,500,"sqlite backend failed on has_tile: %s",sqlite3_errmsg(handle));
+      ctx->set_error(ctx,500,"sqlite backend failed on has_tile: %s",sqlite3_errmsg(conn->handle));
    }
    if(ret == SQLITE_DONE) {
       ret = MAPCACHE_FALSE;
    } else if(ret == SQLITE_ROW){
       ret = MAPCACHE_TRUE;
    }
-   sqlite3_finalize(stmt);
-   sqlite3_close(handle);
+   _reset_stmt(stmt);
+   _release_conn(ctx,conn);
    return ret;
 }
 
 static void _mapcache_cache_sqlite_delete(mapcache_context *ctx, mapcache_tile *tile) {
    mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*)tile->tileset->cache;
-   sqlite3* handle = _get_conn(ctx,tile,0);
+   struct sqlite_conn *conn = _get_conn(ctx,tile,0);
    sqlite3_stmt *stmt;
    int ret;
    GC_CHECK_ERROR(ctx);
-   sqlite3_prepare(handle,cache->delete_stmt.sql,-1,&stmt,NULL);
+   stmt = _get_stmt(ctx,cache,conn,SQLITE_STMT_DELETE);
+   if(GC_HAS_ERROR(ctx)) {
+      _release_conn(ctx,conn);
+      return;
+   }
    _bind_sqlite_params(ctx,stmt,tile);
    ret = sqlite3_step(stmt);
    if(ret != SQLITE_DONE && ret != SQLITE_ROW) {
-      ctx->set_error(ctx,500,"sqlite backend failed on delete: %s",sqlite3_errmsg(handle));
+      ctx->set_error(ctx,500,"sqlite backend failed on delete: %s",sqlite3_errmsg(conn->handle));
    }
-   sqlite3_finalize(stmt);
-   sqlite3_close(handle);
+   _reset_stmt(stmt);
+   _release_conn(ctx,conn);
 }
 
 
 static int _mapcache_cache_sqlite_get(mapcache_context *ctx, mapcache_tile *tile) {
    mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*)tile->tileset->cache;
-   sqlite3 *handle;
+   struct sqlite_conn *conn;
    sqlite3_stmt *stmt;
    int ret;
    if(cache->hitstats) {
-      handle = _get_conn(ctx,tile,0);
+      conn = _get_conn(ctx,tile,0);
    } else {
-      handle = _get_conn(ctx,tile,1);
+      conn = _get_conn(ctx,tile,1);
    }
    if(GC_HAS_ERROR(ctx)) {
-      sqlite3_close(handle);
       return MAPCACHE_FAILURE;
    }
-   sqlite3_prepare(handle,cache->get_stmt.sql,-1,&stmt,NULL);
+   stmt = _get_stmt(ctx,cache,conn,SQLITE_STMT_GET);
+   if(GC_HAS_ERROR(ctx)) {
+      _release_conn(ctx,conn);
+      return MAPCACHE_FAILURE;
+   }
    _bind_sqlite_params(ctx,stmt,tile);
    do {
       ret = sqlite3_step(stmt);
       if(ret!=SQLITE_DONE && ret != SQLITE_ROW && ret!=SQLITE_BUSY && ret !=SQLITE_LOCKED) {
-         ctx->set_error(ctx,500,"sqlite backend failed on get: %s",sqlite3_errmsg(handle));
-         sqlite3_finalize(stmt);
-         sqlite3_close(handle);
+         ctx->set_error(ctx,500,"sqlite backend failed on get: %s",sqlite3_errmsg(conn->handle));
+         _reset_stmt(stmt);
+         _release_conn(ctx,conn);
          return MAPCACHE_FAILURE;
       }
    } while (ret == SQLITE_BUSY || ret == SQLITE_LOCKED);
    if(ret == SQLITE_DONE) {
-      sqlite3_finalize(stmt);
-      sqlite3_close(handle);
+      _reset_stmt(stmt);
+      _release_conn(ctx,conn);
       return MAPCACHE_CACHE_MISS;
    } else {
       const void *blob = sqlite3_column_blob(stmt,0);
@@ -250,42 +425,102 @@ static int _mapcache_cache_sqlite_get(mapcache_context *ctx, mapcache_tile *tile
          time_t mtime = sqlite3_column_int64(stmt, 1);
          apr_time_ansi_put(&(tile->mtime),mtime);
       }
-      sqlite3_finalize(stmt);
+      _reset_stmt(stmt);
 
       /* update the hitstats if we're configured for that */
       if(cache->hitstats) {
-         sqlite3_stmt *hitstmt;
-         sqlite3_prepare(handle,cache->hitstat_stmt.sql,-1,&hitstmt,NULL);
-         _bind_sqlite_params(ctx,stmt,tile);
-         sqlite3_step(hitstmt); /* we ignore the return value , TODO?*/
-         sqlite3_finalize(hitstmt);
+         sqlite3_stmt *hitstmt = _get_stmt(ctx,cache,conn,SQLITE_STMT_HITSTAT);
+         if(hitstmt) {
+            _bind_sqlite_params(ctx,hitstmt,tile);
+            sqlite3_step(hitstmt); /* we ignore the return value , TODO?*/
+            _reset_stmt(hitstmt);
+         } else {
+            ctx->clear_errors(ctx);
+         }
       }
 
-      sqlite3_close(handle);
+      _release_conn(ctx,conn);
       return MAPCACHE_SUCCESS;
    }
 }
 
-static void _mapcache_cache_sqlite_set(mapcache_context *ctx, mapcache_tile *tile) {
-   mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*)tile->tileset->cache;
-   sqlite3* handle = _get_conn(ctx,tile,0);
-   sqlite3_stmt *stmt;
+/**
+ * \brief insert a tile with the prepared set statement of an acquired connection
+ */
+static void _sqlite_set_tile(mapcache_context *ctx, struct sqlite_conn *conn, sqlite3_stmt *stmt, mapcache_tile *tile) {
    int ret;
-   GC_CHECK_ERROR(ctx);
-   sqlite3_prepare(handle,cache->set_stmt.sql,-1,&stmt,NULL);
    _bind_sqlite_params(ctx,stmt,tile);
+   GC_CHECK_ERROR(ctx);
    do {
       ret = sqlite3_step(stmt);
       if(ret != SQLITE_DONE && ret != SQLITE_ROW && ret != SQLITE_BUSY && ret != SQLITE_LOCKED) {
-         ctx->set_error(ctx,500,"sqlite backend failed on set: %s (%d)",sqlite3_errmsg(handle),ret);
+         ctx->set_error(ctx,500,"sqlite backend failed on set: %s (%d)",sqlite3_errmsg(conn->handle),ret);
          break;
       }
       if(ret == SQLITE_BUSY) {
          sqlite3_reset(stmt);
       }
    } while (ret == SQLITE_BUSY || ret == SQLITE_LOCKED);
-   sqlite3_finalize(stmt);
-   sqlite3_close(handle);
+   _reset_stmt(stmt);
+}
+
+static void _mapcache_cache_sqlite_set(mapcache_context *ctx, mapcache_tile *tile) {
+   mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*)tile->tileset->cache;
+   struct sqlite_conn *conn = _get_conn(ctx,tile,0);
+   sqlite3_stmt *stmt;
+   GC_CHECK_ERROR(ctx);
+   stmt = _get_stmt(ctx,cache,conn,SQLITE_STMT_SET);
+   if(stmt) {
+      _sqlite_set_tile(ctx,conn,stmt,tile);
+   }
+   _release_conn(ctx,conn);
+}
+
+/**
+ * \brief insert all the tiles (e.g. of a metatile) in a single transaction
+ */
+static void _mapcache_cache_sqlite_multi_set(mapcache_context *ctx, mapcache_tile *tiles, int ntiles) {
+   mapcache_cache_sqlite *cache = (mapcache_cache_sqlite*)tiles[0].tileset->cache;
+   struct sqlite_conn *conn;
+   sqlite3_stmt *stmt;
+   int i, ret;
+
+   /* encode the tiles beforehand, we don't want to hold the write lock while doing that */
+   for(i=0; i<ntiles; i++) {
+      mapcache_tile *tile = &tiles[i];
+      if(!tile->encoded_data) {
+         tile->encoded_data = tile->tileset->format->write(ctx, tile->raw_image, tile->tileset->format);
+         GC_CHECK_ERROR(ctx);
+      }
+   }
+
+   conn = _get_conn(ctx,&tiles[0],0);
+   GC_CHECK_ERROR(ctx);
+   stmt = _get_stmt(ctx,cache,conn,SQLITE_STMT_SET);
+   if(GC_HAS_ERROR(ctx)) {
+      _release_conn(ctx,conn);
+      return;
+   }
+   ret = sqlite3_exec(conn->handle, "BEGIN IMMEDIATE", 0, 0, NULL);
+   if(ret != SQLITE_OK) {
+      ctx->set_error(ctx,500,"sqlite backend failed to begin transaction: %s (%d)",sqlite3_errmsg(conn->handle),ret);
+      _release_conn(ctx,conn);
+      return;
+   }
+   for(i=0; i<ntiles; i++) {
+      _sqlite_set_tile(ctx,conn,stmt,&tiles[i]);
+      if(GC_HAS_ERROR(ctx)) break;
+   }
+   if(GC_HAS_ERROR(ctx)) {
+      sqlite3_exec(conn->handle, "ROLLBACK", 0, 0, NULL);
+   } else {
+      ret = sqlite3_exec(conn->handle, "COMMIT", 0, 0, NULL);
+      if(ret != SQLITE_OK) {
+         ctx->set_error(ctx,500,"sqlite backend failed to commit %d tiles: %s (%d)",ntiles,sqlite3_errmsg(conn->handle),ret);
+         sqlite3_exec(conn->handle, "ROLLBACK", 0, 0, NULL);
+      }
+   }
+   _release_conn(ctx,conn);
 }
 
 
@@ -306,6 +541,18 @@ static void _mapcache_cache_sqlite_configuration_parse_xml(mapcache_context *ctx
          dcache->hitstats = 1;
       }
    }
+   if ((cur_node = ezxml_child(node,"journal_mode")) != NULL) {
+      if(!strcasecmp(cur_node->txt,"default")) {
+         dcache->journal_mode = NULL;
+      } else if(!strcasecmp(cur_node->txt,"wal") || !strcasecmp(cur_node->txt,"delete") ||
+            !strcasecmp(cur_node->txt,"truncate") || !strcasecmp(cur_node->txt,"persist")) {
+         dcache->journal_mode = apr_pstrdup(ctx->pool,cur_node->txt);
+      } else {
+         ctx->set_error(ctx,400,"sqlite cache \"%s\": invalid <journal_mode> \"%s\" (expecting wal, delete, truncate, persist or default)",
+               cache->name, cur_node->txt);
+         return;
+      }
+   }
    if(!dcache->dbname_template) {
       ctx->set_error(ctx,500,"sqlite cache \"%s\" is missing <dbname_template> entry",cache->name);
       return;
@@ -334,8 +581,18 @@ mapcache_cache* mapcache_cache_sqlite_create(mapcache_context *ctx) {
    cache->cache.tile_get = _mapcache_cache_sqlite_get;
    cache->cache.tile_exists = _mapcache_cache_sqlite_has_tile;
    cache->cache.tile_set = _mapcache_cache_sqlite_set;
+   cache->cache.tile_multi_set = _mapcache_cache_sqlite_multi_set;
    cache->cache.configuration_post_config = _mapcache_cache_sqlite_configuration_post_config;
    cache->cache.configuration_parse_xml = _mapcache_cache_sqlite_configuration_parse_xml;
+   cache->journal_mode = NULL;
+   apr_pool_create(&cache->pool,ctx->pool);
+   cache->connection_pools = apr_hash_make(cache->pool);
+#ifndef _WIN32
+   cache->connection_pools_pid = getpid();
+#endif
+#if APR_HAS_THREADS
+   apr_thread_mutex_create(&cache->connection_pools_mutex, APR_THREAD_MUTEX_DEFAULT, cache->pool);
+#endif
    cache->create_stmt.sql = apr_pstrdup(ctx->pool,
          "create table if not exists tiles(x integer, y integer, z integer, data blob, dim text, ctime datetime, atime datetime, hitcount integer default 0, primary key(x,y,z,dim))");
    cache->exists_stmt.sql = apr_pstrdup(ctx->pool,
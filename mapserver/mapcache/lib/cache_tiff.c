@@ -37,6 +37,10 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <tiffio.h>
+#include <fcntl.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 #ifdef USE_GEOTIFF
 #include "xtiffio.h"
@@ -210,71 +214,336 @@ static void check_tiff_format(mapcache_context *ctx, mapcache_tile *tile, TIFF *
 }
 #endif
 
-static int _mapcache_cache_tiff_has_tile(mapcache_context *ctx, mapcache_tile *tile) {
+/**
+ * \brief a tiff file whose full resolution directory has been parsed
+ *
+ * the tile offsets, tile sizes and jpeg tables of the file are kept in memory,
+ * along with an open descriptor, so that subsequent requests on the same file
+ * only need a stat() and a pread() of the tile data.
+ * handles are allocated with malloc as they are evicted and replaced over the
+ * lifetime of the process. the descriptor is only read with pread(), so handles
+ * inherited by a forked child remain usable.
+ */
+struct tiff_handle {
    char *filename;
-   TIFF *hTIFF;
-   mapcache_cache_tiff *dcache;
-   _mapcache_cache_tiff_tile_key(ctx, tile, &filename);
-   dcache = (mapcache_cache_tiff*)tile->tileset->cache;
-   if(GC_HAS_ERROR(ctx)) {
-      return MAPCACHE_FALSE;
+   apr_time_t mtime; /**< modification time of the file when it was parsed */
+   apr_off_t size; /**< size of the file when it was parsed */
+#ifndef _WIN32
+   int fd;
+#endif
+   uint32 ntiles;
+   toff_t *offsets;
+   toff_t *sizes;
+   unsigned char *jpegtable;
+   uint32 jpegtable_size;
+   int refcount; /**< number of requests currently using the handle */
+   int stale; /**< handle has been removed from the table, free it when the last user is done */
+   apr_uint64_t lastuse;
+};
+
+static void _tiff_handle_free(struct tiff_handle *h) {
+#ifndef _WIN32
+   if(h->fd != -1)
+      close(h->fd);
+#endif
+   free(h->offsets);
+   free(h->sizes);
+   free(h->jpegtable);
+   free(h->filename);
+   free(h);
+}
+
+static void _tiff_handles_lock(mapcache_cache_tiff *dcache) {
+#if APR_HAS_THREADS
+   apr_thread_mutex_lock(dcache->handles_mutex);
+#endif
+}
+
+static void _tiff_handles_unlock(mapcache_cache_tiff *dcache) {
+#if APR_HAS_THREADS
+   apr_thread_mutex_unlock(dcache->handles_mutex);
+#endif
+}
+
+/* remove a handle from the table. must be called with the handles mutex held */
+static void _tiff_handle_forget(mapcache_cache_tiff *dcache, struct tiff_handle *h) {
+   apr_hash_set(dcache->handles, h->filename, APR_HASH_KEY_STRING, NULL);
+   h->stale = 1;
+   if(!h->refcount)
+      _tiff_handle_free(h);
+}
+
+static apr_status_t _tiff_handles_cleanup(void *data) {
+   mapcache_cache_tiff *dcache = (mapcache_cache_tiff*)data;
+   apr_hash_index_t *hi;
+   for(hi = apr_hash_first(NULL,dcache->handles); hi; hi = apr_hash_next(hi)) {
+      void *val;
+      apr_hash_this(hi,NULL,NULL,&val);
+      _tiff_handle_free((struct tiff_handle*)val);
    }
-   hTIFF = MyTIFFOpen(filename,"r");
+   apr_hash_clear(dcache->handles);
+   return APR_SUCCESS;
+}
 
-   if(hTIFF) {
-      do { 
-         uint32 nSubType = 0;
-         int tiff_offx, tiff_offy; /* the x and y offset of the tile inside the tiff image */
-         int tiff_off; /* the index of the tile inside the list of tiles of the tiff image */
-         
-         mapcache_grid_level *level;
-         int ntilesx;
-         int ntilesy;
-         toff_t  *offsets=NULL, *sizes=NULL;
+/**
+ * \brief parse the first full resolution directory of a tiff file
+ * \returns NULL if the file could not be opened or contains no suitable directory,
+ * with an error set on ctx if the file was not usable
+ */
+static struct tiff_handle* _tiff_handle_load(mapcache_context *ctx, mapcache_tile *tile,
+      const char *filename, apr_finfo_t *finfo) {
+   TIFF *hTIFF = MyTIFFOpen(filename,"r");
 
-         if( !TIFFGetField(hTIFF, TIFFTAG_SUBFILETYPE, &nSubType) )
-            nSubType = 0;
+   /* 
+    * we currrently have no way of knowing if the opening failed because the tif
+    * file does not exist (which is not an error condition, as it only signals
+    * that the requested tile does not exist in the cache), or if an other error
+    * that should be signaled occured (access denied, not a tiff file, etc...)
+    *
+    * we ignore this case here and hope that further parts of the code will be
+    * able to detect what's happening more precisely
+    */
+   if(!hTIFF)
+      return NULL;
+
+   do { 
+      uint32 nSubType = 0;
+      toff_t *offsets=NULL, *sizes=NULL;
+      uint32 jpegtable_size = 0;
+      unsigned char* jpegtable_ptr = NULL;
+      struct tiff_handle *h;
 
-         /* skip overviews and masks */
-         if( (nSubType & FILETYPE_REDUCEDIMAGE) ||
-               (nSubType & FILETYPE_MASK) )
-            continue;
+      if( !TIFFGetField(hTIFF, TIFFTAG_SUBFILETYPE, &nSubType) )
+         nSubType = 0;
 
+      /* skip overviews and masks */
+      if( (nSubType & FILETYPE_REDUCEDIMAGE) ||
+            (nSubType & FILETYPE_MASK) )
+         continue;
 
 #ifdef DEBUG
-         check_tiff_format(ctx,tile,hTIFF,filename);
-         if(GC_HAS_ERROR(ctx)) {
-            MyTIFFClose(hTIFF);
-            return MAPCACHE_FALSE;
-         }
+      check_tiff_format(ctx,tile,hTIFF,filename);
+      if(GC_HAS_ERROR(ctx)) {
+         MyTIFFClose(hTIFF);
+         return NULL;
+      }
 #endif
-	 level = tile->grid_link->grid->levels[tile->z];
-         ntilesx = MAPCACHE_MIN(dcache->count_x, level->maxx);
-         ntilesy = MAPCACHE_MIN(dcache->count_y, level->maxy);
-         
-         /* x offset of the tile along a row */
-         tiff_offx = tile->x % ntilesx;
-
-         /* 
-          * y offset of the requested row. we inverse it as the rows are ordered
-          * from top to bottom, whereas the tile y is bottom to top
-          */
-         tiff_offy = ntilesy - (tile->y % ntilesy) -1;
-         tiff_off = tiff_offy * ntilesx + tiff_offx;
-         
-         TIFFGetField( hTIFF, TIFFTAG_TILEOFFSETS, &offsets );
-         TIFFGetField( hTIFF, TIFFTAG_TILEBYTECOUNTS, &sizes );
+
+      /* get the offset of the jpeg data from the start of the file for each tile */
+      if( TIFFGetField( hTIFF, TIFFTAG_TILEOFFSETS, &offsets ) != 1 || !offsets ) {
+         ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" tile offsets",
+               filename);
+         MyTIFFClose(hTIFF);
+         return NULL;
+      }
+
+      /* get the size of the jpeg data for each tile */
+      if( TIFFGetField( hTIFF, TIFFTAG_TILEBYTECOUNTS, &sizes ) != 1 || !sizes ) {
+         ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" tile sizes",
+               filename);
          MyTIFFClose(hTIFF);
-         if( offsets[tiff_off] > 0 && sizes[tiff_off] > 0 ) {
-            return MAPCACHE_TRUE;
-         } else {
-            return MAPCACHE_FALSE;
+         return NULL;
+      }
+
+      h = calloc(1,sizeof(struct tiff_handle));
+      h->filename = strdup(filename);
+      h->mtime = finfo->mtime;
+      h->size = finfo->size;
+      h->ntiles = TIFFNumberOfTiles(hTIFF);
+      h->offsets = malloc(h->ntiles * sizeof(toff_t));
+      h->sizes = malloc(h->ntiles * sizeof(toff_t));
+      memcpy(h->offsets, offsets, h->ntiles * sizeof(toff_t));
+      memcpy(h->sizes, sizes, h->ntiles * sizeof(toff_t));
+
+      /* 
+       * the jpeg header common to all tiles. a missing header is only an
+       * error once we have a tile to return
+       */
+      if( TIFFGetField( hTIFF, TIFFTAG_JPEGTABLES, &jpegtable_size, &jpegtable_ptr ) == 1 &&
+            jpegtable_ptr && jpegtable_size >= 2) {
+         h->jpegtable = malloc(jpegtable_size);
+         memcpy(h->jpegtable, jpegtable_ptr, jpegtable_size);
+         h->jpegtable_size = jpegtable_size;
+      }
+      MyTIFFClose(hTIFF);
+
+#ifndef _WIN32
+      h->fd = open(filename, O_RDONLY);
+      if(h->fd == -1) {
+         /* shouldn't usually happen, we managed to open the file with TIFFOpen */
+         ctx->set_error(ctx,500,"failed to open already parsed tiff file \"%s\": %s",
+               filename, strerror(errno));
+         _tiff_handle_free(h);
+         return NULL;
+      }
+#endif
+      return h;
+   } /* loop through the tiff directories if there are multiple ones */
+   while( TIFFReadDirectory( hTIFF ) );
+
+   /* does the file only contain overviews? */
+   MyTIFFClose(hTIFF);
+   return NULL;
+}
+
+/**
+ * \brief get the parsed handle of a tiff file, parsing it if needed
+ *
+ * a cached handle is reused as long as the modification time and size of the
+ * file are unchanged.
+ * \returns NULL if the file does not exist or holds no usable tiles. the returned
+ * handle must be given back with _tiff_handle_release()
+ */
+static struct tiff_handle* _tiff_handle_acquire(mapcache_context *ctx, mapcache_tile *tile,
+      const char *filename) {
+   mapcache_cache_tiff *dcache = (mapcache_cache_tiff*)tile->tileset->cache;
+   struct tiff_handle *h, *loaded, *discard = NULL;
+   apr_finfo_t finfo;
+
+   if(apr_stat(&finfo,filename,APR_FINFO_MTIME|APR_FINFO_SIZE,ctx->pool) != APR_SUCCESS)
+      return NULL;
+
+   if(dcache->max_handles <= 0) {
+      /* handle caching disabled: the handle is freed as soon as it is released */
+      h = _tiff_handle_load(ctx,tile,filename,&finfo);
+      if(h) {
+         h->stale = 1;
+         h->refcount = 1;
+      }
+      return h;
+   }
+
+   _tiff_handles_lock(dcache);
+   h = apr_hash_get(dcache->handles, filename, APR_HASH_KEY_STRING);
+   if(h && (h->mtime != finfo.mtime || h->size != finfo.size)) {
+      /* the file has been rewritten since we parsed it */
+      _tiff_handle_forget(dcache,h);
+      h = NULL;
+   }
+   if(h) {
+      h->refcount++;
+      h->lastuse = ++dcache->handles_clock;
+   }
+   _tiff_handles_unlock(dcache);
+   if(h)
+      return h;
+
+   /* parse the file without holding the lock, other files can be served meanwhile */
+   loaded = _tiff_handle_load(ctx,tile,filename,&finfo);
+   if(!loaded)
+      return NULL;
+
+   _tiff_handles_lock(dcache);
+   h = apr_hash_get(dcache->handles, filename, APR_HASH_KEY_STRING);
+   if(h && h->mtime == loaded->mtime && h->size == loaded->size) {
+      /* another thread parsed the same file while we were doing so */
+      discard = loaded;
+   } else {
+      if(h)
+         _tiff_handle_forget(dcache,h);
+      if(apr_hash_count(dcache->handles) >= (unsigned int)dcache->max_handles) {
+         /* evict the least recently used handle */
+         struct tiff_handle *lru = NULL;
+         apr_hash_index_t *hi;
+         for(hi = apr_hash_first(NULL,dcache->handles); hi; hi = apr_hash_next(hi)) {
+            void *val;
+            apr_hash_this(hi,NULL,NULL,&val);
+            if(!lru || ((struct tiff_handle*)val)->lastuse < lru->lastuse)
+               lru = (struct tiff_handle*)val;
          }
-      } while( TIFFReadDirectory( hTIFF ) );
-      return MAPCACHE_FALSE; /* TIFF only contains overviews ? */
+         if(lru)
+            _tiff_handle_forget(dcache,lru);
+      }
+      apr_hash_set(dcache->handles, loaded->filename, APR_HASH_KEY_STRING, loaded);
+      h = loaded;
+   }
+   h->refcount++;
+   h->lastuse = ++dcache->handles_clock;
+   _tiff_handles_unlock(dcache);
+   if(discard)
+      _tiff_handle_free(discard);
+   return h;
+}
+
+static void _tiff_handle_release(mapcache_cache_tiff *dcache, struct tiff_handle *h) {
+   int do_free;
+   if(dcache->max_handles <= 0) {
+      _tiff_handle_free(h);
+      return;
+   }
+   _tiff_handles_lock(dcache);
+   h->refcount--;
+   do_free = (h->stale && !h->refcount);
+   _tiff_handles_unlock(dcache);
+   if(do_free)
+      _tiff_handle_free(h);
+}
+
+/**
+ * \brief drop the cached handle of a file we are about to modify
+ */
+static void _tiff_handle_invalidate(mapcache_cache_tiff *dcache, const char *filename) {
+   struct tiff_handle *h;
+   if(dcache->max_handles <= 0)
+      return;
+   _tiff_handles_lock(dcache);
+   h = apr_hash_get(dcache->handles, filename, APR_HASH_KEY_STRING);
+   if(h)
+      _tiff_handle_forget(dcache,h);
+   _tiff_handles_unlock(dcache);
+}
+
+/**
+ * \brief index of the tile inside the list of tiles of its tiff file
+ */
+static int _mapcache_cache_tiff_tile_index(mapcache_tile *tile) {
+   mapcache_cache_tiff *dcache = (mapcache_cache_tiff*)tile->tileset->cache;
+   mapcache_grid_level *level;
+   int ntilesx;
+   int ntilesy;
+   int tiff_offx, tiff_offy; /* the x and y offset of the tile inside the tiff image */
+
+   /* 
+    * compute the width and height of the full tiff file. This
+    * is not simply the tile size times the number of tiles per
+    * file for lower zoom levels
+    */
+   level = tile->grid_link->grid->levels[tile->z];
+   ntilesx = MAPCACHE_MIN(dcache->count_x, level->maxx);
+   ntilesy = MAPCACHE_MIN(dcache->count_y, level->maxy);
+
+   /* x offset of the tile along a row */
+   tiff_offx = tile->x % ntilesx;
+
+   /* 
+    * y offset of the requested row. we inverse it as the rows are ordered
+    * from top to bottom, whereas the tile y is bottom to top
+    */
+   tiff_offy = ntilesy - (tile->y % ntilesy) -1;
+   return tiff_offy * ntilesx + tiff_offx;
+}
+
+static int _mapcache_cache_tiff_has_tile(mapcache_context *ctx, mapcache_tile *tile) {
+   char *filename;
+   struct tiff_handle *h;
+   int tiff_off; /* the index of the tile inside the list of tiles of the tiff image */
+   int ret;
+   _mapcache_cache_tiff_tile_key(ctx, tile, &filename);
+   if(GC_HAS_ERROR(ctx)) {
+      return MAPCACHE_FALSE;
    }
-   else
+   h = _tiff_handle_acquire(ctx, tile, filename);
+   if(!h) {
       return MAPCACHE_FALSE;
+   }
+   tiff_off = _mapcache_cache_tiff_tile_index(tile);
+   if( tiff_off < (int)h->ntiles && h->offsets[tiff_off] > 0 && h->sizes[tiff_off] > 0 ) {
+      ret = MAPCACHE_TRUE;
+   } else {
+      ret = MAPCACHE_FALSE;
+   }
+   _tiff_handle_release((mapcache_cache_tiff*)tile->tileset->cache, h);
+   return ret;
 }
 
 static void _mapcache_cache_tiff_delete(mapcache_context *ctx, mapcache_tile *tile) {
@@ -291,9 +560,11 @@ static void _mapcache_cache_tiff_delete(mapcache_context *ctx, mapcache_tile *ti
  */
 static int _mapcache_cache_tiff_get(mapcache_context *ctx, mapcache_tile *tile) {
    char *filename;
-   TIFF *hTIFF = NULL;
-   int rv;
+   struct tiff_handle *h;
+   int tiff_off; /* the index of the tile inside the list of tiles of the tiff image */
    mapcache_cache_tiff *dcache;
+   char *bufptr;
+   apr_size_t bytes, toread;
    _mapcache_cache_tiff_tile_key(ctx, tile, &filename);
    dcache = (mapcache_cache_tiff*)tile->tileset->cache;
    if(GC_HAS_ERROR(ctx)) {
@@ -303,189 +574,102 @@ static int _mapcache_cache_tiff_get(mapcache_context *ctx, mapcache_tile *tile)
    ctx->log(ctx,MAPCACHE_DEBUG,"tile (%d,%d,%d) => filename %s)",
          tile->x,tile->y,tile->z,filename);
 #endif
-   
-   hTIFF = MyTIFFOpen(filename,"r");
+
+   h = _tiff_handle_acquire(ctx, tile, filename);
+   if(GC_HAS_ERROR(ctx)) {
+      return MAPCACHE_FAILURE;
+   }
+   if(!h) {
+      /* failed to open tiff file, or it only contains overviews */
+      return MAPCACHE_CACHE_MISS;
+   }
+
+   tiff_off = _mapcache_cache_tiff_tile_index(tile);
 
    /* 
-    * we currrently have no way of knowing if the opening failed because the tif
-    * file does not exist (which is not an error condition, as it only signals
-    * that the requested tile does not exist in the cache), or if an other error
-    * that should be signaled occured (access denied, not a tiff file, etc...)
-    *
-    * we ignore this case here and hope that further parts of the code will be
-    * able to detect what's happening more precisely
+    * the tile data exists for the given tiff_off if both offsets and size
+    * are not zero for that index.
+    * if not, the tiff file is sparse and is missing the requested tile
     */
+   if( tiff_off >= (int)h->ntiles || !h->offsets[tiff_off] || !h->sizes[tiff_off] ) {
+      _tiff_handle_release(dcache, h);
+      return MAPCACHE_CACHE_MISS;
+   }
 
-   if(hTIFF) {
-      do { 
-         uint32 nSubType = 0;
-         int tiff_offx, tiff_offy; /* the x and y offset of the tile inside the tiff image */
-         int tiff_off; /* the index of the tile inside the list of tiles of the tiff image */
-         
-         mapcache_grid_level *level;
-         int ntilesx;
-         int ntilesy;
-         toff_t  *offsets=NULL, *sizes=NULL;
-         
-         if( !TIFFGetField(hTIFF, TIFFTAG_SUBFILETYPE, &nSubType) )
-            nSubType = 0;
-
-         /* skip overviews */
-         if( nSubType & FILETYPE_REDUCEDIMAGE )
-            continue;
+   if( !h->jpegtable ) {
+      /* there is no common jpeg header in the tiff tags */
+      ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" jpeg table",
+            filename);
+      _tiff_handle_release(dcache, h);
+      return MAPCACHE_FAILURE;
+   }
 
+   /* 
+    * extract the file modification time. this isn't guaranteed to be the
+    * modification time of the actual tile, but it's the best we can do
+    */
+   tile->mtime = h->mtime;
 
-#ifdef DEBUG
-         check_tiff_format(ctx,tile,hTIFF,filename);
-         if(GC_HAS_ERROR(ctx)) {
-            MyTIFFClose(hTIFF);
-            return MAPCACHE_FAILURE;
-         }
-#endif
-         /* 
-          * compute the width and height of the full tiff file. This
-          * is not simply the tile size times the number of tiles per
-          * file for lower zoom levels
-          */
-	 level = tile->grid_link->grid->levels[tile->z];
-         ntilesx = MAPCACHE_MIN(dcache->count_x, level->maxx);
-         ntilesy = MAPCACHE_MIN(dcache->count_y, level->maxy);
-         
-         /* x offset of the tile along a row */
-         tiff_offx = tile->x % ntilesx;
-
-         /* 
-          * y offset of the requested row. we inverse it as the rows are ordered
-          * from top to bottom, whereas the tile y is bottom to top
-          */
-         tiff_offy = ntilesy - (tile->y % ntilesy) -1;
-         tiff_off = tiff_offy * ntilesx + tiff_offx;
-         
-         /* get the offset of the jpeg data from the start of the file for each tile */
-         rv = TIFFGetField( hTIFF, TIFFTAG_TILEOFFSETS, &offsets );
-         if( rv != 1 ) {
-            ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" tile offsets",
-                  filename);
-            MyTIFFClose(hTIFF);
-            return MAPCACHE_FAILURE;
-         }
+   /* create a memory buffer to contain the jpeg data */
+   tile->encoded_data = mapcache_buffer_create((h->jpegtable_size+h->sizes[tiff_off]-4),ctx->pool);
 
-         /* get the size of the jpeg data for each tile */
-         rv = TIFFGetField( hTIFF, TIFFTAG_TILEBYTECOUNTS, &sizes );
-         if( rv != 1 ) {
-            ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" tile sizes",
-                  filename);
-            MyTIFFClose(hTIFF);
-            return MAPCACHE_FAILURE;
-         }
+   /* 
+    * copy the jpeg header to the beginning of the memory buffer,
+    * omitting the last 2 bytes
+    */
+   memcpy(tile->encoded_data->buf,h->jpegtable,(h->jpegtable_size-2));
 
-         /* 
-          * the tile data exists for the given tiff_off if both offsets and size
-          * are not zero for that index.
-          * if not, the tiff file is sparse and is missing the requested tile
-          */
-         if( offsets[tiff_off] > 0 && sizes[tiff_off] > 0 ) {
-            apr_file_t *f;
-            apr_finfo_t finfo;
-            apr_status_t ret;
-            
-            /* read the jpeg header (common to all tiles) */
-            uint32 jpegtable_size = 0;
-            unsigned char* jpegtable_ptr;
-            rv = TIFFGetField( hTIFF, TIFFTAG_JPEGTABLES, &jpegtable_size, &jpegtable_ptr );
-            if( rv != 1 || !jpegtable_ptr || !jpegtable_size) {
-               /* there is no common jpeg header in the tiff tags */
-               ctx->set_error(ctx,500,"Failed to read TIFF file \"%s\" jpeg table",
-                     filename);
-               MyTIFFClose(hTIFF);
-               return MAPCACHE_FAILURE;
-            }
-
-            /* 
-             * open the tiff file directly to access the jpeg image data with the given
-             * offset
-             */
-            if((ret=apr_file_open(&f, filename, 
-                        APR_FOPEN_READ|APR_FOPEN_BUFFERED|APR_FOPEN_BINARY,APR_OS_DEFAULT,
-                        ctx->pool)) == APR_SUCCESS) {
-               char *bufptr;
-	       apr_off_t off;
-	       apr_size_t bytes;
-               ret = apr_file_info_get(&finfo, APR_FINFO_MTIME, f);
-               if(ret == APR_SUCCESS) {
-                  /* 
-                   * extract the file modification time. this isn't guaranteed to be the
-                   * modification time of the actual tile, but it's the best we can do
-                   */
-                  tile->mtime = finfo.mtime;
-               }           
-
-               /* create a memory buffer to contain the jpeg data */
-               tile->encoded_data = mapcache_buffer_create((jpegtable_size+sizes[tiff_off]-4),ctx->pool);
-
-               /* 
-                * copy the jpeg header to the beginning of the memory buffer,
-                * omitting the last 2 bytes
-                */
-               memcpy(tile->encoded_data->buf,jpegtable_ptr,(jpegtable_size-2));
-
-               /* advance the data pointer to after the header data */
-               bufptr = tile->encoded_data->buf + (jpegtable_size-2);
-
-               
-               /* go to the specified offset in the tiff file, plus 2 bytes */
-               off = offsets[tiff_off]+2;
-               apr_file_seek(f,APR_SET,&off);
-
-               /*
-                * copy the jpeg body at the end of the memory buffer, accounting
-                * for the two bytes we omitted in the previous step
-                */
-               bytes = sizes[tiff_off]-2;
-               apr_file_read(f,bufptr,&bytes);
-
-               /* check we have correctly read the requested number of bytes */
-               if(bytes !=  sizes[tiff_off]-2) {
-                  ctx->set_error(ctx,500,"failed to read jpeg body in \"%s\".\
-                        (read %d of %d bytes)", filename,bytes,sizes[tiff_off]-2);
-                  MyTIFFClose(hTIFF);
-                  return MAPCACHE_FAILURE;
-               }
-
-               tile->encoded_data->size = (jpegtable_size+sizes[tiff_off]-4);
-
-               /* finalize and cleanup */
-               apr_file_close(f);
-               MyTIFFClose(hTIFF);
-               return MAPCACHE_SUCCESS;
-            } else {
-               /* shouldn't usually happen. we managed to open the file with TIFFOpen,
-                * but apr_file_open failed to do so.
-                * nothing much to do except bail out.
-                */
-               ctx->set_error(ctx,500,"apr_file_open failed on already open tiff file \"%s\", giving up .... ",
-                     filename);
-               MyTIFFClose(hTIFF);
-               return MAPCACHE_FAILURE;
-            }
-         } else {
-            /* sparse tiff file without the requested tile */
-            MyTIFFClose(hTIFF);
-            return MAPCACHE_CACHE_MISS;
-         }
-      } /* loop through the tiff directories if there are multiple ones */
-      while( TIFFReadDirectory( hTIFF ) );
+   /* advance the data pointer to after the header data */
+   bufptr = tile->encoded_data->buf + (h->jpegtable_size-2);
 
-      /* 
-       * should not happen?
-       * finished looping through directories and didn't find anything suitable.
-       * does the file only contain overviews?
-       */
-      MyTIFFClose(hTIFF);
-      return MAPCACHE_CACHE_MISS;
+   /*
+    * copy the jpeg body at the end of the memory buffer, accounting
+    * for the two bytes we omitted in the previous step. the body starts
+    * at the specified offset in the tiff file, plus 2 bytes
+    */
+   toread = h->sizes[tiff_off]-2;
+#ifndef _WIN32
+   bytes = 0;
+   while(bytes < toread) {
+      ssize_t rv = pread(h->fd, bufptr + bytes, toread - bytes,
+            (off_t)(h->offsets[tiff_off] + 2 + bytes));
+      if(rv < 0 && errno == EINTR)
+         continue;
+      if(rv <= 0)
+         break;
+      bytes += rv;
+   }
+#else
+   {
+      apr_file_t *f;
+      apr_off_t off;
+      if(apr_file_open(&f, filename, APR_FOPEN_READ|APR_FOPEN_BINARY,APR_OS_DEFAULT,
+                  ctx->pool) != APR_SUCCESS) {
+         /* shouldn't usually happen. we managed to open the file with TIFFOpen */
+         ctx->set_error(ctx,500,"apr_file_open failed on already open tiff file \"%s\", giving up .... ",
+               filename);
+         _tiff_handle_release(dcache, h);
+         return MAPCACHE_FAILURE;
+      }
+      off = h->offsets[tiff_off]+2;
+      apr_file_seek(f,APR_SET,&off);
+      bytes = toread;
+      apr_file_read_full(f,bufptr,toread,&bytes);
+      apr_file_close(f);
    }
-   /* failed to open tiff file */
-   return MAPCACHE_CACHE_MISS;
+#endif
+
+   /* check we have correctly read the requested number of bytes */
+   if(bytes != toread) {
+      ctx->set_error(ctx,500,"failed to read jpeg body in \"%s\".\
+            (read %d of %d bytes)", filename,(int)bytes,(int)toread);
+      _tiff_handle_release(dcache, h);
+      return MAPCACHE_FAILURE;
+   }
+
+   tile->encoded_data->size = (h->jpegtable_size+h->sizes[tiff_off]-4);
+   _tiff_handle_release(dcache, h);
+   return MAPCACHE_SUCCESS;
 }
 
 /**
@@ -725,6 +909,8 @@ static void _mapcache_cache_tiff_set(mapcache_context *ctx, mapcache_tile *tile)
 close_tiff:
    if(hTIFF)
       MyTIFFClose(hTIFF);
+   /* the offsets and sizes of the file have changed */
+   _tiff_handle_invalidate(dcache,filename);
    mapcache_unlock_resource(ctx,filename);
 #else
    ctx->set_error(ctx,500,"tiff write support disabled by default");
@@ -783,6 +969,15 @@ static void _mapcache_cache_tiff_configuration_parse_xml(mapcache_context *ctx,
       return;
    }
    dcache->format = (mapcache_image_format_jpeg*)pformat;
+
+   if ((cur_node = ezxml_child(node,"open_files")) != NULL) {
+      char *endptr;
+      dcache->max_handles = (int)strtol(cur_node->txt,&endptr,10);
+      if(*endptr != 0 || dcache->max_handles < 0) {
+         ctx->set_error(ctx,400,"failed to parse open_files value %s for tiff cache %s", cur_node->txt,cache->name);
+         return;
+      }
+   }
 }
 
 /**
@@ -821,6 +1016,13 @@ mapcache_cache* mapcache_cache_tiff_create(mapcache_context *ctx) {
    cache->cache.configuration_parse_xml = _mapcache_cache_tiff_configuration_parse_xml;
    cache->count_x = 10;
    cache->count_y = 10;
+   cache->max_handles = 64;
+   apr_pool_create(&cache->pool,ctx->pool);
+   cache->handles = apr_hash_make(cache->pool);
+#if APR_HAS_THREADS
+   apr_thread_mutex_create(&cache->handles_mutex, APR_THREAD_MUTEX_DEFAULT, cache->pool);
+#endif
+   apr_pool_cleanup_register(cache->pool, cache, _tiff_handles_cleanup, apr_pool_cleanup_null);
 #ifndef DEBUG
    TIFFSetWarningHandler(NULL);
    TIFFSetErrorHandler(NULL);
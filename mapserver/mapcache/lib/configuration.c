@@ -34,46 +34,18 @@
 #include <math.h>
 
 void mapcache_configuration_parse(mapcache_context *ctx, const char *filename, mapcache_cfg *config, int cgi) {
- apr_dir_t *lockdir;
-   apr_status_t rv;
-   char errmsg[120];  
    char *url;
 
- mapcache_configuration_parse_xml(ctx,filename,config);
+   mapcache_configuration_parse_xml(ctx,filename,config);
   
 
    GC_CHECK_ERROR(ctx);
 
-   if(!config->lockdir || !strlen(config->lockdir)) {
-      config->lockdir = apr_pstrdup(ctx->pool, "/tmp");
+   if(!config->locker) {
+      config->locker = mapcache_locker_disk_create(ctx);
    }
-   rv = apr_dir_open(&lockdir,config->lockdir,ctx->pool);
-   if(rv != APR_SUCCESS) {
-      ctx->set_error(ctx,500, "failed to open lock directory %s: %s"
-            ,config->lockdir,apr_strerror(rv,errmsg,120));
-      return;
-   }
-
-   /* only remove lockfiles if we're not in cgi mode */
-   if(!cgi) {
-      apr_finfo_t finfo;
-      while ((apr_dir_read(&finfo, APR_FINFO_DIRENT|APR_FINFO_TYPE|APR_FINFO_NAME, lockdir)) == APR_SUCCESS) {
-         if(finfo.filetype == APR_REG) {
-            if(!strncmp(finfo.name, MAPCACHE_LOCKFILE_PREFIX, strlen(MAPCACHE_LOCKFILE_PREFIX))) {
-               ctx->log(ctx,MAPCACHE_WARN,"found old lockfile %s/%s, deleting it",config->lockdir,
-                     finfo.name);
-               rv = apr_file_remove(apr_psprintf(ctx->pool,"%s/%s",config->lockdir, finfo.name),ctx->pool);
-               if(rv != APR_SUCCESS) {
-                  ctx->set_error(ctx,500, "failed to remove lockfile %s: %s",finfo.name,apr_strerror(rv,errmsg,120));
-                  return;
-               }
-
-            }
-
-         }
-      }
-   }
-   apr_dir_close(lockdir);
+   config->locker->configuration_post_config(ctx,config->locker,config,cgi);
+   GC_CHECK_ERROR(ctx);
 
    /* if we were suppplied with an onlineresource, make sure it ends with a / */
    if(NULL != (url = (char*)apr_table_get(config->metadata,"url"))) {
@@ -98,6 +70,11 @@ void mapcache_configuration_post_config(mapcache_context *ctx, mapcache_cfg *con
 } 
 
 
+static apr_status_t _mapcache_configuration_cleanup(void *data) {
+   mapcache_thread_pool_destroy((mapcache_cfg*)data);
+   return APR_SUCCESS;
+}
+
 mapcache_cfg* mapcache_configuration_create(apr_pool_t *pool) {
    mapcache_grid *grid;
    int i;
@@ -253,8 +230,14 @@ mapcache_cfg* mapcache_configuration_create(apr_pool_t *pool) {
    }
    mapcache_configuration_add_grid(cfg,grid,"g");
 
-   /* default retry interval is 1/100th of a second, i.e. 10000 microseconds */
-   cfg->lock_retry_interval = 10000;
+   cfg->locker = NULL;
+   cfg->download_threads = 0;
+   cfg->thread_pool = NULL;
+#if APR_HAS_THREADS
+   apr_thread_mutex_create(&cfg->thread_pool_mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+#endif
+   /* registered after the mutex, so it runs before the mutex is destroyed */
+   apr_pool_cleanup_register(pool, cfg, _mapcache_configuration_cleanup, apr_pool_cleanup_null);
 
    cfg->loglevel = MAPCACHE_WARN;
    cfg->autoreload = 0;
@@ -301,6 +301,23 @@ void parseSource(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config) {
    mapcache_configuration_add_source(config,source,name);
 }
 
+void parseLocker(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config) {
+   char *type = (char*)ezxml_attr(node,"type");
+   mapcache_locker *locker = NULL;
+   if(!type || !strlen(type) || !strcmp(type,"disk")) {
+      locker = mapcache_locker_disk_create(ctx);
+   } else if(!strcmp(type,"memory")) {
+      locker = mapcache_locker_memory_create(ctx);
+   } else {
+      ctx->set_error(ctx, 400, "unknown locker type %s (allowed are disk, memory)", type);
+      return;
+   }
+   GC_CHECK_ERROR(ctx);
+   locker->configuration_parse_xml(ctx,node,locker);
+   GC_CHECK_ERROR(ctx);
+   config->locker = locker;
+}
+
 void parseFormat(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config) {
    char *name = NULL,  *type = NULL;
    mapcache_image_format *format = NULL;
@@ -318,12 +335,17 @@ void parseFormat(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config) {
    }
    if(!strcmp(type,"PNG")) {
       int colors = -1;
+      char *palette = NULL;
       mapcache_compression_type compression = MAPCACHE_COMPRESSION_DEFAULT;
+      mapcache_png_filter filter = MAPCACHE_PNG_FILTER_NONE;
+      mapcache_png_strategy strategy = MAPCACHE_PNG_STRATEGY_DEFAULT;
       if ((cur_node = ezxml_child(node,"compression")) != NULL) {
          if(!strcmp(cur_node->txt, "fast")) {
             compression = MAPCACHE_COMPRESSION_FAST;
          } else if(!strcmp(cur_node->txt, "best")) {
             compression = MAPCACHE_COMPRESSION_BEST;
+         } else if(!strcmp(cur_node->txt, "none")) {
+            compression = MAPCACHE_COMPRESSION_NONE;
          } else {
             ctx->set_error(ctx, 400, "unknown compression type %s for format \"%s\"", cur_node->txt, name);
             return;
@@ -340,14 +362,57 @@ void parseFormat(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config) {
             return;
          }
       }
+      if ((cur_node = ezxml_child(node,"filter")) != NULL) {
+         if(!strcmp(cur_node->txt, "none")) {
+            filter = MAPCACHE_PNG_FILTER_NONE;
+         } else if(!strcmp(cur_node->txt, "sub")) {
+            filter = MAPCACHE_PNG_FILTER_SUB;
+         } else if(!strcmp(cur_node->txt, "up")) {
+            filter = MAPCACHE_PNG_FILTER_UP;
+         } else if(!strcmp(cur_node->txt, "avg")) {
+            filter = MAPCACHE_PNG_FILTER_AVG;
+         } else if(!strcmp(cur_node->txt, "paeth")) {
+            filter = MAPCACHE_PNG_FILTER_PAETH;
+         } else if(!strcmp(cur_node->txt, "adaptive")) {
+            filter = MAPCACHE_PNG_FILTER_ADAPTIVE;
+         } else {
+            ctx->set_error(ctx, 400, "unknown filter %s for format \"%s\" "
+                  "(expecting none, sub, up, avg, paeth or adaptive)", cur_node->txt, name);
+            return;
+         }
+      }
+      if ((cur_node = ezxml_child(node,"strategy")) != NULL) {
+         if(!strcmp(cur_node->txt, "default")) {
+            strategy = MAPCACHE_PNG_STRATEGY_DEFAULT;
+         } else if(!strcmp(cur_node->txt, "filtered")) {
+            strategy = MAPCACHE_PNG_STRATEGY_FILTERED;
+         } else if(!strcmp(cur_node->txt, "rle")) {
+            strategy = MAPCACHE_PNG_STRATEGY_RLE;
+         } else if(!strcmp(cur_node->txt, "huffman")) {
+            strategy = MAPCACHE_PNG_STRATEGY_HUFFMAN;
+         } else {
+            ctx->set_error(ctx, 400, "unknown strategy %s for format \"%s\" "
+                  "(expecting default, filtered, rle or huffman)", cur_node->txt, name);
+            return;
+         }
+      }
+      if ((cur_node = ezxml_child(node,"palette")) != NULL) {
+         palette = cur_node->txt;
+      }
 
-      if(colors == -1) {
+      if(colors == -1 && !palette) {
          format = mapcache_imageio_create_png_format(ctx->pool,
                name,compression);
       } else {
          format = mapcache_imageio_create_png_q_format(ctx->pool,
-               name,compression, colors);
+               name,compression, (colors == -1)?256:colors);
+         if(palette) {
+            mapcache_imageio_png_q_load_palette(ctx,format,palette);
+            GC_CHECK_ERROR(ctx);
+         }
       }
+      ((mapcache_image_format_png*)format)->filter = filter;
+      ((mapcache_image_format_png*)format)->strategy = strategy;
    } else if(!strcmp(type,"JPEG")){
       int quality = 95;
       mapcache_photometric photometric = MAPCACHE_PHOTOMETRIC_YCBCR;
@@ -468,6 +533,10 @@ void parseCache(mapcache_context *ctx, ezxml_t node, mapcache_cfg *config) {
       ctx->set_error(ctx,400, "failed to add cache \"%s\": tiff support is not available on this build",name);
       return;
 #endif
+   } else if(!strcmp(type,"memory")) {
+      cache = mapcache_cache_memory_create(ctx);
+   } else if(!strcmp(type,"composite")) {
+      cache = mapcache_cache_composite_create(ctx);
    } else {
       ctx->set_error(ctx, 400, "unknown cache type %s for cache \"%s\"", type, name);
       return;
@@ -962,31 +1031,49 @@ void mapcache_configuration_parse_xml(mapcache_context *ctx, const char *filenam
       }
    }
 
-   if((node = ezxml_child(doc,"lock_dir")) != NULL) {
-      config->lockdir = apr_pstrdup(ctx->pool, node->txt);
-   } else {
-      config->lockdir = apr_pstrdup(ctx->pool,"/tmp");
-   }
-
-   if((node = ezxml_child(doc,"lock_retry")) != NULL) {
-      char *endptr;
-      config->lock_retry_interval = (unsigned int)strtol(node->txt,&endptr,10);
-      if(*endptr != 0 || config->lock_retry_interval < 0) {
-         ctx->set_error(ctx, 400, "failed to parse lock_retry microseconds \"%s\". Expecting a positive integer",
-               node->txt);
-         return;
+   if((node = ezxml_child(doc,"locker")) != NULL) {
+      parseLocker(ctx, node, config);
+      if(GC_HAS_ERROR(ctx)) goto cleanup;
+   } else if(ezxml_child(doc,"lock_dir") || ezxml_child(doc,"lock_retry")) {
+      /* backwards compatible disk locker configuration */
+      mapcache_locker_disk *ldisk;
+      config->locker = mapcache_locker_disk_create(ctx);
+      ldisk = (mapcache_locker_disk*)config->locker;
+      if((node = ezxml_child(doc,"lock_dir")) != NULL) {
+         ldisk->dir = apr_pstrdup(ctx->pool, node->txt);
+      }
+      if((node = ezxml_child(doc,"lock_retry")) != NULL) {
+         char *endptr;
+         ldisk->retry = strtol(node->txt,&endptr,10);
+         if(*endptr != 0 || ldisk->retry < 0) {
+            ctx->set_error(ctx, 400, "failed to parse lock_retry microseconds \"%s\". Expecting a positive integer",
+                  node->txt);
+            return;
+         }
       }
    }
    
+   /* legacy switch, superseded by download_threads when both are set */
    if((node = ezxml_child(doc,"threaded_fetching")) != NULL) {
       if(!strcasecmp(node->txt,"true")) {
-         config->threaded_fetching = 1;
-      } else if(strcasecmp(node->txt,"false")) {
+         config->download_threads = MAPCACHE_DEFAULT_DOWNLOAD_THREADS;
+      } else if(!strcasecmp(node->txt,"false")) {
+         config->download_threads = 0;
+      } else {
          ctx->set_error(ctx, 400, "failed to parse threaded_fetching \"%s\". Expecting true or false",node->txt);
          return;
       }
    }
 
+   if((node = ezxml_child(doc,"download_threads")) != NULL) {
+      char *endptr;
+      config->download_threads = (int)strtol(node->txt,&endptr,10);
+      if(*endptr != 0 || config->download_threads < 0) {
+         ctx->set_error(ctx, 400, "failed to parse download_threads \"%s\". Expecting a positive integer",node->txt);
+         return;
+      }
+   }
+
    if((node = ezxml_child(doc,"log_level")) != NULL) {
       if(!strcasecmp(node->txt,"debug")) {
          config->loglevel = MAPCACHE_DEBUG;
@@ -30,21 +30,6 @@
 
 #include <apr_strings.h>
 #include "mapcache.h"
-#if APR_HAS_THREADS
-#include "apu_version.h"
-
-#if (APU_MAJOR_VERSION <= 1 && APU_MINOR_VERSION <= 3)
- #define USE_THREADPOOL 0
-#else
- #define USE_THREADPOOL 1
-#endif
-
-/* use a thread pool if using 1.3.12 or higher apu */
-#if !USE_THREADPOOL
-#include <apr_thread_proc.h>
-#else
-#include <apr_thread_pool.h>
-#endif
  
 typedef struct {
    mapcache_tile *tile;
@@ -52,17 +37,11 @@ typedef struct {
    int launch;
 } _thread_tile;
 
-static void* APR_THREAD_FUNC _thread_get_tile(apr_thread_t *thread, void *data) {
+static void _thread_get_tile(void *data) {
    _thread_tile* t = (_thread_tile*)data;
    mapcache_tileset_tile_get(t->ctx, t->tile);
-#if !USE_THREADPOOL
-   apr_thread_exit(thread, APR_SUCCESS);
-#endif
-   return NULL;
 }
 
-#endif
-
 
 mapcache_http_response *mapcache_http_response_create(apr_pool_t *pool) {
    mapcache_http_response *response = (mapcache_http_response*) apr_pcalloc(pool,
@@ -74,21 +53,11 @@ mapcache_http_response *mapcache_http_response_create(apr_pool_t *pool) {
 }
 
 void mapcache_prefetch_tiles(mapcache_context *ctx, mapcache_tile **tiles, int ntiles) {
-
-   apr_thread_t **threads;
-   apr_threadattr_t *thread_attrs;
-   int nthreads;
-#if !APR_HAS_THREADS
    int i;
-   for(i=0;i<ntiles;i++) {
-      mapcache_tileset_tile_get(ctx, tiles[i]);
-      GC_CHECK_ERROR(ctx);
-   }
-#else
-   int i,rv;
    _thread_tile* thread_tiles;
-   if(ntiles==1 || ctx->config->threaded_fetching == 0) {
-   /* if threads disabled, or only fetching a single tile, don't launch a thread for the operation */
+   mapcache_task_group *group;
+   if(ntiles==1 || ctx->config->download_threads == 0) {
+   /* if threads disabled, or only fetching a single tile, don't use the thread pool for the operation */
       for(i=0;i<ntiles;i++) {
          mapcache_tileset_tile_get(ctx, tiles[i]);
          GC_CHECK_ERROR(ctx);
@@ -97,21 +66,18 @@ void mapcache_prefetch_tiles(mapcache_context *ctx, mapcache_tile **tiles, int n
    }
 
 
-   /* allocate a thread struct for each tile. Not all will be used */
+   /* allocate a task struct for each tile. Not all will be used */
    thread_tiles = (_thread_tile*)apr_pcalloc(ctx->pool,ntiles*sizeof(_thread_tile));
-#if 1 || !USE_THREADPOOL
-   /* use multiple threads, to fetch from multiple metatiles and/or multiple tilesets */
-   apr_threadattr_create(&thread_attrs, ctx->pool);
-   threads = (apr_thread_t**)apr_pcalloc(ctx->pool, ntiles*sizeof(apr_thread_t*));
-   nthreads = 0;
+   /* use the process wide thread pool, to fetch from multiple metatiles and/or multiple tilesets */
+   group = mapcache_task_group_create(ctx);
    for(i=0;i<ntiles;i++) {
      int j;
       thread_tiles[i].tile = tiles[i];
       thread_tiles[i].launch = 1;
       j=i-1;
       /* 
-       * we only launch one thread per metatile as in the unseeded case the threads
-       * for a same metatile will lock while only a single thread launches the actual
+       * we only queue one task per metatile as in the unseeded case the tasks
+       * for a same metatile will lock while only a single one launches the actual
        * rendering request
        */
       while(j>=0) {
@@ -122,31 +88,21 @@ void mapcache_prefetch_tiles(mapcache_context *ctx, mapcache_tile **tiles, int n
                   thread_tiles[j].tile->x / thread_tiles[j].tile->tileset->metasize_x)&&
                (thread_tiles[i].tile->y / thread_tiles[i].tile->tileset->metasize_y  == 
                   thread_tiles[j].tile->y / thread_tiles[j].tile->tileset->metasize_y)) {
-            thread_tiles[i].launch = 0; /* this tile will not have a thread spawned for it */
+            thread_tiles[i].launch = 0; /* this tile will not have a task queued for it */
             break;
          }
          j--;
       }
-      if(thread_tiles[i].launch)
+      if(thread_tiles[i].launch) {
          thread_tiles[i].ctx = ctx->clone(ctx);
-   }
-   for(i=0;i<ntiles;i++) {
-      if(!thread_tiles[i].launch) continue; /* skip tiles that have been marked */
-      rv = apr_thread_create(&threads[i], thread_attrs, _thread_get_tile, (void*)&(thread_tiles[i]), thread_tiles[i].ctx->pool);
-      if(rv != APR_SUCCESS) {
-         ctx->set_error(ctx,500, "failed to create thread %d of %d\n",i,ntiles);
-         break;
+         mapcache_task_group_push(ctx, group, _thread_get_tile, (void*)&(thread_tiles[i]));
       }
-      nthreads++;
    }
 
-   /* wait for launched threads to finish */
+   /* wait for the queued tasks to finish */
+   mapcache_task_group_wait(ctx, group);
    for(i=0;i<ntiles;i++) {
       if(!thread_tiles[i].launch) continue;
-      apr_thread_join(&rv, threads[i]);
-      if(rv != APR_SUCCESS) {
-         ctx->set_error(ctx,500, "thread %d of %d failed on exit\n",i,ntiles);
-      }
       if(GC_HAS_ERROR(thread_tiles[i].ctx)) {
          /* transfer error message from child thread to main context */
          ctx->set_error(ctx,thread_tiles[i].ctx->get_error(thread_tiles[i].ctx),
@@ -154,38 +110,10 @@ void mapcache_prefetch_tiles(mapcache_context *ctx, mapcache_tile **tiles, int n
       }
    }
    for(i=0;i<ntiles;i++) {
-      /* fetch the tiles that did not get a thread launched for them */
+      /* fetch the tiles that did not get a task queued for them */
       if(thread_tiles[i].launch) continue;
       mapcache_tileset_tile_get(ctx, tiles[i]);
    }
-#else
-    /* experimental version using a threadpool, disabled for stability reasons */
-   apr_thread_pool_t *thread_pool;
-   apr_thread_pool_create(&thread_pool,2,ctx->config->download_threads,ctx->pool);
-   for(i=0;i<ntiles;i++) {
-      ctx->log(ctx,MAPCACHE_DEBUG,"starting thread for tile %s",tiles[i]->tileset->name);
-      thread_tiles[i].tile = tiles[i];
-      thread_tiles[i].ctx = ctx->clone(ctx);
-      rv = apr_thread_pool_push(thread_pool,_thread_get_tile,(void*)&(thread_tiles[i]), 0,NULL);
-      if(rv != APR_SUCCESS) {
-         ctx->set_error(ctx,500, "failed to push thread %d of %d in thread pool\n",i,ntiles);
-         break;
-      }
-   }
-   GC_CHECK_ERROR(ctx);
-   while(apr_thread_pool_tasks_run_count(thread_pool) != ntiles || apr_thread_pool_busy_count(thread_pool)>0)
-      apr_sleep(10000);
-   apr_thread_pool_destroy(thread_pool);
-   for(i=0;i<ntiles;i++) {
-      if(GC_HAS_ERROR(thread_tiles[i].ctx)) {
-         ctx->set_error(ctx,thread_tiles[i].ctx->get_error(thread_tiles[i].ctx),
-               thread_tiles[i].ctx->get_error_message(thread_tiles[i].ctx));
-      }
-   }
-#endif
-   
-#endif
-
 }
 
 mapcache_http_response *mapcache_core_get_tile(mapcache_context *ctx, mapcache_request_get_tile *req_tile) {
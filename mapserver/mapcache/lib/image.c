@@ -33,6 +33,14 @@
 #else
 #include <math.h>
 #endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#define USE_AVX2
+#include <immintrin.h>
+#endif
 
 mapcache_image* mapcache_image_create(mapcache_context *ctx) {
     mapcache_image *img = (mapcache_image*)apr_pcalloc(ctx->pool,sizeof(mapcache_image));
@@ -56,11 +64,115 @@ int mapcache_image_has_alpha(mapcache_image *img) {
    return 0;
 }
 
+#ifndef USE_PIXMAN
+/*
+ * composite a row of premultiplied overlay pixels over a row of base pixels.
+ * each channel becomes o + (255-oa)*b/256, and base pixels under fully
+ * transparent overlay pixels are left untouched. the vector versions give the
+ * exact same results as the scalar one, and skip groups of pixels that are all
+ * transparent or all opaque.
+ */
+static void _mapcache_image_blend_row(unsigned char *bptr, unsigned char *optr, int w) {
+   int j = 0;
+#ifdef USE_AVX2
+   {
+      const __m256i zero = _mm256_setzero_si256();
+      const __m256i lowbyte = _mm256_set1_epi16(0xff);
+      const __m256i alphamask = _mm256_set1_epi32(0xff000000);
+      const __m256i opaque = _mm256_set1_epi32(255);
+      for(; j+8<=w; j+=8) {
+         __m256i o = _mm256_loadu_si256((__m256i*)(optr+j*4));
+         __m256i oa = _mm256_and_si256(o,alphamask);
+         __m256i transparent = _mm256_cmpeq_epi32(oa,zero);
+         __m256i b,ia,lo,hi;
+         if(_mm256_movemask_epi8(transparent) == -1)
+            continue;
+         if(_mm256_movemask_epi8(_mm256_cmpeq_epi32(oa,alphamask)) == -1) {
+            _mm256_storeu_si256((__m256i*)(bptr+j*4),o);
+            continue;
+         }
+         b = _mm256_loadu_si256((__m256i*)(bptr+j*4));
+         /* 255-oa in both 16 bit halves of each pixel */
+         ia = _mm256_sub_epi32(opaque,_mm256_srli_epi32(o,24));
+         ia = _mm256_or_si256(ia,_mm256_slli_epi32(ia,16));
+         lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(b,zero),_mm256_unpacklo_epi32(ia,ia));
+         lo = _mm256_add_epi16(_mm256_srli_epi16(lo,8),_mm256_unpacklo_epi8(o,zero));
+         hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(b,zero),_mm256_unpackhi_epi32(ia,ia));
+         hi = _mm256_add_epi16(_mm256_srli_epi16(hi,8),_mm256_unpackhi_epi8(o,zero));
+         /* wrap around like the scalar unsigned char cast instead of saturating */
+         lo = _mm256_packus_epi16(_mm256_and_si256(lo,lowbyte),_mm256_and_si256(hi,lowbyte));
+         lo = _mm256_or_si256(_mm256_and_si256(transparent,b),_mm256_andnot_si256(transparent,lo));
+         _mm256_storeu_si256((__m256i*)(bptr+j*4),lo);
+      }
+   }
+#endif
+#ifdef USE_SSE2
+   {
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i lowbyte = _mm_set1_epi16(0xff);
+      const __m128i alphamask = _mm_set1_epi32(0xff000000);
+      const __m128i opaque = _mm_set1_epi32(255);
+      for(; j+4<=w; j+=4) {
+         __m128i o = _mm_loadu_si128((__m128i*)(optr+j*4));
+         __m128i oa = _mm_and_si128(o,alphamask);
+         __m128i transparent = _mm_cmpeq_epi32(oa,zero);
+         __m128i b,ia,lo,hi;
+         if(_mm_movemask_epi8(transparent) == 0xffff)
+            continue;
+         if(_mm_movemask_epi8(_mm_cmpeq_epi32(oa,alphamask)) == 0xffff) {
+            _mm_storeu_si128((__m128i*)(bptr+j*4),o);
+            continue;
+         }
+         b = _mm_loadu_si128((__m128i*)(bptr+j*4));
+         /* 255-oa in both 16 bit halves of each pixel */
+         ia = _mm_sub_epi32(opaque,_mm_srli_epi32(o,24));
+         ia = _mm_or_si128(ia,_mm_slli_epi32(ia,16));
+         lo = _mm_mullo_epi16(_mm_unpacklo_epi8(b,zero),_mm_unpacklo_epi32(ia,ia));
+         lo = _mm_add_epi16(_mm_srli_epi16(lo,8),_mm_unpacklo_epi8(o,zero));
+         hi = _mm_mullo_epi16(_mm_unpackhi_epi8(b,zero),_mm_unpackhi_epi32(ia,ia));
+         hi = _mm_add_epi16(_mm_srli_epi16(hi,8),_mm_unpackhi_epi8(o,zero));
+         /* wrap around like the scalar unsigned char cast instead of saturating */
+         lo = _mm_packus_epi16(_mm_and_si128(lo,lowbyte),_mm_and_si128(hi,lowbyte));
+         lo = _mm_or_si128(_mm_and_si128(transparent,b),_mm_andnot_si128(transparent,lo));
+         _mm_storeu_si128((__m128i*)(bptr+j*4),lo);
+      }
+   }
+#endif
+   bptr += j*4;
+   optr += j*4;
+   for(;j<w;j++) {
+      if(optr[3]) { /* if overlay is not completely transparent */
+         if(optr[3] == 255) {
+            bptr[0]=optr[0];
+            bptr[1]=optr[1];
+            bptr[2]=optr[2];
+            bptr[3]=optr[3];
+         } else {
+            unsigned int br = bptr[0];
+            unsigned int bg = bptr[1];
+            unsigned int bb = bptr[2];
+            unsigned int ba = bptr[3];
+            unsigned int or = optr[0];
+            unsigned int og = optr[1];
+            unsigned int ob = optr[2];
+            unsigned int oa = optr[3];
+            bptr[0] = (unsigned char)(or + (((255-oa)*br)>>8));
+            bptr[1] = (unsigned char)(og + (((255-oa)*bg)>>8));
+            bptr[2] = (unsigned char)(ob + (((255-oa)*bb)>>8));
+
+            bptr[3] = oa+((ba*(255-oa))>>8);                    
+         }
+      }
+      bptr+=4;optr+=4;
+   }
+}
+#endif
+
 void mapcache_image_merge(mapcache_context *ctx, mapcache_image *base, mapcache_image *overlay) {
    int starti,startj;
 #ifndef USE_PIXMAN
-   int i,j;
-   unsigned char *browptr, *orowptr, *bptr, *optr;
+   int i;
+   unsigned char *browptr, *orowptr;
 #endif
 
    if(base->w < overlay->w || base->h < overlay->h) {
@@ -85,85 +197,168 @@ void mapcache_image_merge(mapcache_context *ctx, mapcache_image *base, mapcache_
    pixman_image_unref(si);
    pixman_image_unref(bi);
 #else
-   
-
    browptr = base->data + starti * base->stride + startj*4;
    orowptr = overlay->data;
    for(i=0;i<overlay->h;i++) {
-      bptr = browptr;
-      optr = orowptr;
-      for(j=0;j<overlay->w;j++) {
-         if(optr[3]) { /* if overlay is not completely transparent */
-            if(optr[3] == 255) {
-               bptr[0]=optr[0];
-               bptr[1]=optr[1];
-               bptr[2]=optr[2];
-               bptr[3]=optr[3];
-            } else if(optr[3] != 0) {
-               unsigned int br = bptr[0];
-               unsigned int bg = bptr[1];
-               unsigned int bb = bptr[2];
-               unsigned int ba = bptr[3];
-               unsigned int or = optr[0];
-               unsigned int og = optr[1];
-               unsigned int ob = optr[2];
-               unsigned int oa = optr[3];
-               bptr[0] = (unsigned char)(or + (((255-oa)*br)>>8));
-               bptr[1] = (unsigned char)(og + (((255-oa)*bg)>>8));
-               bptr[2] = (unsigned char)(ob + (((255-oa)*bb)>>8));
-
-               bptr[3] = oa+((ba*(255-oa))>>8);                    
-            }
-         }
-         bptr+=4;optr+=4;
-      }
+      _mapcache_image_blend_row(browptr,orowptr,overlay->w);
       browptr += base->stride;
       orowptr += overlay->stride;
    }
 #endif
 }
 
-#ifndef USE_PIXMAN
-#ifndef _WIN32
-static inline void bilinear_pixel(mapcache_image *img, double x, double y, unsigned char *dst) {
-#else
-static __inline void bilinear_pixel(mapcache_image *img, double x, double y, unsigned char *dst) {
-#endif
-
-   int px,py;
-   int px1, py1;
-   unsigned char *p1, *p2, *p3, *p4;
-   float fx, fy, fx1, fy1;
-   int w1, w2, w3, w4;
-   px = (int)x;
-   py = (int)y;
-
-   px1 = (px==(img->w-1))?(px):(px+1);
-   py1 = (py==(img->h-1))?(py):(py+1);
+/*
+ * compute the source column of each destination column for a nearest neighbor
+ * resampling, -1 where the destination pixel falls outside of the source image.
+ * returns the first and last+1 destination columns falling inside the source
+ */
+static int* _mapcache_image_nearest_columns(mapcache_image *src, mapcache_image *dst,
+      double off_x, double scale_x, int *first, int *last) {
+   int dstx;
+   int *cols = malloc(dst->w*sizeof(int));
+   *first = dst->w;
+   *last = 0;
+   for(dstx=0; dstx<dst->w; dstx++) {
+      int srcx = (int)(((dstx-off_x)/scale_x)+0.5);
+      if(srcx >= 0 && srcx < src->w) {
+         cols[dstx] = srcx;
+         if(dstx < *first) *first = dstx;
+         *last = dstx+1;
+      } else {
+         cols[dstx] = -1;
+      }
+   }
+   return cols;
+}
 
-   p1 = &img->data[py*img->stride+px*4];
-   p2 = &img->data[py*img->stride+px1*4];
-   p3 = &img->data[py1*img->stride+px*4];
-   p4 = &img->data[py1*img->stride+px1*4];
+/*
+ * bilinear interpolation parameters of a destination column or row: the byte
+ * offsets (columns) or indexes (rows) of the two source pixels to interpolate,
+ * and the 8 bit fixed point weight of the second one
+ */
+typedef struct {
+   int p0, p1;
+   int w;
+} _mapcache_bilinear_sample;
 
-   // Calculate the weights for each pixel
-   fx = x - px;
-   fy = y - py;
-   fx1 = 1.0f - fx;
-   fy1 = 1.0f - fy;
+/*
+ * fill the interpolation parameters for a destination dimension, returning the
+ * first and last+1 destination positions falling inside the source
+ */
+static void _mapcache_image_bilinear_samples(_mapcache_bilinear_sample *samples, int dstsize, int srcsize,
+      double off, double scale, int pixelsize, int *first, int *last) {
+   int i;
+   *first = dstsize;
+   *last = 0;
+   for(i=0; i<dstsize; i++) {
+      double src = (i-off)/scale;
+      if(src >= 0 && src < srcsize) {
+         int p = (int)src;
+         samples[i].p0 = p*pixelsize;
+         samples[i].p1 = ((p==(srcsize-1))?p:(p+1))*pixelsize;
+         samples[i].w = (int)((src-p)*256);
+         if(i < *first) *first = i;
+         *last = i+1;
+      }
+   }
+}
 
-   w1 = fx1 * fy1 * 256.0f;
-   w2 = fx  * fy1 * 256.0f;
-   w3 = fx1 * fy  * 256.0f;
-   w4 = fx  * fy  * 256.0f;
+/*
+ * interpolate a destination row from two source rows, with 8 bit fixed point
+ * weights: horizontally within each source row, then vertically between them.
+ * both steps are rounded to the nearest value
+ */
+static void _mapcache_image_bilinear_row(unsigned char *dstptr, unsigned char *row0, unsigned char *row1,
+      int wy, _mapcache_bilinear_sample *cols, int first, int last) {
+   int dstx = first;
+   int iwy = 256-wy;
+   dstptr += first*4;
+#ifdef USE_SSE2
+   {
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i wyv = _mm_set_epi16(wy,wy,wy,wy,iwy,iwy,iwy,iwy);
+      const __m128i half = _mm_set1_epi16(128);
+      for(; dstx<last; dstx++) {
+         _mapcache_bilinear_sample *c = &cols[dstx];
+         int wx = c->w, iwx = 256-c->w;
+         __m128i wxv = _mm_set_epi16(wx,wx,wx,wx,iwx,iwx,iwx,iwx);
+         __m128i t,b;
+         /* the two pixels of each row as 16 bit channels, weighted */
+         t = _mm_unpacklo_epi32(_mm_cvtsi32_si128(*(int*)(row0+c->p0)),_mm_cvtsi32_si128(*(int*)(row0+c->p1)));
+         t = _mm_mullo_epi16(_mm_unpacklo_epi8(t,zero),wxv);
+         t = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t,_mm_srli_si128(t,8)),half),8);
+         b = _mm_unpacklo_epi32(_mm_cvtsi32_si128(*(int*)(row1+c->p0)),_mm_cvtsi32_si128(*(int*)(row1+c->p1)));
+         b = _mm_mullo_epi16(_mm_unpacklo_epi8(b,zero),wxv);
+         b = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(b,_mm_srli_si128(b,8)),half),8);
+         /* top and bottom interpolated pixels, weighted */
+         t = _mm_mullo_epi16(_mm_unpacklo_epi64(t,b),wyv);
+         t = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t,_mm_srli_si128(t,8)),half),8);
+         *(int*)dstptr = _mm_cvtsi128_si32(_mm_packus_epi16(t,t));
+         dstptr += 4;
+      }
+   }
+#endif
+   for(; dstx<last; dstx++) {
+      _mapcache_bilinear_sample *c = &cols[dstx];
+      int wx = c->w, iwx = 256-c->w;
+      int i;
+      for(i=0;i<4;i++) {
+         unsigned int t = (row0[c->p0+i]*iwx + row0[c->p1+i]*wx + 128)>>8;
+         unsigned int b = (row1[c->p0+i]*iwx + row1[c->p1+i]*wx + 128)>>8;
+         dstptr[i] = (t*iwy + b*wy + 128)>>8;
+      }
+      dstptr += 4;
+   }
+}
 
-   // Calculate the weighted sum of pixels (for each color channel)
-   dst[0] = (p1[0] * w1 + p2[0] * w2 + p3[0] * w3 + p4[0] * w4) >> 8;
-   dst[1] = (p1[1] * w1 + p2[1] * w2 + p3[1] * w3 + p4[1] * w4) >> 8;
-   dst[2] = (p1[2] * w1 + p2[2] * w2 + p3[2] * w3 + p4[2] * w4) >> 8;
-   dst[3] = (p1[3] * w1 + p2[3] * w2 + p3[3] * w3 + p4[3] * w4) >> 8;
+void mapcache_image_copy_resampled_band(mapcache_context *ctx, mapcache_image *src,
+      int src_y, int src_rows, int src_h, mapcache_image *dst,
+      double off_x, double off_y, double scale_x, double scale_y,
+      mapcache_resample_mode mode) {
+   int dsty;
+   if(mode == MAPCACHE_RESAMPLE_BILINEAR) {
+      int firstx,lastx,firsty,lasty;
+      _mapcache_bilinear_sample *cols = malloc(dst->w*sizeof(_mapcache_bilinear_sample));
+      _mapcache_bilinear_sample *rows = malloc(dst->h*sizeof(_mapcache_bilinear_sample));
+      _mapcache_image_bilinear_samples(cols,dst->w,src->w,off_x,scale_x,4,&firstx,&lastx);
+      _mapcache_image_bilinear_samples(rows,dst->h,src_h,off_y,scale_y,1,&firsty,&lasty);
+      for(dsty=firsty; dsty<lasty; dsty++) {
+         int p0 = rows[dsty].p0 - src_y;
+         int p1 = rows[dsty].p1 - src_y;
+         if(p0 < 0 || p0 >= src_rows)
+            continue;
+         if(p1 >= src->h)
+            p1 = p0; /* the next row hasn't been provided */
+         _mapcache_image_bilinear_row(dst->data + dsty*dst->stride,
+               src->data + p0*src->stride, src->data + p1*src->stride,
+               rows[dsty].w, cols, firstx, lastx);
+      }
+      free(cols);
+      free(rows);
+   } else {
+      int dstx,first,last;
+      unsigned char *dstrowptr = dst->data;
+      int *cols = _mapcache_image_nearest_columns(src,dst,off_x,scale_x,&first,&last);
+      /* at the native resolution the source columns are contiguous, copy whole rows */
+      int contiguous = (first<last && cols[last-1]-cols[first] == last-1-first);
+      for(dsty=0; dsty<dst->h; dsty++) {
+         int srcy = (int)(((dsty-off_y)/scale_y)+0.5);
+         if(srcy >= src_y && srcy < src_y+src_rows && srcy < src_h) {
+            int *srcptr = (int*)&(src->data[(srcy-src_y)*src->stride]);
+            int *dstptr = (int*)dstrowptr;
+            if(contiguous) {
+               memcpy(dstptr+first,srcptr+cols[first],(last-first)*4);
+            } else {
+               for(dstx=first; dstx<last; dstx++) {
+                  dstptr[dstx] = srcptr[cols[dstx]];
+               }
+            }
+         }
+         dstrowptr += dst->stride;
+      }
+      free(cols);
+   }
 }
-#endif
 
 void mapcache_image_copy_resampled_nearest(mapcache_context *ctx, mapcache_image *src, mapcache_image *dst,
       double off_x, double off_y, double scale_x, double scale_y) {
@@ -182,22 +377,8 @@ void mapcache_image_copy_resampled_nearest(mapcache_context *ctx, mapcache_image
    pixman_image_unref(si);
    pixman_image_unref(bi);
 #else
-   int dstx,dsty;
-   unsigned char *dstrowptr = dst->data;
-   for(dsty=0; dsty<dst->h; dsty++) {
-      int *dstptr = (int*)dstrowptr;
-      int srcy = (int)(((dsty-off_y)/scale_y)+0.5);
-      if(srcy >= 0 && srcy < src->h) {
-         for(dstx=0; dstx<dst->w;dstx++) {
-	   int srcx = (int)(((dstx-off_x)/scale_x)+0.5);
-            if(srcx >= 0 && srcx < src->w) {
-               *dstptr = *((int*)&(src->data[srcy*src->stride+srcx*4]));
-            }
-            dstptr ++;
-         }
-      }
-      dstrowptr += dst->stride;
-   }
+   mapcache_image_copy_resampled_band(ctx,src,0,src->h,src->h,dst,off_x,off_y,scale_x,scale_y,
+         MAPCACHE_RESAMPLE_NEAREST);
 #endif
 } 
 
@@ -219,22 +400,8 @@ void mapcache_image_copy_resampled_bilinear(mapcache_context *ctx, mapcache_imag
    pixman_image_unref(si);
    pixman_image_unref(bi);
 #else
-   int dstx,dsty;
-   unsigned char *dstrowptr = dst->data;
-   for(dsty=0; dsty<dst->h; dsty++) {
-      unsigned char *dstptr = dstrowptr;
-      double srcy = (dsty-off_y)/scale_y;
-      if(srcy >= 0 && srcy < src->h) {
-         for(dstx=0; dstx<dst->w;dstx++) {
-            double srcx = (dstx-off_x)/scale_x;
-            if(srcx >= 0 && srcx < src->w) {
-               bilinear_pixel(src,srcx,srcy,dstptr);
-            }
-            dstptr += 4;
-         }
-      }
-      dstrowptr += dst->stride;
-   }
+   mapcache_image_copy_resampled_band(ctx,src,0,src->h,src->h,dst,off_x,off_y,scale_x,scale_y,
+         MAPCACHE_RESAMPLE_BILINEAR);
 #endif
 } 
 
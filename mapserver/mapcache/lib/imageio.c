@@ -83,19 +83,24 @@ void mapcache_image_create_empty(mapcache_context *ctx, mapcache_cfg *cfg) {
    GC_CHECK_ERROR(ctx);
 }
 
-void mapcache_imageio_decode_to_image(mapcache_context *ctx, mapcache_buffer *buffer,
-      mapcache_image *image) {
+void mapcache_imageio_decode_rows_to_image(mapcache_context *ctx, mapcache_buffer *buffer,
+      mapcache_image *image, int nrows) {
    mapcache_image_format_type type = mapcache_imageio_header_sniff(ctx,buffer);
    if(type == GC_PNG) {
-      _mapcache_imageio_png_decode_to_image(ctx,buffer,image);
+      _mapcache_imageio_png_decode_to_image(ctx,buffer,image,nrows);
    } else if(type == GC_JPEG) {
-      _mapcache_imageio_jpeg_decode_to_image(ctx,buffer,image);
+      _mapcache_imageio_jpeg_decode_to_image(ctx,buffer,image,nrows);
    } else {
       ctx->set_error(ctx, 500, "mapcache_imageio_decode: unrecognized image format");
    }
    return;
 }
 
+void mapcache_imageio_decode_to_image(mapcache_context *ctx, mapcache_buffer *buffer,
+      mapcache_image *image) {
+   mapcache_imageio_decode_rows_to_image(ctx,buffer,image,0);
+}
+
 /** @} */
 
 /* vim: ai ts=3 sts=3 et sw=3
@@ -214,7 +214,7 @@ mapcache_buffer* _mapcache_imageio_jpeg_encode(mapcache_context *ctx, mapcache_i
 }
 
 void _mapcache_imageio_jpeg_decode_to_image(mapcache_context *r, mapcache_buffer *buffer,
-      mapcache_image *img) {
+      mapcache_image *img, int nrows) {
   int s;
    struct jpeg_decompress_struct cinfo = {NULL};
    struct jpeg_error_mgr jerr;
@@ -237,9 +237,13 @@ void _mapcache_imageio_jpeg_decode_to_image(mapcache_context *r, mapcache_buffer
       img->stride = img->w * 4;
    }
 
+   if(nrows <= 0 || nrows > img->h) {
+      nrows = img->h;
+   }
+
    temp = malloc(img->w*s);
    apr_pool_cleanup_register(r->pool, temp, (void*)free, apr_pool_cleanup_null) ;
-   while ((int)cinfo.output_scanline < img->h)
+   while ((int)cinfo.output_scanline < nrows)
    {
       int i;
       unsigned char *rowptr = &img->data[cinfo.output_scanline * img->stride];
@@ -275,13 +279,16 @@ void _mapcache_imageio_jpeg_decode_to_image(mapcache_context *r, mapcache_buffer
          return;
       }
    }
-   jpeg_finish_decompress(&cinfo);
+   /* the remaining scanlines are simply dropped if we stopped early */
+   if(nrows == img->h) {
+      jpeg_finish_decompress(&cinfo);
+   }
    jpeg_destroy_decompress(&cinfo);
 }
 
 mapcache_image* _mapcache_imageio_jpeg_decode(mapcache_context *r, mapcache_buffer *buffer) {
    mapcache_image *img = mapcache_image_create(r);
-   _mapcache_imageio_jpeg_decode_to_image(r, buffer,img);
+   _mapcache_imageio_jpeg_decode_to_image(r, buffer,img,0);
    if(GC_HAS_ERROR(r)) {
       return NULL;
    }
@@ -45,6 +45,15 @@ typedef unsigned long int uint64_t;
 #ifndef Z_BEST_COMPRESSION
 #define Z_BEST_COMPRESSION 9
 #endif
+#ifndef Z_NO_COMPRESSION
+#define Z_NO_COMPRESSION 0
+#endif
+#ifndef Z_DEFAULT_STRATEGY
+#define Z_FILTERED 1
+#define Z_HUFFMAN_ONLY 2
+#define Z_RLE 3
+#define Z_DEFAULT_STRATEGY 0
+#endif
 
 
 
@@ -82,10 +91,10 @@ static __inline int premultiply (int color,int alpha)
 
 
 void _mapcache_imageio_png_decode_to_image(mapcache_context *ctx, mapcache_buffer *buffer,
-      mapcache_image *img) {
+      mapcache_image *img, int nrows) {
   unsigned char *rowptr;
   png_uint_32 width, height;
-   int bit_depth,color_type,i;
+   int bit_depth,color_type,interlace_type,i;
    unsigned char **row_pointers;
    png_structp png_ptr = NULL;
    png_infop info_ptr = NULL;
@@ -119,7 +128,7 @@ void _mapcache_imageio_png_decode_to_image(mapcache_context *ctx, mapcache_buffe
    png_set_read_fn(png_ptr,&b,_mapcache_imageio_png_read_func);
 
    png_read_info(png_ptr,info_ptr);
-   if(!png_get_IHDR(png_ptr, info_ptr, &width, &height,&bit_depth, &color_type,NULL,NULL,NULL)) {
+   if(!png_get_IHDR(png_ptr, info_ptr, &width, &height,&bit_depth, &color_type,&interlace_type,NULL,NULL)) {
       ctx->set_error(ctx, 500, "failed to read png header");
       return;
    }
@@ -148,13 +157,18 @@ void _mapcache_imageio_png_decode_to_image(mapcache_context *ctx, mapcache_buffe
    
    png_read_update_info(png_ptr, info_ptr);
 
-   png_read_image(png_ptr, row_pointers);
-   
-   png_read_end(png_ptr,NULL);
+   if(nrows > 0 && nrows < img->h && interlace_type == PNG_INTERLACE_NONE) {
+      /* only decode the requested rows, the remaining data is dropped */
+      png_read_rows(png_ptr, row_pointers, NULL, nrows);
+   } else {
+      nrows = img->h;
+      png_read_image(png_ptr, row_pointers);
+      png_read_end(png_ptr,NULL);
+   }
    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
 
    /* switch buffer from rgba to premultiplied argb */
-   for(i=0;i<img->h;i++) {
+   for(i=0;i<nrows;i++) {
       unsigned int j;
       unsigned char pixel[4];
       uint8_t  alpha;
@@ -185,7 +199,7 @@ void _mapcache_imageio_png_decode_to_image(mapcache_context *ctx, mapcache_buffe
    
 mapcache_image* _mapcache_imageio_png_decode(mapcache_context *ctx, mapcache_buffer *buffer) {
    mapcache_image *img = mapcache_image_create(ctx);
-   _mapcache_imageio_png_decode_to_image(ctx,buffer,img);
+   _mapcache_imageio_png_decode_to_image(ctx,buffer,img,0);
    if(GC_HAS_ERROR(ctx))
       return NULL;
    return img;
@@ -241,6 +255,51 @@ xrgb_to_rgbx (png_structp png, png_row_infop row_info, png_bytep data)
 
 
 
+/**
+ * \brief apply the zlib level and strategy and the row filter of a png format
+ */
+static void _mapcache_imageio_png_set_options(png_structp png_ptr, mapcache_image_format_png *format) {
+   int filter;
+   switch(format->compression_level) {
+      case MAPCACHE_COMPRESSION_BEST:
+         png_set_compression_level (png_ptr, Z_BEST_COMPRESSION);
+         break;
+      case MAPCACHE_COMPRESSION_FAST:
+         png_set_compression_level (png_ptr, Z_BEST_SPEED);
+         break;
+      case MAPCACHE_COMPRESSION_NONE:
+         /* filtering stored data would only cost time */
+         png_set_compression_level (png_ptr, Z_NO_COMPRESSION);
+         png_set_filter(png_ptr,0,PNG_FILTER_NONE);
+         return;
+      default:
+         break;
+   }
+   switch(format->strategy) {
+      case MAPCACHE_PNG_STRATEGY_FILTERED:
+         png_set_compression_strategy(png_ptr, Z_FILTERED);
+         break;
+      case MAPCACHE_PNG_STRATEGY_RLE:
+         png_set_compression_strategy(png_ptr, Z_RLE);
+         break;
+      case MAPCACHE_PNG_STRATEGY_HUFFMAN:
+         png_set_compression_strategy(png_ptr, Z_HUFFMAN_ONLY);
+         break;
+      default:
+         png_set_compression_strategy(png_ptr, Z_DEFAULT_STRATEGY);
+         break;
+   }
+   switch(format->filter) {
+      case MAPCACHE_PNG_FILTER_SUB: filter = PNG_FILTER_SUB; break;
+      case MAPCACHE_PNG_FILTER_UP: filter = PNG_FILTER_UP; break;
+      case MAPCACHE_PNG_FILTER_AVG: filter = PNG_FILTER_AVG; break;
+      case MAPCACHE_PNG_FILTER_PAETH: filter = PNG_FILTER_PAETH; break;
+      case MAPCACHE_PNG_FILTER_ADAPTIVE: filter = PNG_ALL_FILTERS; break;
+      default: filter = PNG_FILTER_NONE; break;
+   }
+   png_set_filter(png_ptr,0,filter);
+}
+
 /**
  * \brief encode an image to RGB(A) PNG format
  * \private \memberof mapcache_image_format_png
@@ -252,17 +311,13 @@ mapcache_buffer* _mapcache_imageio_png_encode(mapcache_context *ctx, mapcache_im
    int color_type;
    size_t row;
    mapcache_buffer *buffer = NULL;
-   int compression = ((mapcache_image_format_png*)format)->compression_level;
+   mapcache_image_format_png *f = (mapcache_image_format_png*)format;
    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL,NULL,NULL);
    if (!png_ptr) {
       ctx->set_error(ctx, 500, "failed to allocate png_struct structure");
       return NULL;
    }
-   if(compression == MAPCACHE_COMPRESSION_BEST)
-      png_set_compression_level (png_ptr, Z_BEST_COMPRESSION);
-   else if(compression == MAPCACHE_COMPRESSION_FAST)
-      png_set_compression_level (png_ptr, Z_BEST_SPEED);
-   png_set_filter(png_ptr,0,PNG_FILTER_NONE);
+   _mapcache_imageio_png_set_options(png_ptr,f);
 
    info_ptr = png_create_info_struct(png_ptr);
    if (!info_ptr)
@@ -280,7 +335,13 @@ mapcache_buffer* _mapcache_imageio_png_encode(mapcache_context *ctx, mapcache_im
       return NULL;
    }
 
-   buffer = mapcache_buffer_create(5000,ctx->pool);
+   if(f->compression_level == MAPCACHE_COMPRESSION_NONE) {
+      /* stored deflate blocks: the output is barely larger than the raw rows */
+      size_t raw = img->h*(img->w*4+1);
+      buffer = mapcache_buffer_create(raw+raw/1024+1024,ctx->pool);
+   } else {
+      buffer = mapcache_buffer_create(5000,ctx->pool);
+   }
 
    png_set_write_fn(png_ptr, buffer, _mapcache_imageio_png_write_func, _mapcache_imageio_png_flush_func);
 
@@ -1148,7 +1209,6 @@ mapcache_buffer* _mapcache_imageio_png_q_encode( mapcache_context *ctx, mapcache
       mapcache_image_format *format) {
    mapcache_buffer *buffer = mapcache_buffer_create(3000,ctx->pool);
    mapcache_image_format_png_q *f = (mapcache_image_format_png_q*)format;
-   int compression = f->format.compression_level;
    unsigned int numPaletteEntries = f->ncolors;
    unsigned char *pixels = (unsigned char*)apr_pcalloc(ctx->pool,image->w*image->h*sizeof(unsigned char));
    rgbaPixel palette[256];
@@ -1160,7 +1220,11 @@ mapcache_buffer* _mapcache_imageio_png_q_encode( mapcache_context *ctx, mapcache
    int row,sample_depth;
    png_structp png_ptr;
 
-   if(MAPCACHE_SUCCESS != _mapcache_imageio_quantize_image(image,&numPaletteEntries,palette, &maxval, NULL, 0)) {
+   if(f->palette) {
+      /* fixed palette: skip the histogram and median cut, only map the pixels */
+      memcpy(palette,f->palette,numPaletteEntries*sizeof(rgbaPixel));
+      maxval = 255;
+   } else if(MAPCACHE_SUCCESS != _mapcache_imageio_quantize_image(image,&numPaletteEntries,palette, &maxval, NULL, 0)) {
       ctx->set_error(ctx,500,"failed to quantize image buffer");
       return NULL;
    }
@@ -1175,11 +1239,7 @@ mapcache_buffer* _mapcache_imageio_png_q_encode( mapcache_context *ctx, mapcache
    if (!png_ptr)
       return (NULL);
 
-   if(compression == MAPCACHE_COMPRESSION_BEST)
-      png_set_compression_level (png_ptr, Z_BEST_COMPRESSION);
-   else if(compression == MAPCACHE_COMPRESSION_FAST)
-      png_set_compression_level (png_ptr, Z_BEST_SPEED);
-   png_set_filter(png_ptr,0,PNG_FILTER_NONE);
+   _mapcache_imageio_png_set_options(png_ptr,&f->format);
    info_ptr = png_create_info_struct(png_ptr);
    if (!info_ptr)
    {
@@ -1287,6 +1347,50 @@ mapcache_image_format* mapcache_imageio_create_png_q_format(apr_pool_t *pool, ch
    return (mapcache_image_format*)format;
 }
 
+void mapcache_imageio_png_q_load_palette(mapcache_context *ctx, mapcache_image_format *format, const char *filename) {
+   mapcache_image_format_png_q *f = (mapcache_image_format_png_q*)format;
+   rgbaPixel *entries = apr_pcalloc(ctx->pool,256*sizeof(rgbaPixel));
+   char line[256];
+   int nentries = 0;
+   FILE *stream = fopen(filename,"r");
+   if(!stream) {
+      ctx->set_error(ctx,400,"failed to open palette file %s for format \"%s\"",filename,format->name);
+      return;
+   }
+   while(fgets(line,sizeof(line),stream)) {
+      int r,g,b,al=255;
+      int n;
+      line[strcspn(line,"\r\n")] = 0;
+      if(line[0] == '#' || line[0] == 0)
+         continue;
+      n = sscanf(line,"%d,%d,%d,%d",&r,&g,&b,&al);
+      if((n != 3 && n != 4) || r<0 || r>255 || g<0 || g>255 || b<0 || b>255 || al<0 || al>255) {
+         ctx->set_error(ctx,400,"failed to parse entry %d \"%s\" of palette file %s "
+               "(expecting r,g,b or r,g,b,a values from 0 to 255)",nentries+1,line,filename);
+         fclose(stream);
+         return;
+      }
+      if(nentries == 256) {
+         ctx->set_error(ctx,400,"palette file %s has more than 256 entries",filename);
+         fclose(stream);
+         return;
+      }
+      /* image pixels are premultiplied */
+      entries[nentries].r = (r*al+127)/255;
+      entries[nentries].g = (g*al+127)/255;
+      entries[nentries].b = (b*al+127)/255;
+      entries[nentries].a = al;
+      nentries++;
+   }
+   fclose(stream);
+   if(nentries < 2) {
+      ctx->set_error(ctx,400,"palette file %s must have at least 2 entries",filename);
+      return;
+   }
+   f->palette = (unsigned char*)entries;
+   f->ncolors = nentries;
+}
+
 /** @} */
 
 /* vim: ai ts=3 sts=3 et sw=3
@@ -31,8 +31,55 @@
 #include <apr_file_io.h>
 #include <apr_strings.h>
 #include <apr_time.h>
+#include <apr_shm.h>
 
-char* lock_filename_for_resource(mapcache_context *ctx, const char *resource) {
+#ifndef _WIN32
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#endif
+
+#if APR_HAS_SHARED_MEMORY && defined(_POSIX_THREAD_PROCESS_SHARED) && (_POSIX_THREAD_PROCESS_SHARED > 0)
+#define MAPCACHE_HAS_MEMORY_LOCKER
+/* robust mutexes are part of the base POSIX.1-2008 */
+#if defined(_POSIX_VERSION) && (_POSIX_VERSION >= 200809L)
+#define MAPCACHE_HAS_ROBUST_MUTEX
+#endif
+#endif
+
+#define MAPCACHE_LOCKER_DEFAULT_TIMEOUT 120 /* seconds */
+
+int mapcache_lock_or_wait_for_resource(mapcache_context *ctx, char *resource) {
+   mapcache_locker *locker = ctx->config->locker;
+   return locker->lock_or_wait(ctx, locker, resource);
+}
+
+void mapcache_unlock_resource(mapcache_context *ctx, char *resource) {
+   mapcache_locker *locker = ctx->config->locker;
+   locker->unlock(ctx, locker, resource);
+}
+
+static void _mapcache_locker_parse_timeout(mapcache_context *ctx, ezxml_t node, mapcache_locker *locker) {
+   ezxml_t cur_node;
+   if((cur_node = ezxml_child(node,"timeout")) != NULL) {
+      char *endptr;
+      long timeout = strtol(cur_node->txt,&endptr,10);
+      if(*endptr != 0 || timeout < 0) {
+         ctx->set_error(ctx, 400, "failed to parse locker timeout seconds \"%s\". Expecting a positive integer",
+               cur_node->txt);
+         return;
+      }
+      locker->timeout = apr_time_from_sec(timeout);
+   }
+}
+
+/*
+ * disk locker: a lock is a file created with O_EXCL in the lock directory,
+ * waiters poll for it to disappear.
+ */
+
+static char* _mapcache_locker_disk_filename(mapcache_context *ctx, mapcache_locker_disk *ldisk, const char *resource) {
    char *saferes = apr_pstrdup(ctx->pool,resource);
    char *safeptr = saferes;
    while(*safeptr) {
@@ -42,42 +89,504 @@ char* lock_filename_for_resource(mapcache_context *ctx, const char *resource) {
       safeptr++;
    }
    return apr_psprintf(ctx->pool,"%s/"MAPCACHE_LOCKFILE_PREFIX"%s.lck",
-         ctx->config->lockdir,saferes);
+         ldisk->dir,saferes);
 }
 
-int mapcache_lock_or_wait_for_resource(mapcache_context *ctx, char *resource) {
-   char *lockname = lock_filename_for_resource(ctx,resource);
+/*
+ * take over a stale lockfile, last seen with the given mtime. The waiters
+ * that find the lock stale elect the one taking it over by creating a
+ * ".takeover" file next to it, and the winner refreshes the mtime of the
+ * lockfile instead of removing it, so that the lock is never seen as released
+ * and cannot be removed from under the new owner by a second waiter.
+ */
+static int _mapcache_locker_disk_takeover(mapcache_context *ctx, mapcache_locker *locker,
+      const char *lockname, apr_time_t mtime) {
+   char *takeovername = apr_pstrcat(ctx->pool, lockname, ".takeover", NULL);
+   apr_file_t *takeoverfile;
+   apr_finfo_t info;
+   int ret = MAPCACHE_FALSE;
+
+   if(apr_file_open(&takeoverfile,takeovername,APR_WRITE|APR_CREATE|APR_EXCL|APR_XTHREAD,
+            APR_OS_DEFAULT,ctx->pool) != APR_SUCCESS) {
+      /* another waiter is taking over, unless it died doing so */
+      if(apr_stat(&info,takeovername,APR_FINFO_MTIME,ctx->pool) == APR_SUCCESS &&
+            apr_time_now() - info.mtime > locker->timeout) {
+         apr_file_remove(takeovername,ctx->pool);
+      }
+      return MAPCACHE_FALSE;
+   }
+   apr_file_close(takeoverfile);
+
+   /* still the same stale lock, i.e. nobody took it over or released it in the meantime */
+   if(apr_stat(&info,lockname,APR_FINFO_MTIME,ctx->pool) == APR_SUCCESS && info.mtime == mtime) {
+      if(apr_file_mtime_set(lockname,apr_time_now(),ctx->pool) == APR_SUCCESS) {
+         ret = MAPCACHE_TRUE;
+      }
+   }
+   apr_file_remove(takeovername,ctx->pool);
+   return ret;
+}
+
+static int _mapcache_locker_disk_lock_or_wait(mapcache_context *ctx, mapcache_locker *locker, char *resource) {
+   mapcache_locker_disk *ldisk = (mapcache_locker_disk*)locker;
+   char *lockname = _mapcache_locker_disk_filename(ctx,ldisk,resource);
    apr_file_t *lockfile;
+   apr_finfo_t info;
    apr_status_t rv;
-   /* create the lockfile */
-   rv = apr_file_open(&lockfile,lockname,APR_WRITE|APR_CREATE|APR_EXCL|APR_XTHREAD,APR_OS_DEFAULT,ctx->pool);
-
-   /* if the file already exists, wait for it to disappear */
-   /* TODO: check the lock isn't stale (i.e. too old) */
-   if( rv != APR_SUCCESS ) {
-      apr_finfo_t info;
-      rv = apr_stat(&info,lockname,0,ctx->pool);
+   int stale = 0;
+
+   while(1) {
+      /* create the lockfile */
+      rv = apr_file_open(&lockfile,lockname,APR_WRITE|APR_CREATE|APR_EXCL|APR_XTHREAD,APR_OS_DEFAULT,ctx->pool);
+      if(rv == APR_SUCCESS) {
+         /* we acquired the lock */
+         apr_file_close(lockfile);
+         return MAPCACHE_TRUE;
+      }
+
+      /* the file already exists, wait for it to disappear */
+      rv = apr_stat(&info,lockname,APR_FINFO_MTIME,ctx->pool);
 #ifdef DEBUG
       if(!APR_STATUS_IS_ENOENT(rv)) {
          ctx->log(ctx, MAPCACHE_DEBUG, "waiting on resource lock %s", resource);
       }
 #endif
       while(!APR_STATUS_IS_ENOENT(rv)) {
+         if(locker->timeout && rv == APR_SUCCESS && apr_time_now() - info.mtime > locker->timeout) {
+            /* whoever created the lock died or hung, try to take it over */
+            stale = 1;
+            if(_mapcache_locker_disk_takeover(ctx,locker,lockname,info.mtime) == MAPCACHE_TRUE) {
+               ctx->log(ctx, MAPCACHE_WARN, "taking over stale lockfile %s", lockname);
+               return MAPCACHE_TRUE;
+            }
+         }
          /* sleep for the configured number of micro-seconds (default is 1/100th of a second) */
-         apr_sleep(ctx->config->lock_retry_interval);
-         rv = apr_stat(&info,lockname,0,ctx->pool);
+         apr_sleep(ldisk->retry);
+         rv = apr_stat(&info,lockname,APR_FINFO_MTIME,ctx->pool);
       }
-      return MAPCACHE_FALSE;
+      /*
+       * the lock was released. If it had gone stale, it may have been released by the
+       * hung renderer coming back, or its lockfile removed by hand: try to grab it
+       * ourselves rather than counting on the tile having been created.
+       */
+      if(!stale) {
+         return MAPCACHE_FALSE;
+      }
+      stale = 0;
+   }
+}
+
+static void _mapcache_locker_disk_unlock(mapcache_context *ctx, mapcache_locker *locker, char *resource) {
+   char *lockname = _mapcache_locker_disk_filename(ctx,(mapcache_locker_disk*)locker,resource);
+   apr_file_remove(lockname,ctx->pool);
+}
+
+static void _mapcache_locker_disk_configuration_parse_xml(mapcache_context *ctx, ezxml_t node, mapcache_locker *locker) {
+   ezxml_t cur_node;
+   mapcache_locker_disk *ldisk = (mapcache_locker_disk*)locker;
+   if((cur_node = ezxml_child(node,"directory")) != NULL) {
+      ldisk->dir = apr_pstrdup(ctx->pool, cur_node->txt);
+   }
+   if((cur_node = ezxml_child(node,"retry")) != NULL) {
+      char *endptr;
+      ldisk->retry = strtol(cur_node->txt,&endptr,10);
+      if(*endptr != 0 || ldisk->retry < 0) {
+         ctx->set_error(ctx, 400, "failed to parse locker retry microseconds \"%s\". Expecting a positive integer",
+               cur_node->txt);
+         return;
+      }
+   }
+   _mapcache_locker_parse_timeout(ctx,node,locker);
+}
+
+static void _mapcache_locker_disk_configuration_post_config(mapcache_context *ctx, mapcache_locker *locker,
+      mapcache_cfg *config, int cgi) {
+   mapcache_locker_disk *ldisk = (mapcache_locker_disk*)locker;
+   apr_dir_t *lockdir;
+   apr_status_t rv;
+   char errmsg[120];
+
+   if(!ldisk->dir || !strlen(ldisk->dir)) {
+      ldisk->dir = apr_pstrdup(ctx->pool, "/tmp");
+   }
+   rv = apr_dir_open(&lockdir,ldisk->dir,ctx->pool);
+   if(rv != APR_SUCCESS) {
+      ctx->set_error(ctx,500, "failed to open lock directory %s: %s"
+            ,ldisk->dir,apr_strerror(rv,errmsg,120));
+      return;
+   }
+
+   /* only remove lockfiles if we're not in cgi mode */
+   if(!cgi) {
+      apr_finfo_t finfo;
+      while ((apr_dir_read(&finfo, APR_FINFO_DIRENT|APR_FINFO_TYPE|APR_FINFO_NAME, lockdir)) == APR_SUCCESS) {
+         if(finfo.filetype == APR_REG) {
+            if(!strncmp(finfo.name, MAPCACHE_LOCKFILE_PREFIX, strlen(MAPCACHE_LOCKFILE_PREFIX))) {
+               ctx->log(ctx,MAPCACHE_WARN,"found old lockfile %s/%s, deleting it",ldisk->dir,
+                     finfo.name);
+               rv = apr_file_remove(apr_psprintf(ctx->pool,"%s/%s",ldisk->dir, finfo.name),ctx->pool);
+               if(rv != APR_SUCCESS) {
+                  ctx->set_error(ctx,500, "failed to remove lockfile %s: %s",finfo.name,apr_strerror(rv,errmsg,120));
+                  apr_dir_close(lockdir);
+                  return;
+               }
+
+            }
+
+         }
+      }
+   }
+   apr_dir_close(lockdir);
+}
+
+mapcache_locker* mapcache_locker_disk_create(mapcache_context *ctx) {
+   mapcache_locker_disk *ldisk = apr_pcalloc(ctx->pool, sizeof(mapcache_locker_disk));
+   ldisk->dir = NULL;
+   /* default retry interval is 1/100th of a second, i.e. 10000 microseconds */
+   ldisk->retry = 10000;
+   ldisk->locker.type = MAPCACHE_LOCKER_DISK;
+   /* lockfiles are never considered stale unless a timeout is configured */
+   ldisk->locker.timeout = 0;
+   ldisk->locker.lock_or_wait = _mapcache_locker_disk_lock_or_wait;
+   ldisk->locker.unlock = _mapcache_locker_disk_unlock;
+   ldisk->locker.configuration_parse_xml = _mapcache_locker_disk_configuration_parse_xml;
+   ldisk->locker.configuration_post_config = _mapcache_locker_disk_configuration_post_config;
+   return (mapcache_locker*)ldisk;
+}
+
+#ifdef MAPCACHE_HAS_MEMORY_LOCKER
+
+/*
+ * memory locker: the locks live in a table of slots in an anonymous shared
+ * memory segment, protected by a process shared mutex. A waiter sleeps on the
+ * condition variable of the slot holding its resource, which is broadcast when
+ * the lock is released.
+ *
+ * a resource is stored in the first free slot at or after the slot its hash
+ * points to (its home slot). The home slot records how far from it the
+ * resources hashed to it may be, so that a lookup only probes that many slots.
+ */
+
+#define MAPCACHE_LOCKER_KEY_LEN 256
+
+typedef struct {
+   int used;
+   apr_uint64_t hash;
+   char key[MAPCACHE_LOCKER_KEY_LEN];
+   unsigned int generation; /* incremented each time the slot is (re)acquired */
+   unsigned int takeovers; /* incremented each time a stale lock is taken over */
+   apr_time_t time; /* when the lock was acquired */
+   pid_t pid;
+   pthread_t thread;
+   int waiters;
+   int maxprobe; /* the resources whose home is this slot are at most maxprobe slots after it */
+   pthread_cond_t released;
+} _mapcache_locker_slot;
+
+typedef struct {
+   pthread_mutex_t mutex;
+   pthread_cond_t freed; /* broadcast when a slot becomes free */
+   int nslots;
+   _mapcache_locker_slot slots[1];
+} _mapcache_locker_table;
+
+/* 64 bit FNV-1a */
+static apr_uint64_t _mapcache_locker_hash(const char *str) {
+   apr_uint64_t hash = 14695981039346656037ULL;
+   while(*str) {
+      hash ^= (unsigned char)*str++;
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+/*
+ * resources that do not fit in a slot are stored truncated, followed by the
+ * hash of the full name.
+ */
+static void _mapcache_locker_memory_key(const char *resource, char *key, apr_uint64_t *hash) {
+   *hash = _mapcache_locker_hash(resource);
+   if(strlen(resource) < MAPCACHE_LOCKER_KEY_LEN) {
+      strcpy(key, resource);
    } else {
-      /* we acquired the lock */
-      apr_file_close(lockfile);
+      apr_snprintf(key, MAPCACHE_LOCKER_KEY_LEN, "%.*s#%016llx", MAPCACHE_LOCKER_KEY_LEN - 18,
+            resource, (unsigned long long)*hash);
+   }
+}
+
+static _mapcache_locker_slot* _mapcache_locker_memory_find(_mapcache_locker_table *table,
+      const char *key, apr_uint64_t hash) {
+   int i, start = (int)(hash % table->nslots);
+   for(i=0; i<=table->slots[start].maxprobe; i++) {
+      _mapcache_locker_slot *slot = &table->slots[(start + i) % table->nslots];
+      if(slot->used && slot->hash == hash && !strcmp(slot->key, key)) {
+         return slot;
+      }
+   }
+   return NULL;
+}
+
+static _mapcache_locker_slot* _mapcache_locker_memory_find_free(_mapcache_locker_table *table, apr_uint64_t hash) {
+   int i, start = (int)(hash % table->nslots);
+   for(i=0; i<table->nslots; i++) {
+      _mapcache_locker_slot *slot = &table->slots[(start + i) % table->nslots];
+      if(!slot->used) {
+         /* recorded before the slot is filled, see _mapcache_locker_memory_recover() */
+         if(i > table->slots[start].maxprobe) {
+            table->slots[start].maxprobe = i;
+         }
+         return slot;
+      }
+   }
+   return NULL;
+}
+
+/* shrink the probe distance of the home slot of a released resource */
+static void _mapcache_locker_memory_release(_mapcache_locker_table *table, _mapcache_locker_slot *slot) {
+   int start = (int)(slot->hash % table->nslots);
+   _mapcache_locker_slot *home = &table->slots[start];
+   slot->used = 0;
+   while(home->maxprobe > 0) {
+      _mapcache_locker_slot *last = &table->slots[(start + home->maxprobe) % table->nslots];
+      if(last->used && (int)(last->hash % table->nslots) == start) {
+         break;
+      }
+      home->maxprobe--;
+   }
+}
+
+static void _mapcache_locker_memory_claim(_mapcache_locker_slot *slot) {
+   slot->generation++;
+   slot->time = apr_time_now();
+   slot->pid = getpid();
+   slot->thread = pthread_self();
+}
+
+/* a lock is stale if it is too old, or if the process that took it is gone */
+static int _mapcache_locker_memory_is_stale(mapcache_locker *locker, _mapcache_locker_slot *slot, apr_time_t now) {
+   if(locker->timeout && now - slot->time > locker->timeout) {
+      return MAPCACHE_TRUE;
+   }
+   if(slot->pid != getpid() && kill(slot->pid, 0) != 0 && errno == ESRCH) {
       return MAPCACHE_TRUE;
    }
+   return MAPCACHE_FALSE;
 }
 
-void mapcache_unlock_resource(mapcache_context *ctx, char *resource) {
-   char *lockname = lock_filename_for_resource(ctx,resource);
-   apr_file_remove(lockname,ctx->pool);
+/*
+ * the previous owner of the table mutex died while holding it (robust mutexes
+ * only). The slots of dead processes are freed and the probe distances are
+ * rebuilt, as the dead owner may have been interrupted while updating them.
+ */
+static void _mapcache_locker_memory_recover(_mapcache_locker_table *table) {
+   int i;
+#ifdef MAPCACHE_HAS_ROBUST_MUTEX
+   pthread_mutex_consistent(&table->mutex);
+#endif
+   for(i=0; i<table->nslots; i++) {
+      _mapcache_locker_slot *slot = &table->slots[i];
+      slot->maxprobe = 0;
+      if(slot->used && slot->pid != getpid() && kill(slot->pid, 0) != 0 && errno == ESRCH) {
+         slot->used = 0;
+         pthread_cond_broadcast(&slot->released);
+      }
+   }
+   for(i=0; i<table->nslots; i++) {
+      _mapcache_locker_slot *slot = &table->slots[i];
+      if(slot->used) {
+         int start = (int)(slot->hash % table->nslots);
+         int probe = (i - start + table->nslots) % table->nslots;
+         if(probe > table->slots[start].maxprobe) {
+            table->slots[start].maxprobe = probe;
+         }
+      }
+   }
+   pthread_cond_broadcast(&table->freed);
+}
+
+static void _mapcache_locker_memory_table_lock(_mapcache_locker_table *table) {
+   if(pthread_mutex_lock(&table->mutex) == EOWNERDEAD) {
+      _mapcache_locker_memory_recover(table);
+   }
+}
+
+static void _mapcache_locker_memory_timedwait(_mapcache_locker_table *table, pthread_cond_t *cond, apr_time_t until) {
+   struct timespec ts;
+   ts.tv_sec = apr_time_sec(until);
+   ts.tv_nsec = apr_time_usec(until) * 1000;
+   if(pthread_cond_timedwait(cond, &table->mutex, &ts) == EOWNERDEAD) {
+      _mapcache_locker_memory_recover(table);
+   }
+}
+
+static int _mapcache_locker_memory_lock_or_wait(mapcache_context *ctx, mapcache_locker *locker, char *resource) {
+   _mapcache_locker_table *table = (_mapcache_locker_table*)((mapcache_locker_memory*)locker)->shm;
+   _mapcache_locker_slot *slot;
+   char key[MAPCACHE_LOCKER_KEY_LEN];
+   apr_uint64_t hash;
+   unsigned int generation, takeovers;
+   int ret, full = 0;
+
+   _mapcache_locker_memory_key(resource, key, &hash);
+   _mapcache_locker_memory_table_lock(table);
+
+   while((slot = _mapcache_locker_memory_find(table, key, hash)) == NULL) {
+      if((slot = _mapcache_locker_memory_find_free(table, hash)) != NULL) {
+         /* nobody is creating this resource, we acquire the lock */
+         slot->hash = hash;
+         strcpy(slot->key, key);
+         slot->waiters = 0;
+         _mapcache_locker_memory_claim(slot);
+         slot->used = 1;
+         pthread_mutex_unlock(&table->mutex);
+         return MAPCACHE_TRUE;
+      }
+      /* all the slots are taken, wait for one to be released */
+      if(!full) {
+         ctx->log(ctx, MAPCACHE_WARN, "memory locker: all %d lock slots in use, waiting for %s",
+               table->nslots, resource);
+         full = 1;
+      }
+      _mapcache_locker_memory_timedwait(table, &table->freed, apr_time_now() + apr_time_from_sec(1));
+   }
+
+#ifdef DEBUG
+   ctx->log(ctx, MAPCACHE_DEBUG, "waiting on resource lock %s", resource);
+#endif
+   /*
+    * someone else holds the lock, wait until it is released: the slot is freed
+    * or reused for another resource, or it was released and acquired again by
+    * someone else (its generation moved on by more than its takeovers). A
+    * takeover by another waiter is not a release, we keep waiting on the new owner.
+    */
+   generation = slot->generation;
+   takeovers = slot->takeovers;
+   slot->waiters++;
+   while(1) {
+      apr_time_t now = apr_time_now(), until;
+      if(!slot->used || slot->hash != hash || strcmp(slot->key, key) ||
+            slot->generation - generation != slot->takeovers - takeovers) {
+         ret = MAPCACHE_FALSE;
+         break;
+      }
+      generation = slot->generation;
+      takeovers = slot->takeovers;
+      if(_mapcache_locker_memory_is_stale(locker, slot, now)) {
+         ctx->log(ctx, MAPCACHE_WARN, "taking over stale lock on %s", resource);
+         _mapcache_locker_memory_claim(slot);
+         slot->takeovers++;
+         ret = MAPCACHE_TRUE;
+         break;
+      }
+      /* wake up at least every second to check whether the holder is still alive */
+      until = now + apr_time_from_sec(1);
+      if(locker->timeout && slot->time + locker->timeout < until) {
+         until = slot->time + locker->timeout + 1;
+      }
+      _mapcache_locker_memory_timedwait(table, &slot->released, until);
+   }
+   slot->waiters--;
+   pthread_mutex_unlock(&table->mutex);
+   return ret;
+}
+
+static void _mapcache_locker_memory_unlock(mapcache_context *ctx, mapcache_locker *locker, char *resource) {
+   _mapcache_locker_table *table = (_mapcache_locker_table*)((mapcache_locker_memory*)locker)->shm;
+   _mapcache_locker_slot *slot;
+   char key[MAPCACHE_LOCKER_KEY_LEN];
+   apr_uint64_t hash;
+
+   _mapcache_locker_memory_key(resource, key, &hash);
+   _mapcache_locker_memory_table_lock(table);
+   slot = _mapcache_locker_memory_find(table, key, hash);
+   /* leave the lock alone if it was taken over by someone else in the meantime */
+   if(slot && slot->pid == getpid() && pthread_equal(slot->thread, pthread_self())) {
+      _mapcache_locker_memory_release(table, slot);
+      if(slot->waiters) {
+         pthread_cond_broadcast(&slot->released);
+      }
+      pthread_cond_broadcast(&table->freed);
+   }
+   pthread_mutex_unlock(&table->mutex);
+}
+
+static void _mapcache_locker_memory_configuration_parse_xml(mapcache_context *ctx, ezxml_t node, mapcache_locker *locker) {
+   ezxml_t cur_node;
+   mapcache_locker_memory *lmem = (mapcache_locker_memory*)locker;
+   if((cur_node = ezxml_child(node,"slots")) != NULL) {
+      char *endptr;
+      lmem->slots = (int)strtol(cur_node->txt,&endptr,10);
+      if(*endptr != 0 || lmem->slots < 1) {
+         ctx->set_error(ctx, 400, "failed to parse locker slots \"%s\". Expecting a positive integer",
+               cur_node->txt);
+         return;
+      }
+   }
+   _mapcache_locker_parse_timeout(ctx,node,locker);
+}
+
+static void _mapcache_locker_memory_configuration_post_config(mapcache_context *ctx, mapcache_locker *locker,
+      mapcache_cfg *config, int cgi) {
+   mapcache_locker_memory *lmem = (mapcache_locker_memory*)locker;
+   _mapcache_locker_table *table;
+   pthread_mutexattr_t mattr;
+   pthread_condattr_t cattr;
+   apr_shm_t *shm;
+   apr_status_t rv;
+   char errmsg[120];
+   int i;
+
+   /* anonymous, so that it is inherited by the children we fork */
+   rv = apr_shm_create(&shm, sizeof(_mapcache_locker_table) + (lmem->slots - 1) * sizeof(_mapcache_locker_slot),
+         NULL, ctx->pool);
+   if(rv != APR_SUCCESS) {
+      ctx->set_error(ctx, 500, "failed to create shared memory for memory locker: %s",
+            apr_strerror(rv,errmsg,120));
+      return;
+   }
+   table = apr_shm_baseaddr_get(shm);
+   memset(table, 0, apr_shm_size_get(shm));
+   table->nslots = lmem->slots;
+
+   pthread_mutexattr_init(&mattr);
+   pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+#ifdef MAPCACHE_HAS_ROBUST_MUTEX
+   /* a process dying while holding the mutex must not block the others forever */
+   pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+#endif
+   pthread_condattr_init(&cattr);
+   pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+   if(pthread_mutex_init(&table->mutex, &mattr) || pthread_cond_init(&table->freed, &cattr)) {
+      ctx->set_error(ctx, 500, "failed to create process shared mutex for memory locker");
+   }
+   for(i=0; i<table->nslots && !GC_HAS_ERROR(ctx); i++) {
+      if(pthread_cond_init(&table->slots[i].released, &cattr)) {
+         ctx->set_error(ctx, 500, "failed to create process shared condition for memory locker");
+      }
+   }
+   pthread_mutexattr_destroy(&mattr);
+   pthread_condattr_destroy(&cattr);
+   lmem->shm = table;
+}
+
+#endif /* MAPCACHE_HAS_MEMORY_LOCKER */
+
+mapcache_locker* mapcache_locker_memory_create(mapcache_context *ctx) {
+#ifdef MAPCACHE_HAS_MEMORY_LOCKER
+   mapcache_locker_memory *lmem = apr_pcalloc(ctx->pool, sizeof(mapcache_locker_memory));
+   lmem->slots = 1024;
+   lmem->shm = NULL;
+   lmem->locker.type = MAPCACHE_LOCKER_MEMORY;
+   lmem->locker.timeout = apr_time_from_sec(MAPCACHE_LOCKER_DEFAULT_TIMEOUT);
+   lmem->locker.lock_or_wait = _mapcache_locker_memory_lock_or_wait;
+   lmem->locker.unlock = _mapcache_locker_memory_unlock;
+   lmem->locker.configuration_parse_xml = _mapcache_locker_memory_configuration_parse_xml;
+   lmem->locker.configuration_post_config = _mapcache_locker_memory_configuration_post_config;
+   return (mapcache_locker*)lmem;
+#else
+   ctx->set_error(ctx, 400, "memory locker is not supported on this platform (needs process shared pthread mutexes)");
+   return NULL;
+#endif
 }
 
 /* vim: ai ts=3 sts=3 et sw=3
@@ -0,0 +1,274 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache tile caching support file: process wide thread pool
+ * Author:   Thomas Bonfort and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include "mapcache.h"
+#include <apr_strings.h>
+
+#if APR_HAS_THREADS
+#include <apr_thread_proc.h>
+#include <apr_thread_cond.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+typedef struct mapcache_task mapcache_task;
+
+struct mapcache_task {
+   mapcache_task_func func;
+   void *data;
+   mapcache_task_group *group;
+   mapcache_task *next;
+};
+
+/*
+ * a fixed set of worker threads consuming a single queue of tasks. Each
+ * request queues its tasks in its own group, and helps out running them while
+ * it waits for the group to complete, so that a request never stays idle while
+ * its tasks are queued behind the ones of other requests.
+ */
+struct mapcache_thread_pool {
+   apr_pool_t *pool; /* not tied to a request, lives as long as the process */
+   apr_thread_mutex_t *mutex;
+   apr_thread_cond_t *work; /* signalled when a task is queued */
+   mapcache_task *head, *tail;
+   apr_thread_t **threads;
+   int nthreads;
+   int stop; /* set by mapcache_thread_pool_destroy(), the workers exit once the queue is empty */
+#ifndef _WIN32
+   pid_t pid; /* the threads of a pool do not survive a fork */
+#endif
+};
+
+struct mapcache_task_group {
+   mapcache_thread_pool *thread_pool;
+   int pending; /* tasks queued or running */
+   apr_thread_cond_t *done; /* broadcast when pending drops to 0 */
+};
+
+static void _mapcache_task_run(mapcache_thread_pool *tp, mapcache_task *task) {
+   mapcache_task_group *group = task->group;
+   task->func(task->data);
+   apr_thread_mutex_lock(tp->mutex);
+   if(--group->pending == 0) {
+      apr_thread_cond_broadcast(group->done);
+   }
+   apr_thread_mutex_unlock(tp->mutex);
+}
+
+static void* APR_THREAD_FUNC _mapcache_thread_pool_worker(apr_thread_t *thread, void *data) {
+   mapcache_thread_pool *tp = (mapcache_thread_pool*)data;
+   while(1) {
+      mapcache_task *task;
+      apr_thread_mutex_lock(tp->mutex);
+      while(!tp->head && !tp->stop) {
+         apr_thread_cond_wait(tp->work, tp->mutex);
+      }
+      if(!tp->head) {
+         apr_thread_mutex_unlock(tp->mutex);
+         break;
+      }
+      task = tp->head;
+      tp->head = task->next;
+      if(!tp->head) tp->tail = NULL;
+      apr_thread_mutex_unlock(tp->mutex);
+      _mapcache_task_run(tp, task);
+   }
+   apr_thread_exit(thread, APR_SUCCESS);
+   return NULL;
+}
+
+static mapcache_thread_pool* _mapcache_thread_pool_create(mapcache_context *ctx, int nthreads) {
+   mapcache_thread_pool *tp;
+   apr_pool_t *pool;
+   apr_threadattr_t *thread_attrs;
+   int i;
+
+   if(apr_pool_create(&pool, NULL) != APR_SUCCESS) {
+      ctx->log(ctx, MAPCACHE_WARN, "failed to create memory pool for the thread pool, fetching tiles sequentially");
+      return NULL;
+   }
+   tp = (mapcache_thread_pool*)apr_pcalloc(pool, sizeof(mapcache_thread_pool));
+   tp->pool = pool;
+#ifndef _WIN32
+   tp->pid = getpid();
+#endif
+   if(apr_thread_mutex_create(&tp->mutex, APR_THREAD_MUTEX_DEFAULT, pool) != APR_SUCCESS ||
+         apr_thread_cond_create(&tp->work, pool) != APR_SUCCESS ||
+         apr_threadattr_create(&thread_attrs, pool) != APR_SUCCESS) {
+      ctx->log(ctx, MAPCACHE_WARN, "failed to initialize the thread pool, fetching tiles sequentially");
+      apr_pool_destroy(pool);
+      return NULL;
+   }
+   tp->threads = (apr_thread_t**)apr_pcalloc(pool, nthreads*sizeof(apr_thread_t*));
+   for(i=0; i<nthreads; i++) {
+      if(apr_thread_create(&tp->threads[i], thread_attrs, _mapcache_thread_pool_worker, tp, pool) != APR_SUCCESS) {
+         break;
+      }
+   }
+   if(i == 0) {
+      ctx->log(ctx, MAPCACHE_WARN, "failed to start any thread pool thread, fetching tiles sequentially");
+      apr_pool_destroy(pool);
+      return NULL;
+   }
+   if(i < nthreads) {
+      ctx->log(ctx, MAPCACHE_WARN, "only started %d of %d thread pool threads", i, nthreads);
+   }
+   tp->nthreads = i;
+   return tp;
+}
+
+static mapcache_thread_pool* _mapcache_thread_pool_get(mapcache_context *ctx) {
+   mapcache_cfg *config = ctx->config;
+   mapcache_thread_pool *tp;
+   apr_thread_mutex_lock(config->thread_pool_mutex);
+   tp = config->thread_pool;
+#ifndef _WIN32
+   if(tp && tp->pid != getpid()) {
+      /* we are a child forked after the pool was started, the workers stayed in the parent */
+      tp = NULL;
+   }
+#endif
+   if(!tp) {
+      tp = config->thread_pool = _mapcache_thread_pool_create(ctx, config->download_threads);
+   }
+   apr_thread_mutex_unlock(config->thread_pool_mutex);
+   return tp;
+}
+
+void mapcache_thread_pool_destroy(mapcache_cfg *config) {
+   mapcache_thread_pool *tp = config->thread_pool;
+   apr_status_t rv;
+   int i;
+   if(!tp) return;
+   config->thread_pool = NULL;
+#ifndef _WIN32
+   if(tp->pid != getpid()) {
+      /* the threads were started by our parent process */
+      return;
+   }
+#endif
+   apr_thread_mutex_lock(tp->mutex);
+   tp->stop = 1;
+   apr_thread_cond_broadcast(tp->work);
+   apr_thread_mutex_unlock(tp->mutex);
+   for(i=0; i<tp->nthreads; i++) {
+      apr_thread_join(&rv, tp->threads[i]);
+   }
+   apr_pool_destroy(tp->pool);
+}
+
+mapcache_task_group* mapcache_task_group_create(mapcache_context *ctx) {
+   mapcache_task_group *group = (mapcache_task_group*)apr_pcalloc(ctx->pool, sizeof(mapcache_task_group));
+   if(ctx->config->download_threads > 0) {
+      group->thread_pool = _mapcache_thread_pool_get(ctx);
+   }
+   if(group->thread_pool && apr_thread_cond_create(&group->done, ctx->pool) != APR_SUCCESS) {
+      group->thread_pool = NULL;
+   }
+   return group;
+}
+
+void mapcache_task_group_push(mapcache_context *ctx, mapcache_task_group *group, mapcache_task_func func, void *data) {
+   mapcache_thread_pool *tp = group->thread_pool;
+   mapcache_task *task;
+   if(!tp) {
+      func(data);
+      return;
+   }
+   task = (mapcache_task*)apr_pcalloc(ctx->pool, sizeof(mapcache_task));
+   task->func = func;
+   task->data = data;
+   task->group = group;
+   apr_thread_mutex_lock(tp->mutex);
+   if(tp->tail) {
+      tp->tail->next = task;
+   } else {
+      tp->head = task;
+   }
+   tp->tail = task;
+   group->pending++;
+   apr_thread_cond_signal(tp->work);
+   apr_thread_mutex_unlock(tp->mutex);
+}
+
+void mapcache_task_group_wait(mapcache_context *ctx, mapcache_task_group *group) {
+   mapcache_thread_pool *tp = group->thread_pool;
+   if(!tp) return;
+   apr_thread_mutex_lock(tp->mutex);
+   while(group->pending) {
+      /* take back the first of our tasks that is still queued */
+      mapcache_task *task = tp->head, *prev = NULL;
+      while(task && task->group != group) {
+         prev = task;
+         task = task->next;
+      }
+      if(task) {
+         if(prev) {
+            prev->next = task->next;
+         } else {
+            tp->head = task->next;
+         }
+         if(tp->tail == task) {
+            tp->tail = prev;
+         }
+         apr_thread_mutex_unlock(tp->mutex);
+         _mapcache_task_run(tp, task);
+         apr_thread_mutex_lock(tp->mutex);
+      } else {
+         /* all our remaining tasks are running in worker threads */
+         apr_thread_cond_wait(group->done, tp->mutex);
+      }
+   }
+   apr_thread_mutex_unlock(tp->mutex);
+}
+
+#else
+
+struct mapcache_task_group {
+   int pending;
+};
+
+mapcache_task_group* mapcache_task_group_create(mapcache_context *ctx) {
+   return (mapcache_task_group*)apr_pcalloc(ctx->pool, sizeof(mapcache_task_group));
+}
+
+void mapcache_task_group_push(mapcache_context *ctx, mapcache_task_group *group, mapcache_task_func func, void *data) {
+   func(data);
+}
+
+void mapcache_task_group_wait(mapcache_context *ctx, mapcache_task_group *group) {
+}
+
+void mapcache_thread_pool_destroy(mapcache_cfg *config) {
+}
+
+#endif /* APR_HAS_THREADS */
+
+/* vim: ai ts=3 sts=3 et sw=3
+*/
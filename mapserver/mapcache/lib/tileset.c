@@ -208,6 +208,47 @@ void mapcache_tileset_get_map_tiles(mapcache_context *ctx, mapcache_tileset *til
    *ntiles = i;
 }
 
+/*
+ * decode the first nrows rows of the tiles of a row of the mosaic, from column
+ * col0 to col1 included, into band. slots without a tile are left transparent
+ */
+static void _mapcache_tileset_decode_band(mapcache_context *ctx, mapcache_tile **rowtiles,
+      int col0, int col1, int tsx, int nrows, mapcache_image *band) {
+   int col,r;
+   for(col=col0; col<=col1; col++) {
+      mapcache_image fakeimg;
+      mapcache_tile *tile = rowtiles[col];
+      fakeimg.stride = band->stride;
+      fakeimg.data = &(band->data[col*tsx*4]);
+      if(!tile) {
+         for(r=0;r<nrows;r++) {
+            memset(fakeimg.data + r*fakeimg.stride, 0, tsx*4);
+         }
+      } else if(!tile->raw_image) {
+         mapcache_imageio_decode_rows_to_image(ctx,tile->encoded_data,&fakeimg,nrows);
+         GC_CHECK_ERROR(ctx);
+      } else {
+         unsigned char *srcptr = tile->raw_image->data;
+         unsigned char *dstptr = fakeimg.data;
+         for(r=0;r<nrows && r<tile->raw_image->h;r++) {
+            memcpy(dstptr,srcptr,MAPCACHE_MIN(tile->raw_image->w,tsx)*4);
+            srcptr += tile->raw_image->stride;
+            dstptr += fakeimg.stride;
+         }
+      }
+   }
+}
+
+static mapcache_image* _mapcache_tileset_band_create(mapcache_context *ctx, int width, int height) {
+   mapcache_image *band = mapcache_image_create(ctx);
+   band->w = width;
+   band->h = height;
+   band->stride = width*4;
+   band->data = malloc(width*height*4*sizeof(unsigned char));
+   apr_pool_cleanup_register(ctx->pool, band->data, (void*)free, apr_pool_cleanup_null) ;
+   return band;
+}
+
 mapcache_image* mapcache_tileset_assemble_map_tiles(mapcache_context *ctx, mapcache_tileset *tileset,
       mapcache_grid_link *grid_link,
       double *bbox, int width, int height,
@@ -217,12 +258,13 @@ mapcache_image* mapcache_tileset_assemble_map_tiles(mapcache_context *ctx, mapca
    double hresolution = mapcache_grid_get_horizontal_resolution(bbox, width);
    double vresolution = mapcache_grid_get_vertical_resolution(bbox, height);
    double tilebbox[4];
-   mapcache_tile *toplefttile=NULL;
    int mx=INT_MAX,my=INT_MAX,Mx=INT_MIN,My=INT_MIN;
-   int i;
+   int i, row, ncols, nrows, tsx, tsy, col0, col1, row0, row1, decoded;
    mapcache_image *image = mapcache_image_create(ctx);
-   mapcache_image *srcimage;
-   double tileresolution, dstminx, dstminy, hf, vf;
+   mapcache_image *band, *next = NULL;
+   mapcache_tile **mosaic;
+   mapcache_grid *grid;
+   double tileresolution, dstminx, dstminy, hf, vf, srcmaxy;
 
    image->w = width;
    image->h = height;
@@ -241,48 +283,25 @@ mapcache_image* mapcache_tileset_assemble_map_tiles(mapcache_context *ctx, mapca
       if(tile->x > Mx) Mx = tile->x;
       if(tile->y > My) My = tile->y;
    }
-   /* create image that will contain the unscaled tiles data */
-   srcimage = mapcache_image_create(ctx);
-   srcimage->w = (Mx-mx+1)*tiles[0]->grid_link->grid->tile_sx;
-   srcimage->h = (My-my+1)*tiles[0]->grid_link->grid->tile_sy;
-   srcimage->stride = srcimage->w*4;
-   srcimage->data = calloc(1,srcimage->w*srcimage->h*4*sizeof(unsigned char));
-   apr_pool_cleanup_register(ctx->pool, srcimage->data, (void*)free, apr_pool_cleanup_null) ;
+   grid = tiles[0]->grid_link->grid;
+   tsx = grid->tile_sx;
+   tsy = grid->tile_sy;
+   ncols = Mx-mx+1;
+   nrows = My-my+1;
 
-   /* copy the tiles data into the src image */
+   /* 
+    * the tiles form a mosaic of ncols*nrows tiles, which is never allocated as a
+    * whole: it is decoded one row of tiles at a time, each row being resampled
+    * onto the destination image before decoding the next one
+    */
+   mosaic = apr_pcalloc(ctx->pool, ncols*nrows*sizeof(mapcache_tile*));
    for(i=0;i<ntiles;i++) {
-     int ox,oy; /* the offset from the start of the src image to the start of the tile */
-      mapcache_image fakeimg;
-      mapcache_tile *tile = tiles[i];
-      if(tile->x == mx && tile->y == My) {
-         toplefttile = tile;
-      }
-      
-      ox = (tile->x - mx) * tile->grid_link->grid->tile_sx;
-      oy = (My - tile->y) * tile->grid_link->grid->tile_sy;
-
-      fakeimg.stride = srcimage->stride;
-      fakeimg.data = &(srcimage->data[oy*srcimage->stride+ox*4]);
-      if(!tile->raw_image) {
-         mapcache_imageio_decode_to_image(ctx,tile->encoded_data,&fakeimg);
-      } else {
-         int r;
-         unsigned char *srcptr = tile->raw_image->data;
-         unsigned char *dstptr = fakeimg.data;
-         for(r=0;r<tile->raw_image->h;r++) {
-            memcpy(dstptr,srcptr,tile->raw_image->stride);
-            srcptr += tile->raw_image->stride;
-            dstptr += fakeimg.stride;
-         }
-      }
+      mosaic[(My-tiles[i]->y)*ncols + tiles[i]->x-mx] = tiles[i];
    }
 
-   assert(toplefttile);
-
-   /* copy/scale the srcimage onto the destination image */
-   tileresolution = toplefttile->grid_link->grid->levels[toplefttile->z]->resolution;
-   mapcache_grid_get_extent(ctx,toplefttile->grid_link->grid,
-         toplefttile->x, toplefttile->y, toplefttile->z, tilebbox);
+   /* position and scale of the mosaic on the destination image */
+   tileresolution = grid->levels[tiles[0]->z]->resolution;
+   mapcache_grid_get_extent(ctx, grid, mx, My, tiles[0]->z, tilebbox);
    
    /*compute the pixel position of top left corner*/
    dstminx = (tilebbox[0]-bbox[0])/hresolution;
@@ -291,16 +310,50 @@ mapcache_image* mapcache_tileset_assemble_map_tiles(mapcache_context *ctx, mapca
    vf = tileresolution/vresolution;
    if(fabs(hf-1)<0.0001 && fabs(vf-1)<0.0001) {
       //use nearest resampling if we are at the resolution of the tiles
-      mapcache_image_copy_resampled_nearest(ctx,srcimage,image,dstminx,dstminy,hf,vf);
-   } else {
-      switch(mode) {
-         case MAPCACHE_RESAMPLE_BILINEAR:
-            mapcache_image_copy_resampled_bilinear(ctx,srcimage,image,dstminx,dstminy,hf,vf);
-            break;
-         default:
-            mapcache_image_copy_resampled_nearest(ctx,srcimage,image,dstminx,dstminy,hf,vf);
-            break;
+      mode = MAPCACHE_RESAMPLE_NEAREST;
+   }
+
+   /*
+    * the tiles and rows of tiles the destination image is resampled from, with a
+    * one pixel margin for rounding and bilinear interpolation. tiles outside of
+    * these are not decoded, and rows past srcmaxy aren't either
+    */
+   col0 = (int)MAPCACHE_MAX(0, floor((floor(-dstminx/hf)-1)/tsx));
+   col1 = (int)MAPCACHE_MIN(ncols-1, floor((floor((width-dstminx)/hf)+1)/tsx));
+   row0 = (int)MAPCACHE_MAX(0, floor((floor(-dstminy/vf)-1)/tsy));
+   srcmaxy = MAPCACHE_MIN(nrows*tsy-1, floor((height-dstminy)/vf)+1);
+   row1 = (int)MAPCACHE_MIN(nrows-1, floor(srcmaxy/tsy));
+   if(col0 > col1 || row0 > row1) {
+      return image;
+   }
+
+   band = _mapcache_tileset_band_create(ctx, ncols*tsx, tsy+1);
+   if(mode == MAPCACHE_RESAMPLE_BILINEAR && row1 > row0) {
+      next = _mapcache_tileset_band_create(ctx, ncols*tsx, tsy+1);
+   }
+   decoded = -1; /* the row of tiles already decoded into next */
+   for(row=row0; row<=row1; row++) {
+      int bandrows = (int)MAPCACHE_MIN(tsy, srcmaxy - row*tsy + 1);
+      if(decoded == row) {
+         mapcache_image *tmp = band;
+         band = next;
+         next = tmp;
+      } else {
+         _mapcache_tileset_decode_band(ctx, &mosaic[row*ncols], col0, col1, tsx, bandrows, band);
+         if(GC_HAS_ERROR(ctx)) return NULL;
       }
+      band->h = tsy;
+      if(next && row < row1) {
+         /* bilinear interpolation of the last row of this band needs the first row of the next one */
+         int nextrows = (int)MAPCACHE_MIN(tsy, srcmaxy - (row+1)*tsy + 1);
+         _mapcache_tileset_decode_band(ctx, &mosaic[(row+1)*ncols], col0, col1, tsx, nextrows, next);
+         if(GC_HAS_ERROR(ctx)) return NULL;
+         decoded = row+1;
+         memcpy(&(band->data[tsy*band->stride + col0*tsx*4]), &(next->data[col0*tsx*4]), (col1-col0+1)*tsx*4);
+         band->h = tsy+1;
+      }
+      mapcache_image_copy_resampled_band(ctx, band, row*tsy, tsy, nrows*tsy, image,
+            dstminx, dstminy, hf, vf, mode);
    }
    return image;
 }
@@ -373,10 +426,58 @@ mapcache_metatile* mapcache_tileset_metatile_get(mapcache_context *ctx, mapcache
    return mt;
 }
 
+typedef struct {
+   mapcache_tile *tile;
+   mapcache_context *ctx;
+} _thread_encode_tile;
+
+static void _thread_encode_tile_func(void *data) {
+   _thread_encode_tile *t = (_thread_encode_tile*)data;
+   t->tile->encoded_data = t->tile->tileset->format->write(t->ctx, t->tile->raw_image, t->tile->tileset->format);
+}
+
+/*
+ * encode the tiles of a split metatile on the thread pool, so that the
+ * caches only have to store the already encoded buffers.
+ * the tiff cache compresses the raw image itself and is left alone.
+ */
+static void _mapcache_tileset_encode_metatile(mapcache_context *ctx, mapcache_metatile *mt) {
+   int i;
+   _thread_encode_tile *thread_tiles;
+   mapcache_task_group *group;
+   if(mt->ntiles < 2 || !mt->map.tileset->format || !ctx->clone ||
+         ctx->config->download_threads == 0) {
+      return;
+   }
+#ifdef USE_TIFF
+   if(mt->map.tileset->cache->type == MAPCACHE_CACHE_TIFF) {
+      return;
+   }
+#endif
+   thread_tiles = (_thread_encode_tile*)apr_pcalloc(ctx->pool, mt->ntiles * sizeof(_thread_encode_tile));
+   group = mapcache_task_group_create(ctx);
+   for(i=0;i<mt->ntiles;i++) {
+      thread_tiles[i].tile = &(mt->tiles[i]);
+      if(thread_tiles[i].tile->encoded_data || !thread_tiles[i].tile->raw_image) continue;
+      thread_tiles[i].ctx = ctx->clone(ctx);
+      mapcache_task_group_push(ctx, group, _thread_encode_tile_func, (void*)&(thread_tiles[i]));
+   }
+   mapcache_task_group_wait(ctx, group);
+   for(i=0;i<mt->ntiles;i++) {
+      if(thread_tiles[i].ctx && GC_HAS_ERROR(thread_tiles[i].ctx)) {
+         /* transfer error message from child thread to main context */
+         ctx->set_error(ctx,thread_tiles[i].ctx->get_error(thread_tiles[i].ctx),
+               thread_tiles[i].ctx->get_error_message(thread_tiles[i].ctx));
+         return;
+      }
+   }
+}
+
 /*
  * do the actual rendering and saving of a metatile:
  *  - query the datasource for the image data
  *  - split the resulting image along the metabuffer / metatiles
+ *  - encode the tiles in parallel
  *  - save each tile to cache
  */
 void _mapcache_tileset_render_metatile(mapcache_context *ctx, mapcache_metatile *mt) {
@@ -391,10 +492,16 @@ void _mapcache_tileset_render_metatile(mapcache_context *ctx, mapcache_metatile
    GC_CHECK_ERROR(ctx);
    mapcache_image_metatile_split(ctx, mt);
    GC_CHECK_ERROR(ctx);
-   for(i=0;i<mt->ntiles;i++) {
-      mapcache_tile *tile = &(mt->tiles[i]);
-      mt->map.tileset->cache->tile_set(ctx, tile);
-      GC_CHECK_ERROR(ctx);
+   _mapcache_tileset_encode_metatile(ctx, mt);
+   GC_CHECK_ERROR(ctx);
+   if(mt->map.tileset->cache->tile_multi_set) {
+      mt->map.tileset->cache->tile_multi_set(ctx, mt->tiles, mt->ntiles);
+   } else {
+      for(i=0;i<mt->ntiles;i++) {
+         mapcache_tile *tile = &(mt->tiles[i]);
+         mt->map.tileset->cache->tile_set(ctx, tile);
+         GC_CHECK_ERROR(ctx);
+      }
    }
 }
 
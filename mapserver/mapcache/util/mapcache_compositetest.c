@@ -0,0 +1,193 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache test of the composite cache tier policies
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+** Runs a composite cache over four fake in memory backends, one per write
+** policy ("all", "rendered", "promoted", "none"), and checks which tiers are
+** read, written and deleted from. The "none" tier fails on delete like the
+** tiff cache does, and a failing read on a tier must not fail the request.
+**
+** usage: mapcache_compositetest
+** exits with a non zero status if a check fails.
+*/
+
+#include "mapcache.h"
+#include <apr_general.h>
+
+#define TEST_NTILES 8
+
+typedef struct {
+   mapcache_cache cache;
+   int stored[TEST_NTILES];
+   int nset, ndelete;
+   int fail_get, fail_delete;
+} test_cache;
+
+static int failures = 0;
+
+#define TEST_CHECK(cond,msg) do { \
+   if(!(cond)) { printf("FAILED: %s\n",msg); failures++; } \
+   else { printf("ok: %s\n",msg); } \
+} while(0)
+
+static int _test_cache_get(mapcache_context *ctx, mapcache_tile *tile) {
+   test_cache *cache = (test_cache*)tile->tileset->cache;
+   if(cache->fail_get) {
+      ctx->set_error(ctx, 500, "%s: read failure", cache->cache.name);
+      return MAPCACHE_FAILURE;
+   }
+   if(!cache->stored[tile->x]) {
+      return MAPCACHE_CACHE_MISS;
+   }
+   tile->encoded_data = mapcache_buffer_create(1,ctx->pool);
+   return MAPCACHE_SUCCESS;
+}
+
+static int _test_cache_exists(mapcache_context *ctx, mapcache_tile *tile) {
+   test_cache *cache = (test_cache*)tile->tileset->cache;
+   return cache->stored[tile->x] ? MAPCACHE_TRUE : MAPCACHE_FALSE;
+}
+
+static void _test_cache_set(mapcache_context *ctx, mapcache_tile *tile) {
+   test_cache *cache = (test_cache*)tile->tileset->cache;
+   cache->stored[tile->x] = 1;
+   cache->nset++;
+}
+
+static void _test_cache_delete(mapcache_context *ctx, mapcache_tile *tile) {
+   test_cache *cache = (test_cache*)tile->tileset->cache;
+   cache->ndelete++;
+   if(cache->fail_delete) {
+      ctx->set_error(ctx, 500, "%s: tile deleting not implemented", cache->cache.name);
+      return;
+   }
+   cache->stored[tile->x] = 0;
+}
+
+static test_cache* test_cache_create(mapcache_context *ctx, mapcache_composite_write_policy write,
+      mapcache_cache_composite *composite) {
+   test_cache *cache = apr_pcalloc(ctx->pool,sizeof(test_cache));
+   mapcache_cache_composite_tier *tier = apr_pcalloc(ctx->pool,sizeof(mapcache_cache_composite_tier));
+   cache->cache.name = apr_psprintf(ctx->pool,"tier%d",composite->tiers->nelts);
+   cache->cache.tile_get = _test_cache_get;
+   cache->cache.tile_exists = _test_cache_exists;
+   cache->cache.tile_set = _test_cache_set;
+   cache->cache.tile_delete = _test_cache_delete;
+   tier->cache = (mapcache_cache*)cache;
+   tier->write = write;
+   APR_ARRAY_PUSH(composite->tiers,mapcache_cache_composite_tier*) = tier;
+   return cache;
+}
+
+static void test_log(mapcache_context *ctx, mapcache_log_level level, char *message, ...) {
+   va_list args;
+   va_start(args,message);
+   printf("   log: ");
+   vprintf(message,args);
+   printf("\n");
+   va_end(args);
+}
+
+int main(int argc, const char **argv) {
+   mapcache_context ctx;
+   apr_pool_t *pool;
+   mapcache_cache_composite *composite;
+   test_cache *all, *rendered, *promoted, *none;
+   mapcache_tileset tileset;
+   mapcache_tile tile;
+   int ret;
+
+   apr_initialize();
+   apr_pool_create(&pool,NULL);
+   memset(&ctx,0,sizeof(ctx));
+   ctx.pool = pool;
+   mapcache_context_init(&ctx);
+   ctx.log = test_log;
+
+   composite = (mapcache_cache_composite*)mapcache_cache_composite_create(&ctx);
+   composite->cache.name = "composite";
+   all = test_cache_create(&ctx,MAPCACHE_COMPOSITE_WRITE_ALL,composite);
+   rendered = test_cache_create(&ctx,MAPCACHE_COMPOSITE_WRITE_RENDERED,composite);
+   promoted = test_cache_create(&ctx,MAPCACHE_COMPOSITE_WRITE_PROMOTED,composite);
+   none = test_cache_create(&ctx,MAPCACHE_COMPOSITE_WRITE_NONE,composite);
+   none->fail_delete = 1;
+
+   memset(&tileset,0,sizeof(tileset));
+   tileset.name = "test";
+   tileset.cache = (mapcache_cache*)composite;
+   memset(&tile,0,sizeof(tile));
+   tile.tileset = &tileset;
+
+   /* a rendered tile goes to the "all" and "rendered" tiers */
+   tile.x = 1;
+   composite->cache.tile_set(&ctx,&tile);
+   TEST_CHECK(!GC_HAS_ERROR(&ctx),"set: no error");
+   TEST_CHECK(all->stored[1] && rendered->stored[1],"set: written to the all and rendered tiers");
+   TEST_CHECK(!promoted->stored[1] && !none->nset,"set: not written to the promoted and none tiers");
+
+   /* a tile only found in the last tier is promoted to the "all" and "promoted" tiers */
+   tile.x = 2;
+   none->stored[2] = 1;
+   ret = composite->cache.tile_get(&ctx,&tile);
+   TEST_CHECK(ret == MAPCACHE_SUCCESS && !GC_HAS_ERROR(&ctx),"get: found in the none tier");
+   TEST_CHECK(all->stored[2] && promoted->stored[2],"get: promoted to the all and promoted tiers");
+   TEST_CHECK(!rendered->stored[2],"get: not promoted to the rendered tier");
+   TEST_CHECK(composite->cache.tile_exists(&ctx,&tile) == MAPCACHE_TRUE,"exists: promoted tile");
+
+   /* a failing tier is skipped */
+   tile.x = 3;
+   rendered->stored[3] = 1;
+   all->fail_get = 1;
+   ret = composite->cache.tile_get(&ctx,&tile);
+   all->fail_get = 0;
+   TEST_CHECK(ret == MAPCACHE_SUCCESS && !GC_HAS_ERROR(&ctx),"get: read error on a tier is not fatal");
+
+   /* deleting leaves the read only tier alone, even if it does not support deleting */
+   tile.x = 2;
+   composite->cache.tile_delete(&ctx,&tile);
+   TEST_CHECK(!GC_HAS_ERROR(&ctx),"delete: no error with a read only tier failing on delete");
+   TEST_CHECK(!all->stored[2] && !promoted->stored[2],"delete: removed from the writable tiers");
+   TEST_CHECK(rendered->ndelete == 1,"delete: called on the rendered tier");
+   TEST_CHECK(none->ndelete == 0 && none->stored[2],"delete: not called on the none tier");
+   ctx.clear_errors(&ctx);
+
+   /* a delete failure on a writable tier is still reported */
+   tile.x = 1;
+   rendered->fail_delete = 1;
+   composite->cache.tile_delete(&ctx,&tile);
+   TEST_CHECK(GC_HAS_ERROR(&ctx),"delete: error on a writable tier is reported");
+   ctx.clear_errors(&ctx);
+
+   apr_pool_destroy(pool);
+   apr_terminate();
+   printf("%d failure(s)\n",failures);
+   return failures ? 1 : 0;
+}
+/* vim: ai ts=3 sts=3 et sw=3
+*/
@@ -0,0 +1,136 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache benchmark of the image compositing and resampling routines
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+** Times mapcache_image_merge() on 256 pixel tiles (watermarking) and on
+** 1024 pixel maps (overlaying the layers of a WMS request), and the nearest
+** and bilinear resamplings of a mosaic of 256 pixel tiles onto a 1024 pixel
+** map as done when assembling WMS GetMap responses from tiles.
+**
+** usage: mapcache_imagebench [-n iterations]
+*/
+
+#include "mapcache.h"
+#include <apr_general.h>
+
+static mapcache_image* bench_image(mapcache_context *ctx, int w, int h, int transparency) {
+   mapcache_image *img = mapcache_image_create(ctx);
+   int i;
+   img->w = w;
+   img->h = h;
+   img->stride = w*4;
+   img->data = apr_palloc(ctx->pool,img->stride*h);
+   for(i=0;i<w*h;i++) {
+      unsigned char *p = &img->data[i*4];
+      int a = 255;
+      if(transparency) {
+         /* a mix of transparent, opaque and translucent pixels, as in an overlay layer */
+         switch((i/7)%4) {
+            case 0: a = 0; break;
+            case 1: a = 255; break;
+            default: a = rand()%256; break;
+         }
+      }
+      p[3] = a;
+      p[0] = rand()%(a+1); /* premultiplied */
+      p[1] = rand()%(a+1);
+      p[2] = rand()%(a+1);
+   }
+   return img;
+}
+
+static double elapsed(struct mctimeval *start) {
+   struct mctimeval now;
+   mapcache_gettimeofday(&now,NULL);
+   return (now.tv_sec-start->tv_sec) + (now.tv_usec-start->tv_usec)/1000000.0;
+}
+
+static void report(const char *name, double duration, int iterations, int w, int h) {
+   printf("%-36s %8.3f ms/op %10.1f Mpix/s\n", name, duration*1000/iterations,
+         (double)w*h*iterations/duration/1000000);
+}
+
+int main(int argc, const char **argv) {
+   mapcache_context ctx;
+   mapcache_image *tile, *watermark, *map, *overlay, *mosaic;
+   struct mctimeval start;
+   int iterations = 200, i;
+
+   for(i=1; i<argc; i++) {
+      if(!strcmp(argv[i],"-n") && i+1<argc) {
+         iterations = atoi(argv[++i]);
+      } else {
+         fprintf(stderr,"usage: %s [-n iterations]\n",argv[0]);
+         return 1;
+      }
+   }
+
+   apr_initialize();
+   apr_pool_create(&ctx.pool,NULL);
+   mapcache_context_init(&ctx);
+   srand(1);
+
+   tile = bench_image(&ctx,256,256,0);
+   watermark = bench_image(&ctx,256,256,1);
+   map = bench_image(&ctx,1024,1024,0);
+   overlay = bench_image(&ctx,1024,1024,1);
+   /* 5x5 tiles covering a 1024 pixel map at native resolution */
+   mosaic = bench_image(&ctx,1280,1280,0);
+
+   mapcache_gettimeofday(&start,NULL);
+   for(i=0;i<iterations*16;i++)
+      mapcache_image_merge(&ctx,tile,watermark);
+   report("merge 256x256 tile",elapsed(&start),iterations*16,256,256);
+
+   mapcache_gettimeofday(&start,NULL);
+   for(i=0;i<iterations;i++)
+      mapcache_image_merge(&ctx,map,overlay);
+   report("merge 1024x1024 map",elapsed(&start),iterations,1024,1024);
+
+   mapcache_gettimeofday(&start,NULL);
+   for(i=0;i<iterations;i++)
+      mapcache_image_copy_resampled_nearest(&ctx,mosaic,map,-117,-45,1.0,1.0);
+   report("nearest 1024x1024, native res",elapsed(&start),iterations,1024,1024);
+
+   mapcache_gettimeofday(&start,NULL);
+   for(i=0;i<iterations;i++)
+      mapcache_image_copy_resampled_nearest(&ctx,mosaic,map,-117.3,-45.8,0.83,0.83);
+   report("nearest 1024x1024, scaled",elapsed(&start),iterations,1024,1024);
+
+   mapcache_gettimeofday(&start,NULL);
+   for(i=0;i<iterations;i++)
+      mapcache_image_copy_resampled_bilinear(&ctx,mosaic,map,-117.3,-45.8,0.83,0.83);
+   report("bilinear 1024x1024, scaled",elapsed(&start),iterations,1024,1024);
+
+   apr_pool_destroy(ctx.pool);
+   apr_terminate();
+   return 0;
+}
+/* vim: ai ts=3 sts=3 et sw=3
+*/
@@ -0,0 +1,204 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  MapCache benchmark of the PNG encoding profiles
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2011 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+** Encodes 256 pixel tiles with each of the PNG format profiles (compression,
+** filter, zlib strategy, quantization with or without a fixed palette) and
+** reports the size and the encoding time of a tile. Two kinds of tiles are
+** used: a rendered map with flat areas and lines, and a smooth noisy image
+** resembling aerial imagery.
+**
+** usage: mapcache_pngbench [-n iterations] [-p palette.txt]
+*/
+
+#include "mapcache.h"
+#include <apr_general.h>
+
+typedef struct {
+   const char *name;
+   mapcache_compression_type compression;
+   mapcache_png_filter filter;
+   mapcache_png_strategy strategy;
+   int ncolors; /* 0 for RGBA output */
+   int fixed_palette;
+} bench_profile;
+
+static bench_profile profiles[] = {
+   {"default",                 MAPCACHE_COMPRESSION_DEFAULT, MAPCACHE_PNG_FILTER_NONE,     MAPCACHE_PNG_STRATEGY_DEFAULT, 0, 0},
+   {"default, adaptive filter",MAPCACHE_COMPRESSION_DEFAULT, MAPCACHE_PNG_FILTER_ADAPTIVE, MAPCACHE_PNG_STRATEGY_DEFAULT, 0, 0},
+   {"best",                    MAPCACHE_COMPRESSION_BEST,    MAPCACHE_PNG_FILTER_NONE,     MAPCACHE_PNG_STRATEGY_DEFAULT, 0, 0},
+   {"fast",                    MAPCACHE_COMPRESSION_FAST,    MAPCACHE_PNG_FILTER_NONE,     MAPCACHE_PNG_STRATEGY_DEFAULT, 0, 0},
+   {"fast, rle",               MAPCACHE_COMPRESSION_FAST,    MAPCACHE_PNG_FILTER_NONE,     MAPCACHE_PNG_STRATEGY_RLE,     0, 0},
+   {"fast, sub filter, rle",   MAPCACHE_COMPRESSION_FAST,    MAPCACHE_PNG_FILTER_SUB,      MAPCACHE_PNG_STRATEGY_RLE,     0, 0},
+   {"fast, up filter, filtered",MAPCACHE_COMPRESSION_FAST,   MAPCACHE_PNG_FILTER_UP,       MAPCACHE_PNG_STRATEGY_FILTERED,0, 0},
+   {"fast, huffman",           MAPCACHE_COMPRESSION_FAST,    MAPCACHE_PNG_FILTER_NONE,     MAPCACHE_PNG_STRATEGY_HUFFMAN, 0, 0},
+   {"none",                    MAPCACHE_COMPRESSION_NONE,    MAPCACHE_PNG_FILTER_NONE,     MAPCACHE_PNG_STRATEGY_DEFAULT, 0, 0},
+   {"png8 fast, fixed palette",MAPCACHE_COMPRESSION_FAST,    MAPCACHE_PNG_FILTER_NONE,     MAPCACHE_PNG_STRATEGY_DEFAULT, 256, 1},
+   {"png8 rle, fixed palette", MAPCACHE_COMPRESSION_FAST,    MAPCACHE_PNG_FILTER_NONE,     MAPCACHE_PNG_STRATEGY_RLE,     256, 1},
+   /* last, as quantizing may reduce the depth of the tile pixels in place */
+   {"png8 fast",               MAPCACHE_COMPRESSION_FAST,    MAPCACHE_PNG_FILTER_NONE,     MAPCACHE_PNG_STRATEGY_DEFAULT, 256, 0},
+   {NULL}
+};
+
+static mapcache_image* bench_tile(mapcache_context *ctx, int aerial) {
+   mapcache_image *img = mapcache_image_create(ctx);
+   int x,y;
+   img->w = img->h = 256;
+   img->stride = img->w*4;
+   img->data = apr_palloc(ctx->pool,img->stride*img->h);
+   for(y=0;y<img->h;y++) {
+      unsigned char *p = &img->data[y*img->stride];
+      for(x=0;x<img->w;x++,p+=4) {
+         if(aerial) {
+            int n = rand()%24;
+            p[0] = 60 + (x+y)/8 + n;
+            p[1] = 90 + y/4 + n;
+            p[2] = 70 + x/5 + n;
+         } else {
+            /* blocks of flat color crossed by roads */
+            int block = ((x/48)*7 + (y/40)*3)%4;
+            static const unsigned char fills[4][3] = {{242,239,233},{200,230,200},{170,211,223},{224,224,224}};
+            p[0] = fills[block][2];
+            p[1] = fills[block][1];
+            p[2] = fills[block][0];
+            if((x+2*y)%97 < 4 || (3*x-y+400)%131 < 3) {
+               p[0] = 90; p[1] = 160; p[2] = 250;
+            }
+         }
+         p[3] = 255;
+      }
+   }
+   return img;
+}
+
+/* a 6x6x6 color cube plus a ramp of grays */
+static unsigned char* bench_palette(mapcache_context *ctx, int *ncolors) {
+   unsigned int *palette = apr_palloc(ctx->pool,256*sizeof(unsigned int));
+   int r,g,b,i,n=0;
+   for(r=0;r<6;r++)
+      for(g=0;g<6;g++)
+         for(b=0;b<6;b++)
+            palette[n++] = 0xff000000 | ((r*51)<<16) | ((g*51)<<8) | (b*51);
+   for(i=0;i<40;i++) {
+      int v = 6 + i*6;
+      palette[n++] = 0xff000000 | (v<<16) | (v<<8) | v;
+   }
+   *ncolors = n;
+   return (unsigned char*)palette;
+}
+
+static double elapsed(struct mctimeval *start) {
+   struct mctimeval now;
+   mapcache_gettimeofday(&now,NULL);
+   return (now.tv_sec-start->tv_sec) + (now.tv_usec-start->tv_usec)/1000000.0;
+}
+
+int main(int argc, const char **argv) {
+   mapcache_context ctx;
+   apr_pool_t *pool, *tmp_pool;
+   mapcache_image *tiles[2];
+   const char *kinds[2] = {"map","aerial"};
+   const char *palette_file = NULL;
+   unsigned char *palette;
+   int npalette;
+   int iterations = 200, i, k;
+   bench_profile *profile;
+
+   for(i=1; i<argc; i++) {
+      if(!strcmp(argv[i],"-n") && i+1<argc) {
+         iterations = atoi(argv[++i]);
+      } else if(!strcmp(argv[i],"-p") && i+1<argc) {
+         palette_file = argv[++i];
+      } else {
+         fprintf(stderr,"usage: %s [-n iterations] [-p palette.txt]\n",argv[0]);
+         return 1;
+      }
+   }
+
+   apr_initialize();
+   apr_pool_create(&pool,NULL);
+   ctx.pool = pool;
+   mapcache_context_init(&ctx);
+   srand(1);
+
+   tiles[0] = bench_tile(&ctx,0);
+   tiles[1] = bench_tile(&ctx,1);
+   palette = bench_palette(&ctx,&npalette);
+   apr_pool_create(&tmp_pool,pool);
+
+   printf("%-28s %-7s %10s %12s\n","profile","tile","bytes","us/tile");
+   for(profile=profiles; profile->name; profile++) {
+      mapcache_image_format *format;
+      if(profile->ncolors) {
+         format = mapcache_imageio_create_png_q_format(pool,"bench",profile->compression,profile->ncolors);
+         if(profile->fixed_palette) {
+            if(palette_file) {
+               mapcache_imageio_png_q_load_palette(&ctx,format,palette_file);
+               if(GC_HAS_ERROR(&ctx)) {
+                  fprintf(stderr,"%s\n",ctx.get_error_message(&ctx));
+                  return 1;
+               }
+            } else {
+               ((mapcache_image_format_png_q*)format)->palette = palette;
+               ((mapcache_image_format_png_q*)format)->ncolors = npalette;
+            }
+         }
+      } else {
+         format = mapcache_imageio_create_png_format(pool,"bench",profile->compression);
+      }
+      ((mapcache_image_format_png*)format)->filter = profile->filter;
+      ((mapcache_image_format_png*)format)->strategy = profile->strategy;
+
+      for(k=0;k<2;k++) {
+         struct mctimeval start;
+         size_t size = 0;
+         mapcache_gettimeofday(&start,NULL);
+         for(i=0;i<iterations;i++) {
+            mapcache_buffer *buf;
+            ctx.pool = tmp_pool;
+            buf = format->write(&ctx,tiles[k],format);
+            if(!buf) {
+               fprintf(stderr,"%s: failed to encode tile\n",profile->name);
+               return 1;
+            }
+            size = buf->size;
+            apr_pool_clear(tmp_pool);
+         }
+         printf("%-28s %-7s %10lu %12.1f\n",profile->name,kinds[k],(unsigned long)size,
+               elapsed(&start)*1000000/iterations);
+      }
+      ctx.pool = pool;
+   }
+
+   apr_pool_destroy(pool);
+   apr_terminate();
+   return 0;
+}
+/* vim: ai ts=3 sts=3 et sw=3
+*/
@@ -67,6 +67,18 @@ int verbose = 0;
 int sig_int_received = 0;
 int error_detected = 0;
 apr_queue_t *work_queue;
+apr_thread_mutex_t *seed_mutex;
+
+/* partitioned seeding: this process only seeds the chunks for which chunk%nprocesses == procid */
+int nprocesses = 1;
+int procid = 0;
+
+/* completed chunks are appended to the journal, and skipped when seeding is resumed */
+apr_file_t *journal = NULL;
+apr_hash_t *journal_chunks = NULL;
+
+/* a chunk is a block of SEED_CHUNK_SIZE x SEED_CHUNK_SIZE metatiles of a given zoom level */
+#define SEED_CHUNK_SIZE 16
 
 apr_time_t age_limit = 0;
 int seededtilestot=0, seededtiles=0, queuedtilestot=0;
@@ -77,7 +89,8 @@ typedef enum {
    MAPCACHE_CMD_STOP,
    MAPCACHE_CMD_DELETE,
    MAPCACHE_CMD_SKIP,
-   MAPCACHE_CMD_TRANSFER
+   MAPCACHE_CMD_TRANSFER,
+   MAPCACHE_CMD_EXAMINE
 } cmd;
 
 typedef enum {
@@ -87,11 +100,36 @@ typedef enum {
 
 mapcache_seed_mode seed_mode = MAPCACHE_SEED_DEPTH_FIRST;
 
+/*
+ * order in which the metatiles of a level are walked. the space filling curves
+ * keep successive metatiles next to each other, so that the source keeps reading
+ * the same data
+ */
+typedef enum {
+   MAPCACHE_SEED_ORDER_ROW,
+   MAPCACHE_SEED_ORDER_MORTON,
+   MAPCACHE_SEED_ORDER_HILBERT
+} mapcache_seed_order;
+
+mapcache_seed_order seed_order = MAPCACHE_SEED_ORDER_ROW;
+
+/* called for each cell of a walk, returns 0 to stop the walk */
+typedef int (*seed_visit_func)(int x, int y, void *data);
+
+struct seed_chunk {
+   int x; /* chunk index, i.e. metatile index / SEED_CHUNK_SIZE */
+   int y;
+   int z;
+   int pending; /* commands still referencing the chunk, plus one for the producer */
+   int failed;
+};
+
 struct seed_cmd {
    cmd command;
    int x;
    int y;
    int z;
+   struct seed_chunk *chunk;
 };
 
 int depthfirst = 1;
@@ -110,6 +148,9 @@ static const apr_getopt_option_t seed_options[] = {
     { "older", 'o', TRUE, "reseed tiles older than supplied date (format: year/month/day hour:minute, eg: 2011/01/31 20:45" },
     { "dimension", 'D', TRUE, "set the value of a dimension (format DIMENSIONNAME=VALUE). Can be used multiple times for multiple dimensions" },
     { "transfer", 'x', TRUE, "tileset to transfer" },    
+    { "nprocesses", 'p', TRUE, "number of processes to fork, each one seeding its share of the tile chunks" },
+    { "journal", 'j', TRUE, "file recording the completed chunks, used to resume an interrupted seeding" },
+    { "order", 'O', TRUE, "order in which the metatiles of a level are seeded: row (default), morton or hilbert" },
 #ifdef USE_CLIPPERS
     { "ogr-datasource", 'd', TRUE, "ogr datasource to get features from"},
     { "ogr-layer", 'l', TRUE, "layer inside datasource"},
@@ -151,11 +192,22 @@ void mapcache_context_seeding_log(mapcache_context *ctx, mapcache_log_level leve
     printf("\n");
 }
 
+/* used to hand a private context to the tasks run on the thread pool, e.g. for metatile encoding */
+static mapcache_context* seed_context_clone(mapcache_context *ctx) {
+   mapcache_context *nctx = (mapcache_context*)apr_pcalloc(ctx->pool, sizeof(mapcache_context));
+   mapcache_context_copy(ctx,nctx);
+   apr_pool_create(&nctx->pool,ctx->pool);
+   return nctx;
+}
+
 #ifdef USE_CLIPPERS
 int ogr_features_intersect_tile(mapcache_context *ctx, mapcache_tile *tile) {
    mapcache_metatile *mt = mapcache_tileset_metatile_get(ctx,tile);
-   GEOSCoordSequence *mtbboxls = GEOSCoordSeq_create(5,2);
+   GEOSCoordSequence *mtbboxls;
    double *e = mt->map.extent;
+   /* the tiles are examined by the seeding threads, and the GEOS global context isn't thread safe */
+   apr_thread_mutex_lock(seed_mutex);
+   mtbboxls = GEOSCoordSeq_create(5,2);
    GEOSCoordSeq_setX(mtbboxls,0,e[0]);
    GEOSCoordSeq_setY(mtbboxls,0,e[1]);
    GEOSCoordSeq_setX(mtbboxls,1,e[2]);
@@ -178,58 +230,37 @@ int ogr_features_intersect_tile(mapcache_context *ctx, mapcache_tile *tile) {
       }
    }
    GEOSGeom_destroy(mtbboxg);
+   apr_thread_mutex_unlock(seed_mutex);
    return intersects;
 }
 
 #endif
 
 int lastmsglen = 0;
+/*
+ * called with seed_mutex held. the rate is refreshed every 5 seconds from
+ * the count of seeded metatiles. the position within the level is not
+ * reported, as the chunked, depth first and curve orders don't walk it
+ * row by row.
+ */
 void progresslog(int x, int y, int z) {
+   static char rate[256] = "";
    char msg[1024];
+   struct mctimeval now_t;
+   float duration;
    if(quiet) return;
-  
-   
-   sprintf(msg,"seeding tile %d %d %d",x,y,z);
-   if(lastmsglen) {
-      char erasestring[1024];
-      int len = MAPCACHE_MIN(1023,lastmsglen);
-      memset(erasestring,' ',len);
-      erasestring[len+1]='\0';
-      sprintf(erasestring,"\r%%%ds\r",lastmsglen);
-      printf(erasestring," ");
-   }
-   lastmsglen = strlen(msg);
-   printf("%s",msg);
-   fflush(NULL);
-   return;
-
-   if(queuedtilestot>nthreads) {
-      struct mctimeval now_t;
-      float duration;
-      float totalduration;
-      seededtilestot = queuedtilestot - nthreads;
-
-      mapcache_gettimeofday(&now_t,NULL);
-      duration = ((now_t.tv_sec-lastlogtime.tv_sec)*1000000+(now_t.tv_usec-lastlogtime.tv_usec))/1000000.0;
-      totalduration = ((now_t.tv_sec-starttime.tv_sec)*1000000+(now_t.tv_usec-starttime.tv_usec))/1000000.0;
-      if(duration>=5) {
-	int Nx, Ny, Ntot, Ncur, ntilessincelast;
-         Nx = (grid_link->grid_limits[z][2]-grid_link->grid_limits[z][0])/tileset->metasize_x;
-         Ny = (grid_link->grid_limits[z][3]-grid_link->grid_limits[z][1])/tileset->metasize_y;
-         Ntot = Nx*Ny;
-         Ncur = (y-grid_link->grid_limits[z][1])/tileset->metasize_y*Nx+(x-grid_link->grid_limits[z][0]+1)/tileset->metasize_x;
-         ntilessincelast = seededtilestot-seededtiles;
-         sprintf(msg,"seeding level %d [%d/%d]: %f metatiles/sec (avg since start: %f)",z,Ncur,Ntot,ntilessincelast/duration,
-               seededtilestot/totalduration);
-         lastlogtime=now_t;
-         seededtiles=seededtilestot;
-      } else {
-         return;
-      }
-   } else {
-      sprintf(msg,"seeding level %d",z);
-   
+
+   mapcache_gettimeofday(&now_t,NULL);
+   duration = ((now_t.tv_sec-lastlogtime.tv_sec)*1000000+(now_t.tv_usec-lastlogtime.tv_usec))/1000000.0;
+   if(duration>=5) {
+      float totalduration = ((now_t.tv_sec-starttime.tv_sec)*1000000+(now_t.tv_usec-starttime.tv_usec))/1000000.0;
+      sprintf(rate,": %f metatiles/sec (avg since start: %f)",(seededtilestot-seededtiles)/duration,
+            seededtilestot/totalduration);
+      lastlogtime=now_t;
+      seededtiles=seededtilestot;
    }
+
+   sprintf(msg,"seeding tile %d %d %d%s",x,y,z,rate);
    if(lastmsglen) {
       char erasestring[1024];
       int len = MAPCACHE_MIN(1023,lastmsglen);
@@ -332,8 +363,142 @@ cmd examine_tile(mapcache_context *ctx, mapcache_tile *tile)
    return action;
 }
 
+static void chunk_release(struct seed_chunk *chunk) {
+   if(!chunk) return;
+   apr_thread_mutex_lock(seed_mutex);
+   if(--chunk->pending == 0) {
+      if(journal && !chunk->failed && !sig_int_received && !error_detected) {
+         char line[64];
+         apr_size_t len;
+         /* a single write on a file opened in append mode, so concurrent processes don't mix their lines */
+         len = snprintf(line,sizeof(line),"%d %d %d\n",chunk->z,chunk->x,chunk->y);
+         apr_file_write(journal,line,&len);
+      }
+      free(chunk);
+   }
+   apr_thread_mutex_unlock(seed_mutex);
+}
+
+static void push_examine(mapcache_tile *tile, struct seed_chunk *chunk) {
+   struct seed_cmd *cmd = malloc(sizeof(struct seed_cmd));
+   cmd->x = tile->x;
+   cmd->y = tile->y;
+   cmd->z = tile->z;
+   cmd->command = MAPCACHE_CMD_EXAMINE;
+   cmd->chunk = chunk;
+   if(chunk) {
+      apr_thread_mutex_lock(seed_mutex);
+      chunk->pending++;
+      apr_thread_mutex_unlock(seed_mutex);
+   }
+   apr_queue_push(work_queue,cmd);
+}
+
+/* remove all items from the queue, when we were asked to stop by hitting ctrl-c or on error */
+static void drain_queue() {
+   void *entry;
+   while (apr_queue_trypop(work_queue,&entry)!=APR_EAGAIN) {
+      struct seed_cmd *cmd = (struct seed_cmd*)entry;
+      chunk_release(cmd->chunk);
+      free(cmd);
+   }
+}
+
+/* position of the d-th cell of the curve on a n x n grid, n being a power of two */
+static void curve_d2xy(int n, apr_uint64_t d, int *x, int *y) {
+   int s;
+   *x = *y = 0;
+   if(seed_order == MAPCACHE_SEED_ORDER_MORTON) {
+      for(s=0; (1<<s)<n; s++) {
+         *x |= (int)((d >> (2*s)) & 1) << s;
+         *y |= (int)((d >> (2*s+1)) & 1) << s;
+      }
+      return;
+   }
+   for(s=1; s<n; s*=2) {
+      int rx = (int)(1 & (d/2));
+      int ry = (int)(1 & (d ^ rx));
+      if(ry == 0) {
+         int t;
+         if(rx == 1) {
+            *x = s-1 - *x;
+            *y = s-1 - *y;
+         }
+         t = *x; *x = *y; *y = t;
+      }
+      *x += s * rx;
+      *y += s * ry;
+      d /= 4;
+   }
+}
+
+/*
+ * visit the cells of the curve numbered [d,d+size*size[, which cover an aligned
+ * size x size square, skipping the squares that fall outside of the requested cells
+ */
+static int curve_walk(int n, apr_uint64_t d, int size, int *limits, seed_visit_func visit, void *data) {
+   int x,y,i;
+   apr_uint64_t quarter;
+   curve_d2xy(n,d,&x,&y);
+   x -= x % size;
+   y -= y % size;
+   if(x > limits[2] || x+size-1 < limits[0] || y > limits[3] || y+size-1 < limits[1]) {
+      return 1;
+   }
+   if(size == 1) {
+      return visit(x,y,data);
+   }
+   quarter = (apr_uint64_t)(size/2) * (size/2);
+   for(i=0; i<4; i++) {
+      if(!curve_walk(n, d + i*quarter, size/2, limits, visit, data)) return 0;
+   }
+   return 1;
+}
+
+/*
+ * visit the cells minx..maxx,miny..maxy (inclusive) in the configured seeding order.
+ * sizex and sizey are the dimensions of the whole level, so that the curve is the same
+ * whatever part of the level is being walked
+ */
+static int seed_walk(int sizex, int sizey, int minx, int miny, int maxx, int maxy,
+      seed_visit_func visit, void *data) {
+   int x,y,n=1;
+   int limits[4];
+   if(seed_order == MAPCACHE_SEED_ORDER_ROW) {
+      for(y=miny; y<=maxy; y++) {
+         for(x=minx; x<=maxx; x++) {
+            if(!visit(x,y,data)) return 0;
+         }
+      }
+      return 1;
+   }
+   while(n < sizex || n < sizey || n <= maxx || n <= maxy) n *= 2;
+   limits[0] = minx; limits[1] = miny;
+   limits[2] = maxx; limits[3] = maxy;
+   return curve_walk(n, 0, n, limits, visit, data);
+}
+
+struct seed_recurse_data {
+   mapcache_context *cmd_ctx;
+   mapcache_tile *tile;
+};
+
+void cmd_recurse(mapcache_context *cmd_ctx, mapcache_tile *tile);
+
+static int visit_recurse(int mx, int my, void *data) {
+   struct seed_recurse_data *rd = (struct seed_recurse_data*)data;
+   rd->tile->x = mx * tileset->metasize_x;
+   rd->tile->y = my * tileset->metasize_y;
+   cmd_recurse(rd->cmd_ctx, rd->tile);
+   return !(sig_int_received || error_detected);
+}
+
+/* number of metatiles along x and y for a level of the grid */
+#define LEVEL_METATILES_X(z) ((grid_link->grid->levels[z]->maxx + tileset->metasize_x - 1) / tileset->metasize_x)
+#define LEVEL_METATILES_Y(z) ((grid_link->grid->levels[z]->maxy + tileset->metasize_y - 1) / tileset->metasize_y)
+
 void cmd_recurse(mapcache_context *cmd_ctx, mapcache_tile *tile) {
-  cmd action;
+  struct seed_recurse_data rd;
   int curx, cury, curz;
   int minchildx,maxchildx,minchildy,maxchildy;
   double bboxbl[4],bboxtr[4];
@@ -341,25 +506,12 @@ void cmd_recurse(mapcache_context *cmd_ctx, mapcache_tile *tile) {
 
    apr_pool_clear(cmd_ctx->pool);
    if(sig_int_received || error_detected) { //stop if we were asked to stop by hitting ctrl-c
-      //remove all items from the queue
-      void *entry;
-      while (apr_queue_trypop(work_queue,&entry)!=APR_EAGAIN) {queuedtilestot--;}
+      drain_queue();
       return;
    }
 
-   action = examine_tile(cmd_ctx, tile);
-
-   if(action == MAPCACHE_CMD_SEED || action == MAPCACHE_CMD_DELETE || action == MAPCACHE_CMD_TRANSFER){
-      //current x,y,z needs seeding, add it to the queue
-      struct seed_cmd *cmd = malloc(sizeof(struct seed_cmd));
-      cmd->x = tile->x;
-      cmd->y = tile->y;
-      cmd->z = tile->z;
-      cmd->command = action;
-      apr_queue_push(work_queue,cmd);
-      queuedtilestot++;
-      progresslog(tile->x,tile->y,tile->z);
-   }
+   /* the seeding threads check whether the tile must be seeded */
+   push_examine(tile,NULL);
 
    //recurse into our 4 child metatiles
    
@@ -397,14 +549,18 @@ void cmd_recurse(mapcache_context *cmd_ctx, mapcache_tile *tile) {
    maxchildx = (maxchildx / tileset->metasize_x + 1)*tileset->metasize_x;
    maxchildy = (maxchildy / tileset->metasize_y + 1)*tileset->metasize_y;
 
-   for(tile->x = minchildx; tile->x < maxchildx; tile->x +=  tileset->metasize_x) {
-      if(tile->x >= grid_link->grid_limits[tile->z][0] && tile->x < grid_link->grid_limits[tile->z][2]) {
-         for(tile->y = minchildy; tile->y < maxchildy; tile->y += tileset->metasize_y) {
-            if(tile->y >= grid_link->grid_limits[tile->z][1] && tile->y < grid_link->grid_limits[tile->z][3]) {
-               cmd_recurse(cmd_ctx,tile);
-            }
-         }
-      }
+   minchildx = MAPCACHE_MAX(minchildx, grid_link->grid_limits[tile->z][0]);
+   minchildy = MAPCACHE_MAX(minchildy, grid_link->grid_limits[tile->z][1]);
+   maxchildx = MAPCACHE_MIN(maxchildx, grid_link->grid_limits[tile->z][2]);
+   maxchildy = MAPCACHE_MIN(maxchildy, grid_link->grid_limits[tile->z][3]);
+
+   if(minchildx < maxchildx && minchildy < maxchildy) {
+      rd.cmd_ctx = cmd_ctx;
+      rd.tile = tile;
+      seed_walk(LEVEL_METATILES_X(tile->z), LEVEL_METATILES_Y(tile->z),
+            minchildx / tileset->metasize_x, minchildy / tileset->metasize_y,
+            (maxchildx - 1) / tileset->metasize_x, (maxchildy - 1) / tileset->metasize_y,
+            visit_recurse, &rd);
    }
 
    tile->x = curx;
@@ -412,73 +568,128 @@ void cmd_recurse(mapcache_context *cmd_ctx, mapcache_tile *tile) {
    tile->z = curz;
 }
 
+struct seed_chunk_data {
+   mapcache_tile *tile;
+   struct seed_chunk *chunk;
+   int n; /* number of chunks walked so far on the current level */
+   int minmx, minmy, maxmx, maxmy;
+};
+
+static int visit_metatile(int mx, int my, void *data) {
+   struct seed_chunk_data *cd = (struct seed_chunk_data*)data;
+   cd->tile->x = mx * tileset->metasize_x;
+   cd->tile->y = my * tileset->metasize_y;
+   push_examine(cd->tile, cd->chunk);
+   if(sig_int_received || error_detected) { //stop if we were asked to stop by hitting ctrl-c
+      drain_queue();
+      return 0;
+   }
+   return 1;
+}
+
+static int visit_chunk(int bx, int by, void *data) {
+   struct seed_chunk_data *cd = (struct seed_chunk_data*)data;
+   int z = cd->tile->z;
+   int ret;
+   if(sig_int_received || error_detected) {
+      drain_queue();
+      return 0;
+   }
+   if((cd->n++) % nprocesses != procid) return 1;
+   if(journal_chunks) {
+      char key[64];
+      snprintf(key,sizeof(key),"%d %d %d",z,bx,by);
+      if(apr_hash_get(journal_chunks, key, APR_HASH_KEY_STRING)) return 1;
+   }
+   cd->chunk = calloc(1,sizeof(struct seed_chunk));
+   cd->chunk->x = bx;
+   cd->chunk->y = by;
+   cd->chunk->z = z;
+   cd->chunk->pending = 1;
+   ret = seed_walk(LEVEL_METATILES_X(z), LEVEL_METATILES_Y(z),
+         MAPCACHE_MAX(cd->minmx, bx * SEED_CHUNK_SIZE), MAPCACHE_MAX(cd->minmy, by * SEED_CHUNK_SIZE),
+         MAPCACHE_MIN(cd->maxmx, bx * SEED_CHUNK_SIZE + SEED_CHUNK_SIZE - 1),
+         MAPCACHE_MIN(cd->maxmy, by * SEED_CHUNK_SIZE + SEED_CHUNK_SIZE - 1),
+         visit_metatile, cd);
+   chunk_release(cd->chunk);
+   cd->chunk = NULL;
+   return ret;
+}
+
+/*
+ * partitioned seeding: the levels are split into chunks of metatiles, which are
+ * dealt out to the processes in a deterministic order so that each process
+ * computes the same partition independently. the chunks already listed in the
+ * journal are skipped.
+ */
+static void cmd_chunks(mapcache_tile *tile) {
+   struct seed_chunk_data cd;
+   int z;
+   cd.tile = tile;
+   cd.chunk = NULL;
+   for(z=minzoom; z<=maxzoom; z++) {
+      if(grid_link->grid_limits[z][2] <= grid_link->grid_limits[z][0] ||
+            grid_link->grid_limits[z][3] <= grid_link->grid_limits[z][1]) {
+         continue;
+      }
+      cd.minmx = grid_link->grid_limits[z][0] / tileset->metasize_x;
+      cd.minmy = grid_link->grid_limits[z][1] / tileset->metasize_y;
+      cd.maxmx = (grid_link->grid_limits[z][2] - 1) / tileset->metasize_x;
+      cd.maxmy = (grid_link->grid_limits[z][3] - 1) / tileset->metasize_y;
+      cd.n = 0;
+      tile->z = z;
+      if(!seed_walk((LEVEL_METATILES_X(z) + SEED_CHUNK_SIZE - 1) / SEED_CHUNK_SIZE,
+               (LEVEL_METATILES_Y(z) + SEED_CHUNK_SIZE - 1) / SEED_CHUNK_SIZE,
+               cd.minmx / SEED_CHUNK_SIZE, cd.minmy / SEED_CHUNK_SIZE,
+               cd.maxmx / SEED_CHUNK_SIZE, cd.maxmy / SEED_CHUNK_SIZE,
+               visit_chunk, &cd)) {
+         return;
+      }
+   }
+}
+
 void cmd_thread() {
      int n;
   mapcache_tile *tile;
    int z = minzoom;
-   int x = grid_link->grid_limits[z][0];
-   int y = grid_link->grid_limits[z][1];
    mapcache_context cmd_ctx = ctx;
    apr_pool_create(&cmd_ctx.pool,ctx.pool);
    tile = mapcache_tileset_tile_create(ctx.pool, tileset, grid_link);
    tile->dimensions = dimensions;
-   if(seed_mode == MAPCACHE_SEED_DEPTH_FIRST) {
-      do {
-         tile->x = x;
-         tile->y = y;
+   if(nprocesses > 1 || journal) {
+      cmd_chunks(tile);
+   } else if(seed_mode == MAPCACHE_SEED_DEPTH_FIRST) {
+      /* walk the first level, each metatile recursing into its children before moving on */
+      if(grid_link->grid_limits[z][2] > grid_link->grid_limits[z][0] &&
+            grid_link->grid_limits[z][3] > grid_link->grid_limits[z][1]) {
+         struct seed_recurse_data rd;
+         rd.cmd_ctx = &cmd_ctx;
+         rd.tile = tile;
          tile->z = z;
-         cmd_recurse(&cmd_ctx,tile);
-         x += tileset->metasize_x;
-         if( x >= grid_link->grid_limits[z][2] ) {
-            y += tileset->metasize_y;
-            if( y < grid_link->grid_limits[z][3]) {
-               x = grid_link->grid_limits[z][0];
-            }
-         }
-      } while (
-            x < grid_link->grid_limits[z][2]
-            &&
-            y < grid_link->grid_limits[z][3]
-            );
+         seed_walk(LEVEL_METATILES_X(z), LEVEL_METATILES_Y(z),
+               grid_link->grid_limits[z][0] / tileset->metasize_x,
+               grid_link->grid_limits[z][1] / tileset->metasize_y,
+               (grid_link->grid_limits[z][2] - 1) / tileset->metasize_x,
+               (grid_link->grid_limits[z][3] - 1) / tileset->metasize_y,
+               visit_recurse, &rd);
+      }
    } else {
-      while(1) {
-	int action;
-         apr_pool_clear(cmd_ctx.pool);
-         if(sig_int_received || error_detected) { //stop if we were asked to stop by hitting ctrl-c
-            //remove all items from the queue
-            void *entry;
-            while (apr_queue_trypop(work_queue,&entry)!=APR_EAGAIN) {queuedtilestot--;}
-            break;
+      struct seed_chunk_data cd;
+      cd.tile = tile;
+      cd.chunk = NULL;
+      for(; z<=maxzoom; z++) {
+         if(grid_link->grid_limits[z][2] <= grid_link->grid_limits[z][0] ||
+               grid_link->grid_limits[z][3] <= grid_link->grid_limits[z][1]) {
+            continue;
          }
-         tile->x = x;
-         tile->y = y;
          tile->z = z;
-	 action = examine_tile(&cmd_ctx, tile);
-
-         if(action == MAPCACHE_CMD_SEED || action == MAPCACHE_CMD_TRANSFER) {
-            //current x,y,z needs seeding, add it to the queue
-            struct seed_cmd *cmd = malloc(sizeof(struct seed_cmd));
-            cmd->x = x;
-            cmd->y = y;
-            cmd->z = z;
-            cmd->command = action;
-            apr_queue_push(work_queue,cmd);
-            queuedtilestot++;
-            progresslog(x,y,z);
-         }
-
-         //compute next x,y,z
-         x += tileset->metasize_x;
-         if(x >= grid_link->grid_limits[z][2]) {
-            //x is too big, increment y
-            y += tileset->metasize_y;
-            if(y >= grid_link->grid_limits[z][3]) {
-               //y is too big, increment z
-               z += 1;
-               if(z > maxzoom) break; //we've finished seeding
-               y = grid_link->grid_limits[z][1]; //set y to the smallest value for current z
-            }
-            x = grid_link->grid_limits[z][0]; //set x to smallest value for current z
+         if(!seed_walk(LEVEL_METATILES_X(z), LEVEL_METATILES_Y(z),
+                  grid_link->grid_limits[z][0] / tileset->metasize_x,
+                  grid_link->grid_limits[z][1] / tileset->metasize_y,
+                  (grid_link->grid_limits[z][2] - 1) / tileset->metasize_x,
+                  (grid_link->grid_limits[z][3] - 1) / tileset->metasize_y,
+                  visit_metatile, &cd)) {
+            break;
          }
       }
    }
@@ -487,6 +698,7 @@ void cmd_thread() {
    for(n=0;n<nthreads;n++) {
       struct seed_cmd *cmd = malloc(sizeof(struct seed_cmd));
       cmd->command = MAPCACHE_CMD_STOP;
+      cmd->chunk = NULL;
       apr_queue_push(work_queue,cmd);
    }
 
@@ -505,6 +717,7 @@ static void* APR_THREAD_FUNC seed_thread(apr_thread_t *thread, void *data) {
    while(1) {
      struct seed_cmd *cmd;
       apr_status_t ret;
+      int action;
       apr_pool_clear(seed_ctx.pool);
       
       ret = apr_queue_pop(work_queue, (void**)&cmd);
@@ -512,9 +725,21 @@ static void* APR_THREAD_FUNC seed_thread(apr_thread_t *thread, void *data) {
       tile->x = cmd->x;
       tile->y = cmd->y;
       tile->z = cmd->z;
-      if(cmd->command == MAPCACHE_CMD_SEED) {
+      tile->encoded_data = NULL;
+      tile->raw_image = NULL;
+      tile->mtime = 0;
+
+      /* the existence checks are done here rather than in the producer, so they run in parallel */
+      action = examine_tile(&seed_ctx, tile);
+      if(action == MAPCACHE_CMD_SEED || action == MAPCACHE_CMD_DELETE || action == MAPCACHE_CMD_TRANSFER) {
+         apr_thread_mutex_lock(seed_mutex);
+         queuedtilestot++;
+         progresslog(tile->x,tile->y,tile->z);
+         apr_thread_mutex_unlock(seed_mutex);
+      }
+      if(action == MAPCACHE_CMD_SEED) {
          mapcache_tileset_tile_get(&seed_ctx,tile);
-      } else if (cmd->command == MAPCACHE_CMD_TRANSFER) {
+      } else if (action == MAPCACHE_CMD_TRANSFER) {
 	  int i;
 	  mapcache_metatile *mt = mapcache_tileset_metatile_get(&seed_ctx, tile);
 	  for(i=0;i<mt->ntiles;i++) {
@@ -524,13 +749,20 @@ static void* APR_THREAD_FUNC seed_thread(apr_thread_t *thread, void *data) {
 	    tileset_transfer->cache->tile_set(&seed_ctx,subtile);
 	  }
       }
-      else { //CMD_DELETE
+      else if (action == MAPCACHE_CMD_DELETE) {
          mapcache_tileset_tile_delete(&seed_ctx,tile,MAPCACHE_TRUE);
       }
+      apr_thread_mutex_lock(seed_mutex);
       if(seed_ctx.get_error(&seed_ctx)) {
          error_detected++;
+         if(cmd->chunk) cmd->chunk->failed = 1;
          ctx.log(&ctx,MAPCACHE_INFO,seed_ctx.get_error_message(&seed_ctx));
+         seed_ctx.clear_errors(&seed_ctx);
+      } else if(action != MAPCACHE_CMD_SKIP) {
+         seededtilestot++;
       }
+      apr_thread_mutex_unlock(seed_mutex);
+      chunk_release(cmd->chunk);
       free(cmd);
    }
    apr_thread_exit(thread,MAPCACHE_SUCCESS);
@@ -596,6 +828,7 @@ int main(int argc, const char **argv) {
     int optch;
     int rv,n;
     const char *old = NULL;
+    const char *journalfile = NULL;
     const char *optarg;
     apr_table_t *argdimensions;
     char *dimkey=NULL, *dimvalue=NULL,*key, *last, *optargcpy=NULL;
@@ -615,6 +848,7 @@ int main(int argc, const char **argv) {
     cfg = mapcache_configuration_create(ctx.pool);
     ctx.config = cfg;
     ctx.log= mapcache_context_seeding_log;
+    ctx.clone = seed_context_clone;
     apr_getopt_init(&opt, ctx.pool, argc, argv);
 
     seededtiles=seededtilestot=queuedtilestot=0;
@@ -661,6 +895,23 @@ int main(int argc, const char **argv) {
             case 'n':
                 nthreads = (int)strtol(optarg, NULL, 10);
                 break;
+            case 'p':
+                nprocesses = (int)strtol(optarg, NULL, 10);
+                break;
+            case 'j':
+                journalfile = optarg;
+                break;
+            case 'O':
+                if(!strcmp(optarg,"hilbert")) {
+                   seed_order = MAPCACHE_SEED_ORDER_HILBERT;
+                } else if(!strcmp(optarg,"morton")) {
+                   seed_order = MAPCACHE_SEED_ORDER_MORTON;
+                } else if(!strcmp(optarg,"row")) {
+                   seed_order = MAPCACHE_SEED_ORDER_ROW;
+                } else {
+                   return usage(argv[0],"invalid order, expecting \"row\", \"morton\" or \"hilbert\"");
+                }
+                break;
             case 'e':
                 if ( MAPCACHE_SUCCESS != mapcache_util_extract_double_list(&ctx, (char*)optarg, ",", &extent, &n) ||
                         n != 4 || extent[0] >= extent[2] || extent[1] >= extent[3] ) {
@@ -926,9 +1177,73 @@ int main(int argc, const char **argv) {
 
     }
 
+    if(nprocesses < 1) {
+        return usage(argv[0],"failed to parse nprocesses, must be a positive int");
+    }
+#if !APR_HAS_FORK
+    if(nprocesses > 1) {
+        return usage(argv[0],"nprocesses is not supported on this platform");
+    }
+#endif
+
+    if(journalfile) {
+       apr_file_t *f;
+       journal_chunks = apr_hash_make(ctx.pool);
+       /* load the chunks completed by a previous run */
+       if(apr_file_open(&f, journalfile, APR_FOPEN_READ, APR_OS_DEFAULT, ctx.pool) == APR_SUCCESS) {
+          char line[128];
+          while(apr_file_gets(line, sizeof(line), f) == APR_SUCCESS) {
+             int z,x,y;
+             if(sscanf(line,"%d %d %d",&z,&x,&y) == 3) {
+                apr_hash_set(journal_chunks, apr_psprintf(ctx.pool,"%d %d %d",z,x,y), APR_HASH_KEY_STRING, (void*)1);
+             }
+          }
+          apr_file_close(f);
+       }
+       if(apr_file_open(&journal, journalfile, APR_FOPEN_WRITE|APR_FOPEN_CREATE|APR_FOPEN_APPEND,
+                APR_OS_DEFAULT, ctx.pool) != APR_SUCCESS) {
+          return usage(argv[0],"failed to open journal file for writing");
+       }
+       if(!quiet && apr_hash_count(journal_chunks)) {
+          printf("resuming seeding, skipping %d chunks listed in %s\n",apr_hash_count(journal_chunks),journalfile);
+       }
+    }
+
+#if APR_HAS_FORK
+    if(nprocesses > 1) {
+       /* fork the seeding processes, each one walks the same chunk sequence and keeps its own share */
+       apr_proc_t *procs = (apr_proc_t*)apr_pcalloc(ctx.pool, nprocesses*sizeof(apr_proc_t));
+       int failed = 0;
+       for(n=0;n<nprocesses;n++) {
+          rv = apr_proc_fork(&procs[n], ctx.pool);
+          if(rv == APR_INCHILD) {
+             procid = n;
+             break;
+          } else if(rv != APR_INPARENT) {
+             return usage(argv[0],"failed to fork seeding process");
+          }
+       }
+       if(n == nprocesses) {
+          /* parent: wait for the seeding processes to finish */
+          for(n=0;n<nprocesses;n++) {
+             int exitcode;
+             apr_exit_why_e why;
+             apr_proc_wait(&procs[n], &exitcode, &why, APR_WAIT);
+             if(!APR_PROC_CHECK_EXIT(why) || exitcode != 0) failed++;
+          }
+          if(failed) {
+             printf("\n%d seeding processes failed\n",failed);
+          }
+          apr_terminate();
+          return failed ? 1 : 0;
+       }
+    }
+#endif
+
     if( ! nthreads ) {
         return usage(argv[0],"failed to parse nthreads, must be int");
     } else {
+        apr_thread_mutex_create(&seed_mutex, APR_THREAD_MUTEX_DEFAULT, ctx.pool);
         //start the thread that will populate the queue.
         //create the queue where tile requests will be put
         apr_queue_create(&work_queue,nthreads,ctx.pool);
@@ -952,11 +1267,18 @@ int main(int argc, const char **argv) {
 	   float duration;
            mapcache_gettimeofday(&now_t,NULL);
            duration = ((now_t.tv_sec-starttime.tv_sec)*1000000+(now_t.tv_usec-starttime.tv_usec))/1000000.0;
-           printf("\nseeded %d metatiles at %g tiles/sec\n",seededtilestot, seededtilestot/duration);
+           if(nprocesses > 1) {
+              printf("\nprocess %d: seeded %d metatiles at %g metatiles/sec\n",procid,seededtilestot, seededtilestot/duration);
+           } else {
+              printf("\nseeded %d metatiles at %g metatiles/sec\n",seededtilestot, seededtilestot/duration);
+           }
         }
     }
+    if(journal) {
+       apr_file_close(journal);
+    }
     apr_terminate();
-    return 0;
+    return error_detected ? 1 : 0;
 }
 /* vim: ai ts=3 sts=3 et sw=3
 */
@@ -135,8 +135,6 @@ struct cluster_layer_info
 };
 
 
-extern int yyparse(parseObj *p);
-
 /* evaluate the filter expression */
 int msClusterEvaluateFilter(expressionObj* expression, shapeObj *shape)
 {
@@ -150,7 +148,7 @@ int msClusterEvaluateFilter(expressionObj* expression, shapeObj *shape)
         p.expr->curtoken = p.expr->tokens; /* reset */
         p.type = MS_PARSE_TYPE_BOOLEAN;
 
-        status = yyparse(&p);
+        status = msRunExpression(&p);
 
         if (status != 0) {
             msSetError(MS_PARSEERR, "Failed to parse expression: %s", "msClusterEvaluateFilter", expression->string);
@@ -185,7 +183,7 @@ char *msClusterGetGroupText(expressionObj* expression, shapeObj *shape)
             p.expr->curtoken = p.expr->tokens; /* reset */
             p.type = MS_PARSE_TYPE_STRING;
 
-            status = yyparse(&p);
+            status = msRunExpression(&p);
 
             if (status != 0) 
             {
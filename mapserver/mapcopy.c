@@ -66,7 +66,15 @@ int msCopyProjection(projectionObj *dst, projectionObj *src) {
         /* Our destination consists of unallocated pointers */
         dst->args[i] = msStrdup(src->args[i]);
     }
-    if (dst->numargs != 0) {
+    if (src->proj_refcount && src->proj) {
+        /* shared PROJ object, see msShareProjection() */
+        dst->proj = src->proj;
+#if PJ_VERSION >= 480
+        dst->proj_ctx = src->proj_ctx;
+#endif
+        dst->proj_refcount = src->proj_refcount;
+        (*dst->proj_refcount)++;
+    } else if (dst->numargs != 0) {
         if (msProcessProjection(dst) != MS_SUCCESS)
             return MS_FAILURE;
 
@@ -33,6 +33,11 @@
 #include "maptime.h"
 #include "mapcopy.h"
 
+#if defined(USE_THREAD) && !defined(_WIN32)
+#define USE_DRAW_THREADS
+#include <pthread.h>
+#endif
+
 MS_CVSID("$Id$")
 
 /*
@@ -267,6 +272,323 @@ imageObj *msPrepareImage(mapObj *map, int allow_nonsquare)
 }
 
 
+#ifdef USE_DRAW_THREADS
+
+/*
+** Layers drawn by a pool of threads (CONFIG "MS_DRAW_THREADS" "n"). Each
+** eligible layer is drawn by a worker in its own transparent imageObj, and
+** msDrawMap() merges these images into the map image in layer order, drawing
+** the other layers itself in between. map->projection is shared by the
+** threads, so its transformations are serialized (see proj_lock).
+**
+** The output is identical to a serial draw: merging a layer image only
+** copies its opaque pixels and skips its transparent ones, which is what
+** drawing the layer directly does if it draws nothing translucent. The AGG
+** and cairo renderers antialias all vector output, so only raster layers
+** are eligible: full opacity, no translucent class colors, no labels, no
+** tileindex layer. A raster that still comes out translucent (an alpha
+** band, resampling at nodata edges) is drawn again by msDrawMap() instead
+** of being merged. No layer is drawn in a thread if a visible layer
+** changes the symbolset or its renderer while being drawn.
+*/
+typedef struct {
+  layerObj *layer;
+  imageObj *image;
+  int status;
+  int done;
+  char *error;
+  double elapsed;
+} layerDrawJob;
+
+typedef struct {
+  mapObj *map;
+  layerDrawJob *jobs;
+  layerDrawJob **layerjobs; /* job of each layer, indexed by layer index, or NULL */
+  int numjobs;
+  int nextjob;
+  pthread_mutex_t lock;
+  pthread_cond_t jobdone;
+  pthread_t *threads;
+  int numthreads;
+} layerDrawPool;
+
+/*
+** Can drawing this layer change state of the map used by the threads? It
+** may add symbols to the symbolset, and thus reallocate the symbol array, or
+** switch the renderer of the symbols to an alternate or mask renderer.
+*/
+static int msLayerChangesSharedState(layerObj *layer)
+{
+  int i, j, k;
+
+  if(layer->styleitem || layer->masklayer || msLayerGetProcessingKey(layer, "RENDERER") != NULL)
+    return MS_TRUE;
+  for(i=0; i<layer->numclasses; i++) {
+    classObj *c = layer->class[i];
+    for(j=0; j<c->numstyles; j++) {
+      if(c->styles[j]->numbindings > 0 && c->styles[j]->bindings[MS_STYLE_BINDING_SYMBOL].item)
+        return MS_TRUE;
+    }
+    for(j=0; j<c->numlabels; j++) {
+      for(k=0; k<c->labels[j]->numstyles; k++) {
+        styleObj *style = c->labels[j]->styles[k];
+        if(style->numbindings > 0 && style->bindings[MS_STYLE_BINDING_SYMBOL].item)
+          return MS_TRUE;
+      }
+    }
+  }
+  return MS_FALSE;
+}
+
+/*
+** Does the layer only draw opaque pixels, so that its image merges back
+** exactly (see above)?
+*/
+static int msLayerCanDrawInThread(mapObj *map, layerObj *layer)
+{
+  int i, j;
+
+  if(layer->postlabelcache || layer->cluster.region || msLayerChangesSharedState(layer))
+    return MS_FALSE;
+  if(layer->type != MS_LAYER_RASTER || layer->connectiontype != MS_RASTER)
+    return MS_FALSE;
+  if(layer->opacity != 100)
+    return MS_FALSE;
+  if(layer->tileindex && msGetLayerIndex(map, layer->tileindex) != -1)
+    return MS_FALSE;
+
+  for(i=0; i<layer->numclasses; i++) {
+    classObj *c = layer->class[i];
+    if(c->numlabels > 0)
+      return MS_FALSE;
+    for(j=0; j<c->numstyles; j++) {
+      styleObj *style = c->styles[j];
+      if(style->opacity != 100 || (MS_VALID_COLOR(style->color) && style->color.alpha != 255))
+        return MS_FALSE;
+      if(style->numbindings > 0 && (style->bindings[MS_STYLE_BINDING_COLOR].item ||
+                                    style->bindings[MS_STYLE_BINDING_OPACITY].item))
+        return MS_FALSE;
+    }
+  }
+  return MS_TRUE;
+}
+
+/* are all the pixels of the buffer either opaque or fully transparent? */
+static int msRasterBufferIsOpaque(rasterBufferObj *rb)
+{
+  int x, y;
+
+  if(rb->type != MS_BUFFER_BYTE_RGBA)
+    return MS_FALSE;
+  if(!rb->data.rgba.a)
+    return MS_TRUE;
+  for(y=0; y<rb->height; y++) {
+    unsigned char *a = rb->data.rgba.a + y * rb->data.rgba.row_step;
+    for(x=0; x<rb->width; x++, a += rb->data.rgba.pixel_step) {
+      if(*a != 0 && *a != 255)
+        return MS_FALSE;
+    }
+  }
+  return MS_TRUE;
+}
+
+static void *msLayerDrawThread(void *arg)
+{
+  layerDrawPool *pool = (layerDrawPool*) arg;
+
+  for(;;) {
+    layerDrawJob *job;
+    struct mstimeval starttime, endtime;
+
+    pthread_mutex_lock(&pool->lock);
+    if(pool->nextjob >= pool->numjobs) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    job = &pool->jobs[pool->nextjob++];
+    pthread_mutex_unlock(&pool->lock);
+
+    msGettimeofday(&starttime, NULL);
+    job->status = msDrawLayer(pool->map, job->layer, job->image);
+    if(job->status != MS_SUCCESS)
+      job->error = msGetErrorString("; ");
+    msResetErrorList();
+    msGettimeofday(&endtime, NULL);
+    job->elapsed = (endtime.tv_sec+endtime.tv_usec/1.0e6)-
+                   (starttime.tv_sec+starttime.tv_usec/1.0e6);
+
+    pthread_mutex_lock(&pool->lock);
+    job->done = MS_TRUE;
+    pthread_cond_broadcast(&pool->jobdone);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  /* the error and debug objects are kept per thread */
+  msResetErrorList();
+  msDebugCleanup();
+  return NULL;
+}
+
+static void msFreeLayerDrawPool(layerDrawPool *pool)
+{
+  int i;
+  for(i=0; i<pool->numjobs; i++) {
+    if(pool->jobs[i].image) msFreeImage(pool->jobs[i].image);
+    msFree(pool->jobs[i].error);
+  }
+  msFree(pool->threads);
+  msFree(pool->jobs);
+  msFree(pool->layerjobs);
+  msFree(pool);
+}
+
+/*
+** Start drawing the eligible layers of the map in numthreads threads. Returns
+** NULL if there is nothing to draw in parallel, the map is then drawn as usual.
+*/
+static layerDrawPool *msStartLayerDrawPool(mapObj *map, imageObj *image, int numthreads)
+{
+  layerDrawPool *pool;
+  rendererVTableObj *renderer;
+  int i;
+
+  if(image->format->renderer != MS_RENDER_WITH_AGG &&
+     image->format->renderer != MS_RENDER_WITH_CAIRO_RASTER)
+    return NULL;
+  renderer = MS_IMAGE_RENDERER(image);
+  if(!renderer->supports_pixel_buffer)
+    return NULL;
+
+  for(i=0; i<map->numlayers; i++) {
+    if(msLayerIsVisible(map, GET_LAYER(map, i)) && msLayerChangesSharedState(GET_LAYER(map, i)))
+      return NULL;
+  }
+
+  pool = (layerDrawPool*) msSmallCalloc(1, sizeof(layerDrawPool));
+  pool->map = map;
+  pool->jobs = (layerDrawJob*) msSmallCalloc(map->numlayers, sizeof(layerDrawJob));
+  pool->layerjobs = (layerDrawJob**) msSmallCalloc(map->numlayers, sizeof(layerDrawJob*));
+
+  for(i=0; i<map->numlayers; i++) {
+    layerObj *lp;
+    layerDrawJob *job;
+
+    if(map->layerorder[i] == -1) continue;
+    lp = GET_LAYER(map, map->layerorder[i]);
+    if(!msLayerIsVisible(map, lp) || lp->opacity == 0 || !msLayerCanDrawInThread(map, lp))
+      continue;
+
+    job = &pool->jobs[pool->numjobs];
+    job->layer = lp;
+    job->image = msImageCreate(image->width, image->height, image->format,
+                               image->imagepath, image->imageurl, map->resolution, map->defresolution, NULL);
+    if(!job->image) {
+      /* leave this layer to msDrawMap() */
+      msResetErrorList();
+      continue;
+    }
+
+    pool->layerjobs[map->layerorder[i]] = job;
+    pool->numjobs++;
+  }
+
+  if(pool->numjobs == 0) {
+    msFreeLayerDrawPool(pool);
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->jobdone, NULL);
+#ifdef USE_PROJ
+  map->projection.proj_lock = MS_TRUE;
+#endif
+  numthreads = MS_MIN(numthreads, pool->numjobs);
+  pool->threads = (pthread_t*) msSmallMalloc(numthreads * sizeof(pthread_t));
+  for(i=0; i<numthreads; i++) {
+    if(pthread_create(&pool->threads[pool->numthreads], NULL, msLayerDrawThread, pool) != 0)
+      break;
+    pool->numthreads++;
+  }
+  if(pool->numthreads == 0) {
+#ifdef USE_PROJ
+    map->projection.proj_lock = MS_FALSE;
+#endif
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->jobdone);
+    msFreeLayerDrawPool(pool);
+    return NULL;
+  }
+
+  if(map->debug >= MS_DEBUGLEVEL_V)
+    msDebug("msDrawMap(): drawing %d layers in %d threads.\n", pool->numjobs, pool->numthreads);
+
+  return pool;
+}
+
+/*
+** Wait for the layer to be drawn, and merge its image into the map image, or
+** draw the layer again in the map image if the merge would not be exact.
+*/
+static int msMergeLayerDrawJob(mapObj *map, layerDrawPool *pool, layerDrawJob *job, imageObj *image)
+{
+  rendererVTableObj *renderer = MS_IMAGE_RENDERER(image);
+  rasterBufferObj rb;
+  int status;
+
+  pthread_mutex_lock(&pool->lock);
+  while(!job->done)
+    pthread_cond_wait(&pool->jobdone, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+
+  if(map->debug >= MS_DEBUGLEVEL_TUNING || job->layer->debug >= MS_DEBUGLEVEL_TUNING)
+    msDebug("msDrawMap(): Layer %s drawn in thread, %.3fs\n",
+            job->layer->name?job->layer->name:"(null)", job->elapsed);
+
+  if(job->status != MS_SUCCESS) {
+    msSetError(MS_IMGERR, "%s", "msDrawMap()", job->error?job->error:"");
+    status = MS_FAILURE;
+  } else {
+    memset(&rb, 0, sizeof(rasterBufferObj));
+    status = renderer->getRasterBufferHandle(job->image, &rb);
+    if(status == MS_SUCCESS && msRasterBufferIsOpaque(&rb)) {
+      status = renderer->mergeRasterBuffer(image, &rb, 1.0, 0, 0, 0, 0, rb.width, rb.height);
+    } else if(status == MS_SUCCESS) {
+      if(map->debug >= MS_DEBUGLEVEL_V || job->layer->debug >= MS_DEBUGLEVEL_V)
+        msDebug("msDrawMap(): Layer %s has translucent pixels, drawing it again.\n",
+                job->layer->name?job->layer->name:"(null)");
+      status = msDrawLayer(map, job->layer, image);
+    }
+  }
+  msFreeImage(job->image);
+  job->image = NULL;
+  return status;
+}
+
+/*
+** Wait for the threads to be done and free the pool. When called on an error,
+** the layers that are not being drawn yet are skipped.
+*/
+static void msFinishLayerDrawPool(layerDrawPool *pool)
+{
+  int i;
+
+  if(!pool) return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->nextjob = pool->numjobs;
+  pthread_mutex_unlock(&pool->lock);
+  for(i=0; i<pool->numthreads; i++)
+    pthread_join(pool->threads[i], NULL);
+#ifdef USE_PROJ
+  pool->map->projection.proj_lock = MS_FALSE;
+#endif
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->jobdone);
+  msFreeLayerDrawPool(pool);
+}
+
+#endif /* USE_DRAW_THREADS */
+
 /*
  * Generic function to render the map file.
  * The type of the image created is based on the imagetype parameter in the map file.
@@ -289,6 +611,9 @@ imageObj *msDrawMap(mapObj *map, int querymap)
   int numOWSLayers=0, numOWSRequests=0;
   wmsParamsObj sLastWMSParams;
 #endif
+#ifdef USE_DRAW_THREADS
+  layerDrawPool *drawpool = NULL;
+#endif
 
   if(map->debug >= MS_DEBUGLEVEL_TUNING) msGettimeofday(&mapstarttime, NULL);
 
@@ -310,6 +635,12 @@ imageObj *msDrawMap(mapObj *map, int querymap)
                map->outputformat->name, 
                map->outputformat->driver );
 
+#ifdef USE_DRAW_THREADS
+  /* start drawing the independent layers while the OWS layers are downloaded */
+  if(!querymap && msGetConfigOption(map, "MS_DRAW_THREADS") && atoi(msGetConfigOption(map, "MS_DRAW_THREADS")) > 0)
+    drawpool = msStartLayerDrawPool(map, image, atoi(msGetConfigOption(map, "MS_DRAW_THREADS")));
+#endif
+
 #if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
 
   /* Time the OWS query phase */
@@ -334,6 +665,9 @@ imageObj *msDrawMap(mapObj *map, int querymap)
     pasOWSReqInfo = (httpRequestObj *)malloc((numOWSLayers+1)*sizeof(httpRequestObj));
     if (pasOWSReqInfo == NULL) {
       msSetError(MS_MEMERR, "Allocation of httpRequestObj failed.", "msDrawMap()");
+#ifdef USE_DRAW_THREADS
+      msFinishLayerDrawPool(drawpool);
+#endif
       return NULL;
     }
     msHTTPInitRequestObj(pasOWSReqInfo, numOWSLayers+1);
@@ -351,6 +685,9 @@ imageObj *msDrawMap(mapObj *map, int querymap)
       if(lp->connectiontype == MS_WMS) {
           if(msPrepareWMSLayerRequest(map->layerorder[i], map, lp, 1, lastconnectiontype, &sLastWMSParams, 0, 0, 0, NULL, pasOWSReqInfo, &numOWSRequests) == MS_FAILURE) {
           msFreeWmsParamsObj(&sLastWMSParams);
+#ifdef USE_DRAW_THREADS
+          msFinishLayerDrawPool(drawpool);
+#endif
           msFreeImage(image);
           msFree(pasOWSReqInfo);
           return NULL;
@@ -362,6 +699,9 @@ imageObj *msDrawMap(mapObj *map, int querymap)
       if(lp->connectiontype == MS_WFS) {
         if(msPrepareWFSLayerRequest(map->layerorder[i], map, lp, pasOWSReqInfo, &numOWSRequests) == MS_FAILURE) {
           msFreeWmsParamsObj(&sLastWMSParams);
+#ifdef USE_DRAW_THREADS
+          msFinishLayerDrawPool(drawpool);
+#endif
           msFreeImage(image);
           msFree(pasOWSReqInfo);
           return NULL;
@@ -378,6 +718,9 @@ imageObj *msDrawMap(mapObj *map, int querymap)
   } /* if numOWSLayers > 0 */
 
   if(numOWSRequests && msOWSExecuteRequests(pasOWSReqInfo, numOWSRequests, map, MS_TRUE) == MS_FAILURE) {
+#ifdef USE_DRAW_THREADS
+    msFinishLayerDrawPool(drawpool);
+#endif
     msFreeImage(image);
     msFree(pasOWSReqInfo);
     return NULL;
@@ -421,6 +764,9 @@ imageObj *msDrawMap(mapObj *map, int querymap)
                      "or another unexpected result in response to the GetMap request. Also check "
                      "and make sure that the layer's connection URL is valid.",
                      "msDrawMap()", lp->name);
+#ifdef USE_DRAW_THREADS
+          msFinishLayerDrawPool(drawpool);
+#endif
           msFreeImage(image);
           msHTTPFreeRequestObj(pasOWSReqInfo, numOWSRequests);
           msFree(pasOWSReqInfo);
@@ -430,16 +776,26 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 
 #else /* ndef USE_WMS_LYR */
         msSetError(MS_WMSCONNERR, "MapServer not built with WMS Client support, unable to render layer '%s'.", "msDrawMap()", lp->name);
+#ifdef USE_DRAW_THREADS
+        msFinishLayerDrawPool(drawpool);
+#endif
         msFreeImage(image);
         return(NULL);
 #endif
       } else { /* Default case: anything but WMS layers */
         if(querymap)
           status = msDrawQueryLayer(map, lp, image);
+#ifdef USE_DRAW_THREADS
+        else if(drawpool && drawpool->layerjobs[map->layerorder[i]])
+          status = msMergeLayerDrawJob(map, drawpool, drawpool->layerjobs[map->layerorder[i]], image);
+#endif
         else
           status = msDrawLayer(map, lp, image);
         if(status == MS_FAILURE) {
           msSetError(MS_IMGERR, "Failed to draw layer named '%s'.", "msDrawMap()", lp->name);
+#ifdef USE_DRAW_THREADS
+          msFinishLayerDrawPool(drawpool);
+#endif
           msFreeImage(image);
 #if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
           if (pasOWSReqInfo) {
@@ -461,6 +817,10 @@ imageObj *msDrawMap(mapObj *map, int querymap)
     }
   }
 
+#ifdef USE_DRAW_THREADS
+  msFinishLayerDrawPool(drawpool);
+#endif
+
   if(map->scalebar.status == MS_EMBED && !map->scalebar.postlabelcache) {
 
     /* We need to temporarily restore the original extent for drawing */
@@ -2511,6 +2871,8 @@ int msDrawOffsettedLabels(imageObj *image, mapObj *map, int priority) {
                labelLeader.line = cachePtr->leaderline; /* setup the label polygon structure */
                labelLeader.numlines = 1;
 
+               msLabelCacheIndexAddLabel(labelcache, priority, l);
+
                for(ll=0;ll<classPtr->leader.numstyles;ll++) {
                   msDrawLineSymbol(&map->symbolset, image,&labelLeader , classPtr->leader.styles[ll], layerPtr->scalefactor);
                }
@@ -2730,6 +3092,9 @@ int msDrawLabelCache(imageObj *image, mapObj *map)
         if(map->debug) msDebug("msDrawLabelCache(): labelcache_map_edge_buffer = %d\n", map->labelcache.gutter);
       }
 
+      /* grid index used to limit collision tests to nearby labels and markers */
+      msInitLabelCacheIndex(&(map->labelcache), image->width, image->height);
+
       for(priority=MS_MAX_LABEL_PRIORITY-1; priority>=0; priority--) {
         labelCacheSlotObj *cacheslot;
         cacheslot = &(map->labelcache.slots[priority]);
@@ -2788,6 +3153,7 @@ int msDrawLabelCache(imageObj *image, mapObj *map)
                cachePtr->poly->bounds.maxx = cachePtr->labelpath->bounds.bounds.maxx;
                cachePtr->poly->bounds.maxy = cachePtr->labelpath->bounds.bounds.maxy;
                msFreeShape(&cachePtr->labelpath->bounds);
+               msLabelCacheIndexAddLabel(&(map->labelcache), priority, l);
             }
 
             msDrawTextLine(image, labelPtr->annotext, labelPtr, cachePtr->labelpath, &(map->fontset), layerPtr->scalefactor); /* Draw the curved label */
@@ -3066,6 +3432,8 @@ int msDrawLabelCache(imageObj *image, mapObj *map)
             
             if(cachePtr->status == MS_OFF)
                continue; /* next label, as we had a collision */
+
+            msLabelCacheIndexAddLabel(&(map->labelcache), priority, l);
             
 
             if(layerPtr->type == MS_LAYER_ANNOTATION && cachePtr->numstyles > 0) { /* need to draw a marker */
@@ -3121,6 +3489,8 @@ int msDrawLabelCache(imageObj *image, mapObj *map)
       }
 #endif
 
+      msFreeLabelCacheIndex(&(map->labelcache));
+
       return MS_SUCCESS; /* necessary? */
     } else if( MS_RENDERER_IMAGEMAP(image->format) ) {
       nReturnVal = msDrawLabelCacheIM(image, map);
@@ -92,6 +92,469 @@ static int allocColorCube(mapObj *map, gdImagePtr img, int *panColorCube);
 #define RGB_LEVEL_INDEX(r,g,b) ((r)*GREEN_LEVELS*BLUE_LEVELS + (g)*BLUE_LEVELS+(b))
 #define RGB_INDEX(r,g,b) RGB_LEVEL_INDEX(((r)/RED_DIV),((g)/GREEN_DIV),((b)/BLUE_DIV))
 
+/*
+ * Strip processing.  With CONFIG "MS_RASTER_THREADS" "n" the window is
+ * read and processed in strips of rows: the calling thread reads the
+ * strips in order through GDAL (holding TLOCK_GDAL as usual) while n
+ * worker threads process each strip as soon as it is read, so that the
+ * I/O of the next strip overlaps the processing of the current one.
+ * Without the option, or without thread support, the window is a single
+ * strip read and processed in the calling thread.
+ *
+ * The process callbacks only touch the rows of their strip, and must not
+ * call GDAL or report errors.
+ *
+ * Strips are preferably aligned on destination rows mapping to a whole
+ * source row, so that GDAL samples the same source rows as for a single
+ * read.  When the scale allows no such alignment finer than the window,
+ * the strips are not aligned: each strip then reads the source rows it
+ * overlaps, and the nearest neighbour sampling may pick a different
+ * source row for the destination rows at the strip edges.
+ */
+#if defined(USE_THREAD) && !defined(_WIN32)
+#define USE_RASTER_THREADS
+#include <pthread.h>
+#endif
+
+typedef int (*rasterStripReadFunc)( void *ctx, int row, int nrows );
+typedef void (*rasterStripProcessFunc)( void *ctx, int strip, int row, int nrows );
+
+typedef struct {
+    int nthreads;
+    int src_yoff, src_ysize;
+    int dst_ysize;
+    int strip_rows;
+    int nstrips;
+} rasterStrips;
+
+static void msInitRasterStrips( mapObj *map, rasterStrips *strips,
+                                int src_yoff, int src_ysize, int dst_ysize )
+{
+    strips->nthreads = 0;
+    strips->src_yoff = src_yoff;
+    strips->src_ysize = src_ysize;
+    strips->dst_ysize = dst_ysize;
+    strips->strip_rows = dst_ysize;
+    strips->nstrips = 1;
+
+#ifdef USE_RASTER_THREADS
+    {
+        const char *value = msGetConfigOption( map, "MS_RASTER_THREADS" );
+        int a = src_ysize, b = dst_ysize, unit, rows;
+
+        if( value == NULL || atoi(value) <= 0 || dst_ysize < 2 )
+            return;
+        strips->nthreads = atoi(value);
+
+        while( b != 0 )
+        {
+            int t = a % b;
+            a = b;
+            b = t;
+        }
+        unit = dst_ysize / a;
+        rows = MAX( 16, dst_ysize / (4 * strips->nthreads) );
+        if( ((rows + unit - 1) / unit) * unit < dst_ysize )
+            rows = ((rows + unit - 1) / unit) * unit;
+        else if( map->debug >= MS_DEBUGLEVEL_V )
+            msDebug( "msInitRasterStrips(): %d source rows to %d rows allow no "
+                     "aligned strips, using unaligned strips of %d rows.\n",
+                     src_ysize, dst_ysize, rows );
+        if( rows < dst_ysize )
+        {
+            strips->strip_rows = rows;
+            strips->nstrips = (dst_ysize + rows - 1) / rows;
+        }
+    }
+#endif
+}
+
+/* source rows overlapped by the destination rows row to row+nrows-1 */
+static void msRasterStripSource( rasterStrips *strips, int row, int nrows,
+                                 int *src_row, int *src_nrows )
+{
+    int first = (int) floor((double) row * strips->src_ysize / strips->dst_ysize);
+    int last = (int) ceil((double) (row + nrows) * strips->src_ysize / strips->dst_ysize);
+
+    *src_row = strips->src_yoff + first;
+    *src_nrows = last - first;
+}
+
+static int msRunRasterStripsSerial( rasterStrips *strips, void *ctx,
+                                    rasterStripReadFunc read,
+                                    rasterStripProcessFunc process )
+{
+    int i;
+
+    for( i = 0; i < strips->nstrips; i++ )
+    {
+        int row = i * strips->strip_rows;
+        int nrows = MIN( strips->strip_rows, strips->dst_ysize - row );
+
+        if( read != NULL && read( ctx, row, nrows ) != 0 )
+            return -1;
+        process( ctx, i, row, nrows );
+    }
+    return 0;
+}
+
+#ifdef USE_RASTER_THREADS
+
+typedef struct {
+    rasterStrips *strips;
+    void *ctx;
+    rasterStripProcessFunc process;
+    int nread;     /* strips read so far */
+    int nextstrip; /* next strip to process */
+    int abort;
+    pthread_mutex_t lock;
+    pthread_cond_t stripread;
+} rasterStripQueue;
+
+static void *msRasterStripThread( void *arg )
+{
+    rasterStripQueue *queue = (rasterStripQueue *) arg;
+    rasterStrips *strips = queue->strips;
+
+    for( ;; )
+    {
+        int strip, row;
+
+        pthread_mutex_lock( &queue->lock );
+        while( !queue->abort && queue->nextstrip < strips->nstrips
+               && queue->nextstrip >= queue->nread )
+            pthread_cond_wait( &queue->stripread, &queue->lock );
+        if( queue->abort || queue->nextstrip >= strips->nstrips )
+        {
+            pthread_mutex_unlock( &queue->lock );
+            break;
+        }
+        strip = queue->nextstrip++;
+        pthread_mutex_unlock( &queue->lock );
+
+        row = strip * strips->strip_rows;
+        queue->process( queue->ctx, strip, row,
+                        MIN( strips->strip_rows, strips->dst_ysize - row ) );
+    }
+    return NULL;
+}
+
+#endif /* USE_RASTER_THREADS */
+
+/*
+ * Read (if read is not NULL) and process all the strips of the window.
+ * Returns -1 if a read failed, the error being set by the read callback.
+ */
+static int msRunRasterStrips( rasterStrips *strips, void *ctx,
+                              rasterStripReadFunc read,
+                              rasterStripProcessFunc process )
+{
+#ifdef USE_RASTER_THREADS
+    rasterStripQueue queue;
+    pthread_t *threads;
+    int i, nthreads, started = 0, status = 0;
+
+    if( strips->nthreads <= 0 || strips->nstrips < 2 )
+        return msRunRasterStripsSerial( strips, ctx, read, process );
+
+    queue.strips = strips;
+    queue.ctx = ctx;
+    queue.process = process;
+    queue.nread = (read != NULL) ? 0 : strips->nstrips;
+    queue.nextstrip = 0;
+    queue.abort = FALSE;
+    pthread_mutex_init( &queue.lock, NULL );
+    pthread_cond_init( &queue.stripread, NULL );
+
+    nthreads = MIN( strips->nthreads, strips->nstrips );
+    threads = (pthread_t *) msSmallMalloc( sizeof(pthread_t) * nthreads );
+    for( i = 0; i < nthreads; i++ )
+    {
+        if( pthread_create( &threads[started], NULL, msRasterStripThread, &queue ) == 0 )
+            started++;
+    }
+
+    if( started == 0 )
+    {
+        free( threads );
+        pthread_mutex_destroy( &queue.lock );
+        pthread_cond_destroy( &queue.stripread );
+        return msRunRasterStripsSerial( strips, ctx, read, process );
+    }
+
+    for( i = 0; read != NULL && i < strips->nstrips; i++ )
+    {
+        int row = i * strips->strip_rows;
+        int result = read( ctx, row, MIN( strips->strip_rows, strips->dst_ysize - row ) );
+
+        pthread_mutex_lock( &queue.lock );
+        if( result != 0 )
+            queue.abort = TRUE;
+        else
+            queue.nread++;
+        pthread_cond_broadcast( &queue.stripread );
+        pthread_mutex_unlock( &queue.lock );
+
+        if( result != 0 )
+        {
+            status = -1;
+            break;
+        }
+    }
+
+    for( i = 0; i < started; i++ )
+        pthread_join( threads[i], NULL );
+    free( threads );
+    pthread_mutex_destroy( &queue.lock );
+    pthread_cond_destroy( &queue.stripread );
+
+    return status;
+#else
+    return msRunRasterStripsSerial( strips, ctx, read, process );
+#endif
+}
+
+/*
+ * Transfer of the loaded 8bit bands to the output raster buffer, done in
+ * strips of rows like the loading.
+ */
+typedef enum {
+    TRANSFER_CMAP_ALPHA_GD,
+    TRANSFER_CMAP_GD,
+    TRANSFER_CMAP_ALPHA_RGBA,
+    TRANSFER_CMAP_RGBA,
+    TRANSFER_RGB_RGBA,
+    TRANSFER_RGB_DITHERED_GD,
+    TRANSFER_RGB_COLORCUBE_GD
+} rasterTransferMode;
+
+typedef struct {
+    rasterTransferMode mode;
+    layerObj *layer;
+    rasterBufferObj *rb;
+    int dst_xoff, dst_yoff, dst_xsize;
+    unsigned char *pabyRaw1, *pabyRaw2, *pabyRaw3, *pabyRawAlpha;
+    unsigned char *pabyDithered;
+    int *cmap;
+    unsigned char (*rb_cmap)[MAXCOLORS];
+    int *anColorCube;
+    int bHaveRGBNoData;
+    int nNoData1, nNoData2, nNoData3;
+} rasterTransferCtx;
+
+static void msTransferRasterStrip( void *pCtx, int strip, int row, int nrows )
+{
+    rasterTransferCtx *ctx = (rasterTransferCtx *) pCtx;
+    layerObj *layer = ctx->layer;
+    rasterBufferObj *rb = ctx->rb;
+    unsigned char *pabyRaw1 = ctx->pabyRaw1, *pabyRaw2 = ctx->pabyRaw2,
+        *pabyRaw3 = ctx->pabyRaw3, *pabyRawAlpha = ctx->pabyRawAlpha;
+    int *cmap = ctx->cmap;
+    unsigned char (*rb_cmap)[MAXCOLORS] = ctx->rb_cmap;
+    int dst_xoff = ctx->dst_xoff, dst_xsize = ctx->dst_xsize;
+    int first_row = ctx->dst_yoff + row, last_row = ctx->dst_yoff + row + nrows;
+    int i, j, k = row * dst_xsize;
+
+    switch( ctx->mode )
+    {
+/* -------------------------------------------------------------------- */
+/*      Single band plus colormap with alpha blending to 8bit.          */
+/* -------------------------------------------------------------------- */
+      case TRANSFER_CMAP_ALPHA_GD:
+        for( i = first_row; i < last_row; i++ )
+        {
+            int	result, alpha;
+          
+            for( j = dst_xoff; j < dst_xoff + dst_xsize; j++ )
+            {
+                alpha = pabyRawAlpha[k];
+
+                result = cmap[pabyRaw1[k++]];
+
+                /* 
+                ** We don't do alpha blending in non-truecolor mode, just
+                ** threshold the point on/off at alpha=128.
+                */
+
+                if( result != -1 && alpha >= 128 )
+                    rb->data.gd_img->pixels[i][j] = result;
+            }
+        }
+
+        assert( k == (row + nrows) * dst_xsize );
+        break;
+
+/* -------------------------------------------------------------------- */
+/*      Single band plus colormap (no alpha) to 8bit.                   */
+/* -------------------------------------------------------------------- */
+      case TRANSFER_CMAP_GD:
+        for( i = first_row; i < last_row; i++ )
+        {
+            int	result;
+          
+            for( j = dst_xoff; j < dst_xoff + dst_xsize; j++ )
+            {
+                result = cmap[pabyRaw1[k++]];
+                if( result != -1 )
+                {
+                    rb->data.gd_img->pixels[i][j] = result;
+                }
+            }
+        }
+
+        assert( k == (row + nrows) * dst_xsize );
+        break;
+
+/* -------------------------------------------------------------------- */
+/*      Single band plus colormap and alpha to truecolor. (RB)          */
+/* -------------------------------------------------------------------- */
+      case TRANSFER_CMAP_ALPHA_RGBA:
+        for( i = first_row; i < last_row; i++ )
+        {
+            for( j = dst_xoff; j < dst_xoff + dst_xsize; j++ )
+            {
+                int	src_pixel, src_alpha, cmap_alpha, merged_alpha;
+
+                src_pixel = pabyRaw1[k];
+                src_alpha = pabyRawAlpha[k];
+                cmap_alpha = rb_cmap[3][src_pixel];
+
+                merged_alpha = (src_alpha * cmap_alpha) / 255;
+
+                if( merged_alpha < 2 )
+                    /* do nothing - transparent */;
+                else if( merged_alpha > 253 )
+                {
+                    RB_SET_PIXEL( rb, j, i, 
+                                  rb_cmap[0][src_pixel], 
+                                  rb_cmap[1][src_pixel], 
+                                  rb_cmap[2][src_pixel], 
+                                  cmap_alpha );
+                }
+                else
+                {
+                    RB_MIX_PIXEL( rb, j, i, 
+                                  rb_cmap[0][src_pixel], 
+                                  rb_cmap[1][src_pixel], 
+                                  rb_cmap[2][src_pixel], 
+                                  merged_alpha );
+                }
+                k++;
+            }
+        }
+        break;
+
+/* -------------------------------------------------------------------- */
+/*      Single band plus colormap (no alpha) to truecolor (RB)          */
+/* -------------------------------------------------------------------- */
+      case TRANSFER_CMAP_RGBA:
+        for( i = first_row; i < last_row; i++ )
+        {
+            for( j = dst_xoff; j < dst_xoff + dst_xsize; j++ )
+            {
+                int src_pixel = pabyRaw1[k++];
+
+                if( rb_cmap[3][src_pixel] > 253 )
+                {
+                    RB_SET_PIXEL( rb, j, i, 
+                                  rb_cmap[0][src_pixel], 
+                                  rb_cmap[1][src_pixel], 
+                                  rb_cmap[2][src_pixel], 
+                                  rb_cmap[3][src_pixel] );
+                }                  
+                else if( rb_cmap[3][src_pixel] > 1 )
+                {
+                    RB_MIX_PIXEL( rb, j, i, 
+                                  rb_cmap[0][src_pixel], 
+                                  rb_cmap[1][src_pixel], 
+                                  rb_cmap[2][src_pixel], 
+                                  rb_cmap[3][src_pixel] );
+                }                  
+            }
+        }
+        break;
+
+/* -------------------------------------------------------------------- */
+/*      Input is 3 band RGB.  Alpha blending is mixed into the loop     */
+/*      since this case is less commonly used and has lots of other     */
+/*      overhead. (RB)                                                  */
+/* -------------------------------------------------------------------- */
+      case TRANSFER_RGB_RGBA:
+        for( i = first_row; i < last_row; i++ )
+        {
+            for( j = dst_xoff; j < dst_xoff + dst_xsize; j++, k++ )
+            {
+                if( MS_VALID_COLOR( layer->offsite )
+                    && pabyRaw1[k] == layer->offsite.red
+                    && pabyRaw2[k] == layer->offsite.green
+                    && pabyRaw3[k] == layer->offsite.blue )
+                    continue;
+
+                if( ctx->bHaveRGBNoData 
+                    && pabyRaw1[k] == ctx->nNoData1 
+                    && pabyRaw2[k] == ctx->nNoData2 
+                    && pabyRaw3[k] == ctx->nNoData3 )
+                    continue;
+
+                if( pabyRawAlpha == NULL || pabyRawAlpha[k] == 255 )
+                {
+                    RB_SET_PIXEL( rb, j, i, 
+                                  pabyRaw1[k],
+                                  pabyRaw2[k],
+                                  pabyRaw3[k],
+                                  255 );
+                }
+                else if( pabyRawAlpha[k] != 0 )
+                {
+                    RB_MIX_PIXEL( rb, j, i, 
+                                  pabyRaw1[k],
+                                  pabyRaw2[k],
+                                  pabyRaw3[k],
+                                  pabyRawAlpha[k] );
+                }
+            }
+        }
+        break;
+
+/* -------------------------------------------------------------------- */
+/*      Input is 3 band RGB, dithered or color cubed to 8bit. (GD)      */
+/* -------------------------------------------------------------------- */
+      case TRANSFER_RGB_DITHERED_GD:
+      case TRANSFER_RGB_COLORCUBE_GD:
+        for( i = first_row; i < last_row; i++ )
+        {
+            for( j = dst_xoff; j < dst_xoff + dst_xsize; j++, k++ )
+            {
+                if( MS_VALID_COLOR( layer->offsite )
+                    && pabyRaw1[k] == layer->offsite.red
+                    && pabyRaw2[k] == layer->offsite.green
+                    && pabyRaw3[k] == layer->offsite.blue )
+                    continue;
+
+                if( ctx->bHaveRGBNoData 
+                    && pabyRaw1[k] == ctx->nNoData1 
+                    && pabyRaw2[k] == ctx->nNoData2 
+                    && pabyRaw3[k] == ctx->nNoData3 )
+                    continue;
+
+                if( pabyRawAlpha != NULL && pabyRawAlpha[k] == 0 )
+                    continue;
+
+                if( ctx->mode == TRANSFER_RGB_DITHERED_GD )
+                    rb->data.gd_img->pixels[i][j] = ctx->pabyDithered[k];
+                else
+                {
+                    int	cc_index;
+                  
+                    cc_index= RGB_INDEX(pabyRaw1[k],pabyRaw2[k],pabyRaw3[k]);
+                    rb->data.gd_img->pixels[i][j] = ctx->anColorCube[cc_index];
+                }
+            }
+        }
+        break;
+    }
+}
+
 /*
  * rasterBufferObj setting macros. 
  */
@@ -106,7 +569,7 @@ int msDrawRasterLayerGDAL(mapObj *map, layerObj *layer, imageObj *image,
                           rasterBufferObj *rb, void *hDSVoid )
 
 {
-    int i,j, k; /* loop counters */
+    int i; /* loop counter */
     int cmap[MAXCOLORS], cmap_set = FALSE;
     unsigned char rb_cmap[4][MAXCOLORS];
     double adfGeoTransform[6], adfInvGeoTransform[6];
@@ -125,6 +588,9 @@ int msDrawRasterLayerGDAL(mapObj *map, layerObj *layer, imageObj *image,
     GDALRasterBandH hBand1=NULL, hBand2=NULL, hBand3=NULL, hBandAlpha=NULL;
     int bHaveRGBNoData = FALSE;
     int nNoData1=-1,nNoData2=-1,nNoData3=-1;
+    unsigned char *pabyDithered = NULL;
+    rasterTransferCtx transfer;
+    int bTransfer = TRUE;
     
     /*only support rawdata and pluggable renderers*/
     assert(MS_RENDERER_RAWDATA(image->format) || (MS_RENDERER_PLUGIN(image->format) && rb));
@@ -838,194 +1304,40 @@ int msDrawRasterLayerGDAL(mapObj *map, layerObj *layer, imageObj *image,
     }
 
 /* -------------------------------------------------------------------- */
-/*      Single band plus colormap with alpha blending to 8bit.          */
+/*      Transfer the bands to the output buffer, the conversion         */
+/*      depending on the bands and the buffer type.                     */
 /* -------------------------------------------------------------------- */
+    memset( &transfer, 0, sizeof(transfer) );
+
     if( hBand2 == NULL && rb->type == MS_BUFFER_GD && hBandAlpha != NULL )
     {
         assert( cmap_set );
-        k = 0;
-
-        for( i = dst_yoff; i < dst_yoff + dst_ysize; i++ )
-        {
-            int	result, alpha;
-          
-            for( j = dst_xoff; j < dst_xoff + dst_xsize; j++ )
-            {
-                alpha = pabyRawAlpha[k];
-
-                result = cmap[pabyRaw1[k++]];
-
-                /* 
-                ** We don't do alpha blending in non-truecolor mode, just
-                ** threshold the point on/off at alpha=128.
-                */
-
-                if( result != -1 && alpha >= 128 )
-                    rb->data.gd_img->pixels[i][j] = result;
-            }
-        }
-
-        assert( k == dst_xsize * dst_ysize );
+        transfer.mode = TRANSFER_CMAP_ALPHA_GD;
     }
-
-/* -------------------------------------------------------------------- */
-/*      Single band plus colormap (no alpha) to 8bit.                   */
-/* -------------------------------------------------------------------- */
     else if( hBand2 == NULL  && rb->type == MS_BUFFER_GD )
     {
         assert( cmap_set );
-        k = 0;
-
-        for( i = dst_yoff; i < dst_yoff + dst_ysize; i++ )
-        {
-            int	result;
-          
-            for( j = dst_xoff; j < dst_xoff + dst_xsize; j++ )
-            {
-                result = cmap[pabyRaw1[k++]];
-                if( result != -1 )
-                {
-                    rb->data.gd_img->pixels[i][j] = result;
-                }
-            }
-        }
-
-        assert( k == dst_xsize * dst_ysize );
+        transfer.mode = TRANSFER_CMAP_GD;
     }
-
-/* -------------------------------------------------------------------- */
-/*      Single band plus colormap and alpha to truecolor. (RB)          */
-/* -------------------------------------------------------------------- */
     else if( hBand2 == NULL && rb->type == MS_BUFFER_BYTE_RGBA && hBandAlpha != NULL )
     {
         assert( cmap_set );
-
-        k = 0;
-        for( i = dst_yoff; i < dst_yoff + dst_ysize; i++ )
-        {
-            for( j = dst_xoff; j < dst_xoff + dst_xsize; j++ )
-            {
-                int	src_pixel, src_alpha, cmap_alpha, merged_alpha;
-
-                src_pixel = pabyRaw1[k];
-                src_alpha = pabyRawAlpha[k];
-                cmap_alpha = rb_cmap[3][src_pixel];
-
-                merged_alpha = (src_alpha * cmap_alpha) / 255;
-
-                if( merged_alpha < 2 )
-                    /* do nothing - transparent */;
-                else if( merged_alpha > 253 )
-                {
-                    RB_SET_PIXEL( rb, j, i, 
-                                  rb_cmap[0][src_pixel], 
-                                  rb_cmap[1][src_pixel], 
-                                  rb_cmap[2][src_pixel], 
-                                  cmap_alpha );
-                }
-                else
-                {
-                    RB_MIX_PIXEL( rb, j, i, 
-                                  rb_cmap[0][src_pixel], 
-                                  rb_cmap[1][src_pixel], 
-                                  rb_cmap[2][src_pixel], 
-                                  merged_alpha );
-                }
-                k++;
-            }
-        }
+        transfer.mode = TRANSFER_CMAP_ALPHA_RGBA;
     }
-
-/* -------------------------------------------------------------------- */
-/*      Single band plus colormap (no alpha) to truecolor (RB)          */
-/* -------------------------------------------------------------------- */
     else if( hBand2 == NULL && rb->type == MS_BUFFER_BYTE_RGBA )
     {
         assert( cmap_set );
-
-        k = 0;
-        for( i = dst_yoff; i < dst_yoff + dst_ysize; i++ )
-        {
-            for( j = dst_xoff; j < dst_xoff + dst_xsize; j++ )
-            {
-                int src_pixel = pabyRaw1[k++];
-
-                if( rb_cmap[3][src_pixel] > 253 )
-                {
-                    RB_SET_PIXEL( rb, j, i, 
-                                  rb_cmap[0][src_pixel], 
-                                  rb_cmap[1][src_pixel], 
-                                  rb_cmap[2][src_pixel], 
-                                  rb_cmap[3][src_pixel] );
-                }                  
-                else if( rb_cmap[3][src_pixel] > 1 )
-                {
-                    RB_MIX_PIXEL( rb, j, i, 
-                                  rb_cmap[0][src_pixel], 
-                                  rb_cmap[1][src_pixel], 
-                                  rb_cmap[2][src_pixel], 
-                                  rb_cmap[3][src_pixel] );
-                }                  
-            }
-        }
+        transfer.mode = TRANSFER_CMAP_RGBA;
     }
-
-/* -------------------------------------------------------------------- */
-/*      Input is 3 band RGB.  Alpha blending is mixed into the loop     */
-/*      since this case is less commonly used and has lots of other     */
-/*      overhead. (RB)                                                  */
-/* -------------------------------------------------------------------- */
     else if( hBand3 != NULL && rb->type == MS_BUFFER_BYTE_RGBA )
     {
-        k = 0;
-        for( i = dst_yoff; i < dst_yoff + dst_ysize; i++ )
-        {
-            for( j = dst_xoff; j < dst_xoff + dst_xsize; j++, k++ )
-            {
-                if( MS_VALID_COLOR( layer->offsite )
-                    && pabyRaw1[k] == layer->offsite.red
-                    && pabyRaw2[k] == layer->offsite.green
-                    && pabyRaw3[k] == layer->offsite.blue )
-                    continue;
-
-                if( bHaveRGBNoData 
-                    && pabyRaw1[k] == nNoData1 
-                    && pabyRaw2[k] == nNoData2 
-                    && pabyRaw3[k] == nNoData3 )
-                    continue;
-
-                if( pabyRawAlpha == NULL || pabyRawAlpha[k] == 255 )
-                {
-                    RB_SET_PIXEL( rb, j, i, 
-                                  pabyRaw1[k],
-                                  pabyRaw2[k],
-                                  pabyRaw3[k],
-                                  255 );
-                }
-                else if( pabyRawAlpha[k] != 0 )
-                {
-                    RB_MIX_PIXEL( rb, j, i, 
-                                  pabyRaw1[k],
-                                  pabyRaw2[k],
-                                  pabyRaw3[k],
-                                  pabyRawAlpha[k] );
-                }
-            }
-        }
+        transfer.mode = TRANSFER_RGB_RGBA;
     }
-
-/* -------------------------------------------------------------------- */
-/*      Input is 3 band RGB.  Alpha blending is mixed into the loop     */
-/*      since this case is less commonly used and has lots of other     */
-/*      overhead. (GD)                                                  */
-/* -------------------------------------------------------------------- */
     else if( hBand3 != NULL && rb->type == MS_BUFFER_GD )
     {
-        /* Dithered 24bit to 8bit conversion */
+        /* Dithered 24bit to 8bit conversion, the error diffusion is serial */
         if( CSLFetchBoolean( layer->processing, "DITHER", FALSE ) )
         {
-            unsigned char *pabyDithered;
-
             pabyDithered = (unsigned char *) malloc(dst_xsize * dst_ysize);
             if( pabyDithered == NULL )
             {
@@ -1038,68 +1350,49 @@ int msDrawRasterLayerGDAL(mapObj *map, layerObj *layer, imageObj *image,
                          dst_xsize, dst_ysize, image->format->transparent, 
                          map->imagecolor, rb->data.gd_img );
 
-            k = 0;
-            for( i = dst_yoff; i < dst_yoff + dst_ysize; i++ )
-            {
-                for( j = dst_xoff; j < dst_xoff + dst_xsize; j++, k++ )
-                {
-                    if( MS_VALID_COLOR( layer->offsite )
-                        && pabyRaw1[k] == layer->offsite.red
-                        && pabyRaw2[k] == layer->offsite.green
-                        && pabyRaw3[k] == layer->offsite.blue )
-                        continue;
-
-                    if( bHaveRGBNoData 
-                        && pabyRaw1[k] == nNoData1 
-                        && pabyRaw2[k] == nNoData2 
-                        && pabyRaw3[k] == nNoData3 )
-                        continue;
-
-                    if( pabyRawAlpha != NULL && pabyRawAlpha[k] == 0 )
-                        continue;
-
-                    rb->data.gd_img->pixels[i][j] = pabyDithered[k];
-                }
-            }
-          
-            free( pabyDithered );
+            transfer.mode = TRANSFER_RGB_DITHERED_GD;
         }
 
         /* Color cubed 24bit to 8bit conversion. */
         else if( rb->type == MS_BUFFER_GD )
         {
-            k = 0;
-            for( i = dst_yoff; i < dst_yoff + dst_ysize; i++ )
-            {
-                for( j = dst_xoff; j < dst_xoff + dst_xsize; j++, k++ )
-                {
-                    int	cc_index;
-                  
-                    if( MS_VALID_COLOR( layer->offsite )
-                        && pabyRaw1[k] == layer->offsite.red
-                        && pabyRaw2[k] == layer->offsite.green
-                        && pabyRaw3[k] == layer->offsite.blue )
-                        continue;
-                  
-                    if( bHaveRGBNoData 
-                        && pabyRaw1[k] == nNoData1 
-                        && pabyRaw2[k] == nNoData2 
-                        && pabyRaw3[k] == nNoData3 )
-                        continue;
-
-                    if( pabyRawAlpha != NULL && pabyRawAlpha[k] == 0 )
-                        continue;
-
-                    cc_index= RGB_INDEX(pabyRaw1[k],pabyRaw2[k],pabyRaw3[k]);
-                    rb->data.gd_img->pixels[i][j] = anColorCube[cc_index];
-                }
-            }
+            transfer.mode = TRANSFER_RGB_COLORCUBE_GD;
         }
         else {
             msSetError(MS_MISCERR,"Unsupported raster configuration","msDrawRasterLayerGDAL()");
             return MS_FAILURE;
         }
     }
+    else
+        bTransfer = FALSE;
+
+    if( bTransfer )
+    {
+        rasterStrips strips;
+
+        transfer.layer = layer;
+        transfer.rb = rb;
+        transfer.dst_xoff = dst_xoff;
+        transfer.dst_yoff = dst_yoff;
+        transfer.dst_xsize = dst_xsize;
+        transfer.pabyRaw1 = pabyRaw1;
+        transfer.pabyRaw2 = pabyRaw2;
+        transfer.pabyRaw3 = pabyRaw3;
+        transfer.pabyRawAlpha = pabyRawAlpha;
+        transfer.pabyDithered = pabyDithered;
+        transfer.cmap = cmap;
+        transfer.rb_cmap = rb_cmap;
+        transfer.anColorCube = anColorCube;
+        transfer.bHaveRGBNoData = bHaveRGBNoData;
+        transfer.nNoData1 = nNoData1;
+        transfer.nNoData2 = nNoData2;
+        transfer.nNoData3 = nNoData3;
+
+        msInitRasterStrips( map, &strips, src_yoff, src_ysize, dst_ysize );
+        msRunRasterStrips( &strips, &transfer, NULL, msTransferRasterStrip );
+    }
+
+    free( pabyDithered );
 
     /*
     ** Cleanup
@@ -1287,19 +1580,21 @@ static int ParseGimpLUT( const char *lut_def, GByte *lut, int iColorIndex )
 }
 
 /************************************************************************/
-/*                              ApplyLUT()                              */
+/*                              LoadLUT()                               */
 /*                                                                      */
-/*      Apply a LUT according to RFC 21.                                */
+/*      Load a LUT according to RFC 21.  *pbHaveLUT is set to FALSE     */
+/*      if there is no LUT for this band.                               */
 /************************************************************************/
 
-static int ApplyLUT( int iColorIndex, layerObj *layer, 
-                     GByte *buffer, int buf_xsize, int buf_ysize )
+static int LoadLUT( int iColorIndex, layerObj *layer, 
+                    GByte *lut, int *pbHaveLUT )
 
 {
     const char *lut_def;
     char key[20], lut_def_fromfile[2500];
-    GByte lut[256];
-    int   err, i;
+    int   err;
+
+    *pbHaveLUT = FALSE;
 
 /* -------------------------------------------------------------------- */
 /*      Get lut specifier from processing directives.  Do nothing if    */
@@ -1362,12 +1657,7 @@ static int ApplyLUT( int iColorIndex, layerObj *layer,
     if( err != 0 )
         return err;
 
-/* -------------------------------------------------------------------- */
-/*      Apply LUT.                                                      */
-/* -------------------------------------------------------------------- */
-    for( i = buf_xsize * buf_ysize - 1; i >= 0; i-- )
-        buffer[i] = lut[buffer[i]];
-
+    *pbHaveLUT = TRUE;
     return 0;
 }
 
@@ -1377,8 +1667,158 @@ static int ApplyLUT( int iColorIndex, layerObj *layer,
 /*      This call will load and process 1-4 bands of input for the      */
 /*      selected rectangle, loading the result into the passed 8bit     */
 /*      buffer.  The processing options include scaling.                */
+/*                                                                      */
+/*      The bands are loaded in strips (see msRunRasterStrips()).       */
+/*      With autoscaling the strips are scanned for their min/max as    */
+/*      they are read and scaled in a second pass, otherwise they are   */
+/*      scaled and have their LUT applied as they are read.             */
 /************************************************************************/
 
+typedef struct {
+    rasterStrips strips;
+    GDALDatasetH hDS;
+    int    *band_numbers;
+    int    band_count;
+    int    src_xoff, src_xsize;
+    int    dst_xsize, dst_ysize;
+    GByte  *pabyWholeBuffer;
+    float  *pafWholeRawData; /* NULL if not scaling */
+
+    GByte  abyLUT[4][256];
+    int    abHaveLUT[4];
+
+    /* scaling */
+    int    bScale;
+    double adfScaleMin[4], adfScaleMax[4];
+    int    abAutoScale[4];
+    int    abGotNoData[4];
+    double adfNoDataValue[4];
+
+    /* min/max of each strip and band, for autoscaling */
+    double *padfStripMin, *padfStripMax;
+    int    *pbStripMinMaxSet;
+} gdalImagesCtx;
+
+static int LoadGDALImagesStrip( void *pCtx, int row, int nrows )
+{
+    gdalImagesCtx *ctx = (gdalImagesCtx *) pCtx;
+    int src_row, src_nrows, nPixelCount = ctx->dst_xsize * ctx->dst_ysize;
+    CPLErr eErr;
+
+    msRasterStripSource( &ctx->strips, row, nrows, &src_row, &src_nrows );
+
+    if( ctx->pafWholeRawData == NULL )
+        eErr = GDALDatasetRasterIO( ctx->hDS, GF_Read, 
+                                    ctx->src_xoff, src_row, ctx->src_xsize, src_nrows, 
+                                    ctx->pabyWholeBuffer + row * ctx->dst_xsize, 
+                                    ctx->dst_xsize, nrows, GDT_Byte,
+                                    ctx->band_count, ctx->band_numbers,
+                                    1, ctx->dst_xsize, nPixelCount );
+    else
+        eErr = GDALDatasetRasterIO( ctx->hDS, GF_Read, 
+                                    ctx->src_xoff, src_row, ctx->src_xsize, src_nrows, 
+                                    ctx->pafWholeRawData + row * ctx->dst_xsize, 
+                                    ctx->dst_xsize, nrows, GDT_Float32,
+                                    ctx->band_count, ctx->band_numbers,
+                                    sizeof(float), sizeof(float) * ctx->dst_xsize,
+                                    sizeof(float) * nPixelCount );
+
+    if( eErr != CE_None )
+    {
+        msSetError( MS_IOERR, 
+                    "GDALDatasetRasterIO() failed: %s", 
+                    "drawGDAL()",
+                    CPLGetLastErrorMsg() );
+        return -1;
+    }
+    return 0;
+}
+
+static void ProcessGDALImagesStrip( void *pCtx, int strip, int row, int nrows )
+{
+    gdalImagesCtx *ctx = (gdalImagesCtx *) pCtx;
+    int nPixelCount = ctx->dst_xsize * ctx->dst_ysize;
+    int first = row * ctx->dst_xsize, last = (row + nrows) * ctx->dst_xsize;
+    int iColorIndex, i;
+
+    for( iColorIndex = 0; iColorIndex < ctx->band_count; iColorIndex++ )
+    {
+        GByte *pabyBuffer = ctx->pabyWholeBuffer + iColorIndex * nPixelCount;
+        float *pafRawData = NULL;
+
+        if( ctx->pafWholeRawData != NULL )
+            pafRawData = ctx->pafWholeRawData + iColorIndex * nPixelCount;
+
+/* -------------------------------------------------------------------- */
+/*      Scan for the min/max of this strip if autoscaling.              */
+/* -------------------------------------------------------------------- */
+        if( pafRawData != NULL && !ctx->bScale )
+        {
+            int idx = strip * ctx->band_count + iColorIndex;
+            int bMinMaxSet = FALSE;
+            double dfMin = 0.0, dfMax = 0.0;
+            /* we force assignment to a float rather than letting pafRawData[i]
+               get promoted to double later to avoid float precision issues. */
+            float fNoDataValue = (float) ctx->adfNoDataValue[iColorIndex];
+
+            if( !ctx->abAutoScale[iColorIndex] )
+                continue;
+
+            for( i = first; i < last; i++ )
+            {
+                if( ctx->abGotNoData[iColorIndex] && pafRawData[i] == fNoDataValue )
+                    continue;
+
+                if( !bMinMaxSet )
+                {
+                    dfMin = dfMax = pafRawData[i];
+                    bMinMaxSet = TRUE;
+                }
+
+                dfMin = MIN(dfMin,pafRawData[i]);
+                dfMax = MAX(dfMax,pafRawData[i]);
+            }
+
+            ctx->padfStripMin[idx] = dfMin;
+            ctx->padfStripMax[idx] = dfMax;
+            ctx->pbStripMinMaxSet[idx] = bMinMaxSet;
+            continue;
+        }
+
+/* -------------------------------------------------------------------- */
+/*      Scale to 8bit.                                                  */
+/* -------------------------------------------------------------------- */
+        if( pafRawData != NULL )
+        {
+            double dfScaleMin = ctx->adfScaleMin[iColorIndex];
+            double dfScaleRatio = 256.0 / (ctx->adfScaleMax[iColorIndex] - dfScaleMin);
+
+            for( i = first; i < last; i++ )
+            {
+                float fScaledValue = (float) ((pafRawData[i]-dfScaleMin)*dfScaleRatio);
+                
+                if( fScaledValue < 0.0 )
+                    pabyBuffer[i] = 0;
+                else if( fScaledValue > 255.0 )
+                    pabyBuffer[i] = 255;
+                else
+                    pabyBuffer[i] = (int) fScaledValue;
+            }
+        }
+
+/* -------------------------------------------------------------------- */
+/*      Apply LUT if there is one.                                      */
+/* -------------------------------------------------------------------- */
+        if( ctx->abHaveLUT[iColorIndex] )
+        {
+            GByte *lut = ctx->abyLUT[iColorIndex];
+
+            for( i = first; i < last; i++ )
+                pabyBuffer[i] = lut[pabyBuffer[i]];
+        }
+    }
+}
+
 static int
 LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
 		layerObj *layer, 
@@ -1389,9 +1829,8 @@ LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
                 int *pnNoData1, int *pnNoData2, int *pnNoData3 )
     
 {
-    int    iColorIndex, result_code=0;
-    CPLErr eErr;
-    float *pafWholeRawData;
+    int    iColorIndex, result_code=0, bAnyAutoScale = FALSE;
+    gdalImagesCtx ctx;
 
 /* -------------------------------------------------------------------- */
 /*      If we have no alpha band, but we do have three input            */
@@ -1418,9 +1857,20 @@ LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
                                   pbHaveRGBNoData);
     }
 
+    memset( &ctx, 0, sizeof(ctx) );
+    msInitRasterStrips( layer->map, &ctx.strips, src_yoff, src_ysize, dst_ysize );
+    ctx.hDS = hDS;
+    ctx.band_numbers = band_numbers;
+    ctx.band_count = band_count;
+    ctx.src_xoff = src_xoff;
+    ctx.src_xsize = src_xsize;
+    ctx.dst_xsize = dst_xsize;
+    ctx.dst_ysize = dst_ysize;
+    ctx.pabyWholeBuffer = pabyWholeBuffer;
+
 /* -------------------------------------------------------------------- */
 /*      Are we doing a simple, non-scaling case?  If so, read directly  */
-/*      and return.                                                     */
+/*      and apply the LUTs.                                             */
 /* -------------------------------------------------------------------- */
     if( CSLFetchNameValue( layer->processing, "SCALE" ) == NULL
 	&& CSLFetchNameValue( layer->processing, "SCALE_1" ) == NULL
@@ -1428,91 +1878,42 @@ LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
 	&& CSLFetchNameValue( layer->processing, "SCALE_3" ) == NULL
 	&& CSLFetchNameValue( layer->processing, "SCALE_4" ) == NULL )
     {
-        eErr = GDALDatasetRasterIO( hDS, GF_Read, 
-				    src_xoff, src_yoff, src_xsize, src_ysize, 
-				    pabyWholeBuffer, 
-				    dst_xsize, dst_ysize, GDT_Byte,
-				    band_count, band_numbers,
-				    0,0,0);
-
-        if( eErr != CE_None )
-	{
-            msSetError( MS_IOERR, 
-                        "GDALDatasetRasterIO() failed: %s", 
-                        "drawGDAL()",
-                        CPLGetLastErrorMsg() );
-	    return -1;
-	}
-
 	for( iColorIndex = 0; 
 	     iColorIndex < band_count && result_code == 0; iColorIndex++ )
-	{
-	    result_code = ApplyLUT( iColorIndex+1, layer, 
-				    pabyWholeBuffer 
-				    + dst_xsize*dst_ysize*iColorIndex, 
-				    dst_xsize, dst_ysize );
-	}
-	
-	return result_code;
-    }
-
-/* -------------------------------------------------------------------- */
-/*      Disable use of nodata if we are doing scaling.                  */
-/* -------------------------------------------------------------------- */
-    *pbHaveRGBNoData = FALSE;
-
-/* -------------------------------------------------------------------- */
-/*      We need to do some scaling.  Will load into either a 16bit      */
-/*      unsigned or a floating point buffer depending on the source     */
-/*      data.  We offer a special case for 16U data because it is       */
-/*      common and it is a substantial win to avoid alot of floating    */
-/*      point operations on it.                                         */
-/* -------------------------------------------------------------------- */
-    /* TODO */
-
-/* -------------------------------------------------------------------- */
-/*      Allocate the raw imagery buffer, and load into it (band         */
-/*      interleaved).                                                   */
-/* -------------------------------------------------------------------- */
-    pafWholeRawData = 
-        (float *) malloc(sizeof(float) * dst_xsize * dst_ysize * band_count );
-
-    if( pafWholeRawData == NULL )
-    {
-        msSetError(MS_MEMERR, 
-                   "Allocating work float image of size %dx%dx%d failed.",
-                   "msDrawRasterLayerGDAL()", 
-                   dst_xsize, dst_ysize, band_count );
-        return -1;
-    }
-	
-    eErr = GDALDatasetRasterIO( 
-        hDS, GF_Read, 
-        src_xoff, src_yoff, src_xsize, src_ysize, 
-        pafWholeRawData, dst_xsize, dst_ysize, GDT_Float32, 
-        band_count, band_numbers,
-        0, 0, 0 );
-    
-    if( eErr != CE_None )
-    {
-        msSetError( MS_IOERR, "GDALDatasetRasterIO() failed: %s", 
-                    "drawGDAL()",
-                    CPLGetLastErrorMsg() );
-        
-        free( pafWholeRawData );
-        return -1;
+	{
+	    result_code = LoadLUT( iColorIndex+1, layer, 
+				   ctx.abyLUT[iColorIndex], 
+				   &ctx.abHaveLUT[iColorIndex] );
+	}
+	if( result_code != 0 )
+	    return result_code;
+
+	return msRunRasterStrips( &ctx.strips, &ctx, 
+	                          LoadGDALImagesStrip, ProcessGDALImagesStrip );
     }
 
 /* -------------------------------------------------------------------- */
-/*      Fetch the scale processing option.                              */
+/*      Disable use of nodata if we are doing scaling.                  */
+/* -------------------------------------------------------------------- */
+    *pbHaveRGBNoData = FALSE;
+
+/* -------------------------------------------------------------------- */
+/*      We need to do some scaling.  Will load into either a 16bit      */
+/*      unsigned or a floating point buffer depending on the source     */
+/*      data.  We offer a special case for 16U data because it is       */
+/*      common and it is a substantial win to avoid alot of floating    */
+/*      point operations on it.                                         */
+/* -------------------------------------------------------------------- */
+    /* TODO */
+
+/* -------------------------------------------------------------------- */
+/*      Fetch the scale processing option, nodata value and LUT of      */
+/*      each band.                                                      */
 /* -------------------------------------------------------------------- */
     for( iColorIndex = 0; iColorIndex < band_count; iColorIndex++ )
     {
-	unsigned char *pabyBuffer;
-	double dfScaleMin=0.0, dfScaleMax=255.0, dfScaleRatio, dfNoDataValue;
+	double dfScaleMin=0.0, dfScaleMax=255.0;
 	const char *pszScaleInfo;
-	float *pafRawData;
-	int   nPixelCount = dst_xsize * dst_ysize, i, bGotNoData = FALSE;
 	GDALRasterBandH hBand =GDALGetRasterBand(hDS,band_numbers[iColorIndex]);
 	pszScaleInfo = CSLFetchNameValue( layer->processing, "SCALE" );
 	if( pszScaleInfo == NULL )
@@ -1537,7 +1938,7 @@ LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
             }
 	    else if( CSLCount(papszTokens) != 2 )
             {
-                free( pafWholeRawData );
+                CSLDestroy( papszTokens );
 		msSetError( MS_MISCERR, 
 			    "SCALE PROCESSING option unparsable for layer %s.",
                             "msDrawGDAL()",
@@ -1551,90 +1952,122 @@ LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
             }
 	    CSLDestroy( papszTokens );
         }
-    
+
+	ctx.adfScaleMin[iColorIndex] = dfScaleMin;
+	ctx.adfScaleMax[iColorIndex] = dfScaleMax;
+	ctx.abAutoScale[iColorIndex] = (dfScaleMin == dfScaleMax);
+	if( ctx.abAutoScale[iColorIndex] )
+	    bAnyAutoScale = TRUE;
+
+        ctx.adfNoDataValue[iColorIndex] = 
+            msGetGDALNoDataValue( layer, hBand, &ctx.abGotNoData[iColorIndex] );
+
+	if( LoadLUT( iColorIndex+1, layer, ctx.abyLUT[iColorIndex], 
+		     &ctx.abHaveLUT[iColorIndex] ) == -1 )
+	    return -1;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Allocate the raw imagery buffer, and load into it (band         */
+/*      interleaved).                                                   */
+/* -------------------------------------------------------------------- */
+    ctx.pafWholeRawData = 
+        (float *) malloc(sizeof(float) * dst_xsize * dst_ysize * band_count );
+
+    if( ctx.pafWholeRawData == NULL )
+    {
+        msSetError(MS_MEMERR, 
+                   "Allocating work float image of size %dx%dx%d failed.",
+                   "msDrawRasterLayerGDAL()", 
+                   dst_xsize, dst_ysize, band_count );
+        return -1;
+    }
+
 /* -------------------------------------------------------------------- */
 /*      If we are using autoscaling, then compute the max and min       */
-/*      now.  Perhaps we should eventually honour the offsite value     */
-/*      as a nodata value, or get it from GDAL.                         */
+/*      of each strip as it is read.                                    */
 /* -------------------------------------------------------------------- */
-	pafRawData = pafWholeRawData + iColorIndex * dst_xsize * dst_ysize;
+    if( bAnyAutoScale )
+    {
+        int n = ctx.strips.nstrips * band_count, i;
 
-        dfNoDataValue = msGetGDALNoDataValue( layer, hBand, &bGotNoData );
+        ctx.padfStripMin = (double *) msSmallMalloc(sizeof(double) * n);
+        ctx.padfStripMax = (double *) msSmallMalloc(sizeof(double) * n);
+        ctx.pbStripMinMaxSet = (int *) msSmallMalloc(sizeof(int) * n);
 
-	if( dfScaleMin == dfScaleMax )
+        result_code = msRunRasterStrips( &ctx.strips, &ctx, 
+                                         LoadGDALImagesStrip, ProcessGDALImagesStrip );
+
+        for( iColorIndex = 0; result_code == 0 && iColorIndex < band_count; iColorIndex++ )
         {
-            int bMinMaxSet = 0;
-            
-            /* we force assignment to a float rather than letting pafRawData[i]
-               get promoted to double later to avoid float precision issues. */
-            float fNoDataValue = (float) dfNoDataValue; 
+            int bMinMaxSet = FALSE;
 
-	    for( i = 0; i < nPixelCount; i++ )
+            if( !ctx.abAutoScale[iColorIndex] )
+                continue;
+
+            for( i = 0; i < ctx.strips.nstrips; i++ )
             {
-                if( bGotNoData && pafRawData[i] == fNoDataValue )
+                int idx = i * band_count + iColorIndex;
+
+                if( !ctx.pbStripMinMaxSet[idx] )
                     continue;
 
                 if( !bMinMaxSet )
                 {
-                    dfScaleMin = dfScaleMax = pafRawData[i];
+                    ctx.adfScaleMin[iColorIndex] = ctx.padfStripMin[idx];
+                    ctx.adfScaleMax[iColorIndex] = ctx.padfStripMax[idx];
                     bMinMaxSet = TRUE;
                 }
 
-		dfScaleMin = MIN(dfScaleMin,pafRawData[i]);
-		dfScaleMax = MAX(dfScaleMax,pafRawData[i]);
+                ctx.adfScaleMin[iColorIndex] = MIN(ctx.adfScaleMin[iColorIndex],ctx.padfStripMin[idx]);
+                ctx.adfScaleMax[iColorIndex] = MAX(ctx.adfScaleMax[iColorIndex],ctx.padfStripMax[idx]);
             }
 
-	    if( dfScaleMin == dfScaleMax )
-                dfScaleMax = dfScaleMin + 1.0;
+            if( ctx.adfScaleMin[iColorIndex] == ctx.adfScaleMax[iColorIndex] )
+                ctx.adfScaleMax[iColorIndex] = ctx.adfScaleMin[iColorIndex] + 1.0;
         }
-	
-	if( layer->debug > 0 )
-            msDebug( "msDrawGDAL(%s): scaling to 8bit, src range=%g,%g\n",
-                     layer->name, dfScaleMin, dfScaleMax );
-	
-/* -------------------------------------------------------------------- */
-/*      Now process the data.                                           */
-/* -------------------------------------------------------------------- */
-	dfScaleRatio = 256.0 / (dfScaleMax - dfScaleMin);
-	pabyBuffer = pabyWholeBuffer + iColorIndex * nPixelCount;
 
-	for( i = 0; i < nPixelCount; i++ )
+        free( ctx.padfStripMin );
+        free( ctx.padfStripMax );
+        free( ctx.pbStripMinMaxSet );
+
+        if( result_code != 0 )
         {
-	    float fScaledValue = (float) ((pafRawData[i]-dfScaleMin)*dfScaleRatio);
-	    
-	    if( fScaledValue < 0.0 )
-                pabyBuffer[i] = 0;
-	    else if( fScaledValue > 255.0 )
-                pabyBuffer[i] = 255;
-	    else
-                pabyBuffer[i] = (int) fScaledValue;
+            free( ctx.pafWholeRawData );
+            return result_code;
         }
+    }
+
+    for( iColorIndex = 0; iColorIndex < band_count; iColorIndex++ )
+    {
+	if( layer->debug > 0 )
+            msDebug( "msDrawGDAL(%s): scaling to 8bit, src range=%g,%g\n",
+                     layer->name, ctx.adfScaleMin[iColorIndex], 
+                     ctx.adfScaleMax[iColorIndex] );
 	
 /* -------------------------------------------------------------------- */
 /*      Report a warning if NODATA keyword was applied.  We are         */
 /*      unable to utilize it since we can't return any pixels marked    */
 /*      as nodata from this function.  Need to fix someday.             */
 /* -------------------------------------------------------------------- */
-	if( bGotNoData )
+	if( ctx.abGotNoData[iColorIndex] )
             msDebug( "LoadGDALImage(%s): NODATA value %g in GDAL\n"
                      "file or PROCESSING directive largely ignored.  Not yet fully supported for\n"
                      "unclassified scaled data.  The NODATA value is excluded from auto-scaling\n"
                      "min/max computation, but will not be transparent.\n",
-                     layer->name, dfNoDataValue );
-	
+                     layer->name, ctx.adfNoDataValue[iColorIndex] );
+    }
+
 /* -------------------------------------------------------------------- */
-/*      Apply LUT if there is one.                                      */
+/*      Now process the data, reading it first if it wasn't needed      */
+/*      for autoscaling.                                                */
 /* -------------------------------------------------------------------- */
-	result_code = ApplyLUT( iColorIndex+1, layer, 
-				pabyBuffer, dst_xsize, dst_ysize );;
-	if( result_code == -1 )
-        {
-            free( pafWholeRawData );
-            return result_code;
-        }
-    }
+    ctx.bScale = TRUE;
+    result_code = msRunRasterStrips( &ctx.strips, &ctx, 
+                                     bAnyAutoScale ? NULL : LoadGDALImagesStrip,
+                                     ProcessGDALImagesStrip );
 
-    free( pafWholeRawData );
+    free( ctx.pafWholeRawData );
 
     return result_code;
 }
@@ -2159,83 +2592,189 @@ msDrawRasterLayerGDAL_RawMode(
 /*      raster into a floating point buffer, and then scale to          */
 /*      16bit.  Eventually we could add optimizations for some of       */
 /*      the 16bit cases at the cost of some complication.               */
+/*                                                                      */
+/*      The window is read and classified in strips (see                */
+/*      msRunRasterStrips()).  When the scaling depends on the data,    */
+/*      the strips are scanned for their min/max as they are read and  */
+/*      classified in a second pass, otherwise they are classified as   */
+/*      they are read.                                                  */
 /************************************************************************/
 
-static int 
-msDrawRasterLayerGDAL_16BitClassification(
-    mapObj *map, layerObj *layer, rasterBufferObj *rb,
-    GDALDatasetH hDS, GDALRasterBandH hBand,
-    int src_xoff, int src_yoff, int src_xsize, int src_ysize,
-    int dst_xoff, int dst_yoff, int dst_xsize, int dst_ysize )
-
-{
+typedef struct {
+    rasterStrips strips;
+    GDALRasterBandH hBand;
+    rasterBufferObj *rb;
+    int   src_xoff, src_xsize;
+    int   dst_xoff, dst_yoff, dst_xsize;
     float *pafRawData;
-    double dfScaleMin=0.0, dfScaleMax=0.0, dfScaleRatio;
-    int   nPixelCount = dst_xsize * dst_ysize, i, nBucketCount=0;
-    GDALDataType eDataType;
-    float fDataMin=0.0, fDataMax=255.0, fNoDataValue;
-    const char *pszScaleInfo;
-    const char *pszBuckets;
-    int  bUseIntegers = FALSE;
-    int  *cmap, c, j, k, bGotNoData = FALSE, bGotFirstValue;
+    int   bGotNoData;
+    float fNoDataValue;
+
+    /* min/max of each strip */
+    float *pafStripMin, *pafStripMax;
+    int   *pbStripMinMaxSet;
+
+    /* classification */
+    int   bClassify;
+    double dfScaleMin, dfScaleRatio;
+    int   nBucketCount;
+    int   *cmap;
     unsigned char *rb_cmap[4];
-    CPLErr eErr;
+} classification16Ctx;
 
-    assert( rb->type == MS_BUFFER_GD || rb->type == MS_BUFFER_BYTE_RGBA );
+static int msRead16BitClassificationStrip( void *pCtx, int row, int nrows )
+{
+    classification16Ctx *ctx = (classification16Ctx *) pCtx;
+    int src_row, src_nrows;
+    CPLErr eErr;
 
-/* ==================================================================== */
-/*      Read the requested data in one gulp into a floating point       */
-/*      buffer.                                                         */
-/* ==================================================================== */
-    pafRawData = (float *) malloc(sizeof(float) * dst_xsize * dst_ysize );
-    if( pafRawData == NULL )
-    {
-        msSetError( MS_MEMERR, "Out of memory allocating working buffer.",
-                    "msDrawRasterLayerGDAL_16BitClassification()" );
-        return -1;
-    }
-    
-    eErr = GDALRasterIO( hBand, GF_Read, 
-                         src_xoff, src_yoff, src_xsize, src_ysize, 
-                         pafRawData, dst_xsize, dst_ysize, GDT_Float32, 0, 0 );
+    msRasterStripSource( &ctx->strips, row, nrows, &src_row, &src_nrows );
+    eErr = GDALRasterIO( ctx->hBand, GF_Read, 
+                         ctx->src_xoff, src_row, ctx->src_xsize, src_nrows, 
+                         ctx->pafRawData + row * ctx->dst_xsize,
+                         ctx->dst_xsize, nrows, GDT_Float32, 0, 0 );
     
     if( eErr != CE_None )
     {
-        free( pafRawData );
         msSetError( MS_IOERR, "GDALRasterIO() failed: %s", 
                     "msDrawRasterLayerGDAL_16BitClassification()",
                     CPLGetLastErrorMsg() );
         return -1;
     }
+    return 0;
+}
 
-    fNoDataValue = (float) msGetGDALNoDataValue( layer, hBand, &bGotNoData );
-
-/* ==================================================================== */
-/*      Determine scaling.                                              */
-/* ==================================================================== */
-    eDataType = GDALGetRasterDataType( hBand );
+static void msProcess16BitClassificationStrip( void *pCtx, int strip, int row, int nrows )
+{
+    classification16Ctx *ctx = (classification16Ctx *) pCtx;
+    rasterBufferObj *rb = ctx->rb;
+    int i, j, k;
 
 /* -------------------------------------------------------------------- */
-/*      Scan for absolute min/max of this block.                        */
+/*      Scan for absolute min/max of this strip (the first pixel of     */
+/*      the window has never been part of the scan).                    */
 /* -------------------------------------------------------------------- */
-    bGotFirstValue = FALSE;
-    
-    for( i = 1; i < nPixelCount; i++ )
+    if( !ctx->bClassify )
     {
-        if( bGotNoData && pafRawData[i] == fNoDataValue )
-            continue;
+        int bGotFirstValue = FALSE;
+        float fDataMin = 0.0, fDataMax = 0.0;
 
-        if( !bGotFirstValue )
+        for( k = MAX(1, row * ctx->dst_xsize); k < (row + nrows) * ctx->dst_xsize; k++ )
         {
-            fDataMin = fDataMax = pafRawData[i];
-            bGotFirstValue = TRUE;
+            if( ctx->bGotNoData && ctx->pafRawData[k] == ctx->fNoDataValue )
+                continue;
+
+            if( !bGotFirstValue )
+            {
+                fDataMin = fDataMax = ctx->pafRawData[k];
+                bGotFirstValue = TRUE;
+            }
+            else
+            {
+                fDataMin = MIN(fDataMin,ctx->pafRawData[k]);
+                fDataMax = MAX(fDataMax,ctx->pafRawData[k]);
+            }
         }
-        else
+
+        ctx->pafStripMin[strip] = fDataMin;
+        ctx->pafStripMax[strip] = fDataMax;
+        ctx->pbStripMinMaxSet[strip] = bGotFirstValue;
+        return;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Apply the classification to the rows of the strip.             */
+/* -------------------------------------------------------------------- */
+    k = row * ctx->dst_xsize;
+
+    for( i = ctx->dst_yoff + row; i < ctx->dst_yoff + row + nrows; i++ )
+    {
+        int	result;
+        
+        for( j = ctx->dst_xoff; j < ctx->dst_xoff + ctx->dst_xsize; j++ )
         {
-            fDataMin = MIN(fDataMin,pafRawData[i]);
-            fDataMax = MAX(fDataMax,pafRawData[i]);
+            float fRawValue = ctx->pafRawData[k++];
+            int   iMapIndex;
+
+            /* 
+             * Skip nodata pixels ... no processing.
+             */
+            if( ctx->bGotNoData && fRawValue == ctx->fNoDataValue )
+            {
+                continue;
+            }
+            
+            /*
+             * The funny +1/-1 is to avoid odd rounding around zero.
+             * We could use floor() but sometimes it is expensive. 
+             */
+            iMapIndex = (int) ((fRawValue - ctx->dfScaleMin) * ctx->dfScaleRatio+1)-1;
+
+            if( iMapIndex >= ctx->nBucketCount || iMapIndex < 0 )
+            {
+                continue;
+            }
+
+            if( rb->type == MS_BUFFER_GD )
+            {
+                result = ctx->cmap[iMapIndex];
+                if( result == -1 )
+                    continue;
+
+                rb->data.gd_img->pixels[i][j] = result;
+            }
+            else if( rb->type == MS_BUFFER_BYTE_RGBA )
+            {
+                /* currently we never have partial alpha so keep simple */
+                if( ctx->rb_cmap[3][iMapIndex] > 0 )
+                    RB_SET_PIXEL( rb, j, i, 
+                                  ctx->rb_cmap[0][iMapIndex], 
+                                  ctx->rb_cmap[1][iMapIndex], 
+                                  ctx->rb_cmap[2][iMapIndex], 
+                                  ctx->rb_cmap[3][iMapIndex] );
+            }
         }
     }
+}
+
+static int 
+msDrawRasterLayerGDAL_16BitClassification(
+    mapObj *map, layerObj *layer, rasterBufferObj *rb,
+    GDALDatasetH hDS, GDALRasterBandH hBand,
+    int src_xoff, int src_yoff, int src_xsize, int src_ysize,
+    int dst_xoff, int dst_yoff, int dst_xsize, int dst_ysize )
+
+{
+    classification16Ctx ctx;
+    double dfScaleMin=0.0, dfScaleMax=0.0;
+    int   i, nBucketCount=0;
+    GDALDataType eDataType;
+    float fDataMin=0.0, fDataMax=255.0;
+    const char *pszScaleInfo;
+    const char *pszBuckets;
+    int  bUseIntegers = FALSE, bIntegerType, bNeedMinMax;
+    int  c, status;
+
+    assert( rb->type == MS_BUFFER_GD || rb->type == MS_BUFFER_BYTE_RGBA );
+
+    memset( &ctx, 0, sizeof(ctx) );
+    msInitRasterStrips( map, &ctx.strips, src_yoff, src_ysize, dst_ysize );
+    ctx.hBand = hBand;
+    ctx.rb = rb;
+    ctx.src_xoff = src_xoff;
+    ctx.src_xsize = src_xsize;
+    ctx.dst_xoff = dst_xoff;
+    ctx.dst_yoff = dst_yoff;
+    ctx.dst_xsize = dst_xsize;
+
+    ctx.fNoDataValue = (float) msGetGDALNoDataValue( layer, hBand, &ctx.bGotNoData );
+
+/* ==================================================================== */
+/*      Determine scaling.                                              */
+/* ==================================================================== */
+    eDataType = GDALGetRasterDataType( hBand );
+    bIntegerType = (eDataType == GDT_Byte || eDataType == GDT_Int16 
+                    || eDataType == GDT_UInt16);
 
 /* -------------------------------------------------------------------- */
 /*      Fetch the scale processing option.                              */
@@ -2256,7 +2795,7 @@ msDrawRasterLayerGDAL_16BitClassification(
         }
         else if( CSLCount(papszTokens) != 2 )
         {
-            free( pafRawData );
+            CSLDestroy( papszTokens );
             msSetError( MS_MISCERR, 
                         "SCALE PROCESSING option unparsable for layer %s.",
                         "msDrawGDAL()",
@@ -2271,14 +2810,81 @@ msDrawRasterLayerGDAL_16BitClassification(
         CSLDestroy( papszTokens );
     }
 
+    if( pszBuckets != NULL && atoi(pszBuckets) < 2 )
+    {
+        msSetError( MS_MISCERR, 
+                    "SCALE_BUCKETS PROCESSING option is not a value of 2 or more: %s.",
+                    "msDrawRasterLayerGDAL_16BitClassification()",
+                    pszBuckets );
+        return -1;
+    }
+
+    /* does the scaling depend on the min/max of the data? */
+    if( bIntegerType )
+        bNeedMinMax = (pszScaleInfo == NULL || pszBuckets == NULL);
+    else
+        bNeedMinMax = (dfScaleMin == 0.0 && dfScaleMax == 0.0);
+
+/* ==================================================================== */
+/*      Read the requested data into a floating point buffer, scanning  */
+/*      it for its min/max if needed.                                   */
+/* ==================================================================== */
+    ctx.pafRawData = (float *) malloc(sizeof(float) * dst_xsize * dst_ysize );
+    if( ctx.pafRawData == NULL )
+    {
+        msSetError( MS_MEMERR, "Out of memory allocating working buffer.",
+                    "msDrawRasterLayerGDAL_16BitClassification()" );
+        return -1;
+    }
+
+    if( bNeedMinMax )
+    {
+        ctx.pafStripMin = (float *) msSmallMalloc(sizeof(float) * ctx.strips.nstrips);
+        ctx.pafStripMax = (float *) msSmallMalloc(sizeof(float) * ctx.strips.nstrips);
+        ctx.pbStripMinMaxSet = (int *) msSmallMalloc(sizeof(int) * ctx.strips.nstrips);
+
+        status = msRunRasterStrips( &ctx.strips, &ctx, msRead16BitClassificationStrip,
+                                    msProcess16BitClassificationStrip );
+        if( status == 0 )
+        {
+            int bGotFirstValue = FALSE;
+
+            for( i = 0; i < ctx.strips.nstrips; i++ )
+            {
+                if( !ctx.pbStripMinMaxSet[i] )
+                    continue;
+                if( !bGotFirstValue )
+                {
+                    fDataMin = ctx.pafStripMin[i];
+                    fDataMax = ctx.pafStripMax[i];
+                    bGotFirstValue = TRUE;
+                }
+                else
+                {
+                    fDataMin = MIN(fDataMin,ctx.pafStripMin[i]);
+                    fDataMax = MAX(fDataMax,ctx.pafStripMax[i]);
+                }
+            }
+        }
+
+        free( ctx.pafStripMin );
+        free( ctx.pafStripMax );
+        free( ctx.pbStripMinMaxSet );
+
+        if( status != 0 )
+        {
+            free( ctx.pafRawData );
+            return -1;
+        }
+    }
+
 /* -------------------------------------------------------------------- */
 /*      Special integer cases for scaling.                              */
 /*                                                                      */
 /*      TODO: Treat Int32 and UInt32 case the same way *if* the min     */
 /*      and max are less than 65536 apart.                              */
 /* -------------------------------------------------------------------- */
-    if( eDataType == GDT_Byte || eDataType == GDT_Int16 
-        || eDataType == GDT_UInt16 )
+    if( bIntegerType )
     {
         if( pszScaleInfo == NULL )
         {
@@ -2314,15 +2920,6 @@ msDrawRasterLayerGDAL_16BitClassification(
     else
     {
         nBucketCount = atoi(pszBuckets);
-        if( nBucketCount < 2 )
-        {
-            free( pafRawData );
-            msSetError( MS_MISCERR, 
-                        "SCALE_BUCKETS PROCESSING option is not a value of 2 or more: %s.",
-                        "msDrawRasterLayerGDAL_16BitClassification()",
-                        pszBuckets );
-            return -1;
-        }
     }
 
 /* -------------------------------------------------------------------- */
@@ -2331,7 +2928,9 @@ msDrawRasterLayerGDAL_16BitClassification(
     if( dfScaleMax == dfScaleMin )
         dfScaleMax = dfScaleMin + 1.0;
 
-    dfScaleRatio = nBucketCount / (dfScaleMax - dfScaleMin);
+    ctx.dfScaleMin = dfScaleMin;
+    ctx.dfScaleRatio = nBucketCount / (dfScaleMax - dfScaleMin);
+    ctx.nBucketCount = nBucketCount;
 
     if( layer->debug > 0 )
         msDebug( "msDrawRasterGDAL_16BitClassification(%s):\n"
@@ -2342,19 +2941,19 @@ msDrawRasterLayerGDAL_16BitClassification(
 /*      Compute classification lookup table.                            */
 /* ==================================================================== */
 
-    cmap = (int *) msSmallCalloc(sizeof(int),nBucketCount);
-    rb_cmap[0] = (unsigned char *) msSmallCalloc(1,nBucketCount);
-    rb_cmap[1] = (unsigned char *) msSmallCalloc(1,nBucketCount);
-    rb_cmap[2] = (unsigned char *) msSmallCalloc(1,nBucketCount);
-    rb_cmap[3] = (unsigned char *) msSmallCalloc(1,nBucketCount);
+    ctx.cmap = (int *) msSmallCalloc(sizeof(int),nBucketCount);
+    ctx.rb_cmap[0] = (unsigned char *) msSmallCalloc(1,nBucketCount);
+    ctx.rb_cmap[1] = (unsigned char *) msSmallCalloc(1,nBucketCount);
+    ctx.rb_cmap[2] = (unsigned char *) msSmallCalloc(1,nBucketCount);
+    ctx.rb_cmap[3] = (unsigned char *) msSmallCalloc(1,nBucketCount);
 
     for(i=0; i < nBucketCount; i++) 
     {
         double dfOriginalValue;
 
-        cmap[i] = -1;
+        ctx.cmap[i] = -1;
 
-        dfOriginalValue = (i+0.5) / dfScaleRatio + dfScaleMin;
+        dfOriginalValue = (i+0.5) / ctx.dfScaleRatio + dfScaleMin;
             
         c = msGetClass_FloatRGB(layer, (float) dfOriginalValue, -1, -1, -1);
         if( c != -1 )
@@ -2371,11 +2970,11 @@ msDrawRasterLayerGDAL_16BitClassification(
             if(rb->type == MS_BUFFER_GD) {
             	RESOLVE_PEN_GD(rb->data.gd_img, layer->class[c]->styles[0]->color);
                 if( MS_TRANSPARENT_COLOR(layer->class[c]->styles[0]->color) )
-                    cmap[i] = -1;
+                    ctx.cmap[i] = -1;
                 else if( MS_VALID_COLOR(layer->class[c]->styles[0]->color))
                 {
                     /* use class color */
-                    cmap[i] = layer->class[c]->styles[0]->color.pen;
+                    ctx.cmap[i] = layer->class[c]->styles[0]->color.pen;
                 }
             }
             else if( rb->type == MS_BUFFER_BYTE_RGBA )
@@ -2387,82 +2986,35 @@ msDrawRasterLayerGDAL_16BitClassification(
                 else if( MS_VALID_COLOR(layer->class[c]->styles[0]->color))
                 {
                     /* use class color */
-                    rb_cmap[0][i] = layer->class[c]->styles[0]->color.red;
-                    rb_cmap[1][i] = layer->class[c]->styles[0]->color.green;
-                    rb_cmap[2][i] = layer->class[c]->styles[0]->color.blue;
-                    rb_cmap[3][i] = (255*layer->class[c]->styles[0]->opacity / 100);
+                    ctx.rb_cmap[0][i] = layer->class[c]->styles[0]->color.red;
+                    ctx.rb_cmap[1][i] = layer->class[c]->styles[0]->color.green;
+                    ctx.rb_cmap[2][i] = layer->class[c]->styles[0]->color.blue;
+                    ctx.rb_cmap[3][i] = (255*layer->class[c]->styles[0]->opacity / 100);
                 }
             }
         }
     }
     
 /* ==================================================================== */
-/*      Now process the data, applying to the working imageObj.         */
+/*      Now process the data, applying to the working imageObj, and     */
+/*      reading it first if it wasn't needed for the scaling.           */
 /* ==================================================================== */
-    k = 0;
-
-    for( i = dst_yoff; i < dst_yoff + dst_ysize; i++ )
-    {
-        int	result;
-        
-        for( j = dst_xoff; j < dst_xoff + dst_xsize; j++ )
-        {
-            float fRawValue = pafRawData[k++];
-            int   iMapIndex;
-
-            /* 
-             * Skip nodata pixels ... no processing.
-             */
-            if( bGotNoData && fRawValue == fNoDataValue )
-            {
-                continue;
-            }
-            
-            /*
-             * The funny +1/-1 is to avoid odd rounding around zero.
-             * We could use floor() but sometimes it is expensive. 
-             */
-            iMapIndex = (int) ((fRawValue - dfScaleMin) * dfScaleRatio+1)-1;
-
-            if( iMapIndex >= nBucketCount || iMapIndex < 0 )
-            {
-                continue;
-            }
-
-            if( rb->type == MS_BUFFER_GD )
-            {
-                result = cmap[iMapIndex];
-                if( result == -1 )
-                    continue;
-
-                rb->data.gd_img->pixels[i][j] = result;
-            }
-            else if( rb->type == MS_BUFFER_BYTE_RGBA )
-            {
-                /* currently we never have partial alpha so keep simple */
-                if( rb_cmap[3][iMapIndex] > 0 )
-                    RB_SET_PIXEL( rb, j, i, 
-                                  rb_cmap[0][iMapIndex], 
-                                  rb_cmap[1][iMapIndex], 
-                                  rb_cmap[2][iMapIndex], 
-                                  rb_cmap[3][iMapIndex] );
-            }
-        }
-    }
+    ctx.bClassify = TRUE;
+    status = msRunRasterStrips( &ctx.strips, &ctx,
+                                bNeedMinMax ? NULL : msRead16BitClassificationStrip,
+                                msProcess16BitClassificationStrip );
 
 /* -------------------------------------------------------------------- */
 /*      Cleanup                                                         */
 /* -------------------------------------------------------------------- */
-    free( pafRawData );
-    free( cmap );
-    free( rb_cmap[0] );
-    free( rb_cmap[1] );
-    free( rb_cmap[2] );
-    free( rb_cmap[3] );
+    free( ctx.pafRawData );
+    free( ctx.cmap );
+    free( ctx.rb_cmap[0] );
+    free( ctx.rb_cmap[1] );
+    free( ctx.rb_cmap[2] );
+    free( ctx.rb_cmap[3] );
 
-    assert( k == dst_xsize * dst_ysize );
-
-    return 0;
+    return status;
 }
 
 /************************************************************************/
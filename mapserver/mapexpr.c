@@ -0,0 +1,791 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Compilation of logical/text expressions to a small postfix
+ *           program, evaluated without going through yyparse().
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** The token list built by msTokenizeExpression() is normally handed to
+** yyparse() for every shape it is evaluated against, which re-runs the
+** grammar (and strdup()s every string token) each time. msCompileExpression()
+** walks the token list once, resolves the type of every sub-expression the
+** way mapparser.y does and emits a postfix program with the operand types
+** baked into the opcodes. msRunExpression() then only has to run that
+** program over a small value stack.
+**
+** Anything the compiler does not handle (the geometry operators and
+** functions, or a token sequence the grammar would reject) simply leaves
+** expr->program NULL, and msRunExpression() falls back to yyparse(), so the
+** two paths always agree on what an expression means.
+*/
+
+#include <math.h>
+
+#include "mapserver.h"
+#include "maptime.h"
+#include "mapparser.h" /* for the IN token */
+
+MS_CVSID("$Id$")
+
+extern int yyparse(parseObj *);
+
+#define MS_EXPR_MAXSTACK 32
+
+/* types of (sub-)expression values, mirrors the grammar's non-terminals */
+enum MS_EXPR_TYPE_ENUM { MS_EXPR_LOGICAL, MS_EXPR_MATH, MS_EXPR_STRING, MS_EXPR_TIME };
+
+enum MS_EXPR_OP_ENUM {
+  MS_EXPR_OP_NUMBER, MS_EXPR_OP_STRING, MS_EXPR_OP_TIME,
+  MS_EXPR_OP_BIND_NUMBER, MS_EXPR_OP_BIND_STRING, MS_EXPR_OP_BIND_TIME,
+  MS_EXPR_OP_TOLOGICAL, MS_EXPR_OP_OR, MS_EXPR_OP_AND, MS_EXPR_OP_NOT,
+  MS_EXPR_OP_EQ_NUM, MS_EXPR_OP_NE_NUM, MS_EXPR_OP_GT_NUM, MS_EXPR_OP_LT_NUM, MS_EXPR_OP_GE_NUM, MS_EXPR_OP_LE_NUM,
+  MS_EXPR_OP_EQ_STR, MS_EXPR_OP_NE_STR, MS_EXPR_OP_GT_STR, MS_EXPR_OP_LT_STR, MS_EXPR_OP_GE_STR, MS_EXPR_OP_LE_STR, MS_EXPR_OP_IEQ_STR,
+  MS_EXPR_OP_EQ_TIME, MS_EXPR_OP_NE_TIME, MS_EXPR_OP_GT_TIME, MS_EXPR_OP_LT_TIME, MS_EXPR_OP_GE_TIME, MS_EXPR_OP_LE_TIME,
+  MS_EXPR_OP_RE, MS_EXPR_OP_IRE, MS_EXPR_OP_RE_COMPILED,
+  MS_EXPR_OP_IN_STR, MS_EXPR_OP_IN_NUM, MS_EXPR_OP_IN_STR_LIST, MS_EXPR_OP_IN_NUM_LIST,
+  MS_EXPR_OP_ADD, MS_EXPR_OP_SUB, MS_EXPR_OP_MUL, MS_EXPR_OP_DIV, MS_EXPR_OP_MOD, MS_EXPR_OP_POW,
+  MS_EXPR_OP_CONCAT, MS_EXPR_OP_LENGTH, MS_EXPR_OP_ROUND, MS_EXPR_OP_TOSTRING, MS_EXPR_OP_COMMIFY
+};
+
+typedef struct {
+  int op;
+  int index; /* item index of attribute bindings */
+  double dblval;
+  char *strval; /* string literal, or the pattern/list folded into a RE or IN op */
+  struct tm tmval;
+  ms_regex_t regex; /* pre-compiled pattern for MS_EXPR_OP_RE_COMPILED */
+  char **values; /* pre-split list for MS_EXPR_OP_IN_xxx_LIST */
+  double *numbers;
+  int numvalues;
+} exprInstructionObj;
+
+struct exprProgram {
+  exprInstructionObj *code;
+  int numcode;
+  int maxcode;
+  int depth, maxdepth; /* value stack usage, tracked while compiling */
+  int type; /* type of the value left on the stack (MS_EXPR_xxx) */
+};
+
+typedef struct {
+  union {
+    double dblval;
+    int intval;
+    char *strval;
+    struct tm tmval;
+  } val;
+  int owned; /* strval was allocated by the program and must be freed */
+} exprValueObj;
+
+/*
+** Compiler
+*/
+
+typedef struct {
+  tokenListNodeObjPtr token; /* next token to consume */
+  exprProgramObj *program;
+} exprCompilerObj;
+
+static int compileExpression(exprCompilerObj *c, int minprec, int *type);
+
+static exprInstructionObj *emitInstruction(exprCompilerObj *c, int op, int delta)
+{
+  exprProgramObj *program = c->program;
+  exprInstructionObj *instr;
+
+  if(program->numcode == program->maxcode) {
+    program->maxcode += 16;
+    program->code = (exprInstructionObj *) msSmallRealloc(program->code, sizeof(exprInstructionObj) * program->maxcode);
+  }
+  instr = program->code + program->numcode++;
+  memset(instr, 0, sizeof(exprInstructionObj));
+  instr->op = op;
+
+  program->depth += delta;
+  if(program->depth > program->maxdepth) program->maxdepth = program->depth;
+
+  return instr;
+}
+
+/* binding precedence of binary operators, 0 if the token isn't one (see the %left lines of mapparser.y) */
+static int binaryPrecedence(int token)
+{
+  switch(token) {
+  case MS_TOKEN_LOGICAL_OR:
+    return 1;
+  case MS_TOKEN_LOGICAL_AND:
+    return 2;
+  case MS_TOKEN_COMPARISON_EQ:
+  case MS_TOKEN_COMPARISON_NE:
+  case MS_TOKEN_COMPARISON_GT:
+  case MS_TOKEN_COMPARISON_LT:
+  case MS_TOKEN_COMPARISON_GE:
+  case MS_TOKEN_COMPARISON_LE:
+  case MS_TOKEN_COMPARISON_IEQ:
+  case MS_TOKEN_COMPARISON_RE:
+  case MS_TOKEN_COMPARISON_IRE:
+  case IN:
+    return 4;
+  case '+':
+  case '-':
+    return 9;
+  case '*':
+  case '/':
+  case '%':
+    return 10;
+  case '^':
+    return 12;
+  }
+  return 0;
+}
+
+static int expectToken(exprCompilerObj *c, int token)
+{
+  if(!c->token || c->token->token != token) return MS_FAILURE;
+  c->token = c->token->next;
+  return MS_SUCCESS;
+}
+
+/* LOGICAL and MATH operands are both accepted wherever the grammar wants a logical_exp */
+static int toLogical(exprCompilerObj *c, int *type)
+{
+  if(*type == MS_EXPR_MATH)
+    emitInstruction(c, MS_EXPR_OP_TOLOGICAL, 0);
+  else if(*type != MS_EXPR_LOGICAL)
+    return MS_FAILURE;
+  *type = MS_EXPR_LOGICAL;
+  return MS_SUCCESS;
+}
+
+/* compiles a function argument list: '(' type [',' type] ')' */
+static int compileArguments(exprCompilerObj *c, int type1, int type2)
+{
+  int type;
+
+  if(expectToken(c, '(') != MS_SUCCESS) return MS_FAILURE;
+  if(compileExpression(c, 1, &type) != MS_SUCCESS || type != type1) return MS_FAILURE;
+  if(type2 != -1) {
+    if(expectToken(c, ',') != MS_SUCCESS) return MS_FAILURE;
+    if(compileExpression(c, 1, &type) != MS_SUCCESS || type != type2) return MS_FAILURE;
+  }
+  return expectToken(c, ')');
+}
+
+static int compilePrimary(exprCompilerObj *c, int *type)
+{
+  tokenListNodeObjPtr token = c->token;
+  exprInstructionObj *instr;
+
+  if(!token) return MS_FAILURE;
+  c->token = token->next;
+
+  switch(token->token) {
+  case MS_TOKEN_LITERAL_NUMBER:
+    instr = emitInstruction(c, MS_EXPR_OP_NUMBER, 1);
+    instr->dblval = token->tokenval.dblval;
+    *type = MS_EXPR_MATH;
+    break;
+  case MS_TOKEN_LITERAL_STRING:
+    instr = emitInstruction(c, MS_EXPR_OP_STRING, 1);
+    instr->strval = msStrdup(token->tokenval.strval);
+    *type = MS_EXPR_STRING;
+    break;
+  case MS_TOKEN_LITERAL_TIME:
+    instr = emitInstruction(c, MS_EXPR_OP_TIME, 1);
+    instr->tmval = token->tokenval.tmval;
+    *type = MS_EXPR_TIME;
+    break;
+  case MS_TOKEN_BINDING_DOUBLE:
+  case MS_TOKEN_BINDING_INTEGER:
+    instr = emitInstruction(c, MS_EXPR_OP_BIND_NUMBER, 1);
+    instr->index = token->tokenval.bindval.index;
+    *type = MS_EXPR_MATH;
+    break;
+  case MS_TOKEN_BINDING_STRING:
+    instr = emitInstruction(c, MS_EXPR_OP_BIND_STRING, 1);
+    instr->index = token->tokenval.bindval.index;
+    *type = MS_EXPR_STRING;
+    break;
+  case MS_TOKEN_BINDING_TIME:
+    instr = emitInstruction(c, MS_EXPR_OP_BIND_TIME, 1);
+    instr->index = token->tokenval.bindval.index;
+    *type = MS_EXPR_TIME;
+    break;
+  case '(':
+    if(compileExpression(c, 1, type) != MS_SUCCESS) return MS_FAILURE;
+    return expectToken(c, ')');
+  case MS_TOKEN_LOGICAL_NOT:
+    if(compileExpression(c, 4, type) != MS_SUCCESS) return MS_FAILURE;
+    if(toLogical(c, type) != MS_SUCCESS) return MS_FAILURE;
+    emitInstruction(c, MS_EXPR_OP_NOT, 0);
+    break;
+  case '-': /* unary minus, which the grammar defines as a no-op */
+    if(compileExpression(c, 12, type) != MS_SUCCESS || *type != MS_EXPR_MATH) return MS_FAILURE;
+    break;
+  case MS_TOKEN_FUNCTION_LENGTH:
+    if(compileArguments(c, MS_EXPR_STRING, -1) != MS_SUCCESS) return MS_FAILURE;
+    emitInstruction(c, MS_EXPR_OP_LENGTH, 0);
+    *type = MS_EXPR_MATH;
+    break;
+  case MS_TOKEN_FUNCTION_ROUND:
+    if(compileArguments(c, MS_EXPR_MATH, MS_EXPR_MATH) != MS_SUCCESS) return MS_FAILURE;
+    emitInstruction(c, MS_EXPR_OP_ROUND, -1);
+    *type = MS_EXPR_MATH;
+    break;
+  case MS_TOKEN_FUNCTION_TOSTRING:
+    if(compileArguments(c, MS_EXPR_MATH, MS_EXPR_STRING) != MS_SUCCESS) return MS_FAILURE;
+    emitInstruction(c, MS_EXPR_OP_TOSTRING, -1);
+    *type = MS_EXPR_STRING;
+    break;
+  case MS_TOKEN_FUNCTION_COMMIFY:
+    if(compileArguments(c, MS_EXPR_STRING, -1) != MS_SUCCESS) return MS_FAILURE;
+    emitInstruction(c, MS_EXPR_OP_COMMIFY, 0);
+    *type = MS_EXPR_STRING;
+    break;
+  default: /* shapes, geometry functions and anything unexpected are left to yyparse() */
+    return MS_FAILURE;
+  }
+
+  return MS_SUCCESS;
+}
+
+/*
+** Folds a literal right hand side of RE/IRE/IN into the operator itself so
+** the pattern is compiled, or the list split, once instead of per feature.
+** rhs is the first instruction of the right operand.
+*/
+static int foldLiteralOperand(exprCompilerObj *c, int rhs, int token, int ltype)
+{
+  exprProgramObj *program = c->program;
+  exprInstructionObj *instr;
+  char *bufferp, *delim;
+  int n;
+
+  if(rhs != program->numcode-1 || program->code[rhs].op != MS_EXPR_OP_STRING) return MS_FALSE;
+  instr = program->code + rhs;
+
+  if(token == MS_TOKEN_COMPARISON_RE || token == MS_TOKEN_COMPARISON_IRE) {
+    int flags = MS_REG_EXTENDED|MS_REG_NOSUB;
+    if(token == MS_TOKEN_COMPARISON_IRE) flags |= MS_REG_ICASE;
+    if(ms_regcomp(&(instr->regex), instr->strval, flags) != 0) return MS_FALSE;
+    instr->op = MS_EXPR_OP_RE_COMPILED;
+  } else { /* IN */
+    n = 1;
+    for(bufferp=instr->strval; (delim=strchr(bufferp, ',')) != NULL; bufferp=delim+1) n++;
+
+    if(ltype == MS_EXPR_STRING) {
+      instr->values = (char **) msSmallMalloc(sizeof(char *) * n);
+      n = 0;
+      bufferp = instr->strval;
+      while((delim=strchr(bufferp, ',')) != NULL) {
+        *delim = '\0';
+        instr->values[n++] = bufferp;
+        bufferp = delim+1;
+      }
+      instr->values[n++] = bufferp;
+      instr->op = MS_EXPR_OP_IN_STR_LIST;
+    } else {
+      instr->numbers = (double *) msSmallMalloc(sizeof(double) * n);
+      n = 0;
+      bufferp = instr->strval;
+      do {
+        instr->numbers[n++] = atof(bufferp); /* atof() stops at the comma */
+        delim = strchr(bufferp, ',');
+        bufferp = delim+1;
+      } while(delim != NULL);
+      instr->op = MS_EXPR_OP_IN_NUM_LIST;
+    }
+    instr->numvalues = n;
+  }
+
+  program->depth--; /* the literal is no longer pushed */
+  return MS_TRUE;
+}
+
+static int compileBinary(exprCompilerObj *c, int token, int *ltype, int rtype, int rhs)
+{
+  int op = -1;
+
+  switch(token) {
+  case MS_TOKEN_LOGICAL_OR:
+  case MS_TOKEN_LOGICAL_AND:
+    if(toLogical(c, &rtype) != MS_SUCCESS) return MS_FAILURE;
+    op = (token == MS_TOKEN_LOGICAL_OR)?MS_EXPR_OP_OR:MS_EXPR_OP_AND;
+    break;
+  case MS_TOKEN_COMPARISON_EQ:
+  case MS_TOKEN_COMPARISON_NE:
+  case MS_TOKEN_COMPARISON_GT:
+  case MS_TOKEN_COMPARISON_LT:
+  case MS_TOKEN_COMPARISON_GE:
+  case MS_TOKEN_COMPARISON_LE:
+  case MS_TOKEN_COMPARISON_IEQ:
+    if(*ltype != rtype) return MS_FAILURE;
+    if(token == MS_TOKEN_COMPARISON_IEQ) {
+      if(rtype == MS_EXPR_STRING) {
+        op = MS_EXPR_OP_IEQ_STR;
+        break;
+      }
+      token = MS_TOKEN_COMPARISON_EQ; /* numbers and times have no case */
+    }
+    switch(token) { /* offset of the comparison within each group of opcodes */
+    case MS_TOKEN_COMPARISON_EQ: op = 0; break;
+    case MS_TOKEN_COMPARISON_NE: op = 1; break;
+    case MS_TOKEN_COMPARISON_GT: op = 2; break;
+    case MS_TOKEN_COMPARISON_LT: op = 3; break;
+    case MS_TOKEN_COMPARISON_GE: op = 4; break;
+    default: op = 5; break; /* MS_TOKEN_COMPARISON_LE */
+    }
+    if(rtype == MS_EXPR_MATH)
+      op += MS_EXPR_OP_EQ_NUM;
+    else if(rtype == MS_EXPR_STRING)
+      op += MS_EXPR_OP_EQ_STR;
+    else if(rtype == MS_EXPR_TIME)
+      op += MS_EXPR_OP_EQ_TIME;
+    else
+      return MS_FAILURE;
+    break;
+  case MS_TOKEN_COMPARISON_RE:
+  case MS_TOKEN_COMPARISON_IRE:
+    if(*ltype != MS_EXPR_STRING || rtype != MS_EXPR_STRING) return MS_FAILURE;
+    if(foldLiteralOperand(c, rhs, token, *ltype)) {
+      *ltype = MS_EXPR_LOGICAL;
+      return MS_SUCCESS;
+    }
+    op = (token == MS_TOKEN_COMPARISON_RE)?MS_EXPR_OP_RE:MS_EXPR_OP_IRE;
+    break;
+  case IN:
+    if((*ltype != MS_EXPR_STRING && *ltype != MS_EXPR_MATH) || rtype != MS_EXPR_STRING) return MS_FAILURE;
+    if(foldLiteralOperand(c, rhs, token, *ltype)) {
+      *ltype = MS_EXPR_LOGICAL;
+      return MS_SUCCESS;
+    }
+    op = (*ltype == MS_EXPR_STRING)?MS_EXPR_OP_IN_STR:MS_EXPR_OP_IN_NUM;
+    break;
+  case '+':
+    if(*ltype != rtype) return MS_FAILURE;
+    if(rtype == MS_EXPR_STRING) {
+      emitInstruction(c, MS_EXPR_OP_CONCAT, -1);
+      return MS_SUCCESS;
+    }
+    /* fall through to the math operators */
+  default:
+    if(*ltype != MS_EXPR_MATH || rtype != MS_EXPR_MATH) return MS_FAILURE;
+    switch(token) {
+    case '+': op = MS_EXPR_OP_ADD; break;
+    case '-': op = MS_EXPR_OP_SUB; break;
+    case '*': op = MS_EXPR_OP_MUL; break;
+    case '/': op = MS_EXPR_OP_DIV; break;
+    case '%': op = MS_EXPR_OP_MOD; break;
+    case '^': op = MS_EXPR_OP_POW; break;
+    default: return MS_FAILURE;
+    }
+    emitInstruction(c, op, -1);
+    return MS_SUCCESS; /* type stays MATH */
+  }
+
+  emitInstruction(c, op, -1);
+  *ltype = MS_EXPR_LOGICAL;
+  return MS_SUCCESS;
+}
+
+/* precedence climbing over the token list, minprec is the loosest operator accepted */
+static int compileExpression(exprCompilerObj *c, int minprec, int *type)
+{
+  int token, prec, rtype, rhs;
+
+  if(compilePrimary(c, type) != MS_SUCCESS) return MS_FAILURE;
+
+  while(c->token && (prec = binaryPrecedence(c->token->token)) >= minprec && prec > 0) {
+    token = c->token->token;
+    c->token = c->token->next;
+
+    if(token == MS_TOKEN_LOGICAL_OR || token == MS_TOKEN_LOGICAL_AND) {
+      if(toLogical(c, type) != MS_SUCCESS) return MS_FAILURE;
+    }
+
+    rhs = c->program->numcode;
+    if(compileExpression(c, (token == '^')?prec:prec+1, &rtype) != MS_SUCCESS) return MS_FAILURE; /* ^ is right associative */
+    if(compileBinary(c, token, type, rtype, rhs) != MS_SUCCESS) return MS_FAILURE;
+  }
+
+  return MS_SUCCESS;
+}
+
+static void freeProgram(exprProgramObj *program)
+{
+  int i;
+
+  for(i=0; i<program->numcode; i++) {
+    exprInstructionObj *instr = program->code + i;
+    if(instr->op == MS_EXPR_OP_RE_COMPILED) ms_regfree(&(instr->regex));
+    msFree(instr->strval);
+    msFree(instr->values);
+    msFree(instr->numbers);
+  }
+  msFree(program->code);
+  msFree(program);
+}
+
+/*
+** Compiles expr->tokens into expr->program. Attribute bindings must already
+** carry their item index (see msTokenizeExpression()). Returns MS_FAILURE,
+** without setting an error, for expressions that have to go through
+** yyparse().
+*/
+int msCompileExpression(expressionObj *expr)
+{
+  exprCompilerObj c;
+  int type;
+
+  msFreeExpressionProgram(expr);
+  if(expr->type != MS_EXPRESSION || !expr->tokens) return MS_FAILURE;
+
+  c.token = expr->tokens;
+  c.program = (exprProgramObj *) msSmallCalloc(1, sizeof(exprProgramObj));
+
+  if(compileExpression(&c, 1, &type) != MS_SUCCESS ||
+     c.token != NULL || /* trailing tokens, a syntax error for the grammar */
+     type == MS_EXPR_TIME || /* not a valid result of a whole expression */
+     c.program->maxdepth > MS_EXPR_MAXSTACK) {
+    freeProgram(c.program);
+    return MS_FAILURE;
+  }
+
+  c.program->type = type;
+  expr->program = c.program;
+  return MS_SUCCESS;
+}
+
+void msFreeExpressionProgram(expressionObj *expr)
+{
+  if(!expr || !expr->program) return;
+  freeProgram(expr->program);
+  expr->program = NULL;
+}
+
+/*
+** Interpreter
+*/
+
+static char *getBinding(shapeObj *shape, int index)
+{
+  if(!shape || index < 0 || index >= shape->numvalues || !shape->values[index]) {
+    msSetError(MS_MISCERR, "Invalid item index.", "msRunExpression()");
+    return NULL;
+  }
+  return shape->values[index];
+}
+
+static int inList(const char *value, const char *list)
+{
+  const char *delim;
+  size_t length = strlen(value);
+
+  for(;;) {
+    delim = strchr(list, ',');
+    if(delim == NULL) return (strcmp(value, list) == 0)?MS_TRUE:MS_FALSE;
+    if((size_t)(delim - list) == length && strncmp(value, list, length) == 0) return MS_TRUE;
+    list = delim+1;
+  }
+}
+
+static int inNumberList(double value, const char *list)
+{
+  const char *delim;
+
+  for(;;) {
+    if(value == atof(list)) return MS_TRUE;
+    if((delim = strchr(list, ',')) == NULL) return MS_FALSE;
+    list = delim+1;
+  }
+}
+
+/* frees a string operand, the slot is then reused for a non-string result */
+#define RELEASE(v) do { if((v)->owned) free((v)->val.strval); (v)->owned = MS_FALSE; } while(0)
+
+static int runProgram(exprProgramObj *program, shapeObj *shape, exprValueObj *result)
+{
+  exprValueObj stack[MS_EXPR_MAXSTACK];
+  exprValueObj *top = stack - 1, *rhs;
+  exprInstructionObj *instr = program->code, *end = program->code + program->numcode;
+  char *s;
+  int i, cmp;
+
+  for(; instr < end; instr++) {
+    switch(instr->op) {
+    case MS_EXPR_OP_NUMBER:
+      (++top)->val.dblval = instr->dblval;
+      top->owned = MS_FALSE;
+      break;
+    case MS_EXPR_OP_STRING:
+      (++top)->val.strval = instr->strval;
+      top->owned = MS_FALSE;
+      break;
+    case MS_EXPR_OP_TIME:
+      (++top)->val.tmval = instr->tmval;
+      top->owned = MS_FALSE;
+      break;
+    case MS_EXPR_OP_BIND_NUMBER:
+      if((s = getBinding(shape, instr->index)) == NULL) goto eval_error;
+      (++top)->val.dblval = atof(s);
+      top->owned = MS_FALSE;
+      break;
+    case MS_EXPR_OP_BIND_STRING:
+      if((s = getBinding(shape, instr->index)) == NULL) goto eval_error;
+      (++top)->val.strval = s;
+      top->owned = MS_FALSE;
+      break;
+    case MS_EXPR_OP_BIND_TIME:
+      if((s = getBinding(shape, instr->index)) == NULL) goto eval_error;
+      (++top)->owned = MS_FALSE;
+      msTimeInit(&(top->val.tmval));
+      if(msParseTime(s, &(top->val.tmval)) != MS_TRUE) {
+        top--;
+        msSetError(MS_PARSEERR, "Parsing time value failed.", "msRunExpression()");
+        goto eval_error;
+      }
+      break;
+
+    case MS_EXPR_OP_TOLOGICAL:
+      top->val.intval = (top->val.dblval != 0)?MS_TRUE:MS_FALSE;
+      break;
+    case MS_EXPR_OP_OR:
+      top--;
+      top->val.intval = (top->val.intval == MS_TRUE || top[1].val.intval == MS_TRUE)?MS_TRUE:MS_FALSE;
+      break;
+    case MS_EXPR_OP_AND:
+      top--;
+      top->val.intval = (top->val.intval == MS_TRUE && top[1].val.intval == MS_TRUE)?MS_TRUE:MS_FALSE;
+      break;
+    case MS_EXPR_OP_NOT:
+      top->val.intval = !top->val.intval;
+      break;
+
+    case MS_EXPR_OP_EQ_NUM: top--; top->val.intval = (top->val.dblval == top[1].val.dblval); break;
+    case MS_EXPR_OP_NE_NUM: top--; top->val.intval = (top->val.dblval != top[1].val.dblval); break;
+    case MS_EXPR_OP_GT_NUM: top--; top->val.intval = (top->val.dblval > top[1].val.dblval); break;
+    case MS_EXPR_OP_LT_NUM: top--; top->val.intval = (top->val.dblval < top[1].val.dblval); break;
+    case MS_EXPR_OP_GE_NUM: top--; top->val.intval = (top->val.dblval >= top[1].val.dblval); break;
+    case MS_EXPR_OP_LE_NUM: top--; top->val.intval = (top->val.dblval <= top[1].val.dblval); break;
+
+    case MS_EXPR_OP_EQ_STR:
+    case MS_EXPR_OP_NE_STR:
+    case MS_EXPR_OP_GT_STR:
+    case MS_EXPR_OP_LT_STR:
+    case MS_EXPR_OP_GE_STR:
+    case MS_EXPR_OP_LE_STR:
+    case MS_EXPR_OP_IEQ_STR:
+      rhs = top--;
+      if(instr->op == MS_EXPR_OP_IEQ_STR)
+        cmp = strcasecmp(top->val.strval, rhs->val.strval);
+      else
+        cmp = strcmp(top->val.strval, rhs->val.strval);
+      RELEASE(top);
+      RELEASE(rhs);
+      switch(instr->op) {
+      case MS_EXPR_OP_NE_STR: top->val.intval = (cmp != 0); break;
+      case MS_EXPR_OP_GT_STR: top->val.intval = (cmp > 0); break;
+      case MS_EXPR_OP_LT_STR: top->val.intval = (cmp < 0); break;
+      case MS_EXPR_OP_GE_STR: top->val.intval = (cmp >= 0); break;
+      case MS_EXPR_OP_LE_STR: top->val.intval = (cmp <= 0); break;
+      default: top->val.intval = (cmp == 0); break; /* EQ, IEQ */
+      }
+      break;
+
+    case MS_EXPR_OP_EQ_TIME: top--; top->val.intval = (msTimeCompare(&(top->val.tmval), &(top[1].val.tmval)) == 0); break;
+    case MS_EXPR_OP_NE_TIME: top--; top->val.intval = (msTimeCompare(&(top->val.tmval), &(top[1].val.tmval)) != 0); break;
+    case MS_EXPR_OP_GT_TIME: top--; top->val.intval = (msTimeCompare(&(top->val.tmval), &(top[1].val.tmval)) > 0); break;
+    case MS_EXPR_OP_LT_TIME: top--; top->val.intval = (msTimeCompare(&(top->val.tmval), &(top[1].val.tmval)) < 0); break;
+    case MS_EXPR_OP_GE_TIME: top--; top->val.intval = (msTimeCompare(&(top->val.tmval), &(top[1].val.tmval)) >= 0); break;
+    case MS_EXPR_OP_LE_TIME: top--; top->val.intval = (msTimeCompare(&(top->val.tmval), &(top[1].val.tmval)) <= 0); break;
+
+    case MS_EXPR_OP_RE:
+    case MS_EXPR_OP_IRE:
+      {
+        ms_regex_t re;
+        int flags = MS_REG_EXTENDED|MS_REG_NOSUB;
+
+        if(instr->op == MS_EXPR_OP_IRE) flags |= MS_REG_ICASE;
+        rhs = top--;
+        cmp = MS_FALSE;
+        if(ms_regcomp(&re, rhs->val.strval, flags) == 0) {
+          if(ms_regexec(&re, top->val.strval, 0, NULL, 0) == 0) cmp = MS_TRUE;
+          ms_regfree(&re);
+        }
+        RELEASE(top);
+        RELEASE(rhs);
+        top->val.intval = cmp;
+      }
+      break;
+    case MS_EXPR_OP_RE_COMPILED:
+      cmp = (ms_regexec(&(instr->regex), top->val.strval, 0, NULL, 0) == 0)?MS_TRUE:MS_FALSE;
+      RELEASE(top);
+      top->val.intval = cmp;
+      break;
+
+    case MS_EXPR_OP_IN_STR:
+      rhs = top--;
+      cmp = inList(top->val.strval, rhs->val.strval);
+      RELEASE(top);
+      RELEASE(rhs);
+      top->val.intval = cmp;
+      break;
+    case MS_EXPR_OP_IN_NUM:
+      rhs = top--;
+      cmp = inNumberList(top->val.dblval, rhs->val.strval);
+      RELEASE(rhs);
+      top->val.intval = cmp;
+      break;
+    case MS_EXPR_OP_IN_STR_LIST:
+      cmp = MS_FALSE;
+      for(i=0; i<instr->numvalues; i++) {
+        if(strcmp(top->val.strval, instr->values[i]) == 0) {
+          cmp = MS_TRUE;
+          break;
+        }
+      }
+      RELEASE(top);
+      top->val.intval = cmp;
+      break;
+    case MS_EXPR_OP_IN_NUM_LIST:
+      cmp = MS_FALSE;
+      for(i=0; i<instr->numvalues; i++) {
+        if(top->val.dblval == instr->numbers[i]) {
+          cmp = MS_TRUE;
+          break;
+        }
+      }
+      top->val.intval = cmp;
+      break;
+
+    case MS_EXPR_OP_ADD: top--; top->val.dblval += top[1].val.dblval; break;
+    case MS_EXPR_OP_SUB: top--; top->val.dblval -= top[1].val.dblval; break;
+    case MS_EXPR_OP_MUL: top--; top->val.dblval *= top[1].val.dblval; break;
+    case MS_EXPR_OP_DIV:
+      top--;
+      if(top[1].val.dblval == 0.0) {
+        msSetError(MS_PARSEERR, "Division by zero.", "msRunExpression()");
+        goto eval_error;
+      }
+      top->val.dblval /= top[1].val.dblval;
+      break;
+    case MS_EXPR_OP_MOD:
+      top--;
+      if((int)top[1].val.dblval == 0) {
+        msSetError(MS_PARSEERR, "Division by zero.", "msRunExpression()");
+        goto eval_error;
+      }
+      top->val.dblval = (int)top->val.dblval % (int)top[1].val.dblval;
+      break;
+    case MS_EXPR_OP_POW: top--; top->val.dblval = pow(top->val.dblval, top[1].val.dblval); break;
+
+    case MS_EXPR_OP_CONCAT:
+      rhs = top--;
+      s = (char *) msSmallMalloc(strlen(top->val.strval) + strlen(rhs->val.strval) + 1);
+      sprintf(s, "%s%s", top->val.strval, rhs->val.strval);
+      RELEASE(top);
+      RELEASE(rhs);
+      top->val.strval = s;
+      top->owned = MS_TRUE;
+      break;
+    case MS_EXPR_OP_LENGTH:
+      s = top->val.strval;
+      top->val.dblval = strlen(s);
+      if(top->owned) free(s);
+      top->owned = MS_FALSE;
+      break;
+    case MS_EXPR_OP_ROUND:
+      top--;
+      top->val.dblval = (MS_NINT(top->val.dblval/top[1].val.dblval))*top[1].val.dblval;
+      break;
+    case MS_EXPR_OP_TOSTRING:
+      rhs = top--;
+      s = (char *) msSmallMalloc(strlen(rhs->val.strval) + 64); /* same sizing as the grammar */
+      sprintf(s, rhs->val.strval, top->val.dblval);
+      RELEASE(rhs);
+      top->val.strval = s;
+      top->owned = MS_TRUE;
+      break;
+    case MS_EXPR_OP_COMMIFY:
+      s = top->owned?top->val.strval:msStrdup(top->val.strval);
+      top->val.strval = msCommifyString(s);
+      top->owned = MS_TRUE;
+      break;
+    }
+  }
+
+  *result = *top;
+  return MS_SUCCESS;
+
+  eval_error:
+  for(; top >= stack; top--)
+    RELEASE(top);
+  return MS_FAILURE;
+}
+
+/*
+** Drop-in replacement for yyparse(p): evaluates p->expr against p->shape
+** using the compiled program when there is one. Returns 0 on success, like
+** yyparse().
+*/
+int msRunExpression(parseObj *p)
+{
+  exprProgramObj *program = p->expr->program;
+  exprValueObj result;
+
+  if(!program || p->type == MS_PARSE_TYPE_SHAPE) {
+    p->expr->curtoken = p->expr->tokens; /* reset */
+    return yyparse(p);
+  }
+
+  if(runProgram(program, p->shape, &result) != MS_SUCCESS)
+    return -1;
+
+  switch(p->type) {
+  case(MS_PARSE_TYPE_BOOLEAN):
+    if(program->type == MS_EXPR_LOGICAL)
+      p->result.intval = result.val.intval;
+    else if(program->type == MS_EXPR_MATH)
+      p->result.intval = (result.val.dblval != 0)?MS_TRUE:MS_FALSE;
+    else { /* string */
+      RELEASE(&result);
+      p->result.intval = MS_TRUE;
+    }
+    break;
+  case(MS_PARSE_TYPE_STRING):
+    if(program->type == MS_EXPR_LOGICAL)
+      p->result.strval = msStrdup(result.val.intval?"true":"false");
+    else if(program->type == MS_EXPR_MATH) {
+      p->result.strval = (char *) msSmallMalloc(64); /* large enough for a double */
+      snprintf(p->result.strval, 64, "%g", result.val.dblval);
+    } else
+      p->result.strval = result.owned?result.val.strval:msStrdup(result.val.strval);
+    break;
+  }
+
+  return 0;
+}
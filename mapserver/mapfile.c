@@ -1028,6 +1028,11 @@ int msInitProjection(projectionObj *p)
   p->args = NULL;
 #ifdef USE_PROJ  
   p->proj = NULL;
+#  if PJ_VERSION >= 480
+  p->proj_ctx = NULL;
+#  endif
+  p->proj_refcount = NULL;
+  p->proj_lock = MS_FALSE;
   p->args = (char **)malloc(MS_MAXPROJARGS*sizeof(char *));
   MS_CHECK_ALLOC(p->args, MS_MAXPROJARGS*sizeof(char *), -1);
 #endif
@@ -1036,11 +1041,33 @@ int msInitProjection(projectionObj *p)
 
 void msFreeProjection(projectionObj *p) {
 #ifdef USE_PROJ
+  if(p->proj_refcount)
+  {
+      /* only the last user of a shared PROJ object frees it */
+      if(--(*p->proj_refcount) > 0)
+      {
+          p->proj = NULL;
+#  if PJ_VERSION >= 480
+          p->proj_ctx = NULL;
+#  endif
+      }
+      else
+          free(p->proj_refcount);
+      p->proj_refcount = NULL;
+  }
+
   if(p->proj)
   {
       pj_free(p->proj);
       p->proj = NULL;
   }
+#  if PJ_VERSION >= 480
+  if(p->proj_ctx)
+  {
+      pj_ctx_free(p->proj_ctx);
+      p->proj_ctx = NULL;
+  }
+#  endif
 
   msFreeCharArray(p->args, p->numargs);  
   p->args = NULL;
@@ -1048,6 +1075,56 @@ void msFreeProjection(projectionObj *p) {
 #endif
 }
 
+/*
+** Mark the PROJ object of a projectionObj as shared: msCopyProjection() then
+** hands the same (reference counted) object to the copy instead of running
+** pj_init() again. Only for objects used from a single thread, such as the
+** mapfiles mapserv keeps preloaded between FastCGI requests.
+*/
+void msShareProjection(projectionObj *p)
+{
+#ifdef USE_PROJ
+  if(p->proj && !p->proj_refcount) {
+    p->proj_refcount = (int *) msSmallMalloc(sizeof(int));
+    *p->proj_refcount = 1;
+  }
+#endif
+}
+
+/*
+** Call pj_init() for a projectionObj.  With PROJ 4.8+ each projectionObj
+** gets its own projCtx so that msProjectPoint() and friends do not need
+** to serialize on TLOCK_PROJ.
+*/
+#ifdef USE_PROJ
+static int msProjectionInit(projectionObj *p, int numargs, char **args)
+{
+#if PJ_VERSION >= 480
+    if( p->proj_ctx == NULL )
+        p->proj_ctx = pj_ctx_alloc();
+
+    if( !(p->proj = pj_init_ctx(p->proj_ctx, numargs, args)) ) {
+        msSetError(MS_PROJERR, pj_strerrno(pj_ctx_get_errno(p->proj_ctx)), 
+                   "msProcessProjection()");	  
+        return(-1);
+    }
+#else
+    msAcquireLock( TLOCK_PROJ );
+    if( !(p->proj = pj_init(numargs, args)) ) {
+        int *pj_errno_ref = pj_get_errno_ref();
+        msReleaseLock( TLOCK_PROJ );
+        msSetError(MS_PROJERR, pj_strerrno(*pj_errno_ref), 
+                   "msProcessProjection()");	  
+        return(-1);
+    }
+    
+    msReleaseLock( TLOCK_PROJ );
+#endif
+
+    return(0);
+}
+#endif /* USE_PROJ */
+
 /*
 ** Handle OGC WMS/WFS AUTO projection in the format:
 **    "AUTO:proj_id,units_id,lon0,lat0"
@@ -1161,16 +1238,10 @@ static int _msProcessAutoProjection(projectionObj *p)
     /* OK, pass the definition to pj_init() */
     args = msStringSplit(szProjBuf, '+', &numargs);
 
-    msAcquireLock( TLOCK_PROJ );
-    if( !(p->proj = pj_init(numargs, args)) ) {
-        int *pj_errno_ref = pj_get_errno_ref();
-        msReleaseLock( TLOCK_PROJ );
-        msSetError(MS_PROJERR, pj_strerrno(*pj_errno_ref), 
-                   "msProcessProjection()");	  
+    if( msProjectionInit(p, numargs, args) != 0 ) {
+        msFreeCharArray(args, numargs);
         return(-1);
     }
-    
-    msReleaseLock( TLOCK_PROJ );
 
     msFreeCharArray(args, numargs);
 
@@ -1205,18 +1276,7 @@ int msProcessProjection(projectionObj *p)
         /*WMS 1.3.0: AUTO2:auto_crs_id,factor,lon0,lat0*/
         return _msProcessAutoProjection(p);
     }
-    msAcquireLock( TLOCK_PROJ );
-    if( !(p->proj = pj_init(p->numargs, p->args)) ) {
-        int *pj_errno_ref = pj_get_errno_ref();
-        msReleaseLock( TLOCK_PROJ );
-        msSetError(MS_PROJERR, pj_strerrno(*pj_errno_ref), 
-                   "msProcessProjection()");	  
-        return(-1);
-    }
-    
-    msReleaseLock( TLOCK_PROJ );
-
-    return(0);
+    return msProjectionInit(p, p->numargs, p->args);
 #else
   msSetError(MS_PROJERR, "Projection support is not available.", 
              "msProcessProjection()");
@@ -2152,6 +2212,7 @@ void initExpression(expressionObj *exp)
   exp->compiled = MS_FALSE;
   exp->flags = 0;
   exp->tokens = exp->curtoken = NULL;
+  exp->program = NULL;
 }
 
 void freeExpressionTokens(expressionObj *exp)
@@ -2161,6 +2222,8 @@ void freeExpressionTokens(expressionObj *exp)
 
   if(!exp) return;
 
+  msFreeExpressionProgram(exp);
+
   if(exp->tokens) {
     node = exp->tokens;
     while (node != NULL) {
@@ -5341,6 +5404,7 @@ int initMap(mapObj *map)
       map->labelcache.slots[i].nummarkers = 0;
   }
   map->labelcache.numlabels = 0;
+  map->labelcache.index = NULL;
 
   map->fontset.filename = NULL;
   map->fontset.numfonts = 0;  
@@ -5488,6 +5552,7 @@ int msFreeLabelCache(labelCacheObj *cache) {
           return MS_FAILURE;
   }
 
+  msFreeLabelCacheIndex(cache);
   cache->numlabels = 0;
 
   return MS_SUCCESS;
@@ -5520,6 +5585,7 @@ int msInitLabelCache(labelCacheObj *cache) {
       if (msInitLabelCacheSlot(&(cache->slots[p])) != MS_SUCCESS)
           return MS_FAILURE;
   }
+  msFreeLabelCacheIndex(cache);
   cache->numlabels = 0;
   cache->gutter = 0;
 
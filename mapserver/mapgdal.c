@@ -45,6 +45,8 @@ MS_CVSID("$Id$")
 
 static int    bGDALInitialized = 0;
 
+static void msGDALPoolFinalCleanup( void );
+
 /************************************************************************/
 /*                          msGDALInitialize()                          */
 /************************************************************************/
@@ -76,6 +78,8 @@ void msGDALCleanup( void )
         int iRepeat = 5;
         msAcquireLock( TLOCK_GDAL );
 
+        msGDALPoolFinalCleanup();
+
 #if GDAL_RELEASE_DATE > 20101207
         {
             /* 
@@ -120,6 +124,269 @@ void msGDALCleanup( void )
     }
 }
 
+/************************************************************************/
+/*                         GDAL dataset pool                            */
+/*                                                                      */
+/*      A process wide pool of open GDAL datasets keyed by path, so     */
+/*      that the files of raster layers and tile indexes are not        */
+/*      opened and their headers parsed again for every request and    */
+/*      every tile.  The pool is shared by all the layers and maps of   */
+/*      the process (FastCGI, mapscript) and its limits are taken from  */
+/*      the map options of the latest request:                          */
+/*                                                                      */
+/*        CONFIG "MS_GDAL_POOL_SIZE" "n": unreferenced datasets kept    */
+/*          open, the least recently used are closed first (default     */
+/*          100, 0 closes datasets when released).                      */
+/*        CONFIG "MS_GDAL_POOL_MEMORY" "mb": the least recently used    */
+/*          unreferenced datasets are also closed while the GDAL block  */
+/*          cache holds more than this (not set by default).            */
+/*                                                                      */
+/*      A dataset is used by one thread at a time, another thread       */
+/*      asking for the same path gets a dataset of its own.  A pooled   */
+/*      dataset whose file was replaced (different modification time   */
+/*      or size) is closed and the file opened again.  All the pool     */
+/*      functions expect the TLOCK_GDAL lock to be held.                */
+/************************************************************************/
+
+#define MS_GDAL_POOL_DEFAULT_SIZE 100
+
+typedef struct {
+    char          *path;
+    GDALDatasetH  hDS;
+    int           ref_count;
+    int           thread_id;
+    unsigned long last_used;
+    int           has_stat; /* FALSE if path is not a file, e.g. a WMS description */
+    time_t        mtime;
+    vsi_l_offset  size;
+} gdalPoolEntry;
+
+static gdalPoolEntry *gdalPool = NULL;
+static int gdalPoolCount = 0;
+static int gdalPoolMax = 0;
+static int gdalPoolSize = MS_GDAL_POOL_DEFAULT_SIZE;
+static int gdalPoolMemory = 0; /* in MB, 0 for no limit */
+static unsigned long gdalPoolClock = 0;
+static unsigned long gdalPoolHits = 0, gdalPoolMisses = 0, gdalPoolEvictions = 0;
+
+static void msGDALPoolClose( int i )
+
+{
+    GDALClose( gdalPool[i].hDS );
+    free( gdalPool[i].path );
+
+    /* move the last entry in place of the closed one */
+    gdalPoolCount--;
+    if( i != gdalPoolCount )
+        gdalPool[i] = gdalPool[gdalPoolCount];
+}
+
+static int msGDALPoolCacheUsedMB( void )
+
+{
+#if GDAL_VERSION_NUM >= 1800
+    return (int) (GDALGetCacheUsed64() / (1024*1024));
+#else
+    return GDALGetCacheUsed() / (1024*1024);
+#endif
+}
+
+/*
+** Close the least recently used unreferenced datasets until the pool is
+** within its limits.
+*/
+static void msGDALPoolTrim( void )
+
+{
+    for( ;; )
+    {
+        int i, unreferenced = 0, lru = -1;
+
+        for( i = 0; i < gdalPoolCount; i++ )
+        {
+            if( gdalPool[i].ref_count > 0 )
+                continue;
+            unreferenced++;
+            if( lru == -1 || gdalPool[i].last_used < gdalPool[lru].last_used )
+                lru = i;
+        }
+
+        if( lru == -1 )
+            return;
+        if( unreferenced <= gdalPoolSize
+            && (gdalPoolMemory <= 0 || msGDALPoolCacheUsedMB() <= gdalPoolMemory) )
+            return;
+
+        msGDALPoolClose( lru );
+        gdalPoolEvictions++;
+    }
+}
+
+/************************************************************************/
+/*                           msGDALPoolOpen()                           */
+/*                                                                      */
+/*      Return an open dataset for path, from the pool if possible.     */
+/*      Returns NULL if the file cannot be opened, CPLGetLastErrorMsg() */
+/*      then tells why.  The dataset must be returned with              */
+/*      msGDALPoolRelease().                                            */
+/************************************************************************/
+
+void *msGDALPoolOpen( mapObj *map, layerObj *layer, const char *path )
+
+{
+    const char *value;
+    GDALDatasetH hDS;
+    VSIStatBufL sStatBuf;
+    int i, thread_id = msGetThreadId(), has_stat = -1;
+
+    if( map && (value = msGetConfigOption( map, "MS_GDAL_POOL_SIZE" )) != NULL )
+        gdalPoolSize = MS_MAX(0, atoi(value));
+    if( map && (value = msGetConfigOption( map, "MS_GDAL_POOL_MEMORY" )) != NULL )
+        gdalPoolMemory = atoi(value);
+
+    /* the pool is small enough for a linear search to cost nothing next to a GDALOpen() */
+    for( i = 0; i < gdalPoolCount; i++ )
+    {
+        gdalPoolEntry *entry = gdalPool + i;
+
+        if( strcmp( entry->path, path ) == 0
+            && (entry->ref_count == 0 || entry->thread_id == thread_id) )
+        {
+            if( has_stat == -1 )
+                has_stat = (VSIStatL( path, &sStatBuf ) == 0);
+
+            if( has_stat != entry->has_stat
+                || (has_stat && (entry->mtime != sStatBuf.st_mtime
+                                 || entry->size != (vsi_l_offset) sStatBuf.st_size)) )
+            {
+                /* the file changed since it was opened */
+                if( layer && layer->debug >= MS_DEBUGLEVEL_VV )
+                    msDebug( "msGDALPoolOpen(%s): %s changed, reopening it.\n",
+                             layer->name, path );
+                if( entry->ref_count == 0 )
+                {
+                    msGDALPoolClose( i );
+                    gdalPoolEvictions++;
+                    i--;
+                }
+                continue;
+            }
+
+            entry->ref_count++;
+            entry->thread_id = thread_id;
+            entry->last_used = ++gdalPoolClock;
+            gdalPoolHits++;
+
+            if( layer && layer->debug >= MS_DEBUGLEVEL_VV )
+                msDebug( "msGDALPoolOpen(%s): reusing %s.\n", layer->name, path );
+            return entry->hDS;
+        }
+    }
+
+    /* stat before opening, so that a file replaced meanwhile is seen as changed */
+    if( has_stat == -1 )
+        has_stat = (VSIStatL( path, &sStatBuf ) == 0);
+
+    hDS = GDALOpen( path, GA_ReadOnly );
+    if( hDS == NULL )
+        return NULL;
+    gdalPoolMisses++;
+
+    if( layer && layer->debug >= MS_DEBUGLEVEL_VV )
+        msDebug( "msGDALPoolOpen(%s): opened %s.\n", layer->name, path );
+
+    if( gdalPoolCount == gdalPoolMax )
+    {
+        gdalPoolEntry *pool = (gdalPoolEntry *)
+            realloc( gdalPool, sizeof(gdalPoolEntry) * (gdalPoolMax + 10) );
+        if( pool == NULL )
+        {
+            msSetError( MS_MEMERR, NULL, "msGDALPoolOpen()" );
+            GDALClose( hDS );
+            return NULL;
+        }
+        gdalPool = pool;
+        gdalPoolMax += 10;
+    }
+
+    gdalPool[gdalPoolCount].path = msStrdup( path );
+    gdalPool[gdalPoolCount].hDS = hDS;
+    gdalPool[gdalPoolCount].ref_count = 1;
+    gdalPool[gdalPoolCount].thread_id = thread_id;
+    gdalPool[gdalPoolCount].last_used = ++gdalPoolClock;
+    gdalPool[gdalPoolCount].has_stat = has_stat;
+    gdalPool[gdalPoolCount].mtime = has_stat ? sStatBuf.st_mtime : 0;
+    gdalPool[gdalPoolCount].size = has_stat ? (vsi_l_offset) sStatBuf.st_size : 0;
+    gdalPoolCount++;
+
+    return hDS;
+}
+
+/************************************************************************/
+/*                         msGDALPoolRelease()                          */
+/*                                                                      */
+/*      Give back a dataset obtained from msGDALPoolOpen().  It is      */
+/*      closed right away with CLOSE_CONNECTION=ALWAYS or NORMAL on     */
+/*      the layer, and otherwise kept open within the pool limits.      */
+/************************************************************************/
+
+void msGDALPoolRelease( layerObj *layer, void *hDS )
+
+{
+    const char *close_connection = NULL;
+    int i;
+
+    if( layer )
+        close_connection = msLayerGetProcessingKey( layer, "CLOSE_CONNECTION" );
+
+    for( i = 0; i < gdalPoolCount; i++ )
+    {
+        if( gdalPool[i].hDS != (GDALDatasetH) hDS )
+            continue;
+
+        gdalPool[i].ref_count--;
+        if( gdalPool[i].ref_count == 0 )
+        {
+            gdalPool[i].thread_id = 0;
+            if( close_connection != NULL
+                && (strcasecmp(close_connection,"ALWAYS") == 0
+                    || strcasecmp(close_connection,"NORMAL") == 0) )
+                msGDALPoolClose( i );
+        }
+        msGDALPoolTrim();
+        return;
+    }
+
+    msDebug( "msGDALPoolRelease(): dataset %p not in the pool.\n", hDS );
+}
+
+/************************************************************************/
+/*                          msGDALPoolReport()                          */
+/*                                                                      */
+/*      Report the pool statistics in the debug output.                 */
+/************************************************************************/
+
+void msGDALPoolReport( const char *caller )
+
+{
+    msDebug( "%s: GDAL dataset pool: %d open, %lu hits, %lu misses, "
+             "%lu closed to stay within %d datasets%s.\n",
+             caller, gdalPoolCount, gdalPoolHits, gdalPoolMisses,
+             gdalPoolEvictions, gdalPoolSize,
+             gdalPoolMemory > 0 ? " and the memory limit" : "" );
+}
+
+/* close all the pooled datasets, called by msGDALCleanup() */
+static void msGDALPoolFinalCleanup( void )
+
+{
+    while( gdalPoolCount > 0 )
+        msGDALPoolClose( 0 );
+    free( gdalPool );
+    gdalPool = NULL;
+    gdalPoolMax = 0;
+}
+
 /************************************************************************/
 /*                            CleanVSIDir()                             */
 /*                                                                      */
@@ -249,7 +249,52 @@ int remapPaletteForPNG(rasterBufferObj *rb, rgbPixel *rgb, unsigned char *a, int
    return MS_SUCCESS;
 }
 
-int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression) {
+#ifndef Z_DEFAULT_STRATEGY
+#define Z_FILTERED 1
+#define Z_HUFFMAN_ONLY 2
+#define Z_RLE 3
+#define Z_DEFAULT_STRATEGY 0
+#endif
+
+/*
+** Parse the PNG_FILTER and PNG_STRATEGY format options into the libpng row
+** filter and the zlib strategy to encode with. The default is no filtering
+** and the default zlib strategy.
+*/
+static int getPNGEncodeOptions(outputFormatObj *format, int *filter, int *strategy) {
+   const char *value;
+   *filter = PNG_FILTER_NONE;
+   *strategy = Z_DEFAULT_STRATEGY;
+
+   value = msGetOutputFormatOption( format, "PNG_FILTER", NULL);
+   if(value && *value) {
+      if(strcasecmp(value,"NONE") == 0) *filter = PNG_FILTER_NONE;
+      else if(strcasecmp(value,"SUB") == 0) *filter = PNG_FILTER_SUB;
+      else if(strcasecmp(value,"UP") == 0) *filter = PNG_FILTER_UP;
+      else if(strcasecmp(value,"AVG") == 0) *filter = PNG_FILTER_AVG;
+      else if(strcasecmp(value,"PAETH") == 0) *filter = PNG_FILTER_PAETH;
+      else if(strcasecmp(value,"ADAPTIVE") == 0) *filter = PNG_ALL_FILTERS;
+      else {
+         msSetError(MS_MISCERR,"failed to parse FORMATOPTION \"PNG_FILTER=%s\", expecting NONE, SUB, UP, AVG, PAETH or ADAPTIVE.","saveAsPNG()",value);
+         return MS_FAILURE;
+      }
+   }
+
+   value = msGetOutputFormatOption( format, "PNG_STRATEGY", NULL);
+   if(value && *value) {
+      if(strcasecmp(value,"DEFAULT") == 0) *strategy = Z_DEFAULT_STRATEGY;
+      else if(strcasecmp(value,"FILTERED") == 0) *strategy = Z_FILTERED;
+      else if(strcasecmp(value,"RLE") == 0) *strategy = Z_RLE;
+      else if(strcasecmp(value,"HUFFMAN") == 0) *strategy = Z_HUFFMAN_ONLY;
+      else {
+         msSetError(MS_MISCERR,"failed to parse FORMATOPTION \"PNG_STRATEGY=%s\", expecting DEFAULT, FILTERED, RLE or HUFFMAN.","saveAsPNG()",value);
+         return MS_FAILURE;
+      }
+   }
+   return MS_SUCCESS;
+}
+
+int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression, int filter, int strategy) {
    png_infop info_ptr;
    rgbPixel rgb[256];
    unsigned char a[256];
@@ -264,7 +309,8 @@ int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression) {
       return (MS_FAILURE);
    
    png_set_compression_level(png_ptr, compression);
-   png_set_filter (png_ptr,0, PNG_FILTER_NONE); 
+   png_set_compression_strategy(png_ptr, strategy);
+   png_set_filter (png_ptr,0, filter); 
 
    info_ptr = png_create_info_struct(png_ptr);
    if (!info_ptr)
@@ -371,6 +417,7 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
 
     const char *force_string,*zlib_compression;
     int compression = -1;
+    int filter, strategy;
 
     zlib_compression = msGetOutputFormatOption( format, "COMPRESSION", NULL);
     if(zlib_compression && *zlib_compression) {
@@ -381,6 +428,8 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
          return MS_FAILURE;
       }
     }
+    if(getPNGEncodeOptions(format,&filter,&strategy) != MS_SUCCESS)
+        return MS_FAILURE;
 
    
     force_string = msGetOutputFormatOption( format, "QUANTIZE_FORCE", NULL );
@@ -436,7 +485,7 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
         }
         if(ret != MS_FAILURE) {
             ret = msClassifyRasterBuffer(rb,&qrb);
-            ret = savePalettePNG(&qrb,info,compression);  
+            ret = savePalettePNG(&qrb,info,compression,filter,strategy);  
         }
         msFree(qrb.data.palette.pixels);
         return ret;
@@ -453,7 +502,8 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
             return (MS_FAILURE);
 	
         png_set_compression_level(png_ptr, compression);
-        png_set_filter (png_ptr,0, PNG_FILTER_NONE); 
+        png_set_compression_strategy(png_ptr, strategy);
+        png_set_filter (png_ptr,0, filter); 
         
         info_ptr = png_create_info_struct(png_ptr);
         if (!info_ptr)
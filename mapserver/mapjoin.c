@@ -154,6 +154,43 @@ int msJoinClose(joinObj *join)
   return MS_FAILURE;
 }
 
+/*  */
+/* Sorted index on the "to" column of file based (XBase, CSV) join tables, */
+/* so that each shape is joined with a binary search instead of a scan of  */
+/* the whole table. Entries with the same key are kept in table order.     */
+/*  */
+typedef struct {
+  char *key;
+  int record;
+} msJoinIndexEntry;
+
+static int msJoinCompareIndexEntries(const void *a, const void *b)
+{
+  const msJoinIndexEntry *ea = (const msJoinIndexEntry *) a;
+  const msJoinIndexEntry *eb = (const msJoinIndexEntry *) b;
+  int result = strcmp(ea->key, eb->key);
+
+  if(result != 0) return result;
+  return ea->record - eb->record;
+}
+
+/* returns the position of the first entry matching target, numentries if there is none */
+static int msJoinFindIndexEntry(msJoinIndexEntry *index, int numentries, const char *target)
+{
+  int low = 0, high = numentries;
+
+  while(low < high) {
+    int mid = low + (high - low) / 2;
+    if(strcmp(index[mid].key, target) < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  if(low < numentries && strcmp(index[low].key, target) == 0) return low;
+  return numentries;
+}
+
 /*  */
 /* XBASE join functions */
 /*  */
@@ -161,7 +198,9 @@ typedef struct {
   DBFHandle hDBF;
   int fromindex, toindex;
   char *target;
-  int nextrecord;
+  int nextrecord; /* position in index */
+  msJoinIndexEntry *index;
+  int numrecords;
 } msDBFJoinInfo;
 
 int msDBFJoinConnect(layerObj *layer, joinObj *join) 
@@ -186,6 +225,8 @@ int msDBFJoinConnect(layerObj *layer, joinObj *join)
   /* initialize any members that won't get set later on in this function */
   joininfo->target = NULL;
   joininfo->nextrecord = 0;
+  joininfo->index = NULL;
+  joininfo->numrecords = 0;
 
   join->joininfo = joininfo;
 
@@ -216,11 +257,26 @@ int msDBFJoinConnect(layerObj *layer, joinObj *join)
     return(MS_FAILURE);
   }
 
-  /* finally store away the item names in the XBase table */
+  /* store away the item names in the XBase table */
   join->numitems =  msDBFGetFieldCount(joininfo->hDBF);
   join->items = msDBFGetItems(joininfo->hDBF);
   if(!join->items) return(MS_FAILURE);  
 
+  /* finally index the records on the "to" item */
+  joininfo->numrecords = msDBFGetRecordCount(joininfo->hDBF);
+  if(joininfo->numrecords > 0) {
+    joininfo->index = (msJoinIndexEntry *) malloc(joininfo->numrecords*sizeof(msJoinIndexEntry));
+    if(!joininfo->index) {
+      msSetError(MS_MEMERR, "Error allocating join index.", "msDBFJoinConnect()");
+      return(MS_FAILURE);
+    }
+    for(i=0; i<joininfo->numrecords; i++) {
+      joininfo->index[i].key = msStrdup(msDBFReadStringAttribute(joininfo->hDBF, i, joininfo->toindex));
+      joininfo->index[i].record = i;
+    }
+    qsort(joininfo->index, joininfo->numrecords, sizeof(msJoinIndexEntry), msJoinCompareIndexEntries);
+  }
+
   return(MS_SUCCESS);
 }
 
@@ -243,11 +299,11 @@ int msDBFJoinPrepare(joinObj *join, shapeObj *shape)
     return(MS_FAILURE);
   }
 
-  joininfo->nextrecord = 0; /* starting with the first record */
-
   if(joininfo->target) free(joininfo->target); /* clear last target */
   joininfo->target = msStrdup(shape->values[joininfo->fromindex]);
 
+  joininfo->nextrecord = msJoinFindIndexEntry(joininfo->index, joininfo->numrecords, joininfo->target); /* starting with the first match */
+
   return(MS_SUCCESS);
 }
 
@@ -272,13 +328,10 @@ int msDBFJoinNext(joinObj *join)
     join->values = NULL;
   }
 
-  n = msDBFGetRecordCount(joininfo->hDBF);
-    
-  for(i=joininfo->nextrecord; i<n; i++) { /* find a match */
-    if(strcmp(joininfo->target, msDBFReadStringAttribute(joininfo->hDBF, i, joininfo->toindex)) == 0) break;
-  }  
-    
-  if(i == n) { /* unable to do the join */
+  n = joininfo->numrecords;
+  i = joininfo->nextrecord;
+
+  if(i == n || strcmp(joininfo->target, joininfo->index[i].key) != 0) { /* unable to do the join */
     if((join->values = (char **)malloc(sizeof(char *)*join->numitems)) == NULL) {
       msSetError(MS_MEMERR, NULL, "msDBFJoinNext()");
       return(MS_FAILURE);
@@ -290,7 +343,7 @@ int msDBFJoinNext(joinObj *join)
     return(MS_DONE);
   }
     
-  if((join->values = msDBFGetValues(joininfo->hDBF,i)) == NULL) 
+  if((join->values = msDBFGetValues(joininfo->hDBF,joininfo->index[i].record)) == NULL) 
     return(MS_FAILURE);
 
   joininfo->nextrecord = i+1; /* so we know where to start looking next time through */
@@ -306,6 +359,12 @@ int msDBFJoinClose(joinObj *join)
 
   if(joininfo->hDBF) msDBFClose(joininfo->hDBF);
   if(joininfo->target) free(joininfo->target);
+  if(joininfo->index) {
+    int i;
+    for(i=0; i<joininfo->numrecords; i++)
+      free(joininfo->index[i].key);
+    free(joininfo->index);
+  }
   free(joininfo);
   joininfo = NULL;
 
@@ -320,7 +379,8 @@ typedef struct {
   char *target;
   char ***rows;
   int numrows;
-  int nextrow;
+  int nextrow; /* position in index */
+  msJoinIndexEntry *index; /* keys point into rows */
 } msCSVJoinInfo;
 
 int msCSVJoinConnect(layerObj *layer, joinObj *join) 
@@ -345,6 +405,7 @@ int msCSVJoinConnect(layerObj *layer, joinObj *join)
   /* initialize any members that won't get set later on in this function */
   joininfo->target = NULL;
   joininfo->nextrow = 0;
+  joininfo->index = NULL;
 
   join->joininfo = joininfo;
 
@@ -390,11 +451,24 @@ int msCSVJoinConnect(layerObj *layer, joinObj *join)
 
   /* get "to" index (for now the user tells us which column, 1..n) */
   joininfo->toindex = atoi(join->to) - 1;
-  if(joininfo->toindex < 0 || joininfo->toindex > join->numitems) {
+  if(joininfo->toindex < 0 || joininfo->toindex >= join->numitems) {
     msSetError(MS_JOINERR, "Invalid column index %s.", "msCSVJoinConnect()", join->to); 
     return(MS_FAILURE);
   }
 
+  /* index the rows on the "to" column */
+  if(joininfo->numrows > 0) {
+    if((joininfo->index = (msJoinIndexEntry *) malloc(joininfo->numrows*sizeof(msJoinIndexEntry))) == NULL) {
+      msSetError(MS_MEMERR, "Error allocating join index.", "msCSVJoinConnect()");
+      return(MS_FAILURE);
+    }
+    for(i=0; i<joininfo->numrows; i++) {
+      joininfo->index[i].key = joininfo->rows[i][joininfo->toindex];
+      joininfo->index[i].record = i;
+    }
+    qsort(joininfo->index, joininfo->numrows, sizeof(msJoinIndexEntry), msJoinCompareIndexEntries);
+  }
+
   /* store away the column names (1..n) */
   if((join->items = (char **) malloc(sizeof(char *)*join->numitems)) == NULL) {
     msSetError(MS_MEMERR, "Error allocating space for join item names.", "msCSVJoinConnect()");
@@ -427,11 +501,11 @@ int msCSVJoinPrepare(joinObj *join, shapeObj *shape)
     return(MS_FAILURE);
   }
 
-  joininfo->nextrow = 0; /* starting with the first record */
-
   if(joininfo->target) free(joininfo->target); /* clear last target */
   joininfo->target = msStrdup(shape->values[joininfo->fromindex]);
 
+  joininfo->nextrow = msJoinFindIndexEntry(joininfo->index, joininfo->numrows, joininfo->target); /* starting with the first match */
+
   return(MS_SUCCESS);
 }
 
@@ -451,16 +525,14 @@ int msCSVJoinNext(joinObj *join)
     join->values = NULL;
   }
 
-  for(i=joininfo->nextrow; i<joininfo->numrows; i++) { /* find a match     */
-    if(strcmp(joininfo->target, joininfo->rows[i][joininfo->toindex]) == 0) break;
-  }  
+  i = joininfo->nextrow;
 
   if((join->values = (char ** )malloc(sizeof(char *)*join->numitems)) == NULL) {
     msSetError(MS_MEMERR, NULL, "msCSVJoinNext()");
     return(MS_FAILURE);
   }
   
-  if(i == joininfo->numrows) { /* unable to do the join     */
+  if(i == joininfo->numrows || strcmp(joininfo->target, joininfo->index[i].key) != 0) { /* unable to do the join     */
     for(j=0; j<join->numitems; j++)
       join->values[j] = msStrdup("\0"); /* intialize to zero length strings */
 
@@ -469,7 +541,7 @@ int msCSVJoinNext(joinObj *join)
   } 
 
   for(j=0; j<join->numitems; j++)
-    join->values[j] = msStrdup(joininfo->rows[i][j]);
+    join->values[j] = msStrdup(joininfo->rows[joininfo->index[i].record][j]);
 
   joininfo->nextrow = i+1; /* so we know where to start looking next time through */
 
@@ -486,6 +558,7 @@ int msCSVJoinClose(joinObj *join)
   for(i=0; i<joininfo->numrows; i++)
     msFreeCharArray(joininfo->rows[i], join->numitems);
   free(joininfo->rows);
+  if(joininfo->index) free(joininfo->index);
   if(joininfo->target) free(joininfo->target);
   free(joininfo);
   joininfo = NULL;
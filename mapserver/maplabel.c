@@ -692,6 +692,280 @@ static int labelInImage(int width, int height, shapeObj *lpoly, int gutter)
   return(MS_TRUE); 
 }
 
+/*
+** Label cache spatial index.
+**
+** The index is a uniform grid of MS_LABELCACHEINDEXCELLSIZE pixel cells
+** covering the image. Coordinates outside of the image are clamped to the
+** border cells so partial labels and labels in the gutter are handled too.
+** Markers are added when the index is built (they are all on the map before
+** labels get drawn), labels are added as soon as they have been rendered.
+** Each entry is stored in every cell its bounds touch, and a query only
+** looks at an entry from the cell holding the lower left corner of the
+** intersection of the entry and query bounds, so no entry is tested twice.
+*/
+static int labelCacheIndexCol(labelCacheIndexObj *index, double x)
+{
+  int col = (int) floor(x / index->cellsize);
+  return MS_MAX(0, MS_MIN(col, index->numcols-1));
+}
+
+static int labelCacheIndexRow(labelCacheIndexObj *index, double y)
+{
+  int row = (int) floor(y / index->cellsize);
+  return MS_MAX(0, MS_MIN(row, index->numrows-1));
+}
+
+static void labelCacheIndexInsert(labelCacheIndexObj *index, rectObj *bounds,
+                                  int priority, int i, int ismarker)
+{
+  int row, col;
+  int mincol = labelCacheIndexCol(index, bounds->minx);
+  int maxcol = labelCacheIndexCol(index, bounds->maxx);
+  int minrow = labelCacheIndexRow(index, bounds->miny);
+  int maxrow = labelCacheIndexRow(index, bounds->maxy);
+
+  for(row=minrow; row<=maxrow; row++) {
+    for(col=mincol; col<=maxcol; col++) {
+      labelCacheIndexCellObj *cell = &(index->cells[row*index->numcols + col]);
+      labelCacheIndexEntryObj *entry;
+      if(cell->numentries == cell->size) {
+        cell->size += MS_LABELCACHEINCREMENT;
+        cell->entries = (labelCacheIndexEntryObj *) msSmallRealloc(cell->entries,
+                              sizeof(labelCacheIndexEntryObj) * cell->size);
+      }
+      entry = &(cell->entries[cell->numentries++]);
+      entry->bounds = *bounds;
+      entry->priority = priority;
+      entry->index = i;
+      entry->ismarker = ismarker;
+    }
+  }
+}
+
+/* msInitLabelCacheIndex()
+**
+** (Re)builds the label cache index for an image of width x height pixels and
+** adds all the cached markers to it. Called by msDrawLabelCache() once all
+** the labels have been cached.
+*/
+int msInitLabelCacheIndex(labelCacheObj *labelcache, int width, int height)
+{
+  labelCacheIndexObj *index;
+  int p, i;
+
+  msFreeLabelCacheIndex(labelcache);
+
+  index = (labelCacheIndexObj *) msSmallMalloc(sizeof(labelCacheIndexObj));
+  index->cellsize = MS_LABELCACHEINDEXCELLSIZE;
+  index->numcols = MS_MAX(1, (int) ceil(width / index->cellsize));
+  index->numrows = MS_MAX(1, (int) ceil(height / index->cellsize));
+  index->cells = (labelCacheIndexCellObj *) msSmallCalloc(index->numcols * index->numrows,
+                                                          sizeof(labelCacheIndexCellObj));
+  labelcache->index = index;
+
+  for(p=0; p<MS_MAX_LABEL_PRIORITY; p++) {
+    labelCacheSlotObj *cacheslot = &(labelcache->slots[p]);
+    for(i=0; i<cacheslot->nummarkers; i++)
+      labelCacheIndexInsert(index, &(cacheslot->markers[i].poly->bounds), p, i, MS_TRUE);
+  }
+
+  return MS_SUCCESS;
+}
+
+void msFreeLabelCacheIndex(labelCacheObj *labelcache)
+{
+  labelCacheIndexObj *index = labelcache->index;
+  int i;
+
+  if(!index) return;
+
+  for(i=0; i<index->numcols*index->numrows; i++)
+    msFree(index->cells[i].entries);
+  msFree(index->cells);
+  msFree(index);
+  labelcache->index = NULL;
+}
+
+/* msLabelCacheIndexAddLabel()
+**
+** Registers a label that has just been rendered (status set to MS_TRUE) so
+** that it gets taken into account by subsequent collision tests.
+*/
+void msLabelCacheIndexAddLabel(labelCacheObj *labelcache, int priority, int label)
+{
+  labelCacheMemberObj *cachePtr;
+  rectObj bounds;
+
+  if(!labelcache->index) return;
+
+  cachePtr = &(labelcache->slots[priority].labels[label]);
+
+  /* the label point is needed for the mindistance duplicate check */
+  bounds.minx = bounds.maxx = cachePtr->point.x;
+  bounds.miny = bounds.maxy = cachePtr->point.y;
+  if(cachePtr->poly)
+    msMergeRect(&bounds, &(cachePtr->poly->bounds));
+  if(cachePtr->leaderbbox)
+    msMergeRect(&bounds, cachePtr->leaderbbox);
+
+  labelCacheIndexInsert(labelcache->index, &bounds, priority, label, MS_FALSE);
+}
+
+/*
+** Tests the candidate cachePtr/poly against an already rendered label. Returns
+** MS_TRUE if they collide or if the candidate is a duplicate of curCachePtr.
+*/
+static int labelCollidesWithRendered(labelCacheMemberObj *cachePtr, shapeObj *poly,
+                                     labelCacheMemberObj *curCachePtr, int mindistance,
+                                     double label_width)
+{
+  int ll, pp;
+
+  /* 
+  ** Note 1: We add the label_size to the mindistance value when comparing because we do want the mindistance 
+  ** value between the labels and not only from point to point. 
+  **
+  ** Note 2: We only check the first label (could be multiples (RFC 77)) since that is *by far* the most common
+  ** use case. Could change in the future but it's not worth the overhead at this point.
+  */
+  if(mindistance >0  && 
+    (cachePtr->layerindex == curCachePtr->layerindex) && 
+    (cachePtr->classindex == curCachePtr->classindex) && 
+    (strcmp(cachePtr->labels[0].annotext, curCachePtr->labels[0].annotext) == 0) &&
+    (msDistancePointToPoint(&(cachePtr->point), &(curCachePtr->point)) <= (mindistance + label_width))) { /* label is a duplicate */
+    return MS_TRUE;
+  }
+
+  if(!curCachePtr->poly) /* nothing but the label point to compare with */
+    return MS_FALSE;
+
+  if(intersectLabelPolygons(curCachePtr->poly, poly) == MS_TRUE) { /* polys intersect */
+    return MS_TRUE;
+  }
+  if(curCachePtr->leaderline) {
+     /* our poly against rendered leader lines */
+     /* first do a bbox check */
+     if(msRectOverlap(curCachePtr->leaderbbox, &(poly->bounds))) {
+        /* look for intersecting line segments */
+        for(ll=0; ll<poly->numlines; ll++)
+           for(pp=1; pp<poly->line[ll].numpoints; pp++)
+              if(msIntersectSegments(
+                       &(poly->line[ll].point[pp-1]),
+                       &(poly->line[ll].point[pp]),
+                       &(curCachePtr->leaderline->point[0]),
+                       &(curCachePtr->leaderline->point[1])) ==  MS_TRUE)
+              {
+                 return(MS_TRUE);
+              }
+     }
+
+  }
+  if(cachePtr->leaderline) {
+     /* does our leader intersect current label */
+     /* first do a bbox check */
+     if(msRectOverlap(cachePtr->leaderbbox, &(curCachePtr->poly->bounds))) {
+        /* look for intersecting line segments */
+        for(ll=0; ll<curCachePtr->poly->numlines; ll++)
+           for(pp=1; pp<curCachePtr->poly->line[ll].numpoints; pp++)
+              if(msIntersectSegments(
+                       &(curCachePtr->poly->line[ll].point[pp-1]),
+                       &(curCachePtr->poly->line[ll].point[pp]),
+                       &(cachePtr->leaderline->point[0]),
+                       &(cachePtr->leaderline->point[1])) ==  MS_TRUE)
+              {
+                 return(MS_TRUE);
+              }
+        
+     }
+     if(curCachePtr->leaderline) {
+        /* TODO: check intersection of leader lines, not only bbox test ? */
+        if(msRectOverlap(curCachePtr->leaderbbox, cachePtr->leaderbbox)) {
+           return MS_TRUE;
+        }
+
+     }
+  }
+
+  return MS_FALSE;
+}
+
+/*
+** Indexed version of the marker and rendered label scans done by
+** msTestLabelCacheCollisions(): same rules, but only the grid cells touched
+** by the candidate (its poly, its leader and its mindistance radius) are
+** visited.
+*/
+static int testLabelCacheIndexCollisions(labelCacheObj *labelcache, labelCacheMemberObj *cachePtr,
+                                         shapeObj *poly, int mindistance, int current_priority,
+                                         int first_label, int current_label, double label_width)
+{
+  labelCacheIndexObj *index = labelcache->index;
+  rectObj query;
+  int row, col, mincol, maxcol, minrow, maxrow, e;
+
+  query = poly->bounds;
+  if(cachePtr->leaderbbox)
+    msMergeRect(&query, cachePtr->leaderbbox);
+  if(mindistance > 0) {
+    rectObj dup;
+    dup.minx = cachePtr->point.x - (mindistance + label_width);
+    dup.maxx = cachePtr->point.x + (mindistance + label_width);
+    dup.miny = cachePtr->point.y - (mindistance + label_width);
+    dup.maxy = cachePtr->point.y + (mindistance + label_width);
+    msMergeRect(&query, &dup);
+  }
+
+  mincol = labelCacheIndexCol(index, query.minx);
+  maxcol = labelCacheIndexCol(index, query.maxx);
+  minrow = labelCacheIndexRow(index, query.miny);
+  maxrow = labelCacheIndexRow(index, query.maxy);
+
+  for(row=minrow; row<=maxrow; row++) {
+    for(col=mincol; col<=maxcol; col++) {
+      labelCacheIndexCellObj *cell = &(index->cells[row*index->numcols + col]);
+
+      for(e=0; e<cell->numentries; e++) {
+        labelCacheIndexEntryObj *entry = &(cell->entries[e]);
+
+        /* markers and labels of lower priority levels are ignored */
+        if(entry->priority < current_priority)
+          continue;
+
+        if(!msRectOverlap(&(entry->bounds), &query))
+          continue;
+
+        /* only handle the entry from one of the cells it was added to */
+        if(labelCacheIndexCol(index, MS_MAX(entry->bounds.minx, query.minx)) != col ||
+           labelCacheIndexRow(index, MS_MAX(entry->bounds.miny, query.miny)) != row)
+          continue;
+
+        if(entry->ismarker) {
+          markerCacheMemberObj *markerPtr = &(labelcache->slots[entry->priority].markers[entry->index]);
+          if(entry->priority == current_priority && current_label == markerPtr->id)
+            continue; /* labels can overlap their own marker */
+          if(intersectLabelPolygons(markerPtr->poly, poly) == MS_TRUE)
+            return MS_FALSE;
+        } else {
+          labelCacheMemberObj *curCachePtr = &(labelcache->slots[entry->priority].labels[entry->index]);
+          if(entry->priority == current_priority && entry->index < first_label)
+            continue;
+          if(curCachePtr->status != MS_TRUE)
+            continue;
+
+          /* skip testing against ourself */
+          assert(entry->priority != current_priority || entry->index != current_label);
+
+          if(labelCollidesWithRendered(cachePtr, poly, curCachePtr, mindistance, label_width))
+            return MS_FALSE;
+        }
+      }
+    }
+  }
+
+  return MS_TRUE;
+}
+
 /* msTestLabelCacheCollisions()
 **
 ** Compares current label against labels already drawn and markers from cache and discards it
@@ -709,7 +983,7 @@ int msTestLabelCacheCollisions(labelCacheObj *labelcache, labelObj *labelPtr,
 int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr, shapeObj *poly,
         int mindistance, int current_priority, int current_label) {
    labelCacheObj *labelcache = &(map->labelcache);
-  int i, p, ll, pp;
+  int i, p, ll;
   double label_width = 0;
   labelCacheMemberObj *curCachePtr=NULL; 
 
@@ -730,6 +1004,13 @@ int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr, shape
    current_label = -current_label;
   }
 
+  if(mindistance > 0)
+     label_width = poly->bounds.maxx - poly->bounds.minx;
+
+  if(labelcache->index)
+    return testLabelCacheIndexCollisions(labelcache, cachePtr, poly, mindistance,
+                                         current_priority, i, current_label, label_width);
+
   /* Compare against all rendered markers from this priority level and higher.
   ** Labels can overlap their own marker and markers from lower priority levels
   */
@@ -746,9 +1027,6 @@ int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr, shape
     }
   }
 
-  if(mindistance > 0)
-     label_width = poly->bounds.maxx - poly->bounds.minx;
-
   for(p=current_priority; p<MS_MAX_LABEL_PRIORITY; p++) {
     labelCacheSlotObj *cacheslot;
     cacheslot = &(labelcache->slots[p]);
@@ -761,67 +1039,8 @@ int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr, shape
          /* skip testing against ourself */
          assert(p!=current_priority || i != current_label);
 
-        /* 
-        ** Note 1: We add the label_size to the mindistance value when comparing because we do want the mindistance 
-        ** value between the labels and not only from point to point. 
-        **
-        ** Note 2: We only check the first label (could be multiples (RFC 77)) since that is *by far* the most common
-        ** use case. Could change in the future but it's not worth the overhead at this point.
-        */
-        if(mindistance >0  && 
-          (cachePtr->layerindex == curCachePtr->layerindex) && 
-          (cachePtr->classindex == curCachePtr->classindex) && 
-          (strcmp(cachePtr->labels[0].annotext, curCachePtr->labels[0].annotext) == 0) &&
-          (msDistancePointToPoint(&(cachePtr->point), &(curCachePtr->point)) <= (mindistance + label_width))) { /* label is a duplicate */
-          return MS_FALSE;
-        }
-
-        if(intersectLabelPolygons(curCachePtr->poly, poly) == MS_TRUE) { /* polys intersect */
-          return MS_FALSE;
-        }
-        if(curCachePtr->leaderline) {
-           /* our poly against rendered leader lines */
-           /* first do a bbox check */
-           if(msRectOverlap(curCachePtr->leaderbbox, &(poly->bounds))) {
-              /* look for intersecting line segments */
-              for(ll=0; ll<poly->numlines; ll++)
-                 for(pp=1; pp<poly->line[ll].numpoints; pp++)
-                    if(msIntersectSegments(
-                             &(poly->line[ll].point[pp-1]),
-                             &(poly->line[ll].point[pp]),
-                             &(curCachePtr->leaderline->point[0]),
-                             &(curCachePtr->leaderline->point[1])) ==  MS_TRUE)
-                    {
-                       return(MS_FALSE);
-                    }
-           }
-
-        }
-        if(cachePtr->leaderline) {
-           /* does our leader intersect current label */
-           /* first do a bbox check */
-           if(msRectOverlap(cachePtr->leaderbbox, &(curCachePtr->poly->bounds))) {
-              /* look for intersecting line segments */
-              for(ll=0; ll<curCachePtr->poly->numlines; ll++)
-                 for(pp=1; pp<curCachePtr->poly->line[ll].numpoints; pp++)
-                    if(msIntersectSegments(
-                             &(curCachePtr->poly->line[ll].point[pp-1]),
-                             &(curCachePtr->poly->line[ll].point[pp]),
-                             &(cachePtr->leaderline->point[0]),
-                             &(cachePtr->leaderline->point[1])) ==  MS_TRUE)
-                    {
-                       return(MS_FALSE);
-                    }
-              
-           }
-           if(curCachePtr->leaderline) {
-              /* TODO: check intersection of leader lines, not only bbox test ? */
-              if(msRectOverlap(curCachePtr->leaderbbox, cachePtr->leaderbbox)) {
-                 return MS_FALSE;
-              }
-
-           }
-        }
+         if(labelCollidesWithRendered(cachePtr, poly, curCachePtr, mindistance, label_width))
+           return MS_FALSE;
       }
     } /* i */
 
@@ -447,6 +447,10 @@ int msTokenizeExpression(expressionObj *expression, char **list, int *listsize)
   expression->curtoken = expression->tokens; /* point at the first token */
 
   msReleaseLock(TLOCK_PARSER);
+
+  /* bindings carry their item index by now, so the program can be built once here */
+  msCompileExpression(expression);
+
   return MS_SUCCESS;
 
   parse_error:
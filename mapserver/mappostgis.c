@@ -51,6 +51,13 @@
 ** msPostGISNextShape reads a row, increments layerinfo->rownum, and returns 
 ** MS_SUCCESS, until rownum reaches ntuples, and it returns MS_DONE instead.
 **
+** When the layer has PROCESSING "FETCH_SIZE=n", drawing (non query) requests
+** are instead run through a server-side cursor: msPostGISLayerWhichShapes
+** declares the cursor and fetches the first n rows into layerinfo->pgresult,
+** and msPostGISNextShape fetches the next batch once rownum reaches ntuples,
+** so only one batch is ever held in memory. Queries keep the whole result
+** since msPostGISLayerGetShape needs random access to it by resultindex.
+**
 */
 
 /* GNU needs this for strcasestr */
@@ -61,6 +68,7 @@
 #include <assert.h>
 #include <string.h>
 #include <math.h>
+#include <float.h>
 #include "mapserver.h"
 #include "maptime.h"
 #include "mappostgis.h"
@@ -77,6 +85,42 @@
 
 #define SEGMENT_ANGLE 10.0
 #define SEGMENT_MINPOINTS 10
+
+/* These are the OIDs for some builtin types, as returned by PQftype(). */
+/* They were copied from pg_type.h in src/include/catalog/pg_type.h */
+
+#ifndef BOOLOID 
+#define BOOLOID                 16
+#define BYTEAOID                17
+#define CHAROID                 18
+#define NAMEOID                 19
+#define INT8OID                 20
+#define INT2OID                 21
+#define INT2VECTOROID           22
+#define INT4OID                 23
+#define REGPROCOID              24
+#define TEXTOID                 25
+#define OIDOID                  26
+#define TIDOID                  27
+#define XIDOID                  28
+#define CIDOID                  29
+#define OIDVECTOROID            30
+#define FLOAT4OID               700
+#define FLOAT8OID               701
+#define INT4ARRAYOID            1007
+#define TEXTARRAYOID            1009
+#define BPCHARARRAYOID          1014
+#define VARCHARARRAYOID         1015
+#define FLOAT4ARRAYOID          1021
+#define FLOAT8ARRAYOID          1022
+#define BPCHAROID		1042
+#define VARCHAROID		1043
+#define DATEOID			1082
+#define TIMEOID			1083
+#define TIMESTAMPOID	        1114
+#define TIMESTAMPTZOID	        1184
+#define NUMERICOID              1700
+#endif
  
 #ifdef USE_POSTGIS
   
@@ -107,6 +151,14 @@ msPostGISLayerInfo *msPostGISCreateLayerInfo(void) {
     layerinfo->endian = 0;
     layerinfo->rownum = 0;
     layerinfo->version = 0;
+    layerinfo->cursor = NULL;
+    layerinfo->fetchsize = 0;
+    layerinfo->cursordone = MS_FALSE;
+    layerinfo->owntransaction = MS_FALSE;
+    layerinfo->rowoffset = 0;
+    layerinfo->binary = MS_FALSE;
+    layerinfo->textcolumns = NULL;
+    layerinfo->textcolumnskey = NULL;
     return layerinfo;
 }
 
@@ -121,7 +173,10 @@ void msPostGISFreeLayerInfo(layerObj *layer) {
     if ( layerinfo->srid ) free(layerinfo->srid);
     if ( layerinfo->geomcolumn ) free(layerinfo->geomcolumn);
     if ( layerinfo->fromsource ) free(layerinfo->fromsource);
+    if ( layerinfo->textcolumns ) free(layerinfo->textcolumns);
+    if ( layerinfo->textcolumnskey ) free(layerinfo->textcolumnskey);
     if ( layerinfo->pgresult ) PQclear(layerinfo->pgresult);
+    msPostGISCloseCursor(layer);
     if ( layerinfo->pgconn ) msConnPoolRelease(layer, layerinfo->pgconn);
     free(layerinfo);
     layer->layerinfo = NULL;
@@ -299,17 +354,24 @@ wkbReadPoint(wkbObj *w)
 static lineObj*
 wkbReadLine(wkbObj *w)
 {
-    int i;
-    pointObj p;
     lineObj *line = msSmallMalloc(sizeof(lineObj));
     int npoints = wkbReadInt(w);
 
     line->numpoints = npoints;
     line->point = msSmallMalloc(npoints * sizeof(pointObj));
-    for ( i = 0; i < npoints; i++ ) {
-        wkbReadPointP(w, &p);
-        line->point[i] = p;
+#ifdef USE_POINT_Z_M
+    {
+        int i;
+        for ( i = 0; i < npoints; i++ ) {
+            wkbReadPointP(w, &(line->point[i]));
+            line->point[i].z = line->point[i].m = 0.0;
+        }
     }
+#else
+    /* A pointObj is exactly the two doubles of a WKB point, copy them in one go. */
+    memcpy(line->point, w->ptr, npoints * 2 * sizeof(double));
+    w->ptr += npoints * 2 * sizeof(double);
+#endif
     return line;
 }
 
@@ -1648,14 +1710,23 @@ char *msPostGISBuildSQLItems(layerObj *layer) {
         ** data once we get it. Forcing to 2D (via the AsBinary function
         ** which includes a 2D force in it) removes ordinates we don't
         ** need, saving transfer and encode/decode time. 
+        ** In binary transfer mode the WKB bytea comes as is and is read
+        ** straight out of the result.
         */
 #if TRANSFER_ENCODING == 64
-        static char *strGeomTemplate = "encode(ST_AsBinary(ST_Force_2D(\"%s\"),'%s'),'base64') as geom,\"%s\"";
+        static char *strGeomTemplate = "encode(ST_AsBinary(ST_Force_2D(\"%s\"),'%s'),'base64') as geom,\"%s\"%s";
 #else
-        static char *strGeomTemplate = "encode(ST_AsBinary(ST_Force_2D(\"%s\"),'%s'),'hex') as geom,\"%s\"";
+        static char *strGeomTemplate = "encode(ST_AsBinary(ST_Force_2D(\"%s\"),'%s'),'hex') as geom,\"%s\"%s";
 #endif
-        strGeom = (char*)msSmallMalloc(strlen(strGeomTemplate) + strlen(strEndian) + strlen(layerinfo->geomcolumn) + strlen(layerinfo->uid));
-        sprintf(strGeom, strGeomTemplate, layerinfo->geomcolumn, strEndian, layerinfo->uid);
+        static char *strBinaryGeomTemplate = "ST_AsBinary(ST_Force_2D(\"%s\"),'%s') as geom,\"%s\"%s";
+        char *strTemplate = layerinfo->binary ? strBinaryGeomTemplate : strGeomTemplate;
+        char *strCast = "";
+
+        if ( layerinfo->binary && layerinfo->textcolumns && layerinfo->textcolumns[layer->numitems] )
+            strCast = "::text";
+
+        strGeom = (char*)msSmallMalloc(strlen(strTemplate) + strlen(strEndian) + strlen(layerinfo->geomcolumn) + strlen(layerinfo->uid) + strlen(strCast));
+        sprintf(strGeom, strTemplate, layerinfo->geomcolumn, strEndian, layerinfo->uid, strCast);
     }
 
     if( layer->debug > 1 ) {
@@ -1675,14 +1746,18 @@ char *msPostGISBuildSQLItems(layerObj *layer) {
         int length = strlen(strGeom) + 2;
         int t;
         for ( t = 0; t < layer->numitems; t++ ) {
-            length += strlen(layer->items[t]) + 3; /* itemname + "", */
+            length += strlen(layer->items[t]) + 3 + 6; /* itemname + "", + ::text */
         }
         strItems = (char*)msSmallMalloc(length);
         strItems[0] = '\0';
         for ( t = 0; t < layer->numitems; t++ ) {
             strlcat(strItems, "\"", length); 
             strlcat(strItems, layer->items[t], length); 
-            strlcat(strItems, "\",", length); 
+            strlcat(strItems, "\"", length); 
+            /* Columns we can't decode in binary are sent as text. */
+            if ( layerinfo->binary && layerinfo->textcolumns && layerinfo->textcolumns[t] )
+                strlcat(strItems, "::text", length); 
+            strlcat(strItems, ",", length); 
         }
         strlcat(strItems, strGeom, length);
     }
@@ -2036,6 +2111,355 @@ char *msPostGISBuildSQL(layerObj *layer, rectObj *rect, long *uid) {
 
 }
 
+/*
+** msPostGISExecCommand()
+**
+** Run a statement that returns no rows (BEGIN, CLOSE, ...) on the layer
+** connection.
+*/
+static int msPostGISExecCommand(layerObj *layer, const char *sql) {
+    msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
+    PGresult *pgresult;
+    int status = MS_SUCCESS;
+
+    if (layer->debug > 1) {
+        msDebug("msPostGISExecCommand: %s\n", sql);
+    }
+
+    pgresult = PQexec(layerinfo->pgconn, sql);
+    if (!pgresult || PQresultStatus(pgresult) != PGRES_COMMAND_OK) {
+        msSetError(MS_QUERYERR, "Error executing '%s': %s", "msPostGISExecCommand()", sql, PQerrorMessage(layerinfo->pgconn));
+        status = MS_FAILURE;
+    }
+    if (pgresult) PQclear(pgresult);
+
+    return status;
+}
+
+/*
+** msPostGISDeclareCursor()
+**
+** Open a server-side cursor for strSQL and read its first batch into
+** layerinfo->pgresult. Cursors only live inside a transaction, so one is
+** started unless the connection is already in one.
+*/
+static int msPostGISDeclareCursor(layerObj *layer, const char *strSQL, int num_bind_values, char **bind_values) {
+    msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
+    PGresult *pgresult = NULL;
+    char *strDeclare;
+    char cursor[64];
+
+    snprintf(cursor, sizeof(cursor), "%s_%d", CURSORNAME, layer->index);
+
+    if (PQtransactionStatus(layerinfo->pgconn) == PQTRANS_IDLE) {
+        if (msPostGISExecCommand(layer, "BEGIN") != MS_SUCCESS)
+            return MS_FAILURE;
+        layerinfo->owntransaction = MS_TRUE;
+    }
+
+    strDeclare = msSmallMalloc(strlen(cursor) + strlen(strSQL) + 64);
+    sprintf(strDeclare, "DECLARE %s NO SCROLL CURSOR FOR %s", cursor, strSQL);
+
+    if (num_bind_values > 0) {
+        pgresult = PQexecParams(layerinfo->pgconn, strDeclare, num_bind_values, NULL, (const char**)bind_values, NULL, NULL, 1);
+    } else {
+        pgresult = PQexecParams(layerinfo->pgconn, strDeclare, 0, NULL, NULL, NULL, NULL, 0);
+    }
+    free(strDeclare);
+
+    if (!pgresult || PQresultStatus(pgresult) != PGRES_COMMAND_OK) {
+        msSetError(MS_QUERYERR, "Error declaring cursor: %s", "msPostGISDeclareCursor()", PQerrorMessage(layerinfo->pgconn));
+        if (pgresult) PQclear(pgresult);
+        if (layerinfo->owntransaction) {
+            msPostGISExecCommand(layer, "ROLLBACK");
+            layerinfo->owntransaction = MS_FALSE;
+        }
+        return MS_FAILURE;
+    }
+    PQclear(pgresult);
+
+    layerinfo->cursor = msStrdup(cursor);
+    layerinfo->cursordone = MS_FALSE;
+    layerinfo->rowoffset = 0;
+    layerinfo->rownum = 0;
+
+    if (msPostGISFetchBatch(layer) == MS_FAILURE) {
+        msPostGISCloseCursor(layer);
+        return MS_FAILURE;
+    }
+
+    return MS_SUCCESS;
+}
+
+/*
+** msPostGISFetchBatch()
+**
+** Replace layerinfo->pgresult with the next layerinfo->fetchsize rows of the
+** open cursor. Returns MS_DONE once the cursor is exhausted.
+*/
+int msPostGISFetchBatch(layerObj *layer) {
+    msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
+    PGresult *pgresult = NULL;
+    char strFetch[128];
+
+    if (!layerinfo->cursor || layerinfo->cursordone) {
+        return MS_DONE;
+    }
+
+    snprintf(strFetch, sizeof(strFetch), "FETCH FORWARD %d FROM %s", layerinfo->fetchsize, layerinfo->cursor);
+    pgresult = PQexecParams(layerinfo->pgconn, strFetch, 0, NULL, NULL, NULL, NULL, layerinfo->binary);
+
+    if (!pgresult || PQresultStatus(pgresult) != PGRES_TUPLES_OK) {
+        msSetError(MS_QUERYERR, "Error fetching from cursor: %s", "msPostGISFetchBatch()", PQerrorMessage(layerinfo->pgconn));
+        if (pgresult) PQclear(pgresult);
+        return MS_FAILURE;
+    }
+
+    if (layer->debug > 1) {
+        msDebug("msPostGISFetchBatch got %d records from %s.\n", PQntuples(pgresult), layerinfo->cursor);
+    }
+
+    /* The shapes read so far own copies of their values, the old batch can go. */
+    if (layerinfo->pgresult) {
+        layerinfo->rowoffset += PQntuples(layerinfo->pgresult);
+        PQclear(layerinfo->pgresult);
+    }
+    layerinfo->pgresult = pgresult;
+    layerinfo->rownum = 0;
+
+    if (PQntuples(pgresult) < layerinfo->fetchsize) {
+        layerinfo->cursordone = MS_TRUE;
+    }
+
+    return (PQntuples(pgresult) > 0) ? MS_SUCCESS : MS_DONE;
+}
+
+/*
+** msPostGISCloseCursor()
+**
+** Close the cursor opened by msPostGISDeclareCursor(), if any, and end the
+** transaction it was opened in.
+*/
+void msPostGISCloseCursor(layerObj *layer) {
+    msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
+
+    if (!layerinfo || !layerinfo->cursor) {
+        return;
+    }
+
+    if (layerinfo->pgconn && PQstatus(layerinfo->pgconn) == CONNECTION_OK) {
+        if (PQtransactionStatus(layerinfo->pgconn) == PQTRANS_INERROR) {
+            /* The cursor went away with the failed transaction. */
+            if (layerinfo->owntransaction) msPostGISExecCommand(layer, "ROLLBACK");
+        } else {
+            char strClose[128];
+            snprintf(strClose, sizeof(strClose), "CLOSE %s", layerinfo->cursor);
+            msPostGISExecCommand(layer, strClose);
+            if (layerinfo->owntransaction) msPostGISExecCommand(layer, "COMMIT");
+        }
+    }
+
+    free(layerinfo->cursor);
+    layerinfo->cursor = NULL;
+    layerinfo->owntransaction = MS_FALSE;
+    layerinfo->cursordone = MS_FALSE;
+}
+
+/*
+** msPostGISBinaryTypeSupported()
+**
+** Column types msPostGISBinaryValueToString() can decode; everything else is
+** cast to text in the SQL when transferring in binary.
+*/
+static int msPostGISBinaryTypeSupported(Oid type) {
+    switch (type) {
+    case BOOLOID:
+    case INT2OID:
+    case INT4OID:
+    case INT8OID:
+    case FLOAT4OID:
+    case FLOAT8OID:
+    case CHAROID:
+    case NAMEOID:
+    case TEXTOID:
+    case BPCHAROID:
+    case VARCHAROID:
+        return MS_TRUE;
+    }
+    return MS_FALSE;
+}
+
+/*
+** msPostGISUseBinaryTransfer()
+**
+** PROCESSING "BINARY_TRANSFER=ON" has rows sent in binary format: the WKB
+** as raw bytea instead of hex, and numeric attributes in their binary form.
+*/
+static int msPostGISUseBinaryTransfer(layerObj *layer) {
+    const char *value = msLayerGetProcessingKey(layer, "BINARY_TRANSFER");
+    return (value && strcasecmp(value, "ON") == 0) ? MS_TRUE : MS_FALSE;
+}
+
+/*
+** msPostGISDescribeColumns()
+**
+** Work out which of the selected columns have to be cast to text for a
+** binary transfer, by having the server describe the query (without running
+** it). The result is kept until the source or the item list changes.
+*/
+int msPostGISDescribeColumns(layerObj *layer, rectObj *rect, long *uid) {
+    msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
+    PGresult *pgresult = NULL;
+    char *strSQL = NULL;
+    char *strKey = NULL;
+    int t, length;
+
+    /* Same source and items as last time, nothing to do. */
+    length = strlen(layerinfo->fromsource) + strlen(layerinfo->uid) + 2;
+    for ( t = 0; t < layer->numitems; t++ ) {
+        length += strlen(layer->items[t]) + 1;
+    }
+    strKey = (char*)msSmallMalloc(length);
+    strcpy(strKey, layerinfo->fromsource);
+    for ( t = 0; t < layer->numitems; t++ ) {
+        strcat(strKey, ",");
+        strcat(strKey, layer->items[t]);
+    }
+    strcat(strKey, ",");
+    strcat(strKey, layerinfo->uid);
+
+    if ( layerinfo->textcolumns && layerinfo->textcolumnskey && strcmp(strKey, layerinfo->textcolumnskey) == 0 ) {
+        free(strKey);
+        return MS_SUCCESS;
+    }
+
+    msFree(layerinfo->textcolumns);
+    layerinfo->textcolumns = NULL; /* so the SQL below has no casts */
+    msFree(layerinfo->textcolumnskey);
+    layerinfo->textcolumnskey = NULL;
+
+    strSQL = msPostGISBuildSQL(layer, rect, uid);
+    if ( ! strSQL ) {
+        free(strKey);
+        return MS_FAILURE;
+    }
+
+    pgresult = PQprepare(layerinfo->pgconn, "", strSQL, 0, NULL);
+    if ( pgresult && PQresultStatus(pgresult) == PGRES_COMMAND_OK ) {
+        PQclear(pgresult);
+        pgresult = PQdescribePrepared(layerinfo->pgconn, "");
+    }
+
+    if ( !pgresult || PQresultStatus(pgresult) != PGRES_COMMAND_OK || PQnfields(pgresult) != layer->numitems + 2 ) {
+        msSetError(MS_QUERYERR, "Error describing query: %s", "msPostGISDescribeColumns()", PQerrorMessage(layerinfo->pgconn));
+        if (pgresult) PQclear(pgresult);
+        free(strSQL);
+        free(strKey);
+        return MS_FAILURE;
+    }
+
+    /* items, then the uid (the geometry column in between is always bytea) */
+    layerinfo->textcolumns = (char*)msSmallCalloc(layer->numitems + 1, sizeof(char));
+    for ( t = 0; t < layer->numitems; t++ ) {
+        layerinfo->textcolumns[t] = ! msPostGISBinaryTypeSupported(PQftype(pgresult, t));
+    }
+    layerinfo->textcolumns[t] = ! msPostGISBinaryTypeSupported(PQftype(pgresult, t + 1));
+    layerinfo->textcolumnskey = strKey;
+
+    if ( layer->debug > 1 ) {
+        for ( t = 0; t < layer->numitems; t++ ) {
+            msDebug("msPostGISDescribeColumns: [%s] type %d%s\n", layer->items[t], PQftype(pgresult, t), layerinfo->textcolumns[t] ? ", sent as text" : "");
+        }
+    }
+
+    PQclear(pgresult);
+    free(strSQL);
+    return MS_SUCCESS;
+}
+
+/*
+** Big endian (network order) integers of a binary result value.
+*/
+static unsigned int msPostGISReadUInt32(const unsigned char *p) {
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | (unsigned int)p[3];
+}
+
+/*
+** msPostGISBinaryValueToString()
+**
+** Format a binary result value of one of the msPostGISBinaryTypeSupported()
+** types the way the server's text output would. 
+** Returns malloc'ed char* that must be freed by caller.
+*/
+char *msPostGISBinaryValueToString(Oid type, const char *value, int length) {
+    const unsigned char *p = (const unsigned char*)value;
+    char buffer[64];
+    char *result;
+
+    switch (type) {
+    case BOOLOID:
+        return msStrdup(p[0] ? "t" : "f");
+    case INT2OID:
+        snprintf(buffer, sizeof(buffer), "%d", (short)((p[0] << 8) | p[1]));
+        return msStrdup(buffer);
+    case INT4OID:
+        snprintf(buffer, sizeof(buffer), "%d", (int)msPostGISReadUInt32(p));
+        return msStrdup(buffer);
+    case INT8OID:
+        snprintf(buffer, sizeof(buffer), "%lld", (long long)(((unsigned long long)msPostGISReadUInt32(p) << 32) | msPostGISReadUInt32(p + 4)));
+        return msStrdup(buffer);
+    case FLOAT4OID:
+    case FLOAT8OID: {
+        double d;
+        if (type == FLOAT4OID) {
+            unsigned int bits = msPostGISReadUInt32(p);
+            float f;
+            memcpy(&f, &bits, sizeof(float));
+            d = f;
+        } else {
+            unsigned long long bits = ((unsigned long long)msPostGISReadUInt32(p) << 32) | msPostGISReadUInt32(p + 4);
+            memcpy(&d, &bits, sizeof(double));
+        }
+        if (msIsNan(d))
+            return msStrdup("NaN");
+        if (d == HUGE_VAL)
+            return msStrdup("Infinity");
+        if (d == -HUGE_VAL)
+            return msStrdup("-Infinity");
+        /*
+        ** The shortest form that reads back to the same value, like the
+        ** float4out() and float8out() of PostgreSQL 12 and later (older
+        ** servers print FLT_DIG and DBL_DIG digits unless
+        ** extra_float_digits is set).
+        */
+        if (type == FLOAT4OID) {
+            int digits;
+            for (digits = FLT_DIG; digits < 9; digits++) {
+                snprintf(buffer, sizeof(buffer), "%.*g", digits, d);
+                if ((float)strtod(buffer, NULL) == (float)d)
+                    break;
+            }
+            snprintf(buffer, sizeof(buffer), "%.*g", digits, d);
+        } else {
+            int digits;
+            for (digits = DBL_DIG; digits < 17; digits++) {
+                snprintf(buffer, sizeof(buffer), "%.*g", digits, d);
+                if (strtod(buffer, NULL) == d)
+                    break;
+            }
+            snprintf(buffer, sizeof(buffer), "%.*g", digits, d);
+        }
+        return msStrdup(buffer);
+    }
+    default:
+        /* The text types are sent as their characters. */
+        result = (char*)msSmallMalloc(length + 1);
+        memcpy(result, value, length);
+        result[length] = '\0';
+        return result;
+    }
+}
+
 int msPostGISReadShape(layerObj *layer, shapeObj *shape) {
 
     char *wkbstr = NULL;
@@ -2062,22 +2486,44 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape) {
     }
 
 
-    wkb = calloc(wkbstrlen, sizeof(char));
+    if ( layerinfo->binary ) {
+        if ( wkbstrlen == 0 ) {
+            return MS_FAILURE;
+        }
+        /* The WKB is read in place out of the result, no copy or decoding needed. */
+        w.wkb = wkbstr;
+        w.size = wkbstrlen;
+    }
+    else {
+        wkb = calloc(wkbstrlen, sizeof(char));
 #if TRANSFER_ENCODING == 64
-    result = msPostGISBase64Decode(wkb, wkbstr, wkbstrlen - 1);
+        result = msPostGISBase64Decode(wkb, wkbstr, wkbstrlen - 1);
 #else
-    result = msPostGISHexDecode(wkb, wkbstr, wkbstrlen);
+        result = msPostGISHexDecode(wkb, wkbstr, wkbstrlen);
 #endif
 
-    if( ! result ) {
-        free(wkb);
-        return MS_FAILURE;
+        if( ! result ) {
+            free(wkb);
+            return MS_FAILURE;
+        }
+
+        w.wkb = (char*)wkb;
+        w.size = (wkbstrlen - 1)/2;
     }
 
     /* Initialize our wkbObj */
-    w.wkb = (char*)wkb;
     w.ptr = w.wkb;
-    w.size = (wkbstrlen - 1)/2;
+
+    /*
+    ** The WKB is read with memcpy() (and the line vertices copied in
+    ** bulk), so it has to be in the byte order asked for in
+    ** msPostGISBuildSQLItems(): 1 for NDR (little endian), 0 for XDR.
+    */
+    if ( w.size < 1 || w.wkb[0] != (layerinfo->endian == LITTLE_ENDIAN ? 1 : 0) ) {
+        msSetError(MS_QUERYERR, "WKB returned is not in the byte order of this machine.", "msPostGISReadShape()");
+        if ( wkb ) free(wkb);
+        return MS_FAILURE;
+    }
     
     /* Set the type map according to what version of PostGIS we are dealing with */
     if( layerinfo->version >= 20000 ) /* PostGIS 2.0+ */
@@ -2122,7 +2568,7 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape) {
     }
 
     /* All done with WKB geometry, free it! */
-    free(wkb);
+    if ( wkb ) free(wkb);
 
     if (result != MS_FAILURE) {
         int t;
@@ -2138,6 +2584,10 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape) {
             if ( isnull ) {
                 shape->values[t] = msStrdup("");
             }
+            else if ( layerinfo->binary ) {
+                shape->values[t] = msPostGISBinaryValueToString(PQftype(layerinfo->pgresult, t), val, size);
+                msStringTrimBlanks(shape->values[t]);
+            }
             else {
                 shape->values[t] = (char*) msSmallMalloc(size + 1);
                 memcpy(shape->values[t], val, size);
@@ -2154,7 +2604,17 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape) {
         
         /* t is the geometry, t+1 is the uid */
         tmp = PQgetvalue(layerinfo->pgresult, layerinfo->rownum, t + 1);
-        if( tmp ) {
+        if( layerinfo->binary && tmp ) {
+            if( PQgetisnull(layerinfo->pgresult, layerinfo->rownum, t + 1) ) {
+                uid = 0;
+            }
+            else {
+                tmp = msPostGISBinaryValueToString(PQftype(layerinfo->pgresult, t + 1), tmp, PQgetlength(layerinfo->pgresult, layerinfo->rownum, t + 1));
+                uid = strtol( tmp, NULL, 10 );
+                free(tmp);
+            }
+        }
+        else if( tmp ) {
             uid = strtol( tmp, NULL, 10 );
         }
         else {
@@ -2162,10 +2622,10 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape) {
         }
         if( layer->debug > 4 ) {
             msDebug("msPostGISReadShape: Setting shape->index = %d\n", uid);
-            msDebug("msPostGISReadShape: Setting shape->resultindex = %d\n", layerinfo->rownum);
+            msDebug("msPostGISReadShape: Setting shape->resultindex = %ld\n", layerinfo->rowoffset + layerinfo->rownum);
         }
         shape->index = uid;
-        shape->resultindex = layerinfo->rownum;
+        shape->resultindex = layerinfo->rowoffset + layerinfo->rownum;
         
         if( layer->debug > 2 ) {
             msDebug("msPostGISReadShape: [index] %d\n",  shape->index);
@@ -2477,6 +2937,14 @@ int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery) {
     */
     layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
 
+    /* Binary transfer needs to know which columns have to come as text. */
+    layerinfo->binary = msPostGISUseBinaryTransfer(layer);
+    if ( layerinfo->binary && msPostGISDescribeColumns(layer, &rect, NULL) != MS_SUCCESS ) {
+        free(bind_key);
+        free(layer_bind_values);
+        return MS_FAILURE;
+    }
+
     /* Build a SQL query based on our current state. */
     strSQL = msPostGISBuildSQL(layer, &rect, NULL);
     if ( ! strSQL ) {
@@ -2488,10 +2956,45 @@ int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery) {
         msDebug("msPostGISLayerWhichShapes query: %s\n", strSQL);
     }
 
+    /* A cursor left over from the previous WhichShapes is of no use anymore. */
+    msPostGISCloseCursor(layer);
+    layerinfo->rowoffset = 0;
+
+    /* Stream drawing requests through a cursor if asked to. */
+    layerinfo->fetchsize = 0;
+    if (!isQuery && msLayerGetProcessingKey(layer, "FETCH_SIZE") != NULL) {
+        layerinfo->fetchsize = atoi(msLayerGetProcessingKey(layer, "FETCH_SIZE"));
+    }
+
+    if (layerinfo->fetchsize > 0) {
+        /* Clean any existing pgresult, the cursor fetches into layerinfo->pgresult. */
+        if(layerinfo->pgresult) PQclear(layerinfo->pgresult);
+        layerinfo->pgresult = NULL;
+
+        if (msPostGISDeclareCursor(layer, strSQL, num_bind_values, layer_bind_values) != MS_SUCCESS) {
+            free(bind_key);
+            free(layer_bind_values);
+            free(strSQL);
+            return MS_FAILURE;
+        }
+        free(bind_key);
+        free(layer_bind_values);
+
+        if ( layer->debug ) {
+            msDebug("msPostGISLayerWhichShapes streaming through cursor %s, %d records per batch.\n", layerinfo->cursor, layerinfo->fetchsize);
+        }
+
+        /* Clean any existing SQL before storing current. */
+        if(layerinfo->sql) free(layerinfo->sql);
+        layerinfo->sql = strSQL;
+
+        return MS_SUCCESS;
+    }
+
     if(num_bind_values > 0) {
         pgresult = PQexecParams(layerinfo->pgconn, strSQL, num_bind_values, NULL, (const char**)layer_bind_values, NULL, NULL, 1);
     } else {
-      pgresult = PQexecParams(layerinfo->pgconn, strSQL,0, NULL, NULL, NULL, NULL, 0);
+      pgresult = PQexecParams(layerinfo->pgconn, strSQL,0, NULL, NULL, NULL, NULL, layerinfo->binary);
     }
 
     /* free bind values */
@@ -2562,6 +3065,13 @@ int msPostGISLayerNextShape(layerObj *layer, shapeObj *shape) {
     ** Roll through pgresult until we hit non-null shape (usually right away).
     */
     while (shape->type == MS_SHAPE_NULL) {
+        if (layerinfo->cursor && layerinfo->rownum >= PQntuples(layerinfo->pgresult)) {
+            /* End of this batch, read the next one from the cursor. */
+            int status = msPostGISFetchBatch(layer);
+            if (status != MS_SUCCESS) {
+                return status;
+            }
+        }
         if (layerinfo->rownum < PQntuples(layerinfo->pgresult)) {
             int rv;
             /* Retrieve this shape, cursor access mode. */
@@ -2638,8 +3148,11 @@ int msPostGISLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
             return MS_FAILURE;
         }
 
+        /* While streaming only the current batch is available. */
+        resultindex -= layerinfo->rowoffset;
+
         /* Check the validity of the requested record number. */
-        if( resultindex >= PQntuples(pgresult) ) {
+        if( resultindex < 0 || resultindex >= PQntuples(pgresult) ) {
             msDebug("msPostGISLayerGetShape got request for (%d) but only has %d tuples.\n", resultindex, PQntuples(pgresult));
             msSetError( MS_MISCERR,
                         "Got request larger than result set.",
@@ -2673,6 +3186,11 @@ int msPostGISLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
         */
         layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
 
+        layerinfo->binary = msPostGISUseBinaryTransfer(layer);
+        if ( layerinfo->binary && msPostGISDescribeColumns(layer, 0, &shapeindex) != MS_SUCCESS ) {
+            return MS_FAILURE;
+        }
+
         /* Build a SQL query based on our current state. */
         strSQL = msPostGISBuildSQL(layer, 0, &shapeindex);
         if ( ! strSQL ) {
@@ -2684,7 +3202,7 @@ int msPostGISLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
             msDebug("msPostGISLayerGetShape query: %s\n", strSQL);
         }
 
-        pgresult = PQexecParams(layerinfo->pgconn, strSQL,0, NULL, NULL, NULL, NULL, 0);
+        pgresult = PQexecParams(layerinfo->pgconn, strSQL,0, NULL, NULL, NULL, NULL, layerinfo->binary);
 
         /* Something went wrong. */
         if ( (!pgresult) || (PQresultStatus(pgresult) != PGRES_TUPLES_OK) ) {
@@ -2701,7 +3219,8 @@ int msPostGISLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
             return MS_FAILURE;
         }
 
-        /* Clean any existing pgresult before storing current one. */
+        /* Clean any existing pgresult (and the cursor it came from) before storing current one. */
+        msPostGISCloseCursor(layer);
         if(layerinfo->pgresult) PQclear(layerinfo->pgresult);
         layerinfo->pgresult = pgresult;
 
@@ -2710,6 +3229,7 @@ int msPostGISLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
         layerinfo->sql = strSQL;
 
         layerinfo->rownum = 0; /* Only return one result. */
+        layerinfo->rowoffset = 0;
 
         /* We don't know the shape type until we read the geometry. */
         shape->type = MS_SHAPE_NULL;
@@ -2742,42 +3262,6 @@ int msPostGISLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
  * defining fields.
  **********************************************************************/
 
-/* These are the OIDs for some builtin types, as returned by PQftype(). */
-/* They were copied from pg_type.h in src/include/catalog/pg_type.h */
-
-#ifndef BOOLOID 
-#define BOOLOID                 16
-#define BYTEAOID                17
-#define CHAROID                 18
-#define NAMEOID                 19
-#define INT8OID                 20
-#define INT2OID                 21
-#define INT2VECTOROID           22
-#define INT4OID                 23
-#define REGPROCOID              24
-#define TEXTOID                 25
-#define OIDOID                  26
-#define TIDOID                  27
-#define XIDOID                  28
-#define CIDOID                  29
-#define OIDVECTOROID            30
-#define FLOAT4OID               700
-#define FLOAT8OID               701
-#define INT4ARRAYOID            1007
-#define TEXTARRAYOID            1009
-#define BPCHARARRAYOID          1014
-#define VARCHARARRAYOID         1015
-#define FLOAT4ARRAYOID          1021
-#define FLOAT8ARRAYOID          1022
-#define BPCHAROID		1042
-#define VARCHAROID		1043
-#define DATEOID			1082
-#define TIMEOID			1083
-#define TIMESTAMPOID	        1114
-#define TIMESTAMPTZOID	        1184
-#define NUMERICOID              1700
-#endif
-
 #ifdef USE_POSTGIS
 static void 
 msPostGISPassThroughFieldDefinitions( layerObj *layer, 
@@ -43,6 +43,9 @@
 /* HEX = 16 or BASE64 = 64*/
 #define TRANSFER_ENCODING 16
 
+/* Name prefix of the server-side cursors used by PROCESSING "FETCH_SIZE=n" */
+#define CURSORNAME "mapserver_cursor"
+
 /* Substitution token for box hackery */
 #define BOXTOKEN "!BOX!"
 #define BOXTOKENLENGTH 5
@@ -63,6 +66,14 @@ typedef struct {
     char        *fromsource; /* Specified record source, ed "thegeom from THETABLE" or "thegeom from (SELECT..) AS FOO" */
     int         endian;      /* Endianness of the mapserver host */
     int         version;     /* PostGIS version of the database */
+    char        *cursor;     /* Name of the open cursor when streaming (FETCH_SIZE), NULL otherwise */
+    int         fetchsize;   /* Rows read per FETCH from the cursor */
+    int         cursordone;  /* The last FETCH returned a short batch, nothing left to read */
+    int         owntransaction; /* We issued the BEGIN the cursor lives in and must end it */
+    long        rowoffset;   /* Rows fetched in the batches before pgresult */
+    int         binary;      /* Rows are transferred in binary format (BINARY_TRANSFER) */
+    char        *textcolumns; /* Per attribute (then uid) column, MS_TRUE if it is cast to text for a binary transfer */
+    char        *textcolumnskey; /* Source and items textcolumns was worked out for */
 }
 msPostGISLayerInfo;
 
@@ -160,6 +171,10 @@ static int wkb_postgis20[WKB_TYPE_COUNT] = {
 void msPostGISFreeLayerInfo(layerObj *layer);
 msPostGISLayerInfo *msPostGISCreateLayerInfo(void);
 char *msPostGISBuildSQL(layerObj *layer, rectObj *rect, long *uid);
+int msPostGISFetchBatch(layerObj *layer);
+int msPostGISDescribeColumns(layerObj *layer, rectObj *rect, long *uid);
+char *msPostGISBinaryValueToString(Oid type, const char *value, int length);
+void msPostGISCloseCursor(layerObj *layer);
 int msPostGISParseData(layerObj *layer);
 int arcStrokeCircularString(wkbObj *w, double segment_angle, lineObj *line);
 int wkbConvGeometryToShape(wkbObj *w, shapeObj *shape);
@@ -94,6 +94,25 @@ typedef struct {
 
 typedef lineObj multipointObj;
 
+#ifndef SWIG
+/* 
+** A shape prepared for repeated intersection tests (see msPrepareShape()):
+** its edges are indexed by horizontal bands.
+*/
+typedef struct {
+  pointObj *a, *b;
+  int closing; /* edge closing the ring, only used for point in polygon */
+} preparedEdgeObj;
+
+typedef struct {
+  shapeObj *shape;
+  double miny, bandscale;
+  int numbands;
+  int *bandstart; /* edges of band i are edges[bandstart[i]..bandstart[i+1]-1] */
+  preparedEdgeObj *edges;
+} preparedShapeObj;
+#endif
+
 #ifndef SWIG
 /* attribute primatives */
 typedef struct {
@@ -37,6 +37,15 @@
 MS_CVSID("$Id$")
 
 #ifdef USE_PROJ
+/* With PROJ >= 4.8 each projectionObj has its own context, so pj_transform() */
+/* only needs the lock if one of them is used by several threads at once */
+/* (ie. map->projection while the layers are drawn in threads). */
+#if PJ_VERSION < 480
+#  define MS_PROJ_NEED_LOCK(in, out) MS_TRUE
+#else
+#  define MS_PROJ_NEED_LOCK(in, out) ((in)->proj_lock || (out)->proj_lock)
+#endif
+
 static int msTestNeedWrap( pointObj pt1, pointObj pt2, pointObj pt2_geo,
                            projectionObj *src_proj, 
                            projectionObj *dst_proj );
@@ -49,7 +58,7 @@ int msProjectPoint(projectionObj *in, projectionObj *out, pointObj *point)
 {
 #ifdef USE_PROJ
   projUV p;
-  int	 error;
+  int	 error, lock;
 
   if( in && in->gt.need_geotransform )
   {
@@ -90,10 +99,13 @@ int msProjectPoint(projectionObj *in, projectionObj *out, pointObj *point)
           point->y *= DEG_TO_RAD;
       }
 
-      msAcquireLock( TLOCK_PROJ );
+      lock = MS_PROJ_NEED_LOCK(in, out);
+      if( lock )
+          msAcquireLock( TLOCK_PROJ );
       error = pj_transform( in->proj, out->proj, 1, 0, 
                             &(point->x), &(point->y), &z );
-      msReleaseLock( TLOCK_PROJ );
+      if( lock )
+          msReleaseLock( TLOCK_PROJ );
 
       if( error || point->x == HUGE_VAL || point->y == HUGE_VAL )
           return MS_FAILURE;
@@ -166,6 +178,119 @@ int msProjectPoint(projectionObj *in, projectionObj *out, pointObj *point)
 #endif
 }
 
+/************************************************************************/
+/*                      msProjectPointsOneByOne()                       */
+/************************************************************************/
+#ifdef USE_PROJ
+static int msProjectPointsOneByOne(projectionObj *in, projectionObj *out, 
+                                   pointObj *points, int numpoints)
+{
+  int i, failed = MS_FALSE;
+
+  for( i = 0; i < numpoints; i++ )
+  {
+      if( msProjectPoint( in, out, points + i ) == MS_FAILURE )
+      {
+          points[i].x = points[i].y = HUGE_VAL;
+          failed = MS_TRUE;
+      }
+  }
+  return failed ? MS_FAILURE : MS_SUCCESS;
+}
+#endif
+
+/************************************************************************/
+/*                          msProjectPoints()                           */
+/*                                                                      */
+/*      Reproject an array of points in place with a single             */
+/*      pj_transform() call instead of one call (and one TLOCK_PROJ     */
+/*      round trip) per vertex.  Points that fail to reproject are      */
+/*      set to HUGE_VAL and MS_FAILURE is returned, but all other       */
+/*      points are still transformed, so callers that need per          */
+/*      point status can inspect the results.                           */
+/************************************************************************/
+int msProjectPoints(projectionObj *in, projectionObj *out, 
+                    pointObj *points, int numpoints)
+{
+#ifdef USE_PROJ
+  int i, error, lock, failed = MS_FALSE;
+  pointObj *original;
+
+  if( numpoints <= 0 )
+      return MS_SUCCESS;
+
+/* -------------------------------------------------------------------- */
+/*      The batched path only covers the pj_transform() case with no    */
+/*      geotransforms involved.  Everything else goes point by point.   */
+/* -------------------------------------------------------------------- */
+  if( numpoints == 1 || in == NULL || in->proj == NULL 
+      || out == NULL || out->proj == NULL
+      || in->gt.need_geotransform || out->gt.need_geotransform
+      || (in->numargs == 1 && out->numargs == 1
+          && strcmp(in->args[0],out->args[0]) == 0) )
+  {
+      return msProjectPointsOneByOne( in, out, points, numpoints );
+  }
+
+  /* kept for the point by point fallback below */
+  original = (pointObj *) msSmallMalloc(sizeof(pointObj) * numpoints);
+  memcpy( original, points, sizeof(pointObj) * numpoints );
+
+  if( pj_is_latlong(in->proj) )
+  {
+      for( i = 0; i < numpoints; i++ )
+      {
+          points[i].x *= DEG_TO_RAD;
+          points[i].y *= DEG_TO_RAD;
+      }
+  }
+
+  /* pointObj is made of doubles only, so x and y are interleaved */
+  /* with a stride of sizeof(pointObj)/sizeof(double) */
+  lock = MS_PROJ_NEED_LOCK(in, out);
+  if( lock )
+      msAcquireLock( TLOCK_PROJ );
+  error = pj_transform( in->proj, out->proj, numpoints, 
+                        sizeof(pointObj) / sizeof(double),
+                        &(points[0].x), &(points[0].y), NULL );
+  if( lock )
+      msReleaseLock( TLOCK_PROJ );
+
+/* -------------------------------------------------------------------- */
+/*      pj_transform() reports non transient errors (ie. a point        */
+/*      outside of a datum grid) for the whole batch, leaving the       */
+/*      array in an undefined state.  Start over point by point, so     */
+/*      that only the points that really fail are lost.                 */
+/* -------------------------------------------------------------------- */
+  if( error )
+  {
+      memcpy( points, original, sizeof(pointObj) * numpoints );
+      free( original );
+      return msProjectPointsOneByOne( in, out, points, numpoints );
+  }
+  free( original );
+
+  for( i = 0; i < numpoints; i++ )
+  {
+      if( points[i].x == HUGE_VAL || points[i].y == HUGE_VAL )
+      {
+          points[i].x = points[i].y = HUGE_VAL;
+          failed = MS_TRUE;
+      }
+      else if( pj_is_latlong(out->proj) )
+      {
+          points[i].x *= RAD_TO_DEG;
+          points[i].y *= RAD_TO_DEG;
+      }
+  }
+
+  return failed ? MS_FAILURE : MS_SUCCESS;
+#else
+  msSetError(MS_PROJERR, "Projection support is not available.", "msProjectPoints()");
+  return(MS_FAILURE);
+#endif
+}
+
 /************************************************************************/
 /*                         msProjectGrowRect()                          */
 /************************************************************************/
@@ -281,6 +406,7 @@ msProjectShapeLine(projectionObj *in, projectionObj *out,
 {
     int i;
     pointObj	lastPoint, thisPoint, wrkPoint, firstPoint;
+    pointObj   *projected;
     lineObj *line = shape->line + line_index;
     lineObj *line_out = line;
     int valid_flag = 0; /* 1=true, -1=false, 0=unknown */
@@ -291,10 +417,21 @@ msProjectShapeLine(projectionObj *in, projectionObj *out,
     wrap_test = out != NULL && out->proj != NULL && pj_is_latlong(out->proj)
         && !pj_is_latlong(in->proj);
 
+    if( numpoints_in == 0 )
+        return(MS_SUCCESS);
+
+/* -------------------------------------------------------------------- */
+/*      Reproject all the vertices in one batch up front.  The          */
+/*      original coordinates are still needed for the horizon and       */
+/*      wrap logic below so we work on a copy.                          */
+/* -------------------------------------------------------------------- */
+    projected = (pointObj *) msSmallMalloc(sizeof(pointObj) * numpoints_in);
+    memcpy( projected, line->point, sizeof(pointObj) * numpoints_in );
+    msProjectPoints( in, out, projected, numpoints_in );
+
     line->numpoints = 0;
 
-    if( numpoints_in > 0 )
-        firstPoint = line->point[0];
+    firstPoint = line->point[0];
 
     memset( &lastPoint, 0, sizeof(lastPoint) );
 
@@ -304,9 +441,13 @@ msProjectShapeLine(projectionObj *in, projectionObj *out,
     for( i=0; i < numpoints_in; i++ )
     {
         int ms_err;
-        wrkPoint = thisPoint = line->point[i];
+        thisPoint = line->point[i];
+        wrkPoint = projected[i];
 
-        ms_err = msProjectPoint(in, out, &wrkPoint );
+        if( wrkPoint.x == HUGE_VAL || wrkPoint.y == HUGE_VAL )
+            ms_err = MS_FAILURE;
+        else
+            ms_err = MS_SUCCESS;
 
 /* -------------------------------------------------------------------- */
 /*      Apply wrap logic.                                               */
@@ -444,6 +585,8 @@ msProjectShapeLine(projectionObj *in, projectionObj *out,
         lastPoint = thisPoint;
     }
 
+    free( projected );
+
 /* -------------------------------------------------------------------- */
 /*      Make sure that polygons are closed, even if the trip over       */
 /*      the horizon left them unclosed.                                 */
@@ -517,19 +660,28 @@ int msProjectLine(projectionObj *in, projectionObj *out, lineObj *line)
   {
       pointObj	startPoint, thisPoint; /* locations in projected space */
 
+      pointObj *original;
+
+      if( line->numpoints == 0 )
+          return(MS_SUCCESS);
+
       startPoint = line->point[0];
 
+      /* keep the unprojected points around for msTestNeedWrap() */
+      original = (pointObj *) msSmallMalloc(sizeof(pointObj) * line->numpoints);
+      memcpy( original, line->point, sizeof(pointObj) * line->numpoints );
+      msProjectPoints(in, out, line->point, line->numpoints);
+
       for(i=0; i<line->numpoints; i++)
       {
           double	dist;
 
-          thisPoint = line->point[i];
+          thisPoint = original[i];
 
           /* 
           ** Read comments before msTestNeedWrap() to better understand
           ** this dateline wrapping logic. 
           */
-          msProjectPoint(in, out, &(line->point[i]));
           if( i > 0 )
           {
               dist = line->point[i].x - line->point[0].x;
@@ -551,14 +703,13 @@ int msProjectLine(projectionObj *in, projectionObj *out, lineObj *line)
 
           }
       }
+
+      free( original );
   }
   else
   {
-      for(i=0; i<line->numpoints; i++)
-      {
-          if( msProjectPoint(in, out, &(line->point[i])) == MS_FAILURE )
-              return MS_FAILURE;
-      }
+      if( msProjectPoints(in, out, line->point, line->numpoints) == MS_FAILURE )
+          return MS_FAILURE;
   }
 
   return(MS_SUCCESS);
@@ -55,6 +55,11 @@ typedef struct {
   char **args; /* variable number of projection args */
 #ifdef USE_PROJ
   projPJ proj; /* a projection structure for the PROJ package */
+#  if PJ_VERSION >= 480
+  projCtx proj_ctx; /* private PROJ context, lets us transform without TLOCK_PROJ */
+#  endif
+  int *proj_refcount; /* if set, proj (and proj_ctx) are shared with the copies of this object, see msShareProjection() */
+  int proj_lock; /* if set, several threads transform with this object, pj_transform() must then hold TLOCK_PROJ */
 #else
   void *proj;
 #endif
@@ -64,6 +69,7 @@ typedef struct {
 
 #ifndef SWIG
 MS_DLL_EXPORT int msProjectPoint(projectionObj *in, projectionObj *out, pointObj *point);
+MS_DLL_EXPORT int msProjectPoints(projectionObj *in, projectionObj *out, pointObj *points, int numpoints);
 MS_DLL_EXPORT int msProjectShape(projectionObj *in, projectionObj *out, shapeObj *shape);
 MS_DLL_EXPORT int msProjectLine(projectionObj *in, projectionObj *out, lineObj *line);
 MS_DLL_EXPORT int msProjectRect(projectionObj *in, projectionObj *out, rectObj *rect);
@@ -75,6 +81,7 @@ MS_DLL_EXPORT char *msProjectionObj2OGCWKT( projectionObj *proj );
 MS_DLL_EXPORT void msFreeProjection(projectionObj *p);
 MS_DLL_EXPORT int msInitProjection(projectionObj *p);
 MS_DLL_EXPORT int msProcessProjection(projectionObj *p);
+MS_DLL_EXPORT void msShareProjection(projectionObj *p);
 MS_DLL_EXPORT int msLoadProjectionString(projectionObj *p, const char *value);
 MS_DLL_EXPORT int msLoadProjectionStringEPSG(projectionObj *p, const char *value);
 MS_DLL_EXPORT char *msGetProjectionString(projectionObj *proj);
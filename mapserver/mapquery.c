@@ -1152,6 +1152,7 @@ int msQueryByFeatures(mapObj *map)
 
   rectObj searchrect;
   shapeObj shape, selectshape;
+  preparedShapeObj *prepared = NULL;
   int nclasses = 0;
   int *classgroup = NULL;
   double minfeaturesize = -1;
@@ -1301,6 +1302,10 @@ int msQueryByFeatures(mapObj *map)
       if (lp->minfeaturesize > 0)
           minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
+      /* index the edges of the selection shape once for all the intersection tests */
+      if(tolerance == 0)
+        prepared = msPrepareShape(&selectshape);
+
       while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
           
 	/* check for dups when there are multiple selection shapes */
@@ -1342,7 +1347,7 @@ int msQueryByFeatures(mapObj *map)
 	  switch(shape.type) { /* make sure shape actually intersects the selectshape */
 	  case MS_SHAPE_POINT:
 	    if(tolerance == 0) /* just test for intersection */
-	      status = msIntersectMultipointPolygon(&shape, &selectshape);
+	      status = msIntersectMultipointPreparedPolygon(&shape, prepared);
 	    else { /* check distance, distance=0 means they intersect */
 	      distance = msDistanceShapeToShape(&selectshape, &shape);
 	      if(distance < tolerance) status = MS_TRUE;
@@ -1350,7 +1355,7 @@ int msQueryByFeatures(mapObj *map)
 	    break;
 	  case MS_SHAPE_LINE:
 	    if(tolerance == 0) { /* just test for intersection */
-	      status = msIntersectPolylinePolygon(&shape, &selectshape);
+	      status = msIntersectPolylinePreparedPolygon(&shape, prepared);
 	    } else { /* check distance, distance=0 means they intersect */
 	      distance = msDistanceShapeToShape(&selectshape, &shape);
 	      if(distance < tolerance) status = MS_TRUE;
@@ -1358,7 +1363,7 @@ int msQueryByFeatures(mapObj *map)
 	    break;
 	  case MS_SHAPE_POLYGON:
 	    if(tolerance == 0) /* just test for intersection */
-	      status = msIntersectPolygons(&shape, &selectshape);
+	      status = msIntersectPolygonPreparedPolygon(&shape, prepared);
 	    else { /* check distance, distance=0 means they intersect */
 	      distance = msDistanceShapeToShape(&selectshape, &shape);
 	      if(distance < tolerance) status = MS_TRUE;
@@ -1382,7 +1387,7 @@ int msQueryByFeatures(mapObj *map)
             break;
           case MS_SHAPE_LINE:
             if(tolerance == 0) { /* just test for intersection */
-              status = msIntersectPolylines(&shape, &selectshape);
+              status = msIntersectPolylinePreparedPolyline(&shape, prepared);
             } else { /* check distance, distance=0 means they intersect */
               distance = msDistanceShapeToShape(&selectshape, &shape);
               if(distance < tolerance) status = MS_TRUE;
@@ -1390,7 +1395,7 @@ int msQueryByFeatures(mapObj *map)
             break;
           case MS_SHAPE_POLYGON:
             if(tolerance == 0) /* just test for intersection */
-              status = msIntersectPolylinePolygon(&selectshape, &shape);
+              status = msIntersectPreparedPolylinePolygon(prepared, &shape);
             else { /* check distance, distance=0 means they intersect */
               distance = msDistanceShapeToShape(&selectshape, &shape);
               if(distance < tolerance) status = MS_TRUE;
@@ -1411,6 +1416,9 @@ int msQueryByFeatures(mapObj *map)
 	msFreeShape(&shape);
       } /* next shape */
 
+      msFreePreparedShape(prepared);
+      prepared = NULL;
+
       if (classgroup)
         msFree(classgroup);
 
@@ -1645,6 +1653,7 @@ int msQueryByShape(mapObj *map)
 {
   int start, stop=0, l;
   shapeObj shape, *qshape=NULL;
+  preparedShapeObj *prepared=NULL;
   layerObj *lp;
   char status;
   double distance, tolerance, layer_tolerance;
@@ -1770,6 +1779,10 @@ int msQueryByShape(mapObj *map)
     if (lp->minfeaturesize > 0)
         minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
+    /* index the edges of the query shape once for all the intersection tests */
+    if(tolerance == 0 && qshape->type != MS_SHAPE_POINT)
+      prepared = msPrepareShape(qshape);
+
     while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
       /* Check if the shape size is ok to be drawn */
@@ -1807,7 +1820,7 @@ int msQueryByShape(mapObj *map)
         switch(shape.type) { /* make sure shape actually intersects the shape */
         case MS_SHAPE_POINT:
           if(tolerance == 0) /* just test for intersection */
-	     status = msIntersectMultipointPolygon(&shape, qshape);
+	     status = msIntersectMultipointPreparedPolygon(&shape, prepared);
 	  else { /* check distance, distance=0 means they intersect */
 	    distance = msDistanceShapeToShape(qshape, &shape);
 	    if(distance < tolerance) status = MS_TRUE;
@@ -1815,7 +1828,7 @@ int msQueryByShape(mapObj *map)
 	  break;
         case MS_SHAPE_LINE:
           if(tolerance == 0) { /* just test for intersection */
-	    status = msIntersectPolylinePolygon(&shape, qshape);
+	    status = msIntersectPolylinePreparedPolygon(&shape, prepared);
 	  } else { /* check distance, distance=0 means they intersect */
 	    distance = msDistanceShapeToShape(qshape, &shape);
 	    if(distance < tolerance) status = MS_TRUE;
@@ -1823,7 +1836,7 @@ int msQueryByShape(mapObj *map)
 	  break;
         case MS_SHAPE_POLYGON:	
 	  if(tolerance == 0) /* just test for intersection */
-	    status = msIntersectPolygons(&shape, qshape);
+	    status = msIntersectPolygonPreparedPolygon(&shape, prepared);
 	  else { /* check distance, distance=0 means they intersect */
 	    distance = msDistanceShapeToShape(qshape, &shape);
 	    if(distance < tolerance) status = MS_TRUE;
@@ -1846,7 +1859,7 @@ int msQueryByShape(mapObj *map)
 	  break;
 	case MS_SHAPE_LINE:
 	  if(tolerance == 0) { /* just test for intersection */
-	    status = msIntersectPolylines(&shape, qshape);
+	    status = msIntersectPolylinePreparedPolyline(&shape, prepared);
 	  } else { /* check distance, distance=0 means they intersect */
 	    distance = msDistanceShapeToShape(qshape, &shape);
 	    if(distance < tolerance) status = MS_TRUE;
@@ -1854,7 +1867,7 @@ int msQueryByShape(mapObj *map)
 	  break;
 	case MS_SHAPE_POLYGON:
 	  if(tolerance == 0) /* just test for intersection */
-	    status = msIntersectPolylinePolygon(qshape, &shape);
+	    status = msIntersectPreparedPolylinePolygon(prepared, &shape);
 	  else { /* check distance, distance=0 means they intersect */
 	    distance = msDistanceShapeToShape(qshape, &shape);
 	    if(distance < tolerance) status = MS_TRUE;
@@ -1881,6 +1894,9 @@ int msQueryByShape(mapObj *map)
       msFreeShape(&shape);
     } /* next shape */
 
+    msFreePreparedShape(prepared);
+    prepared = NULL;
+
     if(status != MS_DONE) return(MS_FAILURE);
 
     if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
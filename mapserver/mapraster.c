@@ -38,7 +38,6 @@
 MS_CVSID("$Id$")
 
 extern int msyylex_destroy(void);
-extern int yyparse(parseObj *);
 
 extern parseResultObj yypresult; /* result of parsing, true/false */
 
@@ -147,7 +146,7 @@ static int msGetClass_String( layerObj *layer, colorObj *color, const char *pixe
               p.expr->curtoken = p.expr->tokens; /* reset */
               p.type = MS_PARSE_TYPE_BOOLEAN;
               
-              status = yyparse(&p);
+              status = msRunExpression(&p);
               
               if (status != 0) {
                   msSetError(MS_PARSEERR, "Failed to parse expression: %s", "msGetClass_FloatRGB", expression->string);
@@ -353,7 +352,6 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
   char *tiAbsDirPath = NULL;
   GDALDatasetH  hDS;
   double	adfGeoTransform[6];
-  const char *close_connection;
 
   msGDALInitialize();
 
@@ -553,7 +551,7 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
         return MS_FAILURE;
 
     msAcquireLock( TLOCK_GDAL );
-    hDS = GDALOpenShared( decrypted_path, GA_ReadOnly );
+    hDS = (GDALDatasetH) msGDALPoolOpen( map, layer, decrypted_path );
 
     /*
     ** If GDAL doesn't recognise it, and it wasn't successfully opened 
@@ -634,6 +632,7 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
                 msSetError(MS_OGRERR, "%s","msDrawRasterLayer()",
                            szLongMsg);
                 
+                msGDALPoolRelease( layer, hDS );
                 msReleaseLock( TLOCK_GDAL );
                 final_status = MS_FAILURE;
                 break;
@@ -674,37 +673,26 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
         status = msDrawRasterLayerGDAL(map, layer, image, rb, hDS );
     }
 
+    /*
+    ** The dataset stays open in the pool for the next tiles and requests
+    ** unless CLOSE_CONNECTION is ALWAYS or NORMAL.
+    */
+    msGDALPoolRelease( layer, hDS );
+    msReleaseLock( TLOCK_GDAL );
+
     if( status == -1 )
     {
-        GDALClose( hDS );
-        msReleaseLock( TLOCK_GDAL );
         final_status = MS_FAILURE;
         break;
     }
+  } /* next tile */
 
-    /*
-    ** Should we keep this file open for future use?  
-    ** default to keeping open for single data files, and 
-    ** to closing for tile indexes
-    */
-
-    close_connection = msLayerGetProcessingKey( layer, 
-                                                "CLOSE_CONNECTION" );
-            
-    if( close_connection == NULL && layer->tileindex == NULL )
-        close_connection = "DEFER";
-    
-    if( close_connection != NULL
-        && strcasecmp(close_connection,"DEFER") == 0 )
-    {
-        GDALDereferenceDataset( hDS );
-    }
-    else
-    {
-        GDALClose( hDS );
-    }
+  if( layer->debug >= MS_DEBUGLEVEL_TUNING || map->debug >= MS_DEBUGLEVEL_TUNING )
+  {
+    msAcquireLock( TLOCK_GDAL );
+    msGDALPoolReport( "msDrawRasterLayerLow()" );
     msReleaseLock( TLOCK_GDAL );
-  } /* next tile */
+  }
 
 cleanup:
   if(layer->tileindex) { /* tiling clean-up */
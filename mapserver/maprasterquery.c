@@ -880,7 +880,7 @@ int msRasterQueryByRect(mapObj *map, layerObj *layer, rectObj queryRect)
             return MS_FAILURE;
 
         msAcquireLock( TLOCK_GDAL );
-        hDS = GDALOpen(decrypted_path, GA_ReadOnly );
+        hDS = (GDALDatasetH) msGDALPoolOpen( map, layer, decrypted_path );
         
         if( hDS == NULL )
         {
@@ -947,6 +947,7 @@ int msRasterQueryByRect(mapObj *map, layerObj *layer, rectObj queryRect)
                     msSetError(MS_OGRERR, "%s","msDrawRasterLayer()",
                                szLongMsg);
 
+                    msGDALPoolRelease( layer, hDS );
                     msReleaseLock( TLOCK_GDAL );
                     return(MS_FAILURE);
                 }
@@ -959,7 +960,7 @@ int msRasterQueryByRect(mapObj *map, layerObj *layer, rectObj queryRect)
         if( status == MS_SUCCESS )
             status = msRasterQueryByRectLow( map, layer, hDS, queryRect );
 
-        GDALClose( hDS );
+        msGDALPoolRelease( layer, hDS );
         msReleaseLock( TLOCK_GDAL );
 
     } /* next tile */
@@ -1523,7 +1524,7 @@ int msRASTERLayerGetExtent(layerObj *layer, rectObj *extent)
   msAcquireLock( TLOCK_GDAL );
   if( decrypted_path )
   {
-      hDS = GDALOpen(decrypted_path, GA_ReadOnly );
+      hDS = (GDALDatasetH) msGDALPoolOpen( map, layer, decrypted_path );
       msFree( decrypted_path );
   }
   else
@@ -1535,7 +1536,7 @@ int msRASTERLayerGetExtent(layerObj *layer, rectObj *extent)
     nYSize = GDALGetRasterYSize( hDS );
     eErr = GDALGetGeoTransform( hDS, adfGeoTransform );
     
-    GDALClose( hDS );
+    msGDALPoolRelease( layer, hDS );
   }
   
   msReleaseLock( TLOCK_GDAL );
@@ -304,6 +304,228 @@ int msIntersectPolygons(shapeObj *p1, shapeObj *p2) {
   return(MS_FALSE);
 }
 
+/*
+** Prepared shapes: the edges of a shape are indexed by horizontal bands
+** so that a shape tested against many others (e.g. the query shape of
+** msQueryByShape() or msQueryByFeatures()) only has its edges near the
+** other shape looked at. The tests give the same results as the brute
+** force functions above.
+*/
+
+static int msPreparedBand(preparedShapeObj *prepared, double y)
+{
+  double band = (y - prepared->miny)*prepared->bandscale;
+
+  if(band < 0) return 0;
+  if(band >= prepared->numbands) return prepared->numbands-1;
+  return (int) band;
+}
+
+static int msPreparedEdgeBand(preparedShapeObj *prepared, preparedEdgeObj *edge, int *last)
+{
+  if(last) *last = msPreparedBand(prepared, MS_MAX(edge->a->y, edge->b->y));
+  return msPreparedBand(prepared, MS_MIN(edge->a->y, edge->b->y));
+}
+
+preparedShapeObj *msPrepareShape(shapeObj *shape)
+{
+  preparedShapeObj *prepared;
+  preparedEdgeObj *edges;
+  int i, j, k, numedges=0, numentries, *next;
+  double maxy;
+
+  prepared = (preparedShapeObj *) msSmallCalloc(1, sizeof(preparedShapeObj));
+  prepared->shape = shape;
+
+  /* the edges of each line, plus the edge closing it */
+  for(i=0; i<shape->numlines; i++) {
+    if(shape->line[i].numpoints > 0)
+      numedges += shape->line[i].numpoints;
+  }
+
+  edges = (preparedEdgeObj *) msSmallMalloc(MS_MAX(numedges,1)*sizeof(preparedEdgeObj));
+  prepared->miny = maxy = 0;
+  for(i=0, k=0; i<shape->numlines; i++) {
+    lineObj *line = &(shape->line[i]);
+    if(line->numpoints == 0) continue;
+    for(j=0; j<line->numpoints; j++, k++) {
+      edges[k].a = &(line->point[j == 0 ? line->numpoints-1 : j-1]);
+      edges[k].b = &(line->point[j]);
+      edges[k].closing = (j == 0);
+      if(k == 0) prepared->miny = maxy = line->point[j].y;
+      prepared->miny = MS_MIN(prepared->miny, line->point[j].y);
+      maxy = MS_MAX(maxy, line->point[j].y);
+    }
+  }
+
+  /* about 4 edges per band, fewer bands if long edges would fill too many of them */
+  prepared->numbands = MS_MAX(1, MS_MIN(numedges/4, 65536));
+  for(;;) {
+    prepared->bandscale = (maxy > prepared->miny) ? prepared->numbands/(maxy - prepared->miny) : 0;
+    numentries = 0;
+    for(k=0; k<numedges; k++) {
+      int last, first = msPreparedEdgeBand(prepared, &edges[k], &last);
+      numentries += last - first + 1;
+    }
+    if(numentries <= 16*numedges || prepared->numbands == 1) break;
+    prepared->numbands /= 2;
+  }
+
+  prepared->bandstart = (int *) msSmallCalloc(prepared->numbands+1, sizeof(int));
+  prepared->edges = (preparedEdgeObj *) msSmallMalloc(MS_MAX(numentries,1)*sizeof(preparedEdgeObj));
+  for(k=0; k<numedges; k++) {
+    int last, first = msPreparedEdgeBand(prepared, &edges[k], &last);
+    for(i=first; i<=last; i++) prepared->bandstart[i+1]++;
+  }
+  for(i=0; i<prepared->numbands; i++)
+    prepared->bandstart[i+1] += prepared->bandstart[i];
+
+  next = (int *) msSmallMalloc(prepared->numbands*sizeof(int));
+  memcpy(next, prepared->bandstart, prepared->numbands*sizeof(int));
+  for(k=0; k<numedges; k++) {
+    int last, first = msPreparedEdgeBand(prepared, &edges[k], &last);
+    for(i=first; i<=last; i++) prepared->edges[next[i]++] = edges[k];
+  }
+
+  free(next);
+  free(edges);
+  return prepared;
+}
+
+void msFreePreparedShape(preparedShapeObj *prepared)
+{
+  if(!prepared) return;
+  msFree(prepared->bandstart);
+  msFree(prepared->edges);
+  msFree(prepared);
+}
+
+/*
+** Same as msIntersectPointPolygon(): the parity of the number of rings
+** containing the point is the parity of the number of edges crossed.
+*/
+int msIntersectPointPreparedPolygon(pointObj *p, preparedShapeObj *poly)
+{
+  int i, band, status=MS_FALSE;
+
+  band = msPreparedBand(poly, p->y);
+  for(i=poly->bandstart[band]; i<poly->bandstart[band+1]; i++) {
+    pointObj *pi = poly->edges[i].b, *pj = poly->edges[i].a; /* as in msPointInPolygon() */
+    if ((((pi->y<=p->y) && (p->y<pj->y)) || ((pj->y<=p->y) && (p->y<pi->y))) && (p->x < (pj->x - pi->x) * (p->y - pi->y) / (pj->y - pi->y) + pi->x))
+      status = !status;
+  }
+
+  return(status);
+}
+
+int msIntersectMultipointPreparedPolygon(shapeObj *multipoint, preparedShapeObj *poly) {
+  int i,j;
+
+  for(i=0; i<multipoint->numlines; i++ ) {
+    lineObj *points = &(multipoint->line[i]);
+    for(j=0; j<points->numpoints; j++) {
+      if(msIntersectPointPreparedPolygon(&(points->point[j]), poly) == MS_TRUE)
+        return(MS_TRUE);
+    }
+  }
+
+  return(MS_FALSE);
+}
+
+/*
+** Does segment a-b intersect an edge of the prepared shape? The segments
+** are passed to msIntersectSegments() in the order of msIntersectPolylines()
+** for the prepared shape being line2, or line1 if preparedfirst is set.
+*/
+static int msIntersectSegmentPrepared(pointObj *a, pointObj *b, preparedShapeObj *prepared, int preparedfirst)
+{
+  int band, first, last, i;
+
+  first = msPreparedBand(prepared, MS_MIN(a->y, b->y));
+  last = msPreparedBand(prepared, MS_MAX(a->y, b->y));
+
+  for(band=first; band<=last; band++) {
+    for(i=prepared->bandstart[band]; i<prepared->bandstart[band+1]; i++) {
+      preparedEdgeObj *edge = &(prepared->edges[i]);
+
+      if(edge->closing) continue;
+      /* an edge in several bands is only tested in the first one it shares with the segment */
+      if(band != first && msPreparedEdgeBand(prepared, edge, NULL) != band) continue;
+
+      if(preparedfirst) {
+        if(msIntersectSegments(edge->a, edge->b, a, b) == MS_TRUE)
+          return(MS_TRUE);
+      } else {
+        if(msIntersectSegments(a, b, edge->a, edge->b) == MS_TRUE)
+          return(MS_TRUE);
+      }
+    }
+  }
+
+  return(MS_FALSE);
+}
+
+int msIntersectPolylinePreparedPolyline(shapeObj *line1, preparedShapeObj *line2) {
+  int c1,v1;
+
+  for(c1=0; c1<line1->numlines; c1++)
+    for(v1=1; v1<line1->line[c1].numpoints; v1++)
+      if(msIntersectSegmentPrepared(&(line1->line[c1].point[v1-1]), &(line1->line[c1].point[v1]), line2, MS_FALSE) == MS_TRUE)
+        return(MS_TRUE);
+
+  return(MS_FALSE);
+}
+
+int msIntersectPolylinePreparedPolygon(shapeObj *line, preparedShapeObj *poly) {
+  int i;
+
+  /* STEP 1: polygon might competely contain the polyline or one of it's parts */
+  for(i=0; i<line->numlines; i++) {
+    if(msIntersectPointPreparedPolygon(&(line->line[i].point[0]), poly) == MS_TRUE)
+      return(MS_TRUE);
+  }
+
+  /* STEP 2: look for intersecting line segments */
+  return msIntersectPolylinePreparedPolyline(line, poly);
+}
+
+int msIntersectPolygonPreparedPolygon(shapeObj *p1, preparedShapeObj *p2) {
+  int i;
+
+  /* STEP 1: polygon 1 completely contains 2 */
+  for(i=0; i<p2->shape->numlines; i++) {
+    if(msIntersectPointPolygon(&(p2->shape->line[i].point[0]), p1) == MS_TRUE)
+      return(MS_TRUE);
+  }
+
+  /* STEP 2: polygon 2 completely contains 1 */
+  for(i=0; i<p1->numlines; i++) {
+    if(msIntersectPointPreparedPolygon(&(p1->line[i].point[0]), p2) == MS_TRUE)
+      return(MS_TRUE);
+  }
+
+  /* STEP 3: look for intersecting line segments */
+  return msIntersectPolylinePreparedPolyline(p1, p2);
+}
+
+int msIntersectPreparedPolylinePolygon(preparedShapeObj *line, shapeObj *poly) {
+  int i,c,v;
+
+  /* STEP 1: polygon might competely contain the polyline or one of it's parts */
+  for(i=0; i<line->shape->numlines; i++) {
+    if(msIntersectPointPolygon(&(line->shape->line[i].point[0]), poly) == MS_TRUE)
+      return(MS_TRUE);
+  }
+
+  /* STEP 2: look for intersecting line segments */
+  for(c=0; c<poly->numlines; c++)
+    for(v=1; v<poly->line[c].numpoints; v++)
+      if(msIntersectSegmentPrepared(&(poly->line[c].point[v-1]), &(poly->line[c].point[v]), line, MS_TRUE) == MS_TRUE)
+        return(MS_TRUE);
+
+  return(MS_FALSE);
+}
+
 
 /*
 ** Distance computations
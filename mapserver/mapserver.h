@@ -244,6 +244,7 @@ extern "C" {
 #define MS_TEMPLATE_EXPR "\\.(xml|wml|html|htm|svg|kml|gml|js|tmpl)$"
 
 #define MS_INDEX_EXTENSION ".qix"
+#define MS_PACKED_INDEX_EXTENSION ".prt"
 
 #define MS_QUERY_RESULTS_MAGIC_STRING "MapServer Query Results"
 #define MS_QUERY_PARAMS_MAGIC_STRING "MapServer Query Params"
@@ -289,6 +290,7 @@ extern "C" {
 
 #define MS_LABELCACHEINITSIZE 100
 #define MS_LABELCACHEINCREMENT 10
+#define MS_LABELCACHEINDEXCELLSIZE 64 /* pixels */
 
 #define MS_RESULTCACHEINITSIZE 10
 #define MS_RESULTCACHEINCREMENT 10
@@ -656,6 +658,9 @@ typedef struct tokenListNode {
 
 typedef tokenListNodeObj * tokenListNodeObjPtr;
 
+struct exprProgram; /* compiled form of the token list, see mapexpr.c */
+typedef struct exprProgram exprProgramObj;
+
 typedef struct {
   char *string;
   int type;
@@ -666,6 +671,7 @@ typedef struct {
   /* logical expression options */
   tokenListNodeObjPtr tokens;
   tokenListNodeObjPtr curtoken;
+  exprProgramObj *program; /* NULL if the expression can only be evaluated by yyparse() */
 
   /* regular expression options */
   ms_regex_t regex; /* compiled regular expression to be matched */
@@ -1146,6 +1152,34 @@ typedef struct {
   int markercachesize;
 } labelCacheSlotObj;
 
+/************************************************************************/
+/*                          labelCacheIndexObj                          */
+/*                                                                      */
+/*      Uniform grid over the image used by msTestLabelCacheCollisions()*/
+/*      so that a candidate label is only compared against the markers  */
+/*      and rendered labels that are close to it.                       */
+/************************************************************************/
+#ifndef SWIG
+typedef struct {
+  rectObj bounds; /* poly bounds, grown by the leader bbox and label point */
+  int priority; /* cache slot */
+  int index; /* index in the slot's labels[] or markers[] array */
+  int ismarker;
+} labelCacheIndexEntryObj;
+
+typedef struct {
+  labelCacheIndexEntryObj *entries;
+  int numentries;
+  int size;
+} labelCacheIndexCellObj;
+
+typedef struct {
+  double cellsize;
+  int numcols, numrows;
+  labelCacheIndexCellObj *cells;
+} labelCacheIndexObj;
+#endif /* SWIG */
+
 /************************************************************************/
 /*                            labelCacheObj                             */
 /************************************************************************/
@@ -1158,6 +1192,9 @@ typedef struct {
      */
     int numlabels;
     int gutter; /* space in pixels around the image where labels cannot be placed */
+#ifndef SWIG
+    labelCacheIndexObj *index; /* built by msDrawLabelCache(), NULL means linear scans */
+#endif /* SWIG */
 } labelCacheObj;
 
 /************************************************************************/
@@ -1859,6 +1896,9 @@ MS_DLL_EXPORT void msOGRInitialize(void);
 MS_DLL_EXPORT void msOGRCleanup(void);
 MS_DLL_EXPORT void msGDALCleanup(void);
 MS_DLL_EXPORT void msGDALInitialize(void);
+MS_DLL_EXPORT void *msGDALPoolOpen(mapObj *map, layerObj *layer, const char *path); /* in mapgdal.c, TLOCK_GDAL held */
+MS_DLL_EXPORT void msGDALPoolRelease(layerObj *layer, void *hDS);
+MS_DLL_EXPORT void msGDALPoolReport(const char *caller);
 
 MS_DLL_EXPORT imageObj *msDrawScalebar(mapObj *map); /* in mapscale.c */
 MS_DLL_EXPORT int msCalculateScale(rectObj extent, int units, int width, int height, double resolution, double *scaledenom);
@@ -1895,6 +1935,16 @@ MS_DLL_EXPORT int msIntersectPointPolygon(pointObj *p, shapeObj *polygon);
 MS_DLL_EXPORT int msIntersectPolylinePolygon(shapeObj *line, shapeObj *poly);
 MS_DLL_EXPORT int msIntersectPolygons(shapeObj *p1, shapeObj *p2);
 MS_DLL_EXPORT int msIntersectPolylines(shapeObj *line1, shapeObj *line2);
+#ifndef SWIG
+MS_DLL_EXPORT preparedShapeObj *msPrepareShape(shapeObj *shape);
+MS_DLL_EXPORT void msFreePreparedShape(preparedShapeObj *prepared);
+MS_DLL_EXPORT int msIntersectPointPreparedPolygon(pointObj *p, preparedShapeObj *poly);
+MS_DLL_EXPORT int msIntersectMultipointPreparedPolygon(shapeObj *multipoint, preparedShapeObj *poly);
+MS_DLL_EXPORT int msIntersectPolylinePreparedPolygon(shapeObj *line, preparedShapeObj *poly);
+MS_DLL_EXPORT int msIntersectPolygonPreparedPolygon(shapeObj *p1, preparedShapeObj *p2);
+MS_DLL_EXPORT int msIntersectPolylinePreparedPolyline(shapeObj *line1, preparedShapeObj *line2);
+MS_DLL_EXPORT int msIntersectPreparedPolylinePolygon(preparedShapeObj *line, shapeObj *poly);
+#endif
 
 MS_DLL_EXPORT int msInitQuery(queryObj *query); /* in mapquery.c */
 MS_DLL_EXPORT void msFreeQuery(queryObj *query);
@@ -2043,6 +2093,9 @@ MS_DLL_EXPORT int msGetLabelSize(mapObj *map, labelObj *label, char *string, dou
 MS_DLL_EXPORT int msAddLabel(mapObj *map, labelObj *label, int layerindex, int classindex, shapeObj *shape, pointObj *point, labelPathObj *labelpath, double featuresize);
 MS_DLL_EXPORT int msAddLabelGroup(mapObj *map, int layerindex, int classindex, shapeObj *shape, pointObj *point, double featuresize);
 MS_DLL_EXPORT int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr, shapeObj *poly, int mindistance, int current_priority, int current_label);
+MS_DLL_EXPORT int msInitLabelCacheIndex(labelCacheObj *labelcache, int width, int height);
+MS_DLL_EXPORT void msFreeLabelCacheIndex(labelCacheObj *labelcache);
+MS_DLL_EXPORT void msLabelCacheIndexAddLabel(labelCacheObj *labelcache, int priority, int label);
 MS_DLL_EXPORT labelCacheMemberObj *msGetLabelCacheMember(labelCacheObj *labelcache, int i);
 
 MS_DLL_EXPORT gdFontPtr msGetBitmapFont(int size);
@@ -2142,6 +2195,13 @@ MS_DLL_EXPORT char* msLayerGetFilterString( layerObj *layer );
 MS_DLL_EXPORT int msLayerSupportsCommonFilters(layerObj *layer);
 MS_DLL_EXPORT int msTokenizeExpression(expressionObj *expression, char **list, int *listsize);
 
+/* Compiled expressions (mapexpr.c) */
+#ifndef SWIG
+MS_DLL_EXPORT int msCompileExpression(expressionObj *expr);
+MS_DLL_EXPORT void msFreeExpressionProgram(expressionObj *expr);
+MS_DLL_EXPORT int msRunExpression(parseObj *p);
+#endif
+
 MS_DLL_EXPORT int msLayerSetTimeFilter(layerObj *lp, const char *timestring, 
                                        const char *timefield);
 /* Helper functions for layers */ 
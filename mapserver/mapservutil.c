@@ -180,6 +180,96 @@ static void setClassGroup(layerObj *layer, char *classgroup) {
   }
 }
 
+/*
+** Mapfiles kept parsed between FastCGI requests. MS_MAPFILE is always kept,
+** mapfiles given through the map parameter only when MS_MAP_CACHE is set to
+** the number of them to keep. Each request works on a msCopyMap() snapshot;
+** the PROJ objects of the cached map are shared with the snapshots (see
+** msShareProjection()) so that copying does not run pj_init() again.
+*/
+#define MS_MAP_CACHE_MAX 64
+
+typedef struct {
+  char *path;
+  time_t mtime;
+  mapObj *map;
+  int lastused;
+} mapCacheEntry;
+
+static mapCacheEntry mapCache[MS_MAP_CACHE_MAX];
+static int mapCacheUse = 0;
+
+static void msCGIShareMapProjections(mapObj *map)
+{
+  int i;
+
+  msShareProjection(&(map->projection));
+  for(i=0; i<map->numlayers; i++)
+    msShareProjection(&(GET_LAYER(map, i)->projection));
+}
+
+static mapObj *msCGILoadCachedMap(const char *path, int maxentries)
+{
+  int i, entry = -1;
+  mapObj *map;
+  struct stat mapfile_stat;
+
+  if(maxentries > MS_MAP_CACHE_MAX) maxentries = MS_MAP_CACHE_MAX;
+
+  for(i=0; i<maxentries; i++) {
+    if(mapCache[i].path && strcmp(mapCache[i].path, path) == 0) {
+      entry = i;
+      break;
+    }
+  }
+
+  if(entry >= 0 && stat(path, &mapfile_stat) == 0 && mapfile_stat.st_mtime != mapCache[entry].mtime) {
+    /* the mapfile has been updated on disk, discard the cached mapObj */
+    msDebug("reloading mapfile %s as it has been changed on disk\n", path);
+    msFreeMap(mapCache[entry].map);
+    mapCache[entry].map = NULL;
+  }
+
+  if(entry < 0) {
+    /* take a free slot, or the least recently used one */
+    for(i=0; i<maxentries; i++) {
+      if(!mapCache[i].path) {
+        entry = i;
+        break;
+      }
+      if(entry < 0 || mapCache[i].lastused < mapCache[entry].lastused)
+        entry = i;
+    }
+    if(mapCache[entry].path) {
+      msFreeMap(mapCache[entry].map);
+      msFree(mapCache[entry].path);
+    }
+    mapCache[entry].path = msStrdup(path);
+    mapCache[entry].map = NULL;
+  }
+
+  if(!mapCache[entry].map) {
+    /* either the mapfile has never been loaded, or it has been destroyed because it was outdated */
+    mapCache[entry].map = msLoadMap((char *) path, NULL);
+    if(!mapCache[entry].map) {
+      msFree(mapCache[entry].path);
+      mapCache[entry].path = NULL;
+      return NULL;
+    }
+    mapCache[entry].mtime = (stat(path, &mapfile_stat) == 0) ? mapfile_stat.st_mtime : 0;
+    msCGIShareMapProjections(mapCache[entry].map);
+  }
+  mapCache[entry].lastused = ++mapCacheUse;
+
+  map = msNewMapObj();
+  if(!map) return NULL;
+  if(msCopyMap(map, mapCache[entry].map) != MS_SUCCESS) {
+    msFreeMap(map);
+    return NULL;
+  }
+  return map;
+}
+
 /*
 ** Extract Map File name from params and load it.  
 ** Returns map object or NULL on error.
@@ -188,33 +278,16 @@ mapObj *msCGILoadMap(mapservObj *mapserv)
 {
   int i, j;
   mapObj *map = NULL;
-  static mapObj *preloadedmap = NULL;
-  static time_t preloadedmap_mtime;
-  static char *ms_mapfile = NULL;
-  struct stat mapfile_stat;
+  const char *ms_mapfile;
+  int cachesize = 0;
+
+  if(getenv("MS_MAP_CACHE"))
+    cachesize = atoi(getenv("MS_MAP_CACHE"));
 
   /* check if we should use and/or create a pre-parsed mapfile */
   ms_mapfile = getenv("MS_MAPFILE");
-  if(preloadedmap || ms_mapfile) {
-     if(preloadedmap) {
-        /* we already have a preloaded mapfile, check if the mapfile itself hasn't changed */
-        stat(ms_mapfile,&mapfile_stat);
-        if(mapfile_stat.st_mtime > preloadedmap_mtime) {
-           /* the mapfile has been updated on disk, discard the cached mapObj */
-           msFreeMap(preloadedmap);
-           preloadedmap = NULL;
-           msDebug("reloading mapfile %s as it has been changed on disk",ms_mapfile);
-        }
-     }
-     if(!preloadedmap) {
-        /* either the mapfile has never been loaded, or it has been destroyed because it was outdated */
-        preloadedmap = msLoadMap(ms_mapfile,NULL);
-        if(!preloadedmap) return NULL;
-        stat(ms_mapfile,&mapfile_stat);
-        preloadedmap_mtime = mapfile_stat.st_mtime;
-     }
-     map = msNewMapObj();
-     msCopyMap(map,preloadedmap);
+  if(ms_mapfile) {
+     map = msCGILoadCachedMap(ms_mapfile, MS_MAX(cachesize, 1));
   } else {
      for(i=0;i<mapserv->request->NumParams;i++) /* find the mapfile parameter first */
         if(strcasecmp(mapserv->request->ParamNames[i], "map") == 0) break;
@@ -223,9 +296,12 @@ mapObj *msCGILoadMap(mapservObj *mapserv)
         msSetError(MS_WEBERR, "CGI variable \"map\" is not set.", "msCGILoadMap()"); /* no default, outta here */
         return NULL;
      } else {
-        if(getenv(mapserv->request->ParamValues[i])) /* an environment variable references the actual file to use */
-           map = msLoadMap(getenv(mapserv->request->ParamValues[i]), NULL);
-        else {
+        if(getenv(mapserv->request->ParamValues[i])) { /* an environment variable references the actual file to use */
+           if(cachesize > 0)
+              map = msCGILoadCachedMap(getenv(mapserv->request->ParamValues[i]), cachesize);
+           else
+              map = msLoadMap(getenv(mapserv->request->ParamValues[i]), NULL);
+        } else {
            /* by here we know the request isn't for something in an environment variable */
            if(getenv("MS_MAP_NO_PATH")) {
               msSetError(MS_WEBERR, "Mapfile not found in environment variables and this server is not configured for full paths.", "msCGILoadMap()");
@@ -238,7 +314,10 @@ mapObj *msCGILoadMap(mapservObj *mapserv)
            }
 
            /* ok to try to load now */
-           map = msLoadMap(mapserv->request->ParamValues[i], NULL);
+           if(cachesize > 0)
+              map = msCGILoadCachedMap(mapserv->request->ParamValues[i], cachesize);
+           else
+              map = msLoadMap(mapserv->request->ParamValues[i], NULL);
         }
      }
   }
@@ -38,6 +38,12 @@
 #include <assert.h>
 #include "mapserver.h"
 
+#ifdef HAVE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
 MS_CVSID("$Id$")
 
 /* Only use this macro on 32-bit integers! */
@@ -184,6 +190,43 @@ static void writeHeader( SHPHandle psSHP )
   free( panSHX );
 }
 
+/************************************************************************/
+/*                            msSHPMapFile()                            */
+/*                                                                      */
+/*      Map a whole file opened read-only into memory, so that records  */
+/*      are decoded straight from the page cache instead of going       */
+/*      through fseek()/fread() and a record buffer. Returns NULL when  */
+/*      mmap() is not available or fails, the callers then fall back    */
+/*      on stdio.                                                       */
+/************************************************************************/
+void *msSHPMapFile( FILE *fp, size_t *pnSize )
+{
+#ifdef HAVE_MMAP
+  struct stat sStat;
+  void *pMap;
+
+  if( fstat( fileno(fp), &sStat ) != 0 || sStat.st_size <= 0 || sStat.st_size > INT_MAX )
+    return( NULL );
+
+  pMap = mmap( NULL, (size_t) sStat.st_size, PROT_READ, MAP_SHARED, fileno(fp), 0 );
+  if( pMap == MAP_FAILED )
+    return( NULL );
+
+  *pnSize = (size_t) sStat.st_size;
+  return( pMap );
+#else
+  return( NULL );
+#endif
+}
+
+void msSHPUnmapFile( void *pMap, size_t nSize )
+{
+#ifdef HAVE_MMAP
+  if( pMap )
+    munmap( pMap, nSize );
+#endif
+}
+
 /************************************************************************/
 /*                              msSHPOpen()                             */
 /*                                                                      */
@@ -229,6 +272,9 @@ SHPHandle msSHPOpen( const char * pszLayer, const char * pszAccess )
   psSHP->panParts = NULL;
   psSHP->nBufSize = psSHP->nPartMax = 0;
 
+  psSHP->pabySHPMap = psSHP->pabySHXMap = NULL;
+  psSHP->nSHPMapSize = psSHP->nSHXMapSize = 0;
+
   /* -------------------------------------------------------------------- */
   /*	Compute the base (layer) name.  If there is any extension	    */
   /*	on the passed in filename we will strip it off.			    */
@@ -371,6 +417,18 @@ SHPHandle msSHPOpen( const char * pszLayer, const char * pszAccess )
     return( NULL );
   }
 
+  /* -------------------------------------------------------------------- */
+  /*      For read-only access map both files, the .shx is only used if   */
+  /*      it really holds an entry for every record.                      */
+  /* -------------------------------------------------------------------- */
+  if( strcmp(pszAccess,"rb") == 0 ) {
+    psSHP->pabySHPMap = (uchar *) msSHPMapFile( psSHP->fpSHP, &(psSHP->nSHPMapSize) );
+    psSHP->pabySHXMap = (uchar *) msSHPMapFile( psSHP->fpSHX, &(psSHP->nSHXMapSize) );
+    if( psSHP->pabySHXMap && psSHP->nSHXMapSize < 100 + 8 * (size_t) psSHP->nRecords ) {
+      msSHPUnmapFile( psSHP->pabySHXMap, psSHP->nSHXMapSize );
+      psSHP->pabySHXMap = NULL;
+    }
+  }
   
   return( psSHP );
 }
@@ -399,6 +457,9 @@ void msSHPClose(SHPHandle psSHP )
   if(psSHP->pabyRec) free(psSHP->pabyRec);
   if(psSHP->panParts) free(psSHP->panParts);
 
+  msSHPUnmapFile( psSHP->pabySHPMap, psSHP->nSHPMapSize );
+  msSHPUnmapFile( psSHP->pabySHXMap, psSHP->nSHXMapSize );
+
   fclose( psSHP->fpSHX );
   fclose( psSHP->fpSHP );
   
@@ -1008,12 +1069,88 @@ static int msSHPReadAllocateBuffer( SHPHandle psSHP, int hEntity, const char* ps
   return MS_SUCCESS;
 }
 
+/*
+** msSHPReadRecord() - Returns the nEntitySize bytes of a record, pointing
+** straight into the mapped .shp if we have one, or read into psSHP->pabyRec.
+*/
+static uchar *msSHPReadRecord( SHPHandle psSHP, int hEntity, int nEntitySize, const char* pszCallingFunction)
+{
+  int nOffset = msSHXReadOffset(psSHP, hEntity);
+
+  if( psSHP->pabySHPMap ) {
+    if( nOffset < 0 || (size_t) nOffset + nEntitySize > psSHP->nSHPMapSize ) {
+      msSetError(MS_SHPERR, "Corrupted .shp file : shape %d (offset %d, size %d) goes past the end of the file.",
+                 pszCallingFunction, hEntity, nOffset, nEntitySize);
+      return NULL;
+    }
+    return psSHP->pabySHPMap + nOffset;
+  }
+
+  if (msSHPReadAllocateBuffer(psSHP, hEntity, pszCallingFunction) == MS_FAILURE)
+    return NULL;
+
+  fseek( psSHP->fpSHP, nOffset, 0 );
+  fread( psSHP->pabyRec, nEntitySize, 1, psSHP->fpSHP );
+
+  return psSHP->pabyRec;
+}
+
+/*
+** msSHPReadPoints() - Copies nPoints consecutive X,Y pairs out of a record.
+** Without Z/M support a pointObj has the layout of a shapefile point, so on
+** little endian machines this is a single memcpy().
+*/
+static void msSHPReadPoints( const uchar *pabySrc, pointObj *points, int nPoints )
+{
+  int i;
+
+#ifndef USE_POINT_Z_M
+  if( !bBigEndian ) {
+    memcpy( points, pabySrc, 16 * nPoints );
+    return;
+  }
+#endif
+
+  for( i = 0; i < nPoints; i++ ) {
+    memcpy( &(points[i].x), pabySrc + 16 * i, 8 );
+    memcpy( &(points[i].y), pabySrc + 16 * i + 8, 8 );
+    if( bBigEndian ) {
+      SwapWord( 8, &(points[i].x) );
+      SwapWord( 8, &(points[i].y) );
+    }
+  }
+}
+
+#ifdef USE_POINT_Z_M
+/*
+** msSHPReadZM() - Sets the Z and M values of nPoints points from the Z or M
+** array of a record, the values missing from the record are set to 0.
+*/
+static void msSHPReadZM( const uchar *pabyZ, const uchar *pabyM, pointObj *points, int nPoints )
+{
+  int i;
+
+  for( i = 0; i < nPoints; i++ ) {
+    points[i].z = points[i].m = 0.0;
+    if( pabyZ ) {
+      memcpy( &(points[i].z), pabyZ + 8 * i, 8 );
+      if( bBigEndian ) SwapWord( 8, &(points[i].z) );
+    }
+    if( pabyM ) {
+      memcpy( &(points[i].m), pabyM + 8 * i, 8 );
+      if( bBigEndian ) SwapWord( 8, &(points[i].m) );
+    }
+  }
+}
+#endif /* USE_POINT_Z_M */
+
 /*
 ** msSHPReadPoint() - Reads a single point from a POINT shape file.
 */
 int msSHPReadPoint( SHPHandle psSHP, int hEntity, pointObj *point )
 {
   int nEntitySize;
+  uchar *pabyRec;
 
   /* -------------------------------------------------------------------- */
   /*      Only valid for point shapefiles                                 */
@@ -1043,19 +1180,15 @@ int msSHPReadPoint( SHPHandle psSHP, int hEntity, pointObj *point )
     return(MS_FAILURE);
   }
 
-  if (msSHPReadAllocateBuffer(psSHP, hEntity, "msSHPReadPoint()") == MS_FAILURE)
-  {
-    return MS_FAILURE;
-  }
-
   /* -------------------------------------------------------------------- */
   /*      Read the record.                                                */
   /* -------------------------------------------------------------------- */
-  fseek( psSHP->fpSHP, msSHXReadOffset( psSHP, hEntity), 0 );
-  fread( psSHP->pabyRec, nEntitySize, 1, psSHP->fpSHP );
+  pabyRec = msSHPReadRecord( psSHP, hEntity, nEntitySize, "msSHPReadPoint()" );
+  if( pabyRec == NULL )
+    return MS_FAILURE;
       
-  memcpy( &(point->x), psSHP->pabyRec + 12, 8 );
-  memcpy( &(point->y), psSHP->pabyRec + 20, 8 );
+  memcpy( &(point->x), pabyRec + 12, 8 );
+  memcpy( &(point->y), pabyRec + 20, 8 );
       
   if( bBigEndian ) {
     SwapWord( 8, &(point->x));
@@ -1085,8 +1218,14 @@ int msSHXLoadPage( SHPHandle psSHP, int shxBufferPage )
     return(MS_FAILURE);
 
   /* The SHX file starts with 100 bytes of header, skip that. */
-  fseek( psSHP->fpSHX, 100 + shxBufferPage * SHX_BUFFER_PAGE * 8, 0 );
-  fread( buffer, 8, SHX_BUFFER_PAGE, psSHP->fpSHX );
+  if( psSHP->pabySHXMap ) {
+    int nPageRecords = MS_MIN(SHX_BUFFER_PAGE, psSHP->nRecords - shxBufferPage * SHX_BUFFER_PAGE);
+    if( nPageRecords > 0 )
+      memcpy( buffer, psSHP->pabySHXMap + 100 + shxBufferPage * SHX_BUFFER_PAGE * 8, 8 * nPageRecords );
+  } else {
+    fseek( psSHP->fpSHX, 100 + shxBufferPage * SHX_BUFFER_PAGE * 8, 0 );
+    fread( buffer, 8, SHX_BUFFER_PAGE, psSHP->fpSHX );
+  }
 
   /* Copy the buffer contents out into the working arrays. */
   for( i = 0; i < SHX_BUFFER_PAGE; i++ ) {
@@ -1126,8 +1265,12 @@ int msSHXLoadAll( SHPHandle psSHP ) {
   int i;
   uchar	*pabyBuf;
 
-  pabyBuf = (uchar *) msSmallMalloc(8 * psSHP->nRecords );
-  fread( pabyBuf, 8, psSHP->nRecords, psSHP->fpSHX );
+  if( psSHP->pabySHXMap )
+    pabyBuf = psSHP->pabySHXMap + 100;
+  else {
+    pabyBuf = (uchar *) msSmallMalloc(8 * psSHP->nRecords );
+    fread( pabyBuf, 8, psSHP->nRecords, psSHP->fpSHX );
+  }
   for( i = 0; i < psSHP->nRecords; i++ ) {
     ms_int32 nOffset, nLength;
     
@@ -1142,7 +1285,8 @@ int msSHXLoadAll( SHPHandle psSHP ) {
     psSHP->panRecOffset[i] = nOffset*2; 
     psSHP->panRecSize[i] = nLength*2; 
   }
-  free(pabyBuf);
+  if( !psSHP->pabySHXMap )
+    free(pabyBuf);
   psSHP->panRecAllLoaded = 1;
   
   return(MS_SUCCESS);
@@ -1157,6 +1301,14 @@ int msSHXReadOffset( SHPHandle psSHP, int hEntity ) {
   if( hEntity < 0 || hEntity >= psSHP->nRecords )
     return(MS_FAILURE);
 
+  /* decode straight from the mapped .shx, there is nothing to cache */
+  if( psSHP->pabySHXMap ) {
+    ms_int32 nOffset;
+    memcpy( &nOffset, psSHP->pabySHXMap + 100 + hEntity * 8 + 0, 4 );
+    if( !bBigEndian ) nOffset = SWAP_FOUR_BYTES( nOffset );
+    return nOffset * 2;
+  }
+
   if( ! (psSHP->panRecAllLoaded || msGetBit(psSHP->panRecLoaded, shxBufferPage)) ) {
     msSHXLoadPage( psSHP, shxBufferPage );
   }
@@ -1173,6 +1325,14 @@ int msSHXReadSize( SHPHandle psSHP, int hEntity ) {
   if( hEntity < 0 || hEntity >= psSHP->nRecords )
     return(MS_FAILURE);
 
+  /* decode straight from the mapped .shx, there is nothing to cache */
+  if( psSHP->pabySHXMap ) {
+    ms_int32 nSize;
+    memcpy( &nSize, psSHP->pabySHXMap + 100 + hEntity * 8 + 4, 4 );
+    if( !bBigEndian ) nSize = SWAP_FOUR_BYTES( nSize );
+    return nSize * 2;
+  }
+
   if( ! (psSHP->panRecAllLoaded || msGetBit(psSHP->panRecLoaded, shxBufferPage)) ) {
     msSHXLoadPage( psSHP, shxBufferPage );
   }
@@ -1186,11 +1346,12 @@ int msSHXReadSize( SHPHandle psSHP, int hEntity ) {
 */
 void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
 {
-  int i, j, k;
+  int i, k;
 #ifdef USE_POINT_Z_M
   int nOffset = 0;
 #endif
   int nEntitySize, nRequiredSize;
+  uchar *pabyRec;
 
   msInitShape(shape); /* initialize the shape */
 
@@ -1206,17 +1367,16 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
   }
 
   nEntitySize = msSHXReadSize(psSHP, hEntity) + 8;
-  if (msSHPReadAllocateBuffer(psSHP, hEntity, "msSHPReadShape()") == MS_FAILURE)
-  {
-    shape->type = MS_SHAPE_NULL;
-    return;
-  }
 
   /* -------------------------------------------------------------------- */
   /*      Read the record.                                                */
   /* -------------------------------------------------------------------- */
-  fseek( psSHP->fpSHP, msSHXReadOffset(psSHP, hEntity), 0 );
-  fread( psSHP->pabyRec, nEntitySize, 1, psSHP->fpSHP );
+  pabyRec = msSHPReadRecord( psSHP, hEntity, nEntitySize, "msSHPReadShape()" );
+  if( pabyRec == NULL )
+  {
+    shape->type = MS_SHAPE_NULL;
+    return;
+  }
 
   /* -------------------------------------------------------------------- */
   /*  Extract vertices for a Polygon or Arc.				    */
@@ -1236,10 +1396,10 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     }
 
     /* copy the bounding box */
-    memcpy( &shape->bounds.minx, psSHP->pabyRec + 8 + 4, 8 );
-    memcpy( &shape->bounds.miny, psSHP->pabyRec + 8 + 12, 8 );
-    memcpy( &shape->bounds.maxx, psSHP->pabyRec + 8 + 20, 8 );
-    memcpy( &shape->bounds.maxy, psSHP->pabyRec + 8 + 28, 8 );
+    memcpy( &shape->bounds.minx, pabyRec + 8 + 4, 8 );
+    memcpy( &shape->bounds.miny, pabyRec + 8 + 12, 8 );
+    memcpy( &shape->bounds.maxx, pabyRec + 8 + 20, 8 );
+    memcpy( &shape->bounds.maxy, pabyRec + 8 + 28, 8 );
 
     if( bBigEndian ) {
       SwapWord( 8, &shape->bounds.minx);
@@ -1248,8 +1408,8 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
       SwapWord( 8, &shape->bounds.maxy);
     }
 
-    memcpy( &nPoints, psSHP->pabyRec + 40 + 8, 4 );
-    memcpy( &nParts, psSHP->pabyRec + 36 + 8, 4 );
+    memcpy( &nPoints, pabyRec + 40 + 8, 4 );
+    memcpy( &nParts, pabyRec + 36 + 8, 4 );
       
     if( bBigEndian ) {
       nPoints = SWAP_FOUR_BYTES(nPoints);
@@ -1300,7 +1460,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
       return;
     }
       
-    memcpy( psSHP->panParts, psSHP->pabyRec + 44 + 8, 4 * nParts );
+    memcpy( psSHP->panParts, pabyRec + 44 + 8, 4 * nParts );
     if( bBigEndian ) {
       for( i = 0; i < nParts; i++ ) {
         *(psSHP->panParts+i) = SWAP_FOUR_BYTES(*(psSHP->panParts+i));
@@ -1321,7 +1481,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
         shape->line[i].numpoints = nPoints - psSHP->panParts[i];
       else
         shape->line[i].numpoints = psSHP->panParts[i+1] - psSHP->panParts[i];
-      if (shape->line[i].numpoints <= 0)
+      if (shape->line[i].numpoints <= 0 || k + shape->line[i].numpoints > nPoints)
       {
         msSetError(MS_SHPERR, "Corrupted .shp file : shape %d, shape->line[%d].numpoints=%d", "msSHPReadShape()",
                    hEntity, i, shape->line[i].numpoints);
@@ -1345,42 +1505,22 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
       }
 
       /* nOffset = 44 + 8 + 4*nParts; */
-      for( j = 0; j < shape->line[i].numpoints; j++ ) {
-        memcpy(&(shape->line[i].point[j].x), psSHP->pabyRec + 44 + 4*nParts + 8 + k * 16, 8 );
-        memcpy(&(shape->line[i].point[j].y), psSHP->pabyRec + 44 + 4*nParts + 8 + k * 16 + 8, 8 );
-	  
-        if( bBigEndian ) {
-          SwapWord( 8, &(shape->line[i].point[j].x) );
-          SwapWord( 8, &(shape->line[i].point[j].y) );
-        }
+      msSHPReadPoints( pabyRec + 44 + 4*nParts + 8 + k * 16, shape->line[i].point, shape->line[i].numpoints );
 
 #ifdef USE_POINT_Z_M
-        /* -------------------------------------------------------------------- */
-        /*      Polygon, Arc with Z values.                                     */
-        /* -------------------------------------------------------------------- */
-        shape->line[i].point[j].z = 0.0; /* initialize */
-        if (psSHP->nShapeType == SHP_POLYGONZ || psSHP->nShapeType == SHP_ARCZ) {
-          nOffset = 44 + 8 + (4*nParts) + (16*nPoints) ;
-          if( nEntitySize >= nOffset + 16 + 8*nPoints ) {
-            memcpy(&(shape->line[i].point[j].z), psSHP->pabyRec + nOffset + 16 + k*8, 8 );
-            if( bBigEndian ) SwapWord( 8, &(shape->line[i].point[j].z) );
-          }   
-        }
-
-        /* -------------------------------------------------------------------- */
-        /*      Measured arc and polygon support.                               */
-        /* -------------------------------------------------------------------- */
-        shape->line[i].point[j].m = 0; /* initialize */
-        if (psSHP->nShapeType == SHP_POLYGONM || psSHP->nShapeType == SHP_ARCM) {
-          nOffset = 44 + 8 + (4*nParts) + (16*nPoints) ;
-          if( nEntitySize >= nOffset + 16 + 8*nPoints ) {
-            memcpy(&(shape->line[i].point[j].m), psSHP->pabyRec + nOffset + 16 + k*8, 8 );
-            if( bBigEndian ) SwapWord( 8, &(shape->line[i].point[j].m) );
-          }   
-        }
+      /* -------------------------------------------------------------------- */
+      /*      Polygon, Arc with Z values, or measured arc and polygon.        */
+      /* -------------------------------------------------------------------- */
+      nOffset = 44 + 8 + (4*nParts) + (16*nPoints) ;
+      if( nEntitySize >= nOffset + 16 + 8*nPoints ) {
+        const uchar *pabyZM = pabyRec + nOffset + 16 + k*8;
+        msSHPReadZM( (psSHP->nShapeType == SHP_POLYGONZ || psSHP->nShapeType == SHP_ARCZ) ? pabyZM : NULL,
+                     (psSHP->nShapeType == SHP_POLYGONM || psSHP->nShapeType == SHP_ARCM) ? pabyZM : NULL,
+                     shape->line[i].point, shape->line[i].numpoints );
+      } else
+        msSHPReadZM( NULL, NULL, shape->line[i].point, shape->line[i].numpoints );
 #endif /* USE_POINT_Z_M */
-	      k++;
-	    }
+      k += shape->line[i].numpoints;
     }
 
     if(psSHP->nShapeType == SHP_POLYGON 
@@ -1408,10 +1548,10 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     }
 
     /* copy the bounding box */
-    memcpy( &shape->bounds.minx, psSHP->pabyRec + 8 + 4, 8 );
-    memcpy( &shape->bounds.miny, psSHP->pabyRec + 8 + 12, 8 );
-    memcpy( &shape->bounds.maxx, psSHP->pabyRec + 8 + 20, 8 );
-    memcpy( &shape->bounds.maxy, psSHP->pabyRec + 8 + 28, 8 );
+    memcpy( &shape->bounds.minx, pabyRec + 8 + 4, 8 );
+    memcpy( &shape->bounds.miny, pabyRec + 8 + 12, 8 );
+    memcpy( &shape->bounds.maxx, pabyRec + 8 + 20, 8 );
+    memcpy( &shape->bounds.maxy, pabyRec + 8 + 28, 8 );
 
     if( bBigEndian ) {
       SwapWord( 8, &shape->bounds.minx);
@@ -1420,7 +1560,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
       SwapWord( 8, &shape->bounds.maxy);
     }
 
-    memcpy( &nPoints, psSHP->pabyRec + 44, 4 );
+    memcpy( &nPoints, pabyRec + 44, 4 );
     if( bBigEndian ) nPoints = SWAP_FOUR_BYTES(nPoints);
     
     /* -------------------------------------------------------------------- */
@@ -1465,37 +1605,17 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
       return;
     }
       
-    for( i = 0; i < nPoints; i++ ) {
-      memcpy(&(shape->line[0].point[i].x), psSHP->pabyRec + 48 + 16 * i, 8 );
-      memcpy(&(shape->line[0].point[i].y), psSHP->pabyRec + 48 + 16 * i + 8, 8 );
-	
-      if( bBigEndian ) {
-	      SwapWord( 8, &(shape->line[0].point[i].x) );
-        SwapWord( 8, &(shape->line[0].point[i].y) );
-      }
+    msSHPReadPoints( pabyRec + 48, shape->line[0].point, nPoints );
 
 #ifdef USE_POINT_Z_M
-      /* -------------------------------------------------------------------- */
-      /*      MulipointZ                                                      */
-      /* -------------------------------------------------------------------- */
-      shape->line[0].point[i].z = 0; /* initialize */
-      if (psSHP->nShapeType == SHP_MULTIPOINTZ) {
-        nOffset = 48 + 16*nPoints;
-        memcpy(&(shape->line[0].point[i].z), psSHP->pabyRec + nOffset + 16 + i*8, 8 );
-        if( bBigEndian ) SwapWord( 8, &(shape->line[0].point[i].z));
-      }
-
-      /* -------------------------------------------------------------------- */
-      /*      Measured shape : multipont.                                     */
-      /* -------------------------------------------------------------------- */
-      shape->line[0].point[i].m = 0; /* initialize */
-      if (psSHP->nShapeType == SHP_MULTIPOINTM) {
-        nOffset = 48 + 16*nPoints;
-        memcpy(&(shape->line[0].point[i].m), psSHP->pabyRec + nOffset + 16 + i*8, 8 );
-        if( bBigEndian ) SwapWord( 8, &(shape->line[0].point[i].m));
-      }
+    /* -------------------------------------------------------------------- */
+    /*      MulipointZ, or measured shape : multipont.                      */
+    /* -------------------------------------------------------------------- */
+    nOffset = 48 + 16*nPoints;
+    msSHPReadZM( psSHP->nShapeType == SHP_MULTIPOINTZ ? pabyRec + nOffset + 16 : NULL,
+                 psSHP->nShapeType == SHP_MULTIPOINTM ? pabyRec + nOffset + 16 : NULL,
+                 shape->line[0].point, nPoints );
 #endif /* USE_POINT_Z_M */
-    }
 
     shape->type = MS_SHAPE_POINT;
   }
@@ -1524,8 +1644,8 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     shape->line[0].numpoints = 1;
     shape->line[0].point = (pointObj *) msSmallMalloc(sizeof(pointObj));
       
-    memcpy( &(shape->line[0].point[0].x), psSHP->pabyRec + 12, 8 );
-    memcpy( &(shape->line[0].point[0].y), psSHP->pabyRec + 20, 8 );
+    memcpy( &(shape->line[0].point[0].x), pabyRec + 12, 8 );
+    memcpy( &(shape->line[0].point[0].y), pabyRec + 20, 8 );
       
     if( bBigEndian ) {
       SwapWord( 8, &(shape->line[0].point[0].x));
@@ -1540,7 +1660,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     if (psSHP->nShapeType == SHP_POINTZ) {
       nOffset = 20 + 8;
       if( nEntitySize >= nOffset + 8 ) {
-        memcpy(&(shape->line[0].point[0].z), psSHP->pabyRec + nOffset, 8 );        
+        memcpy(&(shape->line[0].point[0].z), pabyRec + nOffset, 8 );        
         if( bBigEndian ) SwapWord( 8, &(shape->line[0].point[0].z));
       }
     }
@@ -1552,7 +1672,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     if (psSHP->nShapeType == SHP_POINTM) {
       nOffset = 20 + 8;
       if( nEntitySize >= nOffset + 8 ) {
-        memcpy(&(shape->line[0].point[0].m), psSHP->pabyRec + nOffset, 8 );
+        memcpy(&(shape->line[0].point[0].m), pabyRec + nOffset, 8 );
         if( bBigEndian ) SwapWord( 8, &(shape->line[0].point[0].m));
       }
     }
@@ -1570,6 +1690,30 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
   return;
 }
 
+/*
+** msSHPReadBoundsRecord() - Reads the first nValues doubles following the
+** shape type of a record: the bounding box, or the point of a point record.
+*/
+static int msSHPReadBoundsRecord( SHPHandle psSHP, int hEntity, rectObj *padBounds, int nValues )
+{
+  int nOffset = msSHXReadOffset(psSHP, hEntity) + 12;
+
+  if( psSHP->pabySHPMap ) {
+    if( nOffset < 12 || (size_t) nOffset + nValues * sizeof(double) > psSHP->nSHPMapSize ) {
+      padBounds->minx = padBounds->miny = padBounds->maxx = padBounds->maxy = 0.0;
+      msSetError(MS_SHPERR, "Corrupted .shp file : shape %d goes past the end of the file.",
+                 "msSHPReadBounds()", hEntity);
+      return MS_FAILURE;
+    }
+    memcpy( padBounds, psSHP->pabySHPMap + nOffset, nValues * sizeof(double) );
+  } else {
+    fseek( psSHP->fpSHP, nOffset, 0 );
+    fread( padBounds, sizeof(double)*nValues, 1, psSHP->fpSHP );
+  }
+
+  return MS_SUCCESS;
+}
+
 int msSHPReadBounds( SHPHandle psSHP, int hEntity, rectObj *padBounds)
 {
   /* -------------------------------------------------------------------- */
@@ -1596,8 +1740,8 @@ int msSHPReadBounds( SHPHandle psSHP, int hEntity, rectObj *padBounds)
     } 
     
     if( psSHP->nShapeType != SHP_POINT && psSHP->nShapeType != SHP_POINTZ && psSHP->nShapeType != SHP_POINTM) {
-      fseek( psSHP->fpSHP, msSHXReadOffset(psSHP, hEntity) + 12, 0 );
-      fread( padBounds, sizeof(double)*4, 1, psSHP->fpSHP );
+      if( msSHPReadBoundsRecord( psSHP, hEntity, padBounds, 4 ) != MS_SUCCESS )
+        return MS_FAILURE;
 
       if( bBigEndian ) {
         SwapWord( 8, &(padBounds->minx) );
@@ -1616,8 +1760,8 @@ int msSHPReadBounds( SHPHandle psSHP, int hEntity, rectObj *padBounds)
       /*      minimum and maximum bound.                                      */
       /* -------------------------------------------------------------------- */
       
-      fseek( psSHP->fpSHP, msSHXReadOffset(psSHP, hEntity) + 12, 0 );
-      fread( padBounds, sizeof(double)*2, 1, psSHP->fpSHP );
+      if( msSHPReadBoundsRecord( psSHP, hEntity, padBounds, 2 ) != MS_SUCCESS )
+        return MS_FAILURE;
       
       if( bBigEndian ) {
         SwapWord( 8, &(padBounds->minx) );
@@ -1775,19 +1919,23 @@ int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug)
     s = strstr(sourcename, ".shp");
     if( s ) *s = '\0';
 
-    filename = (char *)malloc(strlen(sourcename)+strlen(MS_INDEX_EXTENSION)+1);
-    MS_CHECK_ALLOC(filename, strlen(sourcename)+strlen(MS_INDEX_EXTENSION)+1, MS_FAILURE);
-  
-    sprintf(filename, "%s%s", sourcename, MS_INDEX_EXTENSION);
-    
-    shpfile->status = msSearchDiskTree(filename, rect, debug);
+    filename = (char *)malloc(strlen(sourcename)+MS_MAX(strlen(MS_INDEX_EXTENSION), strlen(MS_PACKED_INDEX_EXTENSION))+1);
+    MS_CHECK_ALLOC(filename, strlen(sourcename)+MS_MAX(strlen(MS_INDEX_EXTENSION), strlen(MS_PACKED_INDEX_EXTENSION))+1, MS_FAILURE);
+
+    /* the packed R-tree holds the shape bounds, no need to filter its results */
+    sprintf(filename, "%s%s", sourcename, MS_PACKED_INDEX_EXTENSION);
+    shpfile->status = msSearchPackedTree(filename, rect, shpfile->numshapes, debug);
+
+    if(!shpfile->status) {
+      sprintf(filename, "%s%s", sourcename, MS_INDEX_EXTENSION);
+      shpfile->status = msSearchDiskTree(filename, rect, debug);
+      if(shpfile->status) /* index  */
+        msFilterTreeSearch(shpfile, shpfile->status, rect);
+    }
     free(filename);
     free(sourcename);
 
-    if(shpfile->status) { /* index  */
-      msFilterTreeSearch(shpfile, shpfile->status, rect);
-    }
-    else { /* no index  */
+    if(!shpfile->status) { /* no index  */
       shpfile->status = msAllocBitArray(shpfile->numshapes);
       if(!shpfile->status) {
         msSetError(MS_MEMERR, NULL, "msShapefileWhichShapes()");       
@@ -102,6 +102,11 @@ typedef	struct {
     int		nPartMax;
     int		*panParts;
 
+    uchar	*pabySHPMap; /* read-only access: the .shp and .shx mapped in memory, or NULL */
+    size_t	nSHPMapSize;
+    uchar	*pabySHXMap;
+    size_t	nSHXMapSize;
+
 } SHPInfo;
 typedef SHPInfo * SHPHandle;
 #endif
@@ -136,6 +141,11 @@ typedef	struct
 
     char 	*pszStringField;
     int		nStringFieldLen;    
+
+#ifndef SWIG
+    char	*pachMap; /* read-only access: the .dbf mapped in memory, or NULL */
+    size_t	nMapSize;
+#endif
 #ifdef SWIG
 %mutable;
 #endif
@@ -203,6 +213,9 @@ MS_DLL_EXPORT int msSHXLoadAll( SHPHandle psSHP );
 MS_DLL_EXPORT int msSHXLoadPage( SHPHandle psSHP, int shxBufferPage );
 MS_DLL_EXPORT int msSHXReadOffset( SHPHandle psSHP, int hEntity );
 MS_DLL_EXPORT int msSHXReadSize( SHPHandle psSHP, int hEntity );
+/* read-only file mappings, shared by the SHP/SHX and DBF readers */
+void *msSHPMapFile( FILE *fp, size_t *pnSize );
+void msSHPUnmapFile( void *pMap, size_t nSize );
 
 
 /* tiledShapefileObj function prototypes are in mapserver.h */
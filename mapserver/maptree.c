@@ -791,3 +791,375 @@ void msFilterTreeSearch(shapefileObj *shp, ms_bitarray status, rectObj search_re
   }
 
 }
+
+/* -------------------------------------------------------------------- */
+/*      Packed Hilbert R-tree (.prt)                                    */
+/*                                                                      */
+/*      A static R-tree built bottom-up from the shapes sorted on the   */
+/*      Hilbert value of the centre of their bounds, all nodes full     */
+/*      but the last one of each level. The file is written in LSB      */
+/*      order and is searched through mmap():                           */
+/*                                                                      */
+/*        header (64 bytes): "MSRT", byte order (1 = LSB), version,     */
+/*          nodesize (2 bytes), numshapes, numitems, numlevels          */
+/*          (4 bytes each), 12 reserved bytes, bounds (4 doubles)       */
+/*        internal nodes, root level first: bounds (4 doubles)          */
+/*        items, in Hilbert order: bounds (4 doubles), shape id,        */
+/*          4 bytes of padding                                          */
+/*                                                                      */
+/*      The children of node i of a level are the nodes (or items)      */
+/*      i*nodesize to i*nodesize+nodesize-1 of the next level. As the   */
+/*      items carry the shape bounds, a search returns the shapes that  */
+/*      overlap the area of interest without reading the .shp file.     */
+/* -------------------------------------------------------------------- */
+#define MS_PACKED_TREE_HEADER_SIZE 64
+#define MS_PACKED_TREE_NODE_SIZE 32
+#define MS_PACKED_TREE_ITEM_SIZE 40
+#define MS_PACKED_TREE_MAX_LEVELS 32
+
+typedef struct {
+  unsigned int hilbert;
+  ms_int32 id;
+  rectObj rect;
+} packedTreeItem;
+
+typedef struct {
+  const uchar *levels[MS_PACKED_TREE_MAX_LEVELS+1]; /* the items are the last level */
+  int counts[MS_PACKED_TREE_MAX_LEVELS+1];
+  int numlevels;
+  int nodesize;
+  int needswap;
+  rectObj aoi;
+  ms_bitarray status;
+  int numshapes;
+  int invalid; /* set if an item holds an id out of range */
+} packedTreeSearch;
+
+/* position of (x,y) along a Hilbert curve filling a 65536x65536 grid */
+static unsigned int packedTreeHilbert(unsigned int x, unsigned int y)
+{
+  unsigned int rx, ry, s, t, d=0;
+
+  for(s=1<<15; s>0; s>>=1) {
+    rx = (x & s) > 0;
+    ry = (y & s) > 0;
+    d += s * s * ((3 * rx) ^ ry);
+    if(ry == 0) {
+      if(rx == 1) {
+        x = 0xffff - x;
+        y = 0xffff - y;
+      }
+      t = x; x = y; y = t;
+    }
+  }
+  return d;
+}
+
+static int packedTreeCompare(const void *a, const void *b)
+{
+  const packedTreeItem *ia = (const packedTreeItem *) a;
+  const packedTreeItem *ib = (const packedTreeItem *) b;
+
+  if(ia->hilbert != ib->hilbert)
+    return (ia->hilbert < ib->hilbert) ? -1 : 1;
+  return ia->id - ib->id;
+}
+
+static void packedTreeEncodeRect(uchar *buf, const rectObj *rect, int needswap)
+{
+  memcpy(buf, &rect->minx, 8);
+  memcpy(buf+8, &rect->miny, 8);
+  memcpy(buf+16, &rect->maxx, 8);
+  memcpy(buf+24, &rect->maxy, 8);
+  if(needswap) {
+    SwapWord(8, buf); SwapWord(8, buf+8);
+    SwapWord(8, buf+16); SwapWord(8, buf+24);
+  }
+}
+
+static void packedTreeDecodeRect(const uchar *buf, rectObj *rect, int needswap)
+{
+  memcpy(&rect->minx, buf, 8);
+  memcpy(&rect->miny, buf+8, 8);
+  memcpy(&rect->maxx, buf+16, 8);
+  memcpy(&rect->maxy, buf+24, 8);
+  if(needswap) {
+    SwapWord(8, &rect->minx); SwapWord(8, &rect->miny);
+    SwapWord(8, &rect->maxx); SwapWord(8, &rect->maxy);
+  }
+}
+
+static void packedTreeEncodeInt(uchar *buf, ms_int32 value, int needswap)
+{
+  memcpy(buf, &value, 4);
+  if(needswap) SwapWord(4, buf);
+}
+
+static ms_int32 packedTreeDecodeInt(const uchar *buf, int needswap)
+{
+  ms_int32 value;
+  memcpy(&value, buf, 4);
+  if(needswap) SwapWord(4, &value);
+  return value;
+}
+
+/*
+** Writes the packed R-tree of the shapefile to filename. nodesize is the
+** number of children of a node, 0 for MS_PACKED_TREE_NODESIZE.
+*/
+int msWritePackedTree(shapefileObj *shapefile, char *filename, int nodesize)
+{
+  packedTreeItem *items;
+  rectObj *nodes[MS_PACKED_TREE_MAX_LEVELS], bounds;
+  int counts[MS_PACKED_TREE_MAX_LEVELS];
+  int numitems=0, numlevels=0, needswap, level, i, j, count;
+  unsigned short nodesize16;
+  uchar header[MS_PACKED_TREE_HEADER_SIZE], buf[MS_PACKED_TREE_ITEM_SIZE];
+  double xscale, yscale;
+  FILE *fp;
+
+  if(!shapefile) return(MS_FAILURE);
+  if(nodesize == 0) nodesize = MS_PACKED_TREE_NODESIZE;
+  if(nodesize < 2 || nodesize > 65535) {
+    msSetError(MS_MISCERR, "Invalid node size %d.", "msWritePackedTree()", nodesize);
+    return(MS_FAILURE);
+  }
+
+  i = 1;
+  needswap = (*((uchar *) &i) != 1); /* the file is LSB */
+
+  /* -------------------------------------------------------------------- */
+  /*      Collect the shape bounds and sort them along the Hilbert        */
+  /*      curve. Shapes without bounds (null shapes) are left out.        */
+  /* -------------------------------------------------------------------- */
+  items = (packedTreeItem *) malloc(sizeof(packedTreeItem) * MS_MAX(shapefile->numshapes, 1));
+  MS_CHECK_ALLOC(items, sizeof(packedTreeItem) * MS_MAX(shapefile->numshapes, 1), MS_FAILURE);
+
+  xscale = (shapefile->bounds.maxx > shapefile->bounds.minx) ? 65535.0 / (shapefile->bounds.maxx - shapefile->bounds.minx) : 0;
+  yscale = (shapefile->bounds.maxy > shapefile->bounds.miny) ? 65535.0 / (shapefile->bounds.maxy - shapefile->bounds.miny) : 0;
+
+  for(i=0; i<shapefile->numshapes; i++) {
+    double cx, cy;
+    if(msSHPReadBounds(shapefile->hSHP, i, &bounds) != MS_SUCCESS)
+      continue;
+    cx = ((bounds.minx + bounds.maxx) / 2 - shapefile->bounds.minx) * xscale;
+    cy = ((bounds.miny + bounds.maxy) / 2 - shapefile->bounds.miny) * yscale;
+    items[numitems].hilbert = packedTreeHilbert((unsigned int) MS_MAX(0, MS_MIN(cx, 65535)),
+                                                (unsigned int) MS_MAX(0, MS_MIN(cy, 65535)));
+    items[numitems].id = i;
+    items[numitems].rect = bounds;
+    numitems++;
+  }
+  qsort(items, numitems, sizeof(packedTreeItem), packedTreeCompare);
+
+  /* -------------------------------------------------------------------- */
+  /*      Build the internal levels bottom up: counts[0] and nodes[0]     */
+  /*      are the level right above the items.                            */
+  /* -------------------------------------------------------------------- */
+  count = numitems;
+  while(count > 1 || numlevels == 0) {
+    int numnodes = (count + nodesize - 1) / nodesize;
+    if(numitems == 0) break;
+    if(numlevels == MS_PACKED_TREE_MAX_LEVELS) {
+      msSetError(MS_MISCERR, "Too many levels, increase the node size.", "msWritePackedTree()");
+      for(level=0; level<numlevels; level++) free(nodes[level]);
+      free(items);
+      return(MS_FAILURE);
+    }
+    nodes[numlevels] = (rectObj *) msSmallMalloc(sizeof(rectObj) * numnodes);
+    for(i=0; i<numnodes; i++) {
+      for(j=i*nodesize; j<count && j<(i+1)*nodesize; j++) {
+        const rectObj *child = (numlevels == 0) ? &items[j].rect : &nodes[numlevels-1][j];
+        if(j == i*nodesize)
+          nodes[numlevels][i] = *child;
+        else {
+          nodes[numlevels][i].minx = MS_MIN(nodes[numlevels][i].minx, child->minx);
+          nodes[numlevels][i].miny = MS_MIN(nodes[numlevels][i].miny, child->miny);
+          nodes[numlevels][i].maxx = MS_MAX(nodes[numlevels][i].maxx, child->maxx);
+          nodes[numlevels][i].maxy = MS_MAX(nodes[numlevels][i].maxy, child->maxy);
+        }
+      }
+    }
+    counts[numlevels] = numnodes;
+    count = numnodes;
+    numlevels++;
+  }
+
+  fp = fopen(filename, "wb");
+  if(!fp) {
+    msSetError(MS_IOERR, "Unable to create %s.", "msWritePackedTree()", filename);
+    for(level=0; level<numlevels; level++) free(nodes[level]);
+    free(items);
+    return(MS_FAILURE);
+  }
+
+  /* -------------------------------------------------------------------- */
+  /*      Write the header, the nodes from the root down and the items.   */
+  /* -------------------------------------------------------------------- */
+  memset(header, 0, sizeof(header));
+  memcpy(header, "MSRT", 4);
+  header[4] = MS_NEW_LSB_ORDER;
+  header[5] = 1; /* version */
+  nodesize16 = (unsigned short) nodesize;
+  memcpy(header+6, &nodesize16, 2);
+  if(needswap) SwapWord(2, header+6);
+  packedTreeEncodeInt(header+8, shapefile->numshapes, needswap);
+  packedTreeEncodeInt(header+12, numitems, needswap);
+  packedTreeEncodeInt(header+16, numlevels, needswap);
+  packedTreeEncodeRect(header+32, &shapefile->bounds, needswap);
+  fwrite(header, MS_PACKED_TREE_HEADER_SIZE, 1, fp);
+
+  for(level=numlevels-1; level>=0; level--) {
+    for(i=0; i<counts[level]; i++) {
+      packedTreeEncodeRect(buf, &nodes[level][i], needswap);
+      fwrite(buf, MS_PACKED_TREE_NODE_SIZE, 1, fp);
+    }
+    free(nodes[level]);
+  }
+
+  memset(buf, 0, sizeof(buf));
+  for(i=0; i<numitems; i++) {
+    packedTreeEncodeRect(buf, &items[i].rect, needswap);
+    packedTreeEncodeInt(buf+32, items[i].id, needswap);
+    fwrite(buf, MS_PACKED_TREE_ITEM_SIZE, 1, fp);
+  }
+  free(items);
+
+  if(fclose(fp) != 0) {
+    msSetError(MS_IOERR, "Unable to write %s.", "msWritePackedTree()", filename);
+    return(MS_FAILURE);
+  }
+
+  return(MS_SUCCESS);
+}
+
+/* sets the bit of an item, the file being mapped as is the id may be anything */
+static void packedTreeSetItem(packedTreeSearch *search, const uchar *item)
+{
+  ms_int32 id = packedTreeDecodeInt(item + 32, search->needswap);
+
+  if(id < 0 || id >= search->numshapes)
+    search->invalid = MS_TRUE;
+  else
+    msSetBit(search->status, id, 1);
+}
+
+/* sets the bits of all the items under node index of level */
+static void packedTreeCollectAll(packedTreeSearch *search, int level, int index)
+{
+  int first = index, last = index+1, i;
+
+  for(; level<search->numlevels; level++) {
+    first *= search->nodesize;
+    last = MS_MIN(last * search->nodesize, search->counts[level+1]);
+  }
+  for(i=first; i<last && !search->invalid; i++)
+    packedTreeSetItem(search, search->levels[level] + i*MS_PACKED_TREE_ITEM_SIZE);
+}
+
+static void packedTreeSearchNode(packedTreeSearch *search, int level, int index)
+{
+  rectObj rect;
+  int i, last;
+
+  if(level == search->numlevels) { /* an item */
+    const uchar *item = search->levels[level] + index*MS_PACKED_TREE_ITEM_SIZE;
+    packedTreeDecodeRect(item, &rect, search->needswap);
+    if(msRectOverlap(&rect, &search->aoi) == MS_TRUE)
+      packedTreeSetItem(search, item);
+    return;
+  }
+
+  packedTreeDecodeRect(search->levels[level] + index*MS_PACKED_TREE_NODE_SIZE, &rect, search->needswap);
+  if(msRectOverlap(&rect, &search->aoi) != MS_TRUE)
+    return;
+  if(msRectContained(&rect, &search->aoi) == MS_TRUE) {
+    packedTreeCollectAll(search, level, index);
+    return;
+  }
+
+  last = MS_MIN((index+1) * search->nodesize, search->counts[level+1]);
+  for(i=index*search->nodesize; i<last && !search->invalid; i++)
+    packedTreeSearchNode(search, level+1, i);
+}
+
+/*
+** Returns the shapes whose bounds overlap aoi, or NULL if there is no
+** usable .prt file (missing, out of date or mmap() unavailable), in which
+** case the caller falls back on the .qix index. Unlike msSearchDiskTree()
+** the result needs no msFilterTreeSearch().
+*/
+ms_bitarray msSearchPackedTree(char *filename, rectObj aoi, int numshapes, int debug)
+{
+  packedTreeSearch search;
+  FILE *fp;
+  uchar *map;
+  size_t size = 0, expected;
+  int numitems, level, i;
+
+  fp = fopen(filename, "rb");
+  if(!fp) return(NULL);
+  map = (uchar *) msSHPMapFile(fp, &size);
+  fclose(fp); /* the mapping stays valid */
+  if(!map) {
+    if(debug) msDebug("msSearchPackedTree(): unable to map %s, using the .qix index.\n", filename);
+    return(NULL);
+  }
+
+  i = 1;
+  search.needswap = (*((uchar *) &i) != 1);
+  search.aoi = aoi;
+  search.status = NULL;
+  search.numshapes = numshapes;
+  search.invalid = MS_FALSE;
+
+  if(size < MS_PACKED_TREE_HEADER_SIZE || memcmp(map, "MSRT", 4) != 0 ||
+     map[4] != MS_NEW_LSB_ORDER || map[5] != 1)
+    goto invalid;
+
+  search.nodesize = map[6] | (map[7] << 8);
+  numitems = packedTreeDecodeInt(map+12, search.needswap);
+  search.numlevels = packedTreeDecodeInt(map+16, search.needswap);
+  if(packedTreeDecodeInt(map+8, search.needswap) != numshapes || search.nodesize < 2 ||
+     numitems < 0 || numitems > numshapes ||
+     search.numlevels < 0 || search.numlevels > MS_PACKED_TREE_MAX_LEVELS ||
+     (search.numlevels == 0 && numitems != 0))
+    goto invalid;
+
+  /* level sizes from the items up, then the offsets from the root down */
+  search.counts[search.numlevels] = numitems;
+  for(level=search.numlevels-1; level>=0; level--)
+    search.counts[level] = (search.counts[level+1] + search.nodesize - 1) / search.nodesize;
+  if(search.numlevels > 0 && search.counts[0] != 1)
+    goto invalid;
+
+  expected = MS_PACKED_TREE_HEADER_SIZE;
+  for(level=0; level<=search.numlevels; level++) {
+    search.levels[level] = map + expected;
+    expected += (size_t) search.counts[level] * ((level == search.numlevels) ? MS_PACKED_TREE_ITEM_SIZE : MS_PACKED_TREE_NODE_SIZE);
+  }
+  if(expected != size)
+    goto invalid;
+
+  search.status = msAllocBitArray(numshapes);
+  if(!search.status) {
+    msSetError(MS_MEMERR, NULL, "msSearchPackedTree()");
+    msSHPUnmapFile(map, size);
+    return(NULL);
+  }
+
+  if(search.numlevels > 0)
+    packedTreeSearchNode(&search, 0, 0);
+  if(search.invalid) {
+    free(search.status);
+    goto invalid;
+  }
+
+  msSHPUnmapFile(map, size);
+  return(search.status);
+
+invalid:
+  if(debug) msDebug("msSearchPackedTree(): %s is invalid or out of date, using the .qix index.\n", filename);
+  msSHPUnmapFile(map, size);
+  return(NULL);
+}
@@ -93,6 +93,12 @@ MS_DLL_EXPORT int msWriteTree(treeObj *tree, char *filename, int LSB_order);
 
 MS_DLL_EXPORT void msFilterTreeSearch(shapefileObj *shp, ms_bitarray status, rectObj search_rect);
 
+/* packed Hilbert R-tree (.prt), see msWritePackedTree() */
+#define MS_PACKED_TREE_NODESIZE 16
+
+MS_DLL_EXPORT int msWritePackedTree(shapefileObj *shapefile, char *filename, int nodesize);
+MS_DLL_EXPORT ms_bitarray msSearchPackedTree(char *filename, rectObj aoi, int numshapes, int debug);
+
 #ifdef __cplusplus
 }
 #endif
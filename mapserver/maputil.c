@@ -465,7 +465,7 @@ int msEvalExpression(layerObj *layer, shapeObj *shape, expressionObj *expression
       p.expr->curtoken = p.expr->tokens; /* reset */
       p.type = MS_PARSE_TYPE_BOOLEAN;
 
-      status = yyparse(&p);
+      status = msRunExpression(&p);
 
       if (status != 0) {
         msSetError(MS_PARSEERR, "Failed to parse expression: %s", "msEvalExpression", expression->string);
@@ -626,7 +626,7 @@ static char *evalTextExpression(expressionObj *expr, shapeObj *shape) {
       p.expr->curtoken = p.expr->tokens; /* reset */
       p.type = MS_PARSE_TYPE_STRING;
 
-      status = yyparse(&p);
+      status = msRunExpression(&p);
 
       if (status != 0) {
         msSetError(MS_PARSEERR, "Failed to process text expression: %s", "evalTextExpression", expr->string);
@@ -218,6 +218,13 @@ DBFHandle msDBFOpen( const char * pszFilename, const char * pszAccess )
     fseek( psDBF->fp, 32, 0 );
     fread( pabyBuf, nHeadLen, 1, psDBF->fp );
 
+    /* -------------------------------------------------------------------- */
+    /*      For read-only access map the file, records are then copied      */
+    /*      out of the page cache without a seek and read per record.       */
+    /* -------------------------------------------------------------------- */
+    if( strchr(pszAccess,'+') == NULL )
+        psDBF->pachMap = (char *) msSHPMapFile( psDBF->fp, &(psDBF->nMapSize) );
+
     psDBF->panFieldOffset = (int *) msSmallMalloc(sizeof(int) * nFields);
     psDBF->panFieldSize = (int *) msSmallMalloc(sizeof(int) * nFields);
     psDBF->panFieldDecimals = (int *) msSmallMalloc(sizeof(int) * nFields);
@@ -292,6 +299,7 @@ void  msDBFClose(DBFHandle psDBF)
     /* -------------------------------------------------------------------- */
     /*      Close, and free resources.                                      */
     /* -------------------------------------------------------------------- */
+    msSHPUnmapFile( psDBF->pachMap, psDBF->nMapSize );
     fclose( psDBF->fp );
 
     if( psDBF->panFieldOffset != NULL )
@@ -369,6 +377,9 @@ DBFHandle msDBFCreate( const char * pszFilename )
     psDBF->bNoHeader = MS_TRUE;
     psDBF->bUpdated = MS_FALSE;
 
+    psDBF->pachMap = NULL;
+    psDBF->nMapSize = 0;
+
     return( psDBF );
 }
 
@@ -535,8 +546,12 @@ static char *msDBFReadAttribute(DBFHandle psDBF, int hEntity, int iField )
 
 	nRecordOffset = psDBF->nRecordLength * hEntity + psDBF->nHeaderLength;
 
-	safe_fseek( psDBF->fp, nRecordOffset, 0 );
-	fread( psDBF->pszCurrentRecord, psDBF->nRecordLength, 1, psDBF->fp );
+	if( psDBF->pachMap && (size_t) nRecordOffset + psDBF->nRecordLength <= psDBF->nMapSize )
+	    memcpy( psDBF->pszCurrentRecord, psDBF->pachMap + nRecordOffset, psDBF->nRecordLength );
+	else {
+	    safe_fseek( psDBF->fp, nRecordOffset, 0 );
+	    fread( psDBF->pszCurrentRecord, psDBF->nRecordLength, 1, psDBF->fp );
+	}
 
 	psDBF->nCurrentRecord = hEntity;
     }
@@ -0,0 +1,202 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Benchmark of PostGIS geometry transfer and decoding.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+/*
+** Creates a table of polygons holding a few million vertices in total on a
+** PostgreSQL/PostGIS server, then reads it back through the PostGIS layer
+** with the default hex encoded WKB and with PROCESSING "BINARY_TRANSFER=ON".
+** For each mode it reports the bytes received for the geometry column, the
+** time spent running the query (msLayerWhichShapes()) and the time spent
+** converting the rows to shapeObj (msLayerNextShape()).
+**
+** usage: postgisbench [-n rows] [-v vertices] "conninfo"
+*/
+
+#include "mapserver.h"
+#include "maptime.h"
+
+MS_CVSID("$Id$")
+
+#ifdef USE_POSTGIS
+
+#include "mappostgis.h"
+
+#define BENCH_TABLE "mapserver_postgisbench"
+
+static const char *bench_map =
+  "MAP\n"
+  "  EXTENT -180 -90 180 90\n"
+  "  SIZE 1000 500\n"
+  "  LAYER\n"
+  "    NAME \"bench\"\n"
+  "    TYPE POLYGON\n"
+  "    STATUS ON\n"
+  "    CONNECTIONTYPE POSTGIS\n"
+  "    CONNECTION \"%s\"\n"
+  "    DATA \"geom from " BENCH_TABLE " using unique gid using srid=4326\"\n"
+  "    PROCESSING \"BINARY_TRANSFER=%s\"\n"
+  "  END\n"
+  "END\n";
+
+static double elapsedSince(struct mstimeval *start)
+{
+  struct mstimeval now;
+  msGettimeofday(&now, NULL);
+  return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static int execSQL(PGconn *conn, const char *sql)
+{
+  PGresult *result = PQexec(conn, sql);
+  int status = (PQresultStatus(result) == PGRES_COMMAND_OK) ? MS_SUCCESS : MS_FAILURE;
+  if(status != MS_SUCCESS)
+    fprintf(stderr, "postgisbench: %s\n%s", sql, PQerrorMessage(conn));
+  PQclear(result);
+  return status;
+}
+
+static int runBench(const char *conninfo, int binary)
+{
+  char *mapstring;
+  mapObj *map;
+  layerObj *layer;
+  msPostGISLayerInfo *layerinfo;
+  shapeObj shape;
+  struct mstimeval start;
+  double query_time, decode_time, bytes = 0, vertices = 0;
+  int i, j, status;
+
+  mapstring = (char *) msSmallMalloc(strlen(bench_map) + strlen(conninfo) + 16);
+  sprintf(mapstring, bench_map, conninfo, binary ? "ON" : "OFF");
+  map = msLoadMapFromString(mapstring, NULL);
+  free(mapstring);
+  if(!map)
+    return MS_FAILURE;
+  layer = GET_LAYER(map, 0);
+
+  if(msLayerOpen(layer) != MS_SUCCESS || msLayerWhichItems(layer, MS_FALSE, NULL) != MS_SUCCESS) {
+    msFreeMap(map);
+    return MS_FAILURE;
+  }
+
+  msGettimeofday(&start, NULL);
+  if(msLayerWhichShapes(layer, map->extent, MS_FALSE) != MS_SUCCESS) {
+    msLayerClose(layer);
+    msFreeMap(map);
+    return MS_FAILURE;
+  }
+  query_time = elapsedSince(&start);
+
+  layerinfo = (msPostGISLayerInfo *) layer->layerinfo;
+  for(i=0; i<PQntuples(layerinfo->pgresult); i++)
+    bytes += PQgetlength(layerinfo->pgresult, i, 0);
+
+  msInitShape(&shape);
+  msGettimeofday(&start, NULL);
+  while((status = msLayerNextShape(layer, &shape)) == MS_SUCCESS) {
+    for(j=0; j<shape.numlines; j++)
+      vertices += shape.line[j].numpoints;
+    msFreeShape(&shape);
+  }
+  decode_time = elapsedSince(&start);
+
+  printf("%-6s rows=%-8d vertices=%-10.0f bytes=%-12.0f query=%8.3fs decode=%8.3fs\n",
+         binary ? "binary" : "hex", PQntuples(layerinfo->pgresult), vertices, bytes,
+         query_time, decode_time);
+
+  msLayerClose(layer);
+  msFreeMap(map);
+  return (status == MS_DONE) ? MS_SUCCESS : MS_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *conninfo = NULL;
+  char sql[512];
+  PGconn *conn;
+  int numrows = 20000, numvertices = 200, i, status = MS_SUCCESS;
+
+  for(i=1; i<argc; i++) {
+    if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+      numrows = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-v") == 0 && i+1 < argc)
+      numvertices = atoi(argv[++i]);
+    else if(argv[i][0] != '-')
+      conninfo = argv[i];
+  }
+  if(!conninfo || numrows <= 0 || numvertices < 4) {
+    fprintf(stderr, "usage: postgisbench [-n rows] [-v vertices] \"conninfo\"\n");
+    exit(1);
+  }
+
+  conn = PQconnectdb(conninfo);
+  if(PQstatus(conn) != CONNECTION_OK) {
+    fprintf(stderr, "postgisbench: %s", PQerrorMessage(conn));
+    PQfinish(conn);
+    exit(1);
+  }
+
+  /* ST_Buffer() with quad_segs gives numvertices+1 points per ring */
+  snprintf(sql, sizeof(sql),
+           "DROP TABLE IF EXISTS " BENCH_TABLE "; "
+           "CREATE TABLE " BENCH_TABLE " AS SELECT i AS gid, "
+           "ST_SetSRID(ST_Buffer(ST_MakePoint(random()*340-170, random()*160-80), 1, %d), 4326) AS geom "
+           "FROM generate_series(1, %d) AS i",
+           numvertices / 4, numrows);
+  if(execSQL(conn, sql) != MS_SUCCESS) {
+    PQfinish(conn);
+    exit(1);
+  }
+
+  if(msSetup() != MS_SUCCESS) {
+    msWriteError(stderr);
+    exit(1);
+  }
+
+  for(i=0; i<=1 && status == MS_SUCCESS; i++) {
+    if((status = runBench(conninfo, i)) != MS_SUCCESS)
+      msWriteError(stderr);
+  }
+
+  execSQL(conn, "DROP TABLE " BENCH_TABLE);
+  PQfinish(conn);
+  msCleanup();
+  return (status == MS_SUCCESS) ? 0 : 1;
+}
+
+#else
+
+int main(int argc, char *argv[])
+{
+  fprintf(stderr, "postgisbench: MapServer built without PostGIS support.\n");
+  return 1;
+}
+
+#endif /* USE_POSTGIS */
@@ -0,0 +1,202 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Micro-benchmark of vertex reprojection throughput.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** Reprojects a synthetic polygon over and over from a number of threads
+** and reports vertices/sec, once going through msProjectPoint() vertex
+** by vertex and once through the batched msProjectPoints().
+**
+** usage: projbench [-n vertices] [-i iterations] [-t threads] [src dst]
+*/
+
+#include "mapserver.h"
+#include "maptime.h"
+
+#ifdef USE_THREAD
+#include <pthread.h>
+#endif
+
+MS_CVSID("$Id$")
+
+typedef struct {
+  const char *src;
+  const char *dst;
+  int numpoints;
+  int iterations;
+  int batched;
+  int status;
+} benchJob;
+
+static void *benchThread(void *arg)
+{
+  benchJob *job = (benchJob *) arg;
+  projectionObj in, out;
+  pointObj *seed, *work;
+  int i, j;
+
+  /* each thread owns its projections, as each request owns its mapObj */
+  msInitProjection(&in);
+  msInitProjection(&out);
+  if(msLoadProjectionString(&in, job->src) != 0 ||
+     msLoadProjectionString(&out, job->dst) != 0) {
+    job->status = MS_FAILURE;
+    return NULL;
+  }
+
+  seed = (pointObj *) msSmallMalloc(sizeof(pointObj) * job->numpoints);
+  work = (pointObj *) msSmallMalloc(sizeof(pointObj) * job->numpoints);
+  for(i=0; i<job->numpoints; i++) {
+    double a = 2 * MS_PI * i / job->numpoints;
+    seed[i].x = -93.0 + 5.0 * cos(a);
+    seed[i].y = 45.0 + 5.0 * sin(a);
+#ifdef USE_POINT_Z_M
+    seed[i].z = seed[i].m = 0.0;
+#endif
+  }
+
+  for(j=0; j<job->iterations; j++) {
+    memcpy(work, seed, sizeof(pointObj) * job->numpoints);
+    if(job->batched)
+      msProjectPoints(&in, &out, work, job->numpoints);
+    else {
+      for(i=0; i<job->numpoints; i++)
+        msProjectPoint(&in, &out, work + i);
+    }
+  }
+
+  free(seed);
+  free(work);
+  msFreeProjection(&in);
+  msFreeProjection(&out);
+  job->status = MS_SUCCESS;
+  return NULL;
+}
+
+static int runBench(const char *src, const char *dst, int numpoints,
+                    int iterations, int numthreads, int batched)
+{
+  benchJob *jobs;
+  struct mstimeval start, end;
+  double elapsed, vertices;
+  int i, status = MS_SUCCESS;
+#ifdef USE_THREAD
+  pthread_t *threads;
+#endif
+
+  jobs = (benchJob *) msSmallCalloc(numthreads, sizeof(benchJob));
+  for(i=0; i<numthreads; i++) {
+    jobs[i].src = src;
+    jobs[i].dst = dst;
+    jobs[i].numpoints = numpoints;
+    jobs[i].iterations = iterations;
+    jobs[i].batched = batched;
+  }
+
+  msGettimeofday(&start, NULL);
+#ifdef USE_THREAD
+  threads = (pthread_t *) msSmallMalloc(sizeof(pthread_t) * numthreads);
+  for(i=0; i<numthreads; i++)
+    pthread_create(threads + i, NULL, benchThread, jobs + i);
+  for(i=0; i<numthreads; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+#else
+  for(i=0; i<numthreads; i++)
+    benchThread(jobs + i);
+#endif
+  msGettimeofday(&end, NULL);
+
+  for(i=0; i<numthreads; i++) {
+    if(jobs[i].status != MS_SUCCESS)
+      status = MS_FAILURE;
+  }
+  free(jobs);
+
+  if(status != MS_SUCCESS) {
+    msWriteError(stderr);
+    return MS_FAILURE;
+  }
+
+  elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+  vertices = (double) numpoints * iterations * numthreads;
+  printf("%-8s threads=%-3d vertices=%-10.0f %8.3fs %12.0f vertices/sec\n",
+         batched ? "batched" : "single", numthreads, vertices, elapsed,
+         elapsed > 0 ? vertices / elapsed : 0);
+
+  return MS_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *src = "+proj=latlong +datum=WGS84";
+  const char *dst = "+proj=merc +datum=WGS84";
+  int numpoints = 10000, iterations = 100, numthreads = 0;
+  int thread_counts[] = {1, 4, 16};
+  int i, batched;
+
+  for(i=1; i<argc; i++) {
+    if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+      numpoints = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-i") == 0 && i+1 < argc)
+      iterations = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-t") == 0 && i+1 < argc)
+      numthreads = atoi(argv[++i]);
+    else if(i+1 < argc) {
+      src = argv[i];
+      dst = argv[++i];
+    } else {
+      fprintf(stderr, "usage: projbench [-n vertices] [-i iterations] [-t threads] [src dst]\n");
+      exit(1);
+    }
+  }
+
+  if(msSetup() != MS_SUCCESS) {
+    msWriteError(stderr);
+    exit(1);
+  }
+
+#ifndef USE_THREAD
+  fprintf(stderr, "projbench: built without USE_THREAD, threads run sequentially.\n");
+#endif
+
+  for(batched=0; batched<=1; batched++) {
+    if(numthreads > 0) {
+      if(runBench(src, dst, numpoints, iterations, numthreads, batched) != MS_SUCCESS)
+        exit(1);
+      continue;
+    }
+    for(i=0; i<3; i++) {
+      if(runBench(src, dst, numpoints, iterations, thread_counts[i], batched) != MS_SUCCESS)
+        exit(1);
+    }
+  }
+
+  msCleanup();
+  return 0;
+}
@@ -69,7 +69,7 @@ int main(int argc, char *argv[])
 
   treeObj *tree;
   int byte_order = MS_NEW_LSB_ORDER, i;
-  int depth=0;
+  int depth=0, packed=MS_FALSE;
 
   if(argc > 1 && strcmp(argv[1], "-v") == 0) {
     printf("%s\n", msGetVersion());
@@ -98,6 +98,10 @@ int main(int argc, char *argv[])
    fprintf(stdout," <index_format> (optional) is one of:\n");
    fprintf(stdout,"           NL: LSB byte order, using new index format\n");
    fprintf(stdout,"           NM: MSB byte order, using new index format\n");
+   fprintf(stdout,"           R:  packed R-tree (%s file) holding the shape\n", MS_PACKED_INDEX_EXTENSION);
+   fprintf(stdout,"               bounds, <depth> is then the node size\n");
+   fprintf(stdout,"               (default %d). Used instead of the %s file\n", MS_PACKED_TREE_NODESIZE, MS_INDEX_EXTENSION);
+   fprintf(stdout,"               by the shapefile driver when present.\n");
    fprintf(stdout,"       The following old format options are deprecated:\n");
    fprintf(stdout,"           N:  Native byte order\n");
    fprintf(stdout,"           L:  LSB (intel) byte order\n");
@@ -122,6 +126,8 @@ int main(int argc, char *argv[])
       byte_order = MS_NEW_LSB_ORDER; 
     if( !strcasecmp(argv[3],"NM" ))
       byte_order = MS_NEW_MSB_ORDER; 
+    if( !strcasecmp(argv[3],"R" ))
+      packed = MS_TRUE;
   }
     
   if(msShapefileOpen(&shapefile, "rb", argv[1], MS_TRUE) == -1) {
@@ -129,6 +135,14 @@ int main(int argc, char *argv[])
     exit(0);
   }
 
+  if(packed) {
+    printf( "creating packed R-tree index\n");
+    if(msWritePackedTree(&shapefile, AddFileSuffix(argv[1], MS_PACKED_INDEX_EXTENSION), depth) != MS_SUCCESS)
+      msWriteError(stdout);
+    msShapefileClose(&shapefile);
+    return(0);
+  }
+
   printf( "creating index of %s %s format\n",(byte_order < 1 ? "old (deprecated)" :"new"), 
      ((byte_order == MS_NATIVE_ORDER) ? "native" : 
      ((byte_order == MS_LSB_ORDER) || (byte_order == MS_NEW_LSB_ORDER)? " LSB":"MSB")));
@@ -0,0 +1,166 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Test of the prepared shape intersection functions
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** Compares the prepared shape intersection functions (msPrepareShape())
+** with the plain ones on random shapes: a 3 ring polygon and a polyline
+** of 5000 vertices each, tested against random points and small hexagons.
+** The test is run once with real coordinates, and once with coordinates
+** snapped to integers so that vertices, edges and test points coincide.
+**
+** usage: testprepared [iterations]
+** exits with a non zero status if a prepared test differs from the plain one.
+*/
+
+#include "mapserver.h"
+
+MS_CVSID("$Id$")
+
+static double randomValue()
+{
+  return rand() / (double) RAND_MAX;
+}
+
+static void makePolygon(shapeObj *shape, int numrings, int numpoints,
+                        double cx, double cy, double radius, int snap)
+{
+  int i, j;
+
+  msInitShape(shape);
+  shape->type = MS_SHAPE_POLYGON;
+  for(i=0; i<numrings; i++) {
+    lineObj line;
+    double ring_radius = radius*(1-0.3*i);
+    double ring_cx = cx + randomValue()*radius*0.2, ring_cy = cy + randomValue()*radius*0.2;
+
+    line.numpoints = numpoints+1;
+    line.point = (pointObj *) msSmallMalloc(sizeof(pointObj)*(numpoints+1));
+    for(j=0; j<numpoints; j++) {
+      double angle = 2*MS_PI*j/numpoints, r = ring_radius*(0.5+0.5*randomValue());
+      line.point[j].x = ring_cx + r*cos(angle);
+      line.point[j].y = ring_cy + r*sin(angle);
+      if(snap) {
+        line.point[j].x = floor(line.point[j].x);
+        line.point[j].y = floor(line.point[j].y);
+      }
+    }
+    line.point[numpoints] = line.point[0];
+    msAddLineDirectly(shape, &line);
+  }
+}
+
+static void makePolyline(shapeObj *shape, int numpoints, double x, double y, double step, int snap)
+{
+  lineObj line;
+  int j;
+
+  msInitShape(shape);
+  shape->type = MS_SHAPE_LINE;
+  line.numpoints = numpoints;
+  line.point = (pointObj *) msSmallMalloc(sizeof(pointObj)*numpoints);
+  for(j=0; j<numpoints; j++) {
+    line.point[j].x = snap ? floor(x) : x;
+    line.point[j].y = snap ? floor(y) : y;
+    x += (randomValue()-0.5)*step;
+    y += (randomValue()-0.5)*step;
+  }
+  msAddLineDirectly(shape, &line);
+}
+
+int main(int argc, char *argv[])
+{
+  int iterations = 20000, snap, i, numtests = 0, numhits = 0, mismatches = 0;
+
+  if(argc > 1)
+    iterations = atoi(argv[1]);
+  srand(1);
+
+  for(snap=0; snap<2; snap++) {
+    shapeObj polygon, polyline;
+    preparedShapeObj *prepared_polygon, *prepared_polyline;
+
+    makePolygon(&polygon, 3, 5000, 0, 0, 1000, snap);
+    makePolyline(&polyline, 5000, 0, 0, 40, snap);
+    prepared_polygon = msPrepareShape(&polygon);
+    prepared_polyline = msPrepareShape(&polyline);
+    if(!prepared_polygon || !prepared_polyline) {
+      msWriteError(stderr);
+      return 1;
+    }
+
+    for(i=0; i<iterations; i++) {
+      shapeObj hexagon;
+      pointObj point;
+      int plain, prepared;
+
+      point.x = (randomValue()-0.5)*2400;
+      point.y = (randomValue()-0.5)*2400;
+      makePolygon(&hexagon, 1, 6, point.x, point.y, 20, snap);
+      if(snap) {
+        point.x = floor(point.x);
+        point.y = floor(point.y);
+      }
+
+#define COMPARE(name, plain_call, prepared_call) \
+      plain = plain_call; prepared = prepared_call; \
+      numtests++; numhits += (plain == MS_TRUE); \
+      if(plain != prepared) { \
+        mismatches++; \
+        printf("%s: mismatch at %g %g (snap=%d): plain %d, prepared %d\n", \
+               name, point.x, point.y, snap, plain, prepared); \
+      }
+
+      COMPARE("msIntersectPointPreparedPolygon",
+              msIntersectPointPolygon(&point, &polygon),
+              msIntersectPointPreparedPolygon(&point, prepared_polygon));
+      COMPARE("msIntersectPolygonPreparedPolygon",
+              msIntersectPolygons(&hexagon, &polygon),
+              msIntersectPolygonPreparedPolygon(&hexagon, prepared_polygon));
+      COMPARE("msIntersectPolylinePreparedPolygon",
+              msIntersectPolylinePolygon(&hexagon, &polygon),
+              msIntersectPolylinePreparedPolygon(&hexagon, prepared_polygon));
+      COMPARE("msIntersectPolylinePreparedPolyline",
+              msIntersectPolylines(&hexagon, &polyline),
+              msIntersectPolylinePreparedPolyline(&hexagon, prepared_polyline));
+      COMPARE("msIntersectPreparedPolylinePolygon",
+              msIntersectPolylinePolygon(&polyline, &hexagon),
+              msIntersectPreparedPolylinePolygon(prepared_polyline, &hexagon));
+
+      msFreeShape(&hexagon);
+    }
+
+    msFreePreparedShape(prepared_polygon);
+    msFreePreparedShape(prepared_polyline);
+    msFreeShape(&polygon);
+    msFreeShape(&polyline);
+  }
+
+  printf("%d tests, %d intersecting, %d mismatches\n", numtests, numhits, mismatches);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,214 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Benchmark of the .qix and packed R-tree spatial indexes.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** Writes a point shapefile of randomly placed features in random order,
+** builds both its .qix quadtree and its .prt packed R-tree, and times the
+** shapefile driver's search of each index (msSearchDiskTree() followed by
+** msFilterTreeSearch() for the quadtree, msSearchPackedTree() alone for the
+** packed R-tree) over small, medium and large extents. The original use
+** case is a 10M feature shapefile: treebench -n 10000000
+**
+** usage: treebench [-n features] [-q queries] [basename]
+*/
+
+#include "mapserver.h"
+#include "maptime.h"
+
+MS_CVSID("$Id$")
+
+#define BENCH_WIDTH 1000000.0
+
+static double elapsedSince(struct mstimeval *start)
+{
+  struct mstimeval now;
+  msGettimeofday(&now, NULL);
+  return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static int countBits(ms_bitarray status, int numshapes)
+{
+  int i, count = 0;
+  for(i = msGetNextBit(status, 0, numshapes); i >= 0; i = msGetNextBit(status, i+1, numshapes))
+    count++;
+  return count;
+}
+
+static int writeShapefile(char *basename, int numfeatures)
+{
+  char filename[MS_MAXPATHLEN];
+  shapefileObj shapefile;
+  DBFHandle hDBF;
+  pointObj point;
+  int i;
+
+  snprintf(filename, sizeof(filename), "%s.shp", basename);
+  if(msShapefileCreate(&shapefile, filename, SHP_POINT) != 0)
+    return MS_FAILURE;
+  snprintf(filename, sizeof(filename), "%s.dbf", basename);
+  hDBF = msDBFCreate(filename);
+  if(!hDBF) {
+    msSetError(MS_IOERR, "(%s)", "writeShapefile()", filename);
+    msShapefileClose(&shapefile);
+    return MS_FAILURE;
+  }
+  msDBFAddField(hDBF, "ID", FTInteger, 10, 0);
+
+  memset(&point, 0, sizeof(point));
+  for(i=0; i<numfeatures; i++) {
+    point.x = BENCH_WIDTH * rand() / RAND_MAX;
+    point.y = BENCH_WIDTH * rand() / RAND_MAX;
+    msSHPWritePoint(shapefile.hSHP, &point);
+    msDBFWriteIntegerAttribute(hDBF, i, 0, i);
+  }
+
+  msDBFClose(hDBF);
+  msShapefileClose(&shapefile);
+  return MS_SUCCESS;
+}
+
+static int runQueries(shapefileObj *shapefile, char *qix, char *prt, const char *name,
+                      double size, int numqueries)
+{
+  rectObj *extents;
+  ms_bitarray status;
+  struct mstimeval start;
+  double qixtime, prttime;
+  long qixcount = 0, prtcount = 0;
+  int i;
+
+  extents = (rectObj *) msSmallMalloc(sizeof(rectObj) * numqueries);
+  for(i=0; i<numqueries; i++) {
+    extents[i].minx = (BENCH_WIDTH - size) * rand() / RAND_MAX;
+    extents[i].miny = (BENCH_WIDTH - size) * rand() / RAND_MAX;
+    extents[i].maxx = extents[i].minx + size;
+    extents[i].maxy = extents[i].miny + size;
+  }
+
+  msGettimeofday(&start, NULL);
+  for(i=0; i<numqueries; i++) {
+    status = msSearchDiskTree(qix, extents[i], MS_FALSE);
+    if(!status) {
+      msSetError(MS_IOERR, "Unable to search %s.", "runQueries()", qix);
+      free(extents);
+      return MS_FAILURE;
+    }
+    msFilterTreeSearch(shapefile, status, extents[i]);
+    qixcount += countBits(status, shapefile->numshapes);
+    msFree(status);
+  }
+  qixtime = elapsedSince(&start);
+
+  msGettimeofday(&start, NULL);
+  for(i=0; i<numqueries; i++) {
+    status = msSearchPackedTree(prt, extents[i], shapefile->numshapes, MS_FALSE);
+    if(!status) {
+      msSetError(MS_IOERR, "Unable to search %s.", "runQueries()", prt);
+      free(extents);
+      return MS_FAILURE;
+    }
+    prtcount += countBits(status, shapefile->numshapes);
+    msFree(status);
+  }
+  prttime = elapsedSince(&start);
+
+  printf("%-7s extent=%-8.0f features/query=%-9.1f qix %10.3f ms/query   prt %10.3f ms/query%s\n",
+         name, size, (double) prtcount / numqueries,
+         qixtime * 1000 / numqueries, prttime * 1000 / numqueries,
+         qixcount != prtcount ? "   RESULTS DIFFER" : "");
+
+  free(extents);
+  return MS_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+  char *basename = "treebench";
+  char shp[MS_MAXPATHLEN], qix[MS_MAXPATHLEN], prt[MS_MAXPATHLEN];
+  shapefileObj shapefile;
+  treeObj *tree;
+  struct mstimeval start;
+  int numfeatures = 1000000, numqueries = 100, i;
+
+  for(i=1; i<argc; i++) {
+    if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+      numfeatures = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-q") == 0 && i+1 < argc)
+      numqueries = atoi(argv[++i]);
+    else if(argv[i][0] != '-')
+      basename = argv[i];
+    else {
+      fprintf(stderr, "usage: treebench [-n features] [-q queries] [basename]\n");
+      exit(1);
+    }
+  }
+
+  snprintf(shp, sizeof(shp), "%s.shp", basename);
+  snprintf(qix, sizeof(qix), "%s%s", basename, MS_INDEX_EXTENSION);
+  snprintf(prt, sizeof(prt), "%s%s", basename, MS_PACKED_INDEX_EXTENSION);
+  srand(1);
+
+  msGettimeofday(&start, NULL);
+  if(writeShapefile(basename, numfeatures) != MS_SUCCESS) {
+    msWriteError(stderr);
+    exit(1);
+  }
+  printf("wrote %d features in %.3fs\n", numfeatures, elapsedSince(&start));
+
+  if(msShapefileOpen(&shapefile, "rb", shp, MS_TRUE) == -1) {
+    msWriteError(stderr);
+    exit(1);
+  }
+
+  msGettimeofday(&start, NULL);
+  tree = msCreateTree(&shapefile, 0);
+  if(!tree || !msWriteTree(tree, qix, MS_NEW_LSB_ORDER)) {
+    msWriteError(stderr);
+    exit(1);
+  }
+  msDestroyTree(tree);
+  printf("built %s in %.3fs\n", qix, elapsedSince(&start));
+
+  msGettimeofday(&start, NULL);
+  if(msWritePackedTree(&shapefile, prt, 0) != MS_SUCCESS) {
+    msWriteError(stderr);
+    exit(1);
+  }
+  printf("built %s in %.3fs\n", prt, elapsedSince(&start));
+
+  if(runQueries(&shapefile, qix, prt, "small", BENCH_WIDTH / 1000, numqueries) != MS_SUCCESS ||
+     runQueries(&shapefile, qix, prt, "medium", BENCH_WIDTH / 100, numqueries) != MS_SUCCESS ||
+     runQueries(&shapefile, qix, prt, "large", BENCH_WIDTH / 5, numqueries) != MS_SUCCESS) {
+    msWriteError(stderr);
+    exit(1);
+  }
+
+  msShapefileClose(&shapefile);
+  return 0;
+}